@@ -0,0 +1,186 @@
+// Minimal cJSON for the host tests. Like the real library it allocates one
+// node per item plus a copy of every key and string through the installed
+// hooks, so allocation counts and arena use match the target.
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#include "cJSON.h"
+
+static cJSON_Hooks hooks = {&malloc, &free};
+
+void cJSON_InitHooks(cJSON_Hooks* new_hooks) {
+  if (new_hooks == nullptr) {
+    hooks = {&malloc, &free};
+    return;
+  }
+  hooks.malloc_fn = new_hooks->malloc_fn ? new_hooks->malloc_fn : &malloc;
+  hooks.free_fn = new_hooks->free_fn ? new_hooks->free_fn : &free;
+}
+
+static cJSON* new_item() {
+  auto* item = static_cast<cJSON*>(hooks.malloc_fn(sizeof(cJSON)));
+  if (item != nullptr) {
+    memset(item, 0, sizeof(cJSON));
+  }
+  return item;
+}
+
+static const char* skip_whitespace(const char* in) {
+  while (*in == ' ' || *in == '\t' || *in == '\n' || *in == '\r') {
+    in++;
+  }
+  return in;
+}
+
+// Escapes are kept as is, the tests do not use them
+static const char* parse_string(const char* in, char** out) {
+  const char* end = strchr(in + 1, '"');
+  if (end == nullptr) {
+    return nullptr;
+  }
+  size_t length = end - in - 1;
+  *out = static_cast<char*>(hooks.malloc_fn(length + 1));
+  if (*out == nullptr) {
+    return nullptr;
+  }
+  memcpy(*out, in + 1, length);
+  (*out)[length] = '\0';
+  return end + 1;
+}
+
+static const char* parse_value(cJSON* item, const char* in);
+
+static const char* parse_children(cJSON* item, const char* in, char close,
+                                  bool has_keys) {
+  in = skip_whitespace(in + 1);
+  if (*in == close) {
+    return in + 1;
+  }
+
+  cJSON** next = &item->child;
+  while (true) {
+    cJSON* child = new_item();
+    if (child == nullptr) {
+      return nullptr;
+    }
+    *next = child;
+    next = &child->next;
+
+    if (has_keys) {
+      in = skip_whitespace(in);
+      if (*in != '"') {
+        return nullptr;
+      }
+      in = parse_string(in, &child->string);
+      if (in == nullptr) {
+        return nullptr;
+      }
+      in = skip_whitespace(in);
+      if (*in != ':') {
+        return nullptr;
+      }
+      in++;
+    }
+
+    in = parse_value(child, skip_whitespace(in));
+    if (in == nullptr) {
+      return nullptr;
+    }
+    in = skip_whitespace(in);
+    if (*in == close) {
+      return in + 1;
+    }
+    if (*in != ',') {
+      return nullptr;
+    }
+    in++;
+  }
+}
+
+static const char* parse_value(cJSON* item, const char* in) {
+  if (*in == '"') {
+    item->type = cJSON_String;
+    return parse_string(in, &item->valuestring);
+  }
+  if (*in == '{') {
+    item->type = cJSON_Object;
+    return parse_children(item, in, '}', true);
+  }
+  if (*in == '[') {
+    item->type = cJSON_Array;
+    return parse_children(item, in, ']', false);
+  }
+  if (strncmp(in, "true", 4) == 0) {
+    item->type = cJSON_True;
+    item->valueint = 1;
+    return in + 4;
+  }
+  if (strncmp(in, "false", 5) == 0) {
+    item->type = cJSON_False;
+    return in + 5;
+  }
+  if (strncmp(in, "null", 4) == 0) {
+    item->type = cJSON_NULL;
+    return in + 4;
+  }
+
+  char* end;
+  double number = strtod(in, &end);
+  if (end == in) {
+    return nullptr;
+  }
+  item->type = cJSON_Number;
+  item->valuedouble = number;
+  item->valueint = static_cast<int>(number);
+  return end;
+}
+
+cJSON* cJSON_Parse(const char* value) {
+  cJSON* root = new_item();
+  if (root == nullptr) {
+    return nullptr;
+  }
+
+  const char* end = parse_value(root, skip_whitespace(value));
+  if (end == nullptr || *skip_whitespace(end) != '\0') {
+    cJSON_Delete(root);
+    return nullptr;
+  }
+  return root;
+}
+
+void cJSON_Delete(cJSON* item) {
+  while (item != nullptr) {
+    cJSON* next = item->next;
+    cJSON_Delete(item->child);
+    if (item->valuestring != nullptr) {
+      hooks.free_fn(item->valuestring);
+    }
+    if (item->string != nullptr) {
+      hooks.free_fn(item->string);
+    }
+    hooks.free_fn(item);
+    item = next;
+  }
+}
+
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* string) {
+  if (object == nullptr) {
+    return nullptr;
+  }
+  for (cJSON* child = object->child; child != nullptr; child = child->next) {
+    if (child->string != nullptr && strcasecmp(child->string, string) == 0) {
+      return child;
+    }
+  }
+  return nullptr;
+}
+
+int cJSON_IsString(const cJSON* item) {
+  return item != nullptr && item->type == cJSON_String;
+}
+
+int cJSON_IsNumber(const cJSON* item) {
+  return item != nullptr && item->type == cJSON_Number;
+}
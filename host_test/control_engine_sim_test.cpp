@@ -0,0 +1,244 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include "ControlEngine.hpp"
+#include "Heatpump.hpp"
+
+// Closed-loop simulation of the control engine against a single room heated
+// by a heatpump that runs its own thermostat on a sensor in the indoor unit.
+// The results back the defaults in Kconfig.projbuild.
+
+constexpr int TARGET_TEMPERATURE = 21;
+constexpr float OUTDOOR_TEMPERATURE = 5;
+constexpr float START_TEMPERATURE = 16;
+constexpr int64_t STEP_US = 10 * 1000000LL;
+// CONFIG_TEMPERATURE_CHECK_INTERVAL_MS
+constexpr int64_t UPDATE_INTERVAL_US = 30 * 1000000LL;
+constexpr int64_t DURATION_US = 12 * 3600 * 1000000LL;
+// Steady state is judged on the second half of the run
+constexpr int64_t STEADY_AFTER_US = DURATION_US / 2;
+// The room has settled once it stays this close to the target
+constexpr float SETTLED_BAND = 0.5f;
+
+// Kconfig defaults
+constexpr float FILTER_ALPHA = 0.3f;
+constexpr float HYSTERESIS = 0.5f;
+constexpr ControlGains PID_GAINS = {1.5f, 0.05f, 0};
+constexpr int MAX_SETPOINT_OFFSET = 3;
+constexpr uint32_t MIN_DWELL_MS = 600000;
+constexpr uint32_t MIN_COMMAND_INTERVAL_MS = 300000;
+
+static int64_t now_us;
+static int64_t sim_clock() { return now_us; }
+
+// First-order room: heat leaks to the outside with time_constant_h, the
+// heatpump adds up to capacity C/h. The unit modulates on its own sensor,
+// which reads the room temperature plus unit_bias, e.g. colder near the
+// floor.
+struct Room {
+  float temperature;
+  float unit_bias;
+  float time_constant_h;
+  float capacity;
+
+  void step(const ControlOutput& command, float hours) {
+    float output = 0;
+    if (command.is_on) {
+      float unit_reading = temperature + unit_bias;
+      float max_output = command.fan_speed == MAX_FAN_SPEED ? 1.0f : 0.8f;
+      output = 0.6f * (command.target_temperature + 0.5f - unit_reading);
+      output = fminf(fmaxf(output, 0), max_output);
+    }
+    temperature += ((OUTDOOR_TEMPERATURE - temperature) / time_constant_h +
+                    capacity * output) *
+                   hours;
+  }
+};
+
+struct SimulationResult {
+  float overshoot;
+  float steady_error;
+  // Hours until the room stays within SETTLED_BAND, the whole run when it
+  // never does
+  float settling_time_h;
+  uint32_t toggles;
+  uint32_t commands;
+};
+
+// Runs the room for DURATION_US, with the engine when one is given and with
+// the user's target state sent once otherwise
+static SimulationResult simulate(ControlEngine* engine, Room room) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> noise(-0.15f, 0.15f);
+
+  now_us = 1;
+  ControlOutput output = {true, TARGET_TEMPERATURE, 0};
+  if (engine != nullptr) {
+    engine->reset(Mode::HEAT, TARGET_TEMPERATURE, 0);
+    output = engine->get_output();
+  }
+
+  SimulationResult result = {};
+  float error_sum = 0;
+  uint32_t steady_samples = 0;
+  int64_t settled_at = 0;
+  for (int64_t t = 0; t < DURATION_US; t += STEP_US) {
+    now_us = t + 1;
+    if (engine != nullptr && t % UPDATE_INTERVAL_US == 0) {
+      // The DHT reports tenths of a degree
+      float reading = roundf((room.temperature + noise(rng)) * 10) / 10;
+      if (engine->update(reading)) {
+        ControlOutput next = engine->get_output();
+        if (next.is_on != output.is_on) {
+          result.toggles++;
+        }
+        output = next;
+      }
+    }
+
+    room.step(output, STEP_US / 3600e6f);
+    result.overshoot = fmaxf(result.overshoot,
+                             room.temperature - TARGET_TEMPERATURE);
+    if (fabsf(room.temperature - TARGET_TEMPERATURE) > SETTLED_BAND) {
+      settled_at = t + STEP_US;
+    }
+    if (t >= STEADY_AFTER_US) {
+      error_sum += fabsf(room.temperature - TARGET_TEMPERATURE);
+      steady_samples++;
+    }
+  }
+
+  result.steady_error = error_sum / steady_samples;
+  result.settling_time_h = settled_at / 3600e6f;
+  result.commands = engine != nullptr ? engine->get_stats().commands : 1;
+  return result;
+}
+
+static ControlEngine make_hysteresis(uint32_t min_dwell_ms,
+                                     uint32_t min_command_interval_ms) {
+  return ControlEngine(ControlAlgorithm::HYSTERESIS, FILTER_ALPHA, HYSTERESIS,
+                       {0, 0, 0}, 0, min_dwell_ms, min_command_interval_ms,
+                       &sim_clock);
+}
+
+static ControlEngine make_pid(ControlGains gains) {
+  return ControlEngine(ControlAlgorithm::PID, FILTER_ALPHA, 0, gains,
+                       MAX_SETPOINT_OFFSET, MIN_DWELL_MS,
+                       MIN_COMMAND_INTERVAL_MS, &sim_clock);
+}
+
+static void print(const char* name, const SimulationResult& result) {
+  printf("%-34s overshoot %5.2f C, steady error %4.2f C, settled after "
+         "%5.2f h, %3u on/off, %3u commands\n",
+         name, result.overshoot, result.steady_error, result.settling_time_h,
+         static_cast<unsigned>(result.toggles),
+         static_cast<unsigned>(result.commands));
+}
+
+// The unit's sensor reads 3 C low, so on its own it overheats the room
+constexpr Room OVERHEATED_ROOM = {START_TEMPERATURE, -3, 3, 8};
+// The unit's sensor reads 1.5 C high, so on its own the room stays cold
+constexpr Room UNDERHEATED_ROOM = {START_TEMPERATURE, 1.5f, 3, 8};
+// A small, poorly insulated room with an oversized unit reacts within
+// minutes
+constexpr Room SMALL_ROOM = {START_TEMPERATURE, -3, 0.5f, 60};
+
+TEST(ControlEngineSimulation, HysteresisStopsOverheating) {
+  SimulationResult open_loop = simulate(nullptr, OVERHEATED_ROOM);
+  ControlEngine engine = make_hysteresis(MIN_DWELL_MS, MIN_COMMAND_INTERVAL_MS);
+  SimulationResult hysteresis = simulate(&engine, OVERHEATED_ROOM);
+  print("open loop", open_loop);
+  print("hysteresis", hysteresis);
+
+  EXPECT_GT(open_loop.steady_error, 2);
+  EXPECT_LT(hysteresis.overshoot, open_loop.overshoot / 2);
+  EXPECT_LT(hysteresis.steady_error, HYSTERESIS);
+}
+
+TEST(ControlEngineSimulation, DwellLimitsHysteresisCycling) {
+  ControlEngine limited =
+      make_hysteresis(MIN_DWELL_MS, MIN_COMMAND_INTERVAL_MS);
+  ControlEngine unlimited = make_hysteresis(0, 0);
+  SimulationResult with_limits = simulate(&limited, SMALL_ROOM);
+  SimulationResult without_limits = simulate(&unlimited, SMALL_ROOM);
+  print("hysteresis, small room", with_limits);
+  print("hysteresis, small room, no dwell", without_limits);
+
+  // Without the dwell the compressor toggles every few minutes
+  EXPECT_LT(with_limits.toggles * 2, without_limits.toggles);
+  EXPECT_LE(with_limits.toggles, DURATION_US / (MIN_DWELL_MS * 1000LL));
+}
+
+TEST(ControlEngineSimulation, PidHoldsTargetWithoutCycling) {
+  for (const Room& room : {OVERHEATED_ROOM, UNDERHEATED_ROOM}) {
+    SimulationResult open_loop = simulate(nullptr, room);
+    ControlEngine engine = make_pid(PID_GAINS);
+    SimulationResult pid = simulate(&engine, room);
+    print("open loop", open_loop);
+    print("pid", pid);
+
+    EXPECT_EQ(pid.toggles, 0u);
+    EXPECT_LT(pid.settling_time_h, 4);
+    EXPECT_LT(pid.steady_error, 0.25f);
+    EXPECT_LT(pid.steady_error * 4, open_loop.steady_error);
+    EXPECT_LT(pid.overshoot, MAX_SETPOINT_OFFSET / 2.0f);
+  }
+}
+
+TEST(ControlEngineSimulation, PidBeatsHysteresis) {
+  ControlEngine hysteresis_engine =
+      make_hysteresis(MIN_DWELL_MS, MIN_COMMAND_INTERVAL_MS);
+  ControlEngine pid_engine = make_pid(PID_GAINS);
+  SimulationResult open_loop = simulate(nullptr, OVERHEATED_ROOM);
+  SimulationResult hysteresis = simulate(&hysteresis_engine, OVERHEATED_ROOM);
+  SimulationResult pid = simulate(&pid_engine, OVERHEATED_ROOM);
+  print("hysteresis", hysteresis);
+  print("pid", pid);
+
+  EXPECT_LT(pid.steady_error, hysteresis.steady_error);
+  EXPECT_LT(pid.toggles, hysteresis.toggles);
+  // Hysteresis keeps swinging out of the band around the target
+  EXPECT_LT(pid.settling_time_h * 2, hysteresis.settling_time_h);
+  // The integral only catches up with the unit's bias during the warm-up,
+  // so PID overshoots more than hysteresis there, still well below the unit
+  // on its own
+  EXPECT_LT(pid.overshoot, open_loop.overshoot * 0.6f);
+
+  // Hysteresis cannot help a unit that stops heating too early
+  ControlEngine cold_hysteresis_engine =
+      make_hysteresis(MIN_DWELL_MS, MIN_COMMAND_INTERVAL_MS);
+  ControlEngine cold_pid_engine = make_pid(PID_GAINS);
+  SimulationResult cold_hysteresis =
+      simulate(&cold_hysteresis_engine, UNDERHEATED_ROOM);
+  SimulationResult cold_pid = simulate(&cold_pid_engine, UNDERHEATED_ROOM);
+  print("hysteresis, cold", cold_hysteresis);
+  print("pid, cold", cold_pid);
+
+  EXPECT_GT(cold_hysteresis.steady_error, 1.5f);
+  EXPECT_LT(cold_pid.steady_error, 0.25f);
+}
+
+TEST(ControlEngineSimulation, DefaultGainsAreBalanced) {
+  for (const Room& room : {OVERHEATED_ROOM, UNDERHEATED_ROOM}) {
+    ControlEngine default_engine = make_pid(PID_GAINS);
+    ControlEngine proportional_engine = make_pid({PID_GAINS.kp, 0, 0});
+    ControlEngine aggressive_engine = make_pid(
+        {PID_GAINS.kp * 4, PID_GAINS.ki * 4, PID_GAINS.kd * 4});
+    SimulationResult defaults = simulate(&default_engine, room);
+    SimulationResult proportional = simulate(&proportional_engine, room);
+    SimulationResult aggressive = simulate(&aggressive_engine, room);
+    print("pid, default gains", defaults);
+    print("pid, no integral", proportional);
+    print("pid, 4x gains", aggressive);
+
+    // Without the integral the unit's bias is only partly corrected
+    EXPECT_LT(defaults.steady_error * 3, proportional.steady_error);
+    // Higher gains hold the target a little closer, for several times the IR
+    // commands
+    EXPECT_LT(defaults.steady_error, aggressive.steady_error + 0.15f);
+    EXPECT_LT(defaults.commands * 2, aggressive.commands);
+  }
+}
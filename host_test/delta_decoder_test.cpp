@@ -0,0 +1,197 @@
+#include "DeltaDecoder.hpp"
+
+#include <gtest/gtest.h>
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+typedef std::vector<uint8_t> Bytes;
+
+static Bytes read_fixture(const char* name) {
+  std::ifstream file(std::string(DELTA_FIXTURES_DIR) + "/" + name,
+                     std::ios::binary);
+  EXPECT_TRUE(file) << name;
+  return Bytes(std::istreambuf_iterator<char>(file), {});
+}
+
+// Stands in for the partitions FirmwareUpdater reads from and writes to
+struct Partitions {
+  Bytes source;
+  Bytes target;
+
+  static esp_err_t read_source(void* context, size_t offset, uint8_t* data,
+                               size_t size) {
+    auto* self = static_cast<Partitions*>(context);
+    if (offset + size > self->source.size()) {
+      return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(data, self->source.data() + offset, size);
+    return ESP_OK;
+  }
+
+  static esp_err_t write_target(void* context, const uint8_t* data,
+                                size_t size) {
+    auto* self = static_cast<Partitions*>(context);
+    self->target.insert(self->target.end(), data, data + size);
+    return ESP_OK;
+  }
+};
+
+class DeltaDecoderTest : public testing::Test {
+ protected:
+  Partitions partitions;
+  DeltaDecoder decoder;
+
+  DeltaDecoderTest()
+      : decoder({&Partitions::read_source, &Partitions::write_target,
+                 &partitions}) {
+    partitions.source = read_fixture("source.bin");
+  }
+
+  esp_err_t feed(const Bytes& delta, size_t chunk_size) {
+    for (size_t offset = 0; offset < delta.size(); offset += chunk_size) {
+      size_t length = std::min(chunk_size, delta.size() - offset);
+      esp_err_t err = decoder.feed(delta.data() + offset, length);
+      if (err != ESP_OK) {
+        return err;
+      }
+    }
+    return ESP_OK;
+  }
+
+  // The check FirmwareUpdater makes on the rebuilt image
+  bool matches_header_hash() {
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    SHA256(partitions.target.data(), partitions.target.size(), digest);
+    return memcmp(digest, decoder.get_header().target_sha256,
+                  sizeof(digest)) == 0;
+  }
+};
+
+TEST_F(DeltaDecoderTest, RebuildsTargetInAnyChunkSize) {
+  Bytes target = read_fixture("target.bin");
+
+  for (const char* name : {"patch.delta", "full.delta"}) {
+    Bytes delta = read_fixture(name);
+    for (size_t chunk_size : {1, 2, 3, 7, 44, 45, 61, 512, 1024, 100000}) {
+      SCOPED_TRACE(testing::Message() << name << " in chunks of "
+                                      << chunk_size);
+      decoder.reset();
+      partitions.target.clear();
+
+      ASSERT_EQ(feed(delta, chunk_size), ESP_OK);
+      EXPECT_TRUE(decoder.is_complete());
+      EXPECT_EQ(decoder.get_written(), target.size());
+      EXPECT_EQ(decoder.get_header().target_size, target.size());
+      EXPECT_TRUE(partitions.target == target);
+      EXPECT_TRUE(matches_header_hash());
+    }
+  }
+}
+
+TEST_F(DeltaDecoderTest, PatchIsSmallerThanImage) {
+  Bytes delta = read_fixture("patch.delta");
+  Bytes full = read_fixture("full.delta");
+  EXPECT_LT(delta.size() * 10, full.size());
+}
+
+TEST_F(DeltaDecoderTest, TruncatedDeltaIsIncomplete) {
+  Bytes delta = read_fixture("patch.delta");
+
+  for (size_t length : {size_t{0}, size_t{10}, DELTA_HEADER_SIZE,
+                        DELTA_HEADER_SIZE + 2, delta.size() / 2,
+                        delta.size() - 1}) {
+    SCOPED_TRACE(testing::Message() << "cut at " << length);
+    decoder.reset();
+    partitions.target.clear();
+
+    Bytes truncated(delta.begin(), delta.begin() + length);
+    EXPECT_EQ(feed(truncated, 64), ESP_OK);
+    EXPECT_FALSE(decoder.is_complete());
+    EXPECT_EQ(decoder.has_header(), length >= DELTA_HEADER_SIZE);
+  }
+}
+
+TEST_F(DeltaDecoderTest, RejectsBadMagic) {
+  Bytes delta = read_fixture("patch.delta");
+  delta[3] = '2';
+
+  EXPECT_EQ(feed(delta, 16), ESP_ERR_INVALID_VERSION);
+  EXPECT_TRUE(partitions.target.empty());
+}
+
+TEST_F(DeltaDecoderTest, RejectsBadOpcodeAndStaysFailed) {
+  Bytes delta = read_fixture("patch.delta");
+  delta[DELTA_HEADER_SIZE] = 0x7F;
+
+  EXPECT_EQ(feed(delta, 16), ESP_ERR_INVALID_ARG);
+  EXPECT_TRUE(partitions.target.empty());
+
+  // The first error is sticky until reset()
+  uint8_t insert[] = {0x02, 0x01, 0xAA};
+  EXPECT_EQ(decoder.feed(insert, sizeof(insert)), ESP_ERR_INVALID_ARG);
+  EXPECT_FALSE(decoder.is_complete());
+}
+
+TEST_F(DeltaDecoderTest, RejectsOversizedTarget) {
+  Bytes delta = read_fixture("patch.delta");
+  Bytes target = read_fixture("target.bin");
+
+  // Announce one byte less than the operations write
+  uint32_t target_size = target.size() - 1;
+  memcpy(delta.data() + 8, &target_size, sizeof(target_size));
+
+  EXPECT_EQ(feed(delta, 256), ESP_ERR_INVALID_SIZE);
+  EXPECT_LE(partitions.target.size(), target_size);
+  EXPECT_FALSE(decoder.is_complete());
+}
+
+TEST_F(DeltaDecoderTest, RejectsOperationsAfterTarget) {
+  Bytes delta = read_fixture("patch.delta");
+  delta.insert(delta.end(), {0x02, 0x01, 0xAA});
+
+  EXPECT_EQ(feed(delta, 256), ESP_ERR_INVALID_SIZE);
+}
+
+TEST_F(DeltaDecoderTest, RejectsCopyOutsideSource) {
+  Bytes delta = read_fixture("patch.delta");
+
+  // Copies reach past the announced source image
+  uint32_t source_size = 1024;
+  memcpy(delta.data() + 4, &source_size, sizeof(source_size));
+
+  EXPECT_EQ(feed(delta, 256), ESP_ERR_INVALID_SIZE);
+}
+
+TEST_F(DeltaDecoderTest, RejectsOverlongVarint) {
+  Bytes delta = read_fixture("patch.delta");
+  delta.resize(DELTA_HEADER_SIZE);
+  delta.insert(delta.end(), {0x02, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01});
+
+  EXPECT_EQ(feed(delta, 1), ESP_ERR_INVALID_ARG);
+}
+
+TEST_F(DeltaDecoderTest, HashMismatchIsDetected) {
+  // A corrupted inserted byte still decodes, only the hash catches it
+  Bytes delta = read_fixture("full.delta");
+  delta.back() ^= 0x01;
+
+  ASSERT_EQ(feed(delta, 512), ESP_OK);
+  EXPECT_TRUE(decoder.is_complete());
+  EXPECT_FALSE(matches_header_hash());
+
+  // As does a header announcing another image
+  decoder.reset();
+  partitions.target.clear();
+  delta = read_fixture("patch.delta");
+  delta[12] ^= 0x01;
+
+  ASSERT_EQ(feed(delta, 512), ESP_OK);
+  EXPECT_TRUE(decoder.is_complete());
+  EXPECT_FALSE(matches_header_hash());
+}
@@ -0,0 +1,149 @@
+#include "DHTDecoder.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+
+// Builds the levels the RMT receiver captures for one AM2301 frame: the end
+// of the start pulse, the pull-up, the 80/80 us response and 40 bits
+struct FrameOptions {
+  int jitter_us = 0;
+  bool split_highs = false;
+  bool corrupt_checksum = false;
+};
+
+static uint16_t jittered(int duration_us, int jitter_us) {
+  if (jitter_us == 0) {
+    return duration_us;
+  }
+  return duration_us + rand() % (2 * jitter_us + 1) - jitter_us;
+}
+
+static std::vector<DHTPulse> build_frame(const uint8_t (&data)[5],
+                                         const FrameOptions& options = {}) {
+  std::vector<DHTPulse> pulses = {
+      {0, 3},
+      {1, jittered(30, options.jitter_us)},
+      {0, jittered(80, options.jitter_us)},
+      {1, jittered(80, options.jitter_us)},
+  };
+  for (size_t bit = 0; bit < 40; bit++) {
+    uint8_t byte = data[bit / 8];
+    if (bit >= 32 && options.corrupt_checksum) {
+      byte ^= 0x01;
+    }
+    bool is_one = byte & (0x80 >> (bit % 8));
+    pulses.push_back({0, jittered(50, options.jitter_us)});
+    uint16_t high = jittered(is_one ? 70 : 26, options.jitter_us);
+    if (options.split_highs) {
+      pulses.push_back({1, static_cast<uint16_t>(high / 2)});
+      pulses.push_back({1, static_cast<uint16_t>(high - high / 2)});
+    } else {
+      pulses.push_back({1, high});
+    }
+  }
+  pulses.push_back({0, 50});
+  return pulses;
+}
+
+static void encode(uint16_t humidity_x10, int16_t temperature_x10,
+                   uint8_t (&data)[5]) {
+  uint16_t temperature = temperature_x10 < 0
+                             ? static_cast<uint16_t>(-temperature_x10) | 0x8000
+                             : temperature_x10;
+  data[0] = humidity_x10 >> 8;
+  data[1] = humidity_x10;
+  data[2] = temperature >> 8;
+  data[3] = temperature;
+  data[4] = data[0] + data[1] + data[2] + data[3];
+}
+
+TEST(DHTDecoder, DecodesKnownFrame) {
+  // 65.2 %, -10.1 C as sent by the sensor
+  const uint8_t data[5] = {0x02, 0x8C, 0x80, 0x65, 0x73};
+  std::vector<DHTPulse> pulses = build_frame(data);
+
+  int16_t temperature_x10;
+  uint16_t humidity_x10;
+  ASSERT_EQ(dht_decode_frame(pulses.data(), pulses.size(), temperature_x10,
+                             humidity_x10),
+            ESP_OK);
+  EXPECT_EQ(temperature_x10, -101);
+  EXPECT_EQ(humidity_x10, 652);
+}
+
+TEST(DHTDecoder, DecodesPositiveTemperature) {
+  uint8_t data[5];
+  encode(411, 235, data);
+  std::vector<DHTPulse> pulses = build_frame(data);
+
+  int16_t temperature_x10;
+  uint16_t humidity_x10;
+  ASSERT_EQ(dht_decode_frame(pulses.data(), pulses.size(), temperature_x10,
+                             humidity_x10),
+            ESP_OK);
+  EXPECT_EQ(temperature_x10, 235);
+  EXPECT_EQ(humidity_x10, 411);
+}
+
+TEST(DHTDecoder, RejectsChecksumMismatch) {
+  const uint8_t data[5] = {0x02, 0x8C, 0x80, 0x65, 0x73};
+  std::vector<DHTPulse> pulses = build_frame(data, {.corrupt_checksum = true});
+
+  int16_t temperature_x10;
+  uint16_t humidity_x10;
+  EXPECT_EQ(dht_decode_frame(pulses.data(), pulses.size(), temperature_x10,
+                             humidity_x10),
+            ESP_ERR_INVALID_CRC);
+}
+
+TEST(DHTDecoder, RejectsTruncatedCapture) {
+  const uint8_t data[5] = {0x02, 0x8C, 0x80, 0x65, 0x73};
+  std::vector<DHTPulse> pulses = build_frame(data);
+
+  int16_t temperature_x10;
+  uint16_t humidity_x10;
+  // Cut off in the middle of the data bits
+  EXPECT_EQ(dht_decode_frame(pulses.data(), 40, temperature_x10, humidity_x10),
+            ESP_ERR_INVALID_RESPONSE);
+  // Cut off before the response
+  EXPECT_EQ(dht_decode_frame(pulses.data(), 2, temperature_x10, humidity_x10),
+            ESP_ERR_TIMEOUT);
+  EXPECT_EQ(dht_decode_frame(pulses.data(), 0, temperature_x10, humidity_x10),
+            ESP_ERR_TIMEOUT);
+}
+
+TEST(DHTDecoder, RejectsOutOfRangeBit) {
+  const uint8_t data[5] = {0x02, 0x8C, 0x80, 0x65, 0x73};
+  std::vector<DHTPulse> pulses = build_frame(data);
+  // High phase of the first data bit far too long
+  pulses[5].duration_us = 400;
+
+  int16_t temperature_x10;
+  uint16_t humidity_x10;
+  EXPECT_EQ(dht_decode_frame(pulses.data(), pulses.size(), temperature_x10,
+                             humidity_x10),
+            ESP_ERR_INVALID_RESPONSE);
+}
+
+TEST(DHTDecoder, ToleratesJitterAndSplitPulses) {
+  srand(1);
+  for (int i = 0; i < 2000; i++) {
+    uint16_t humidity = rand() % 1001;
+    int16_t temperature = rand() % 1201 - 400;
+    uint8_t data[5];
+    encode(humidity, temperature, data);
+    std::vector<DHTPulse> pulses =
+        build_frame(data, {.jitter_us = 8, .split_highs = i % 2 == 1});
+
+    int16_t temperature_x10;
+    uint16_t humidity_x10;
+    ASSERT_EQ(dht_decode_frame(pulses.data(), pulses.size(), temperature_x10,
+                               humidity_x10),
+              ESP_OK)
+        << "frame " << i;
+    EXPECT_EQ(temperature_x10, temperature);
+    EXPECT_EQ(humidity_x10, humidity);
+  }
+}
@@ -0,0 +1,222 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <memory>
+
+#include "esp_timer.h"
+#include "network_sim.hpp"
+#include "nvs_flash.h"
+#include "sim_controller.hpp"
+
+// The fault campaign of CONFIG_FAULT_INJECTION on the host: the real network,
+// command and telemetry path runs against the simulated access point, broker
+// and drivers, and each fault is what the unit would see from the outside.
+// A broker outage refuses connects, so recovery goes through esp-mqtt's
+// reconnect timeout.
+
+constexpr const char* DEVICE_ID = "heatpump-controller";
+constexpr int64_t SECOND_US = 1000 * 1000;
+
+class FaultRecoveryTest : public ::testing::Test {
+ protected:
+  std::unique_ptr<SimController> controller;
+
+  void SetUp() override {
+    sim_reset();
+    nvs_commit_result = ESP_OK;
+    controller = std::make_unique<SimController>(DEVICE_ID);
+    ASSERT_EQ(controller->start(), ESP_OK);
+    ASSERT_TRUE(sim_run_until([&]() { return controller->mqtt.is_ready(); },
+                              10 * SECOND_US));
+  }
+
+  // Runs until condition holds and returns how long that took, -1 if it
+  // did not within timeout_us
+  int64_t time_until(const std::function<bool()>& condition,
+                     int64_t timeout_us) {
+    int64_t started_at = esp_timer_get_time();
+    if (!sim_run_until(condition, timeout_us)) {
+      return -1;
+    }
+    return esp_timer_get_time() - started_at;
+  }
+
+  void send_target_temperature(int target_temperature) {
+    char message[128];
+    snprintf(message, sizeof(message),
+             "{\"deviceId\":\"%s\",\"mode\":\"HEAT\","
+             "\"targetTemperature\":%d}",
+             DEVICE_ID, target_temperature);
+    sim_broker_publish(SIM_TARGET_STATE_TOPIC, message, 1);
+  }
+
+  size_t telemetry_since(int64_t since) {
+    size_t count = 0;
+    for (const auto& message : sim_broker_messages()) {
+      if (message.at_us >= since && message.client_id == DEVICE_ID &&
+          message.topic == SIM_CURRENT_STATE_TOPIC) {
+        count++;
+      }
+    }
+    return count;
+  }
+};
+
+TEST_F(FaultRecoveryTest, BrokerOutageRetriesEveryReconnectTimeout) {
+  constexpr int64_t OUTAGE_US = 60 * SECOND_US;
+  constexpr int64_t RETRY_US =
+      SIM_MQTT_RECONNECT_TIMEOUT_MS * 1000 + 2 * SIM_BROKER_LATENCY_US;
+
+  sim_set_broker(false);
+  sim_run_for(OUTAGE_US);
+
+  EXPECT_FALSE(controller->mqtt.is_ready());
+  MQTTStats stats = controller->mqtt.get_stats();
+  EXPECT_GE(stats.connect_failures, OUTAGE_US / RETRY_US - 1);
+  EXPECT_LE(stats.connect_failures, OUTAGE_US / RETRY_US + 1);
+
+  // The command waits in the persistent session until the unit is back
+  sim_set_broker(true);
+  send_target_temperature(24);
+
+  int64_t recovery_us =
+      time_until([&]() { return controller->mqtt.is_ready(); },
+                 10 * SECOND_US);
+  EXPECT_GE(recovery_us, 0);
+  EXPECT_LE(recovery_us, RETRY_US + SIM_BROKER_CONNECT_US);
+
+  stats = controller->mqtt.get_stats();
+  EXPECT_EQ(stats.reconnects, 1u);
+  EXPECT_EQ(stats.session_resumes, 1u);
+
+  EXPECT_GE(time_until(
+                [&]() {
+                  return controller->heatpump.get_target_temperature() == 24;
+                },
+                5 * SECOND_US),
+            0);
+
+  // The applied command forces a reading, telemetry is back right away
+  int64_t recovered_at = esp_timer_get_time();
+  EXPECT_GE(time_until([&]() { return telemetry_since(recovered_at) > 0; },
+                       5 * SECOND_US),
+            0);
+}
+
+TEST_F(FaultRecoveryTest, ShortWifiDropKeepsTheConnection) {
+  // Shorter than the beacon timeout, the station never disconnects
+  sim_set_access_point(false);
+  sim_run_for(3 * SECOND_US);
+  sim_set_access_point(true);
+  sim_run_for(10 * SECOND_US);
+
+  EXPECT_TRUE(controller->mqtt.is_ready());
+  EXPECT_EQ(controller->wifi.get_stats().reconnects, 0u);
+  EXPECT_EQ(controller->mqtt.get_stats().reconnects, 0u);
+  EXPECT_EQ(controller->mqtt.get_stats().connect_failures, 0u);
+}
+
+TEST_F(FaultRecoveryTest, WifiOutageBacksOffAndRecovers) {
+  constexpr int64_t OUTAGE_US = 300 * SECOND_US;
+
+  sim_set_access_point(false);
+  sim_run_for(OUTAGE_US);
+
+  // The dead connection was given up on at the keepalive, the client has
+  // been retrying without a route since
+  EXPECT_FALSE(controller->is_wifi_connected());
+  EXPECT_FALSE(controller->mqtt.is_ready());
+  EXPECT_GT(controller->mqtt.get_stats().connect_failures, 0u);
+
+  // Backoff doubles from the minimum up to the maximum, with jitter down to
+  // half of it
+  WiFiStats wifi_stats = controller->wifi.get_stats();
+  EXPECT_GE(wifi_stats.failed_attempts, 8u);
+  EXPECT_LE(wifi_stats.failed_attempts, 20u);
+
+  sim_set_access_point(true);
+  int64_t wifi_recovery_us =
+      time_until([&]() { return controller->is_wifi_connected(); },
+                 2 * SIM_WIFI_BACKOFF_MAX_MS * 1000);
+  EXPECT_GE(wifi_recovery_us, 0);
+  EXPECT_LE(wifi_recovery_us,
+            SIM_WIFI_BACKOFF_MAX_MS * 1000 + SIM_WIFI_SCAN_CONNECT_US);
+
+  // The connect callback cuts the reconnect timeout short
+  int64_t mqtt_recovery_us =
+      time_until([&]() { return controller->mqtt.is_ready(); },
+                 10 * SECOND_US);
+  EXPECT_GE(mqtt_recovery_us, 0);
+  EXPECT_LE(mqtt_recovery_us, SIM_BROKER_CONNECT_US + SIM_BROKER_LATENCY_US);
+
+  EXPECT_EQ(controller->wifi.get_stats().reconnects, 1u);
+  EXPECT_EQ(controller->mqtt.get_stats().reconnects, 1u);
+}
+
+TEST_F(FaultRecoveryTest, SensorFaultPublishesInvalidReadingsUntilCleared) {
+  constexpr int64_t INTERVAL_US = SIM_TEMPERATURE_CHECK_INTERVAL_MS * 1000;
+
+  sim_run_for(INTERVAL_US);
+  TemperatureSensorStats before = controller->temperature_sensor.get_stats();
+
+  controller->sensor.is_failing = true;
+  int64_t failed_at = esp_timer_get_time();
+  sim_run_for(4 * INTERVAL_US);
+  controller->sensor.is_failing = false;
+  int64_t cleared_at = esp_timer_get_time();
+
+  TemperatureSensorStats after = controller->temperature_sensor.get_stats();
+  EXPECT_EQ(after.reads - before.reads, 4u);
+  EXPECT_EQ(after.errors - before.errors, 4u);
+  EXPECT_LT(controller->get_stats().last_valid_reading_at, failed_at);
+  EXPECT_GE(telemetry_since(failed_at), 4u);
+
+  EXPECT_GE(time_until(
+                [&]() {
+                  return controller->get_stats().last_valid_reading_at >
+                         cleared_at;
+                },
+                INTERVAL_US + SECOND_US),
+            0);
+}
+
+TEST_F(FaultRecoveryTest, NvsFaultFailsCommandsUntilCleared) {
+  nvs_commit_result = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+  send_target_temperature(25);
+  sim_run_for(5 * SECOND_US);
+
+  EXPECT_EQ(controller->get_stats().commands_failed, 1u);
+  EXPECT_EQ(controller->heatpump.get_target_temperature(), 21);
+
+  nvs_commit_result = ESP_OK;
+  send_target_temperature(25);
+  sim_run_for(5 * SECOND_US);
+
+  EXPECT_EQ(controller->get_stats().commands_applied, 1u);
+  EXPECT_EQ(controller->heatpump.get_target_temperature(), 25);
+}
+
+// What inject_fault() and clear_fault() do on the unit
+TEST_F(FaultRecoveryTest, RefusingBrokerUriRecoversOnReconnectTimeout) {
+  constexpr int64_t RETRY_US =
+      SIM_MQTT_RECONNECT_TIMEOUT_MS * 1000 + 2 * SIM_BROKER_LATENCY_US;
+
+  controller->run([&]() {
+    controller->mqtt.set_broker_uri("mqtt://127.0.0.1:1");
+    controller->mqtt.stop();
+    EXPECT_EQ(controller->mqtt.start(), ESP_OK);
+  });
+  sim_run_for(20 * SECOND_US);
+
+  EXPECT_FALSE(controller->mqtt.is_ready());
+  EXPECT_GE(controller->mqtt.get_stats().connect_failures, 9u);
+
+  controller->run(
+      [&]() { controller->mqtt.set_broker_uri(SIM_BROKER_URI); });
+  int64_t recovery_us =
+      time_until([&]() { return controller->mqtt.is_ready(); },
+                 10 * SECOND_US);
+  EXPECT_GE(recovery_us, 0);
+  EXPECT_LE(recovery_us, RETRY_US + SIM_BROKER_CONNECT_US);
+  EXPECT_EQ(controller->mqtt.get_stats().reconnects, 1u);
+}
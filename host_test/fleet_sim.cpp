@@ -0,0 +1,233 @@
+#include "fleet_sim.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "esp_timer.h"
+#include "network_sim.hpp"
+#include "sim_controller.hpp"
+
+constexpr const char* DEVICE_PREFIX = "heatpump-sim";
+// Long enough for the fleet to connect after the ramp, with Wi-Fi retries
+constexpr int64_t CONNECT_TIMEOUT_US = 60 * 1000 * 1000;
+// One command in flight per device, so every reply can be matched
+constexpr int64_t COMMAND_SPACING_US = 5 * 1000 * 1000;
+// Late replies still count, commands without one are lost
+constexpr int64_t GRACE_US = 5 * 1000 * 1000;
+
+struct Command {
+  int target_temperature;
+  int64_t sent_at;
+};
+
+struct Baseline {
+  int64_t cpu_ns;
+  MQTTStats mqtt;
+  uint32_t foreign_commands;
+};
+
+static double percentile(const std::vector<double>& sorted, double fraction) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(fraction * sorted.size());
+  return sorted[std::min(sorted.size() - 1, index)];
+}
+
+FleetResult run_fleet(const FleetOptions& options) {
+  sim_reset(options.seed);
+  std::mt19937 random(options.seed);
+
+  // IDs first, the controllers keep pointers to them
+  std::vector<std::string> device_ids;
+  for (size_t i = 0; i < options.devices; i++) {
+    char device_id[40];
+    snprintf(device_id, sizeof(device_id), "%s-%05u", DEVICE_PREFIX,
+             static_cast<unsigned>(i));
+    device_ids.push_back(device_id);
+  }
+  std::vector<std::unique_ptr<SimController>> controllers;
+  for (const auto& device_id : device_ids) {
+    controllers.push_back(
+        std::make_unique<SimController>(device_id.c_str(), options.control));
+  }
+
+  for (size_t i = 0; i < options.devices; i++) {
+    SimController* controller = controllers[i].get();
+    sim_schedule(options.ramp_us * static_cast<int64_t>(i) /
+                     static_cast<int64_t>(options.devices),
+                 [controller]() { controller->start(); });
+  }
+  auto count_ready = [&]() {
+    return static_cast<size_t>(
+        std::count_if(controllers.begin(), controllers.end(),
+                      [](const auto& c) { return c->mqtt.is_ready(); }));
+  };
+  sim_run_until([&]() { return count_ready() == options.devices; },
+                options.ramp_us + CONNECT_TIMEOUT_US);
+
+  FleetResult result = {};
+  result.devices = options.devices;
+  result.devices_connected = count_ready();
+  result.recovery_ms = -1;
+
+  // Counters start once the fleet is connected
+  std::vector<Baseline> baselines;
+  for (const auto& controller : controllers) {
+    baselines.push_back({sim_node_stats(controller->get_node()).cpu_ns,
+                         controller->mqtt.get_stats(),
+                         controller->get_stats().foreign_commands});
+  }
+  int64_t broker_cpu_ns = sim_broker_stats().cpu_ns;
+  size_t first_message = sim_broker_messages().size();
+  int64_t started_at = esp_timer_get_time();
+  int64_t ends_at = started_at + options.duration_us;
+
+  std::vector<std::deque<Command>> commands(options.devices);
+  std::vector<int> targets(options.devices, 21);
+  std::vector<int64_t> last_sent_at(options.devices, -COMMAND_SPACING_US);
+  std::uniform_int_distribution<int> temperatures(17, 30);
+  sim_repeat(static_cast<int64_t>(1e6 / options.command_rate), [&]() {
+    int64_t now = esp_timer_get_time();
+    if (now >= ends_at) {
+      return;
+    }
+    std::vector<size_t> idle;
+    for (size_t i = 0; i < options.devices; i++) {
+      if (now - last_sent_at[i] >= COMMAND_SPACING_US) {
+        idle.push_back(i);
+      }
+    }
+    if (idle.empty()) {
+      return;
+    }
+
+    // A new target each time, an unchanged one is not published again
+    size_t device = idle[random() % idle.size()];
+    int target_temperature;
+    do {
+      target_temperature = temperatures(random);
+    } while (target_temperature == targets[device]);
+    targets[device] = target_temperature;
+    last_sent_at[device] = now;
+    commands[device].push_back({target_temperature, now});
+    result.commands_sent++;
+
+    char message[128];
+    snprintf(message, sizeof(message),
+             "{\"deviceId\":\"%s\",\"mode\":\"HEAT\","
+             "\"targetTemperature\":%d}",
+             device_ids[device].c_str(), target_temperature);
+    sim_broker_publish(SIM_TARGET_STATE_TOPIC, message, 1);
+  });
+
+  if (options.broker_outage_us > 0) {
+    int64_t restored_at = -1;
+    sim_schedule(options.duration_us / 2, [&]() {
+      sim_set_broker(false);
+      sim_schedule(options.broker_outage_us, [&]() {
+        sim_set_broker(true);
+        restored_at = esp_timer_get_time();
+      });
+    });
+    sim_repeat(10 * 1000, [&]() {
+      if (restored_at >= 0 && result.recovery_ms < 0 &&
+          count_ready() == options.devices) {
+        result.recovery_ms = (esp_timer_get_time() - restored_at) / 1000.0;
+      }
+    });
+  }
+
+  sim_run_for(options.duration_us + GRACE_US);
+  double elapsed_s = (esp_timer_get_time() - started_at) / 1e6;
+  result.duration_s = elapsed_s;
+
+  // Commanded states are matched to the commands of their device in order
+  std::vector<double> latencies;
+  const std::vector<SimMessage>& messages = sim_broker_messages();
+  size_t prefix_length = strlen(SIM_COMMANDED_STATE_TOPIC) + 1;
+  for (size_t i = first_message; i < messages.size(); i++) {
+    const SimMessage& message = messages[i];
+    if (message.topic.compare(0, prefix_length - 1,
+                              SIM_COMMANDED_STATE_TOPIC) != 0) {
+      continue;
+    }
+    size_t device = strtoul(
+        message.topic.c_str() + prefix_length + strlen(DEVICE_PREFIX) + 1,
+        nullptr, 10);
+    const char* value =
+        strstr(message.payload.c_str(), "\"targetTemperature\":");
+    if (device >= options.devices || value == nullptr) {
+      continue;
+    }
+    int target_temperature = atoi(value + strlen("\"targetTemperature\":"));
+
+    // Republished states after a reconnect match no command, commands
+    // before the matching one were merged into it
+    auto& pending = commands[device];
+    auto command = std::find_if(
+        pending.begin(), pending.end(), [&](const Command& command) {
+          return command.sent_at <= message.at_us &&
+                 command.target_temperature == target_temperature;
+        });
+    if (command != pending.end()) {
+      latencies.push_back((message.at_us - command->sent_at) / 1000.0);
+      result.commands_superseded +=
+          static_cast<uint32_t>(command - pending.begin());
+      pending.erase(pending.begin(), command + 1);
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+  result.commands_confirmed = static_cast<uint32_t>(latencies.size());
+  result.commands_lost = result.commands_sent - result.commands_confirmed -
+                         result.commands_superseded;
+  result.latency_p50_ms = percentile(latencies, 0.5);
+  result.latency_p90_ms = percentile(latencies, 0.9);
+  result.latency_p99_ms = percentile(latencies, 0.99);
+  result.latency_max_ms = latencies.empty() ? 0 : latencies.back();
+
+  uint64_t published = 0;
+  uint64_t deliveries = 0;
+  uint64_t delivered_bytes = 0;
+  uint64_t foreign = 0;
+  for (size_t i = 0; i < options.devices; i++) {
+    SimController& controller = *controllers[i];
+    const Baseline& baseline = baselines[i];
+    MQTTStats mqtt_stats = controller.mqtt.get_stats();
+    published += mqtt_stats.messages_published -
+                 baseline.mqtt.messages_published;
+    deliveries += mqtt_stats.messages_received -
+                  baseline.mqtt.messages_received;
+    delivered_bytes += mqtt_stats.bytes_received -
+                       baseline.mqtt.bytes_received;
+    foreign +=
+        controller.get_stats().foreign_commands - baseline.foreign_commands;
+    result.connect_failures +=
+        mqtt_stats.connect_failures - baseline.mqtt.connect_failures;
+
+    double cpu_us_per_s =
+        (sim_node_stats(controller.get_node()).cpu_ns - baseline.cpu_ns) /
+        1000.0 / elapsed_s;
+    result.controller_cpu_us_per_s += cpu_us_per_s / options.devices;
+    result.max_controller_cpu_us_per_s =
+        std::max(result.max_controller_cpu_us_per_s, cpu_us_per_s);
+  }
+
+  double commands_sent = std::max<uint32_t>(1, result.commands_sent);
+  result.device_publishes_per_s = published / elapsed_s / options.devices;
+  result.device_deliveries_per_s = deliveries / elapsed_s;
+  result.deliveries_per_command = deliveries / commands_sent;
+  result.bytes_per_command = delivered_bytes / commands_sent;
+  result.foreign_fraction =
+      static_cast<double>(foreign) / std::max<uint64_t>(1, deliveries);
+  result.broker_cpu_us_per_s =
+      (sim_broker_stats().cpu_ns - broker_cpu_ns) / 1000.0 / elapsed_s;
+  return result;
+}
@@ -0,0 +1,63 @@
+#ifndef FLEET_SIM_HPP
+#define FLEET_SIM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "sim_control.hpp"
+
+// A fleet of SimControllers sharing the broker of network_sim.cpp, driven
+// by a backend that sends target-state commands to random devices and waits
+// for their commanded state. Everything on a controller is the firmware
+// from main/, so its CPU time is what the controller logic costs on the
+// host, not on the ESP32.
+
+struct FleetOptions {
+  size_t devices;
+  int64_t duration_us;
+  // Connects are spread over the ramp, like a fleet coming back online
+  int64_t ramp_us;
+  // Fleet-wide target-state commands per second
+  double command_rate;
+  SimControl control;
+  // The broker goes down halfway through for this long, 0 for never
+  int64_t broker_outage_us;
+  uint32_t seed;
+};
+
+struct FleetResult {
+  size_t devices;
+  size_t devices_connected;
+  double duration_s;
+
+  uint32_t commands_sent;
+  uint32_t commands_confirmed;
+  // Merged with a later command for the same device before it was applied
+  uint32_t commands_superseded;
+  uint32_t commands_lost;
+  // From the command reaching the broker to the commanded state reaching it
+  double latency_p50_ms;
+  double latency_p90_ms;
+  double latency_p99_ms;
+  double latency_max_ms;
+
+  double device_publishes_per_s;
+  double device_deliveries_per_s;
+  double deliveries_per_command;
+  double bytes_per_command;
+  double foreign_fraction;
+
+  // Host CPU microseconds per simulated second
+  double controller_cpu_us_per_s;
+  double max_controller_cpu_us_per_s;
+  double broker_cpu_us_per_s;
+
+  uint32_t connect_failures;
+  // From the broker coming back until every controller is ready again, -1
+  // without an outage or when they did not all recover
+  double recovery_ms;
+};
+
+FleetResult run_fleet(const FleetOptions& options);
+
+#endif
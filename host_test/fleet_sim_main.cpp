@@ -0,0 +1,182 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "fleet_sim.hpp"
+
+// Runs fleets of controllers built from main/ against the simulated broker
+// and reports command latency, MQTT traffic and CPU time per controller:
+//
+//   fleet_sim [--devices N [N ...]] [--duration S] [--ramp S]
+//             [--command-rate R] [--control off|hysteresis|pid]
+//             [--broker-outage S] [--seed N] [--label NAME] [--csv PATH]
+//
+// Time is simulated, so a fleet runs as fast as the host allows. CPU time
+// is measured on the host for each controller's node; compare it across
+// fleet sizes and releases rather than with the ESP32.
+
+constexpr const char* FIELDS =
+    "label,devices,devices_connected,duration_s,commands_sent,"
+    "commands_confirmed,commands_superseded,commands_lost,latency_p50_ms,"
+    "latency_p90_ms,latency_p99_ms,latency_max_ms,device_publishes_per_s,"
+    "device_deliveries_per_s,deliveries_per_command,bytes_per_command,"
+    "foreign_fraction,controller_cpu_us_per_s,max_controller_cpu_us_per_s,"
+    "broker_cpu_us_per_s,connect_failures,recovery_ms";
+
+static bool parse_control(const char* value, SimControl& control) {
+  if (strcmp(value, "off") == 0) {
+    control = SimControl::OFF;
+  } else if (strcmp(value, "hysteresis") == 0) {
+    control = SimControl::HYSTERESIS;
+  } else if (strcmp(value, "pid") == 0) {
+    control = SimControl::PID;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: fleet_sim [--devices N [N ...]] [--duration S] [--ramp S] "
+          "[--command-rate R] [--control off|hysteresis|pid] "
+          "[--broker-outage S] [--seed N] [--label NAME] [--csv PATH]\n");
+}
+
+static void print_result(const FleetResult& result) {
+  printf("  connected: %zu/%zu\n", result.devices_connected, result.devices);
+  printf("  commands: %u/%u confirmed, %u superseded, %u lost\n",
+         result.commands_confirmed, result.commands_sent,
+         result.commands_superseded, result.commands_lost);
+  printf("  latency: p50 %.0f ms, p90 %.0f ms, p99 %.0f ms, max %.0f ms\n",
+         result.latency_p50_ms, result.latency_p90_ms, result.latency_p99_ms,
+         result.latency_max_ms);
+  printf("  per device: %.2f publishes/s\n", result.device_publishes_per_s);
+  printf("  broker to devices: %.1f deliveries/s, %.1f per command, "
+         "%.0f bytes per command, %.0f%% foreign\n",
+         result.device_deliveries_per_s, result.deliveries_per_command,
+         result.bytes_per_command, result.foreign_fraction * 100);
+  printf("  cpu: %.1f us/s per controller (max %.1f), broker %.1f us/s\n",
+         result.controller_cpu_us_per_s, result.max_controller_cpu_us_per_s,
+         result.broker_cpu_us_per_s);
+  if (result.recovery_ms >= 0) {
+    printf("  broker outage: all ready %.0f ms after it came back, "
+           "%u connect failures\n",
+           result.recovery_ms, result.connect_failures);
+  }
+}
+
+static void write_row(FILE* file, const char* label,
+                      const FleetResult& result) {
+  fprintf(file,
+          "%s,%zu,%zu,%.1f,%u,%u,%u,%u,%.1f,%.1f,%.1f,%.1f,%.3f,%.1f,%.2f,"
+          "%.0f,%.3f,%.1f,%.1f,%.1f,%u,%.0f\n",
+          label, result.devices, result.devices_connected, result.duration_s,
+          result.commands_sent, result.commands_confirmed,
+          result.commands_superseded, result.commands_lost,
+          result.latency_p50_ms, result.latency_p90_ms, result.latency_p99_ms,
+          result.latency_max_ms, result.device_publishes_per_s,
+          result.device_deliveries_per_s, result.deliveries_per_command,
+          result.bytes_per_command, result.foreign_fraction,
+          result.controller_cpu_us_per_s, result.max_controller_cpu_us_per_s,
+          result.broker_cpu_us_per_s, result.connect_failures,
+          result.recovery_ms);
+}
+
+int main(int argc, char** argv) {
+  FleetOptions options = {};
+  options.duration_us = 60 * 1000 * 1000;
+  options.ramp_us = 10 * 1000 * 1000;
+  options.command_rate = 1;
+  options.control = SimControl::HYSTERESIS;
+  options.seed = 1;
+  std::vector<size_t> fleet_sizes;
+  const char* label = "";
+  const char* csv_path = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--devices") == 0) {
+      while (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        fleet_sizes.push_back(strtoul(argv[++i], nullptr, 10));
+      }
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    const char* value = argv[++i];
+    if (strcmp(argv[i - 1], "--duration") == 0) {
+      options.duration_us = static_cast<int64_t>(atof(value) * 1e6);
+    } else if (strcmp(argv[i - 1], "--ramp") == 0) {
+      options.ramp_us = static_cast<int64_t>(atof(value) * 1e6);
+    } else if (strcmp(argv[i - 1], "--command-rate") == 0) {
+      options.command_rate = atof(value);
+    } else if (strcmp(argv[i - 1], "--control") == 0) {
+      if (!parse_control(value, options.control)) {
+        usage();
+        return 2;
+      }
+    } else if (strcmp(argv[i - 1], "--broker-outage") == 0) {
+      options.broker_outage_us = static_cast<int64_t>(atof(value) * 1e6);
+    } else if (strcmp(argv[i - 1], "--seed") == 0) {
+      options.seed = strtoul(value, nullptr, 10);
+    } else if (strcmp(argv[i - 1], "--label") == 0) {
+      label = value;
+    } else if (strcmp(argv[i - 1], "--csv") == 0) {
+      csv_path = value;
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (fleet_sizes.empty()) {
+    fleet_sizes = {10, 100};
+  }
+  if (options.duration_us <= 0 || options.command_rate <= 0) {
+    usage();
+    return 2;
+  }
+
+  std::vector<FleetResult> results;
+  for (size_t devices : fleet_sizes) {
+    if (devices == 0) {
+      usage();
+      return 2;
+    }
+    printf("%zu devices...\n", devices);
+    fflush(stdout);
+    options.devices = devices;
+    clock_t started = clock();
+    results.push_back(run_fleet(options));
+    print_result(results.back());
+    printf("  simulated in %.1f s of host CPU\n",
+           static_cast<double>(clock() - started) / CLOCKS_PER_SEC);
+  }
+
+  if (csv_path != nullptr) {
+    FILE* file = fopen(csv_path, "a");
+    if (file == nullptr) {
+      fprintf(stderr, "%s: cannot open\n", csv_path);
+      return 2;
+    }
+    // A header for a new file only, rows are appended across runs
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) {
+      fprintf(file, "%s\n", FIELDS);
+    }
+    for (const auto& result : results) {
+      write_row(file, label, result);
+    }
+    fclose(file);
+  }
+
+  bool is_complete = true;
+  for (const auto& result : results) {
+    is_complete = is_complete && result.commands_lost == 0 &&
+                  result.devices_connected == result.devices;
+  }
+  return is_complete ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include "fleet_sim.hpp"
+#include "sim_controller.hpp"
+
+// Small fleets of the real controllers on the simulated broker, see
+// fleet_sim_main.cpp for the larger runs.
+
+constexpr size_t DEVICES = 20;
+
+static FleetOptions fleet_options() {
+  FleetOptions options = {};
+  options.devices = DEVICES;
+  options.duration_us = 60 * 1000 * 1000;
+  options.ramp_us = 2 * 1000 * 1000;
+  options.command_rate = 2;
+  options.control = SimControl::HYSTERESIS;
+  options.seed = 7;
+  return options;
+}
+
+TEST(FleetSimTest, EveryCommandIsConfirmedAndFansOutToTheFleet) {
+  FleetResult result = run_fleet(fleet_options());
+
+  EXPECT_EQ(result.devices_connected, DEVICES);
+  EXPECT_GT(result.commands_sent, 60u);
+  EXPECT_EQ(result.commands_lost, 0u);
+  // The shared target-state topic reaches every controller, only one acts
+  EXPECT_NEAR(result.deliveries_per_command, DEVICES, 0.5);
+  EXPECT_NEAR(result.foreign_fraction, 1.0 - 1.0 / DEVICES, 0.01);
+  // The settle window of CommandShaper and a round trip to the broker
+  EXPECT_GE(result.latency_p50_ms, 300);
+  EXPECT_LE(result.latency_max_ms, 1000);
+}
+
+TEST(FleetSimTest, CpuTimeIsReportedPerController) {
+  FleetResult result = run_fleet(fleet_options());
+
+  EXPECT_GT(result.controller_cpu_us_per_s, 0);
+  EXPECT_GE(result.max_controller_cpu_us_per_s,
+            result.controller_cpu_us_per_s);
+  EXPECT_GT(result.broker_cpu_us_per_s, 0);
+}
+
+TEST(FleetSimTest, FleetReconnectsAfterABrokerOutage) {
+  FleetOptions options = fleet_options();
+  options.broker_outage_us = 10 * 1000 * 1000;
+  FleetResult result = run_fleet(options);
+
+  // Every controller retries on its own reconnect timeout
+  ASSERT_GE(result.recovery_ms, 0);
+  EXPECT_LE(result.recovery_ms,
+            SIM_MQTT_RECONNECT_TIMEOUT_MS + SIM_BROKER_CONNECT_US / 1000);
+  EXPECT_GE(result.connect_failures, DEVICES);
+  // Persistent sessions hold the commands sent during the outage
+  EXPECT_EQ(result.commands_lost, 0u);
+}
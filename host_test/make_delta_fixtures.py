@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+"""Build the images and deltas the DeltaDecoder tests apply.
+
+    make_delta_fixtures.py OUTPUT_DIR
+
+Deltas come from tools/make_delta.py, so the tests check the device decoder
+against the deltas that are actually published.
+"""
+
+import os
+import random
+import sys
+
+# Keep the source tree clean of __pycache__
+sys.dont_write_bytecode = True
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), "..", "tools"))
+import make_delta  # noqa: E402
+
+
+def make_images():
+    rng = random.Random(1)
+    source = bytearray(rng.getrandbits(8) for _ in range(64 * 1024))
+
+    # A new release: patched code, a moved block, a removed and a new section
+    target = bytearray(source)
+    for offset in range(1000, 60000, 4099):
+        patch = bytes(rng.getrandbits(8) for _ in range(16))
+        target[offset : offset + 16] = patch
+    target[20000:20000] = source[40000:42000]
+    del target[50000:53000]
+    target += bytes(rng.getrandbits(8) for _ in range(3000))
+    return bytes(source), bytes(target)
+
+
+def main():
+    output_dir = sys.argv[1]
+    os.makedirs(output_dir, exist_ok=True)
+    source, target = make_images()
+
+    files = {
+        "source.bin": source,
+        "target.bin": target,
+        "patch.delta": make_delta.make_delta(source, target, False),
+        "full.delta": make_delta.make_delta(source, target, True),
+    }
+    assert make_delta.apply_delta(source, files["patch.delta"]) == target
+    for name, data in files.items():
+        with open(os.path.join(output_dir, name), "wb") as f:
+            f.write(data)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,936 @@
+#include "network_sim.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <utility>
+
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "mqtt_client.h"
+
+constexpr uint8_t AP_BSSID[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+constexpr uint8_t AP_CHANNEL = 6;
+constexpr int AP_RSSI = -62;
+
+// esp-mqtt defaults
+constexpr int DEFAULT_KEEPALIVE_S = 120;
+constexpr int DEFAULT_RECONNECT_TIMEOUT_MS = 10000;
+constexpr int64_t OUTBOX_EXPIRED_TIMEOUT_US = 30 * 1000 * 1000;
+
+extern "C" {
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+}
+static esp_event_base_t const MQTT_EVENTS = "MQTT_EVENTS";
+
+typedef std::pair<int64_t, uint64_t> EventKey;
+
+struct ScheduledEvent {
+  SimNode* node;
+  std::function<void()> callback;
+};
+
+struct EventHandler {
+  esp_event_base_t base;
+  int32_t id;
+  esp_event_handler_t handler;
+  void* arg;
+};
+
+enum class StationState { IDLE, CONNECTING, CONNECTED };
+
+struct SimNode {
+  void* context;
+  uint32_t index;
+  bool has_event_loop;
+  bool is_wifi_started;
+  StationState station;
+  // Bumped on every connect and disconnect, pending results check it
+  uint64_t station_attempt;
+  wifi_config_t wifi_config;
+  std::vector<EventHandler> handlers;
+  SimNodeStats stats;
+};
+
+struct esp_timer {
+  esp_timer_cb_t callback;
+  void* arg;
+  SimNode* node;
+  bool is_armed;
+  EventKey event;
+};
+
+struct OutboxMessage {
+  int msg_id;
+  std::string topic;
+  std::string payload;
+  int qos;
+};
+
+struct ClientHandler {
+  int32_t event;
+  esp_event_handler_t handler;
+  void* arg;
+};
+
+enum class ClientState { STOPPED, CONNECTING, CONNECTED, WAIT_RECONNECT };
+
+struct esp_mqtt_client {
+  SimNode* node;
+  std::string uri;
+  std::string client_id;
+  bool is_clean_session;
+  int keepalive_s;
+  int reconnect_timeout_ms;
+  uint64_t outbox_limit;
+  std::vector<ClientHandler> handlers;
+  ClientState state;
+  // Bumped whenever a connection ends, deliveries for an older one are lost
+  uint64_t connection;
+  // Packets get through, a connection can outlive a short outage
+  bool is_link_up;
+  bool has_reconnect;
+  EventKey reconnect_event;
+  std::vector<OutboxMessage> outbox;
+  int next_msg_id;
+};
+
+struct Subscription {
+  std::string filter;
+  int qos;
+};
+
+struct Session {
+  bool is_clean;
+  esp_mqtt_client* client;
+  std::vector<Subscription> subscriptions;
+  std::vector<SimMessage> queued;
+};
+
+struct Simulation {
+  int64_t now_us;
+  uint64_t next_sequence;
+  std::map<EventKey, ScheduledEvent> queue;
+  std::vector<std::unique_ptr<SimNode>> nodes;
+  SimNode* current;
+  std::vector<std::unique_ptr<esp_timer>> timers;
+  std::vector<std::unique_ptr<esp_mqtt_client>> clients;
+  std::mt19937 random;
+  bool is_ap_available;
+  bool is_broker_available;
+  std::map<std::string, Session> sessions;
+  std::vector<SimMessage> messages;
+  SimNodeStats broker_stats;
+};
+
+static Simulation sim;
+
+static int64_t thread_cpu_ns() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// A null node is the broker
+static EventKey schedule_on(SimNode* node, int64_t delay_us,
+                            std::function<void()> callback) {
+  EventKey key = {sim.now_us + std::max<int64_t>(delay_us, 0),
+                  sim.next_sequence++};
+  sim.queue.emplace(key, ScheduledEvent{node, std::move(callback)});
+  return key;
+}
+
+static void run_on(SimNode* node, const std::function<void()>& callback) {
+  SimNode* previous = sim.current;
+  sim.current = node;
+  int64_t started_at = thread_cpu_ns();
+  callback();
+  SimNodeStats& stats = node != nullptr ? node->stats : sim.broker_stats;
+  stats.cpu_ns += thread_cpu_ns() - started_at;
+  stats.events++;
+  sim.current = previous;
+}
+
+static bool run_next(int64_t until_us) {
+  if (sim.queue.empty() || sim.queue.begin()->first.first > until_us) {
+    return false;
+  }
+
+  auto next = sim.queue.begin();
+  ScheduledEvent event = std::move(next->second);
+  sim.now_us = next->first.first;
+  sim.queue.erase(next);
+  run_on(event.node, event.callback);
+  return true;
+}
+
+// Simulation
+
+void sim_reset(uint32_t seed) {
+  // Queued callbacks point into the nodes, timers and clients
+  sim.queue.clear();
+  sim.clients.clear();
+  sim.timers.clear();
+  sim.nodes.clear();
+  sim.sessions.clear();
+  sim.messages.clear();
+
+  sim.now_us = SIM_BOOT_TIME_US;
+  sim.next_sequence = 0;
+  sim.random.seed(seed);
+  sim.is_ap_available = true;
+  sim.is_broker_available = true;
+  sim.broker_stats = {};
+  sim.current = sim_add_node(nullptr);
+}
+
+SimNode* sim_default_node() { return sim.nodes.front().get(); }
+
+SimNode* sim_add_node(void* context) {
+  auto node = std::make_unique<SimNode>();
+  node->context = context;
+  node->index = static_cast<uint32_t>(sim.nodes.size());
+  node->station = StationState::IDLE;
+  sim.nodes.push_back(std::move(node));
+  return sim.nodes.back().get();
+}
+
+void* sim_current_context() {
+  return sim.current != nullptr ? sim.current->context : nullptr;
+}
+
+void sim_run_on(SimNode* node, const std::function<void()>& callback) {
+  run_on(node, callback);
+}
+
+SimNodeStats sim_node_stats(SimNode* node) { return node->stats; }
+
+SimNodeStats sim_broker_stats() { return sim.broker_stats; }
+
+void sim_schedule(int64_t delay_us, std::function<void()> callback) {
+  schedule_on(sim.current, delay_us, std::move(callback));
+}
+
+void sim_repeat(int64_t period_us, std::function<void()> callback) {
+  sim_schedule(period_us, [period_us, callback]() {
+    callback();
+    sim_repeat(period_us, callback);
+  });
+}
+
+void sim_run_for(int64_t duration_us) {
+  int64_t until_us = sim.now_us + duration_us;
+  while (run_next(until_us)) {
+  }
+  sim.now_us = until_us;
+}
+
+bool sim_run_until(const std::function<bool()>& condition,
+                   int64_t timeout_us) {
+  int64_t until_us = sim.now_us + timeout_us;
+  while (!condition()) {
+    if (!run_next(until_us)) {
+      sim.now_us = until_us;
+      return condition();
+    }
+  }
+  return true;
+}
+
+static struct SimInit {
+  SimInit() { sim_reset(); }
+} sim_init;
+
+// Network
+
+static bool is_network_up(SimNode* node) {
+  return sim.is_ap_available && node->station == StationState::CONNECTED;
+}
+
+static bool is_reachable(esp_mqtt_client* client) {
+  return is_network_up(client->node) && sim.is_broker_available &&
+         client->uri == SIM_BROKER_URI;
+}
+
+static void resume_link(esp_mqtt_client* client);
+static void drop_connection(esp_mqtt_client* client, int sock_errno);
+
+// Checks every connection after the access point, a station or the broker
+// changed
+static void update_links() {
+  for (auto& entry : sim.clients) {
+    esp_mqtt_client* client = entry.get();
+    if (client->state != ClientState::CONNECTED ||
+        client->is_link_up == is_reachable(client)) {
+      continue;
+    }
+
+    client->is_link_up = !client->is_link_up;
+    if (client->is_link_up) {
+      resume_link(client);
+      continue;
+    }
+
+    // A broker that went down is noticed from the reset of its host, a
+    // network that went away only from the missing answer to the next
+    // keepalive ping
+    uint64_t connection = client->connection;
+    bool is_reset = is_network_up(client->node);
+    int64_t keepalive_us = static_cast<int64_t>(client->keepalive_s) * 1000000;
+    int64_t delay_us = is_reset ? SIM_BROKER_LATENCY_US : keepalive_us;
+    schedule_on(client->node, delay_us, [client, connection, is_reset]() {
+      if (client->connection == connection && !client->is_link_up) {
+        drop_connection(client, is_reset ? ECONNRESET : 0);
+      }
+    });
+  }
+}
+
+static void post_event(SimNode* node, esp_event_base_t base, int32_t id,
+                       const void* data, size_t size);
+
+void sim_set_access_point(bool is_available) {
+  sim.is_ap_available = is_available;
+
+  // Stations notice that the access point is gone once its beacons are
+  // missing for a while
+  if (!is_available) {
+    for (auto& entry : sim.nodes) {
+      SimNode* node = entry.get();
+      schedule_on(node, SIM_WIFI_BEACON_TIMEOUT_US, [node]() {
+        if (sim.is_ap_available || node->station != StationState::CONNECTED) {
+          return;
+        }
+        node->station = StationState::IDLE;
+        node->station_attempt++;
+        update_links();
+
+        wifi_event_sta_disconnected_t event = {};
+        event.reason = WIFI_REASON_BEACON_TIMEOUT;
+        post_event(node, WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event,
+                   sizeof(event));
+      });
+    }
+  }
+  update_links();
+}
+
+void sim_set_broker(bool is_available) {
+  sim.is_broker_available = is_available;
+  update_links();
+}
+
+// Timers and ticks
+
+extern "C" int64_t esp_timer_get_time() { return sim.now_us; }
+
+extern "C" TickType_t xTaskGetTickCount() {
+  return static_cast<TickType_t>(sim.now_us / 1000 / portTICK_PERIOD_MS);
+}
+
+extern "C" uint32_t esp_random() { return sim.random(); }
+
+extern "C" esp_err_t esp_timer_create(const esp_timer_create_args_t* args,
+                                      esp_timer_handle_t* out_handle) {
+  auto timer = std::make_unique<esp_timer>();
+  timer->callback = args->callback;
+  timer->arg = args->arg;
+  timer->node = sim.current;
+  timer->is_armed = false;
+  *out_handle = timer.get();
+  sim.timers.push_back(std::move(timer));
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_timer_start_once(esp_timer_handle_t timer,
+                                          uint64_t timeout_us) {
+  if (timer->is_armed) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->is_armed = true;
+  timer->event = schedule_on(timer->node, static_cast<int64_t>(timeout_us),
+                             [timer]() {
+                               timer->is_armed = false;
+                               timer->callback(timer->arg);
+                             });
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  if (!timer->is_armed) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  sim.queue.erase(timer->event);
+  timer->is_armed = false;
+  return ESP_OK;
+}
+
+// Event loop and station
+
+static void post_event(SimNode* node, esp_event_base_t base, int32_t id,
+                       const void* data, size_t size) {
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  std::vector<uint8_t> copy(bytes, bytes + size);
+  schedule_on(node, 0, [node, base, id, copy]() mutable {
+    for (size_t i = 0; i < node->handlers.size(); i++) {
+      EventHandler handler = node->handlers[i];
+      if (handler.base == base &&
+          (handler.id == id || handler.id == ESP_EVENT_ANY_ID)) {
+        handler.handler(handler.arg, base, id, copy.data());
+      }
+    }
+  });
+}
+
+extern "C" esp_err_t esp_event_loop_create_default() {
+  if (sim.current->has_event_loop) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  sim.current->has_event_loop = true;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_event_handler_register(
+    esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void* event_handler_arg) {
+  sim.current->handlers.push_back(
+      {event_base, event_id, event_handler, event_handler_arg});
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_netif_init() { return ESP_OK; }
+
+extern "C" esp_netif_t* esp_netif_create_default_wifi_sta() {
+  return reinterpret_cast<esp_netif_t*>(sim.current);
+}
+
+extern "C" esp_err_t esp_wifi_init(const wifi_init_config_t* config) {
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_wifi_set_mode(wifi_mode_t mode) { return ESP_OK; }
+
+extern "C" esp_err_t esp_wifi_set_config(wifi_interface_t interface,
+                                         wifi_config_t* conf) {
+  sim.current->wifi_config = *conf;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_wifi_start() {
+  sim.current->is_wifi_started = true;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_wifi_connect() {
+  SimNode* node = sim.current;
+  if (!node->is_wifi_started) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (node->station != StationState::IDLE) {
+    return ESP_OK;
+  }
+
+  // A station that was given the BSSID and channel of the access point
+  // skips the scan
+  const wifi_sta_config_t& config = node->wifi_config.sta;
+  bool is_fast = config.bssid_set && config.channel == AP_CHANNEL &&
+                 memcmp(config.bssid, AP_BSSID, sizeof(AP_BSSID)) == 0;
+
+  node->station = StationState::CONNECTING;
+  uint64_t attempt = ++node->station_attempt;
+  schedule_on(
+      node, is_fast ? SIM_WIFI_FAST_CONNECT_US : SIM_WIFI_SCAN_CONNECT_US,
+      [node, attempt]() {
+        if (node->station_attempt != attempt) {
+          return;
+        }
+
+        if (!sim.is_ap_available) {
+          node->station = StationState::IDLE;
+          wifi_event_sta_disconnected_t event = {};
+          event.reason = WIFI_REASON_NO_AP_FOUND;
+          post_event(node, WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event,
+                     sizeof(event));
+          return;
+        }
+
+        node->station = StationState::CONNECTED;
+        update_links();
+
+        // 10.0.0.0/8, a fleet does not fit a home network
+        ip_event_got_ip_t event = {};
+        event.ip_info.ip.addr = 10 | (node->index >> 16 & 0xFF) << 8 |
+                                (node->index >> 8 & 0xFF) << 16 |
+                                (node->index & 0xFF) << 24;
+        post_event(node, IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event));
+      });
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_wifi_disconnect() {
+  SimNode* node = sim.current;
+  node->station_attempt++;
+  if (node->station == StationState::IDLE) {
+    return ESP_OK;
+  }
+
+  node->station = StationState::IDLE;
+  update_links();
+
+  wifi_event_sta_disconnected_t event = {};
+  event.reason = WIFI_REASON_ASSOC_LEAVE;
+  post_event(node, WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event,
+             sizeof(event));
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t* ap_info) {
+  if (sim.current->station != StationState::CONNECTED) {
+    return ESP_FAIL;
+  }
+  memcpy(ap_info->bssid, AP_BSSID, sizeof(AP_BSSID));
+  ap_info->primary = AP_CHANNEL;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_wifi_sta_get_rssi(int* rssi) {
+  if (sim.current->station != StationState::CONNECTED) {
+    return ESP_FAIL;
+  }
+  *rssi = AP_RSSI;
+  return ESP_OK;
+}
+
+// Broker
+
+static bool topic_matches(const std::string& filter, const std::string& topic) {
+  size_t f = 0;
+  size_t t = 0;
+  while (f < filter.size()) {
+    if (filter[f] == '#') {
+      return true;
+    }
+    if (filter[f] == '+') {
+      while (t < topic.size() && topic[t] != '/') {
+        t++;
+      }
+      f++;
+      continue;
+    }
+    if (t >= topic.size() || filter[f] != topic[t]) {
+      return false;
+    }
+    f++;
+    t++;
+  }
+  return t == topic.size();
+}
+
+static void dispatch(esp_mqtt_client* client, esp_mqtt_event_id_t event_id,
+                     esp_mqtt_event_t& event) {
+  event.event_id = event_id;
+  event.client = client;
+  for (size_t i = 0; i < client->handlers.size(); i++) {
+    ClientHandler handler = client->handlers[i];
+    if (handler.event == event_id || handler.event == MQTT_EVENT_ANY) {
+      handler.handler(handler.arg, MQTT_EVENTS, event_id, &event);
+    }
+  }
+}
+
+static void deliver(esp_mqtt_client* client, SimMessage message) {
+  uint64_t connection = client->connection;
+  schedule_on(client->node, SIM_BROKER_LATENCY_US,
+              [client, connection, message]() mutable {
+                if (client->connection != connection) {
+                  return;
+                }
+                esp_mqtt_event_t event = {};
+                event.topic = message.topic.data();
+                event.topic_len = static_cast<int>(message.topic.size());
+                event.data = message.payload.data();
+                event.data_len = static_cast<int>(message.payload.size());
+                event.total_data_len = event.data_len;
+                event.qos = message.qos;
+                dispatch(client, MQTT_EVENT_DATA, event);
+              });
+}
+
+// Routes a message to every matching subscription, sessions that are not
+// connected keep their QoS>0 messages
+static void receive(const std::string& client_id, const std::string& topic,
+                    const std::string& payload, int qos) {
+  sim.messages.push_back({sim.now_us, client_id, topic, payload, qos});
+
+  for (auto& [id, session] : sim.sessions) {
+    int subscription_qos = -1;
+    for (const auto& subscription : session.subscriptions) {
+      if (topic_matches(subscription.filter, topic)) {
+        subscription_qos = std::max(subscription_qos, subscription.qos);
+      }
+    }
+    if (subscription_qos < 0) {
+      continue;
+    }
+
+    SimMessage message = {sim.now_us, client_id, topic, payload,
+                          std::min(qos, subscription_qos)};
+    if (session.client != nullptr && session.client->is_link_up) {
+      deliver(session.client, message);
+    } else if (!session.is_clean && message.qos > 0) {
+      session.queued.push_back(message);
+    }
+  }
+}
+
+void sim_broker_publish(const char* topic, const char* payload, int qos) {
+  receive("backend", topic, payload, qos);
+}
+
+const std::vector<SimMessage>& sim_broker_messages() { return sim.messages; }
+
+// MQTT client
+
+static int next_msg_id(esp_mqtt_client* client) {
+  client->next_msg_id = client->next_msg_id % 65535 + 1;
+  return client->next_msg_id;
+}
+
+static bool remove_from_outbox(esp_mqtt_client* client, int msg_id) {
+  for (auto it = client->outbox.begin(); it != client->outbox.end(); ++it) {
+    if (it->msg_id == msg_id) {
+      client->outbox.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void send(esp_mqtt_client* client, const OutboxMessage& message) {
+  uint64_t connection = client->connection;
+  schedule_on(nullptr, SIM_BROKER_LATENCY_US, [client, connection, message]() {
+    if (!sim.is_broker_available) {
+      return;
+    }
+    receive(client->client_id, message.topic, message.payload, message.qos);
+    if (message.qos == 0) {
+      return;
+    }
+
+    int msg_id = message.msg_id;
+    schedule_on(client->node, SIM_BROKER_LATENCY_US, [client, connection,
+                                                  msg_id]() {
+      if (client->connection != connection ||
+          !remove_from_outbox(client, msg_id)) {
+        return;
+      }
+      esp_mqtt_event_t event = {};
+      event.msg_id = msg_id;
+      dispatch(client, MQTT_EVENT_PUBLISHED, event);
+    });
+  });
+}
+
+static Session* find_session(esp_mqtt_client* client) {
+  auto it = sim.sessions.find(client->client_id);
+  if (it == sim.sessions.end() || it->second.client != client) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+// Unacknowledged messages are sent again, like esp-mqtt does after its
+// retransmit timeout, and the broker hands over what it queued meanwhile
+static void resume_link(esp_mqtt_client* client) {
+  for (const auto& message : client->outbox) {
+    send(client, message);
+  }
+
+  Session* session = find_session(client);
+  if (session != nullptr) {
+    for (const auto& message : session->queued) {
+      deliver(client, message);
+    }
+    session->queued.clear();
+  }
+}
+
+static void connect(esp_mqtt_client* client);
+
+static void schedule_reconnect(esp_mqtt_client* client, int64_t delay_us) {
+  client->has_reconnect = true;
+  client->reconnect_event = schedule_on(client->node, delay_us, [client]() {
+    client->has_reconnect = false;
+    if (client->state == ClientState::WAIT_RECONNECT) {
+      connect(client);
+    }
+  });
+}
+
+static void cancel_reconnect(esp_mqtt_client* client) {
+  if (client->has_reconnect) {
+    sim.queue.erase(client->reconnect_event);
+    client->has_reconnect = false;
+  }
+}
+
+static void detach_session(esp_mqtt_client* client) {
+  Session* session = find_session(client);
+  if (session == nullptr) {
+    return;
+  }
+  session->client = nullptr;
+  if (session->is_clean) {
+    sim.sessions.erase(client->client_id);
+  }
+}
+
+// esp_mqtt_abort_connection(): the client waits reconnect_timeout_ms before
+// it connects again
+static void abort_connection(esp_mqtt_client* client) {
+  client->connection++;
+  client->is_link_up = false;
+  detach_session(client);
+  client->state = ClientState::WAIT_RECONNECT;
+
+  esp_mqtt_event_t event = {};
+  dispatch(client, MQTT_EVENT_DISCONNECTED, event);
+  schedule_reconnect(client,
+                     static_cast<int64_t>(client->reconnect_timeout_ms) * 1000);
+}
+
+// A zero errno is a connection that went silent, which the client gives up
+// on without an error
+static void drop_connection(esp_mqtt_client* client, int sock_errno) {
+  if (sock_errno != 0) {
+    esp_mqtt_error_codes_t error = {};
+    error.error_type = MQTT_ERROR_TYPE_TCP_TRANSPORT;
+    error.esp_tls_last_esp_err = ESP_FAIL;
+    error.esp_transport_sock_errno = sock_errno;
+    esp_mqtt_event_t event = {};
+    event.error_handle = &error;
+    dispatch(client, MQTT_EVENT_ERROR, event);
+  }
+  abort_connection(client);
+}
+
+static void accept(esp_mqtt_client* client) {
+  auto it = sim.sessions.find(client->client_id);
+  bool is_session_present = it != sim.sessions.end() && !it->second.is_clean &&
+                            !client->is_clean_session;
+  if (!is_session_present) {
+    sim.sessions[client->client_id] = {client->is_clean_session, nullptr, {},
+                                       {}};
+  }
+  sim.sessions[client->client_id].client = client;
+
+  client->state = ClientState::CONNECTED;
+  client->is_link_up = true;
+
+  esp_mqtt_event_t event = {};
+  event.session_present = is_session_present;
+  dispatch(client, MQTT_EVENT_CONNECTED, event);
+  resume_link(client);
+}
+
+static void connect(esp_mqtt_client* client) {
+  client->state = ClientState::CONNECTING;
+  uint64_t connection = ++client->connection;
+
+  esp_mqtt_event_t event = {};
+  dispatch(client, MQTT_EVENT_BEFORE_CONNECT, event);
+
+  // Without a network there is no route, otherwise a host without a broker
+  // refuses the connection
+  if (!is_reachable(client)) {
+    bool is_refused = is_network_up(client->node);
+    schedule_on(client->node, is_refused ? 2 * SIM_BROKER_LATENCY_US : 0,
+                [client, connection, is_refused]() {
+                  if (client->connection == connection) {
+                    drop_connection(client,
+                                    is_refused ? ECONNREFUSED : EHOSTUNREACH);
+                  }
+                });
+    return;
+  }
+
+  schedule_on(client->node, SIM_BROKER_CONNECT_US, [client, connection]() {
+    if (client->connection != connection) {
+      return;
+    }
+    if (!is_reachable(client)) {
+      drop_connection(client, ECONNRESET);
+      return;
+    }
+    accept(client);
+  });
+}
+
+extern "C" esp_mqtt_client_handle_t esp_mqtt_client_init(
+    const esp_mqtt_client_config_t* config) {
+  auto client = std::make_unique<esp_mqtt_client>();
+  client->node = sim.current;
+  client->uri = config->broker.address.uri ? config->broker.address.uri : "";
+  client->client_id =
+      config->credentials.client_id ? config->credentials.client_id : "";
+  client->is_clean_session = !config->session.disable_clean_session;
+  client->keepalive_s = config->session.keepalive > 0
+                            ? config->session.keepalive
+                            : DEFAULT_KEEPALIVE_S;
+  client->reconnect_timeout_ms = config->network.reconnect_timeout_ms > 0
+                                     ? config->network.reconnect_timeout_ms
+                                     : DEFAULT_RECONNECT_TIMEOUT_MS;
+  client->outbox_limit = config->outbox.limit;
+  client->state = ClientState::STOPPED;
+  sim.clients.push_back(std::move(client));
+  return sim.clients.back().get();
+}
+
+extern "C" esp_err_t esp_mqtt_client_register_event(
+    esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+    esp_event_handler_t event_handler, void* event_handler_arg) {
+  if (client == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  client->handlers.push_back({event, event_handler, event_handler_arg});
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_mqtt_client_set_uri(esp_mqtt_client_handle_t client,
+                                             const char* uri) {
+  client->uri = uri;
+  return ESP_OK;
+}
+
+// The client task takes over, nothing is dispatched on the caller
+extern "C" esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+  if (client->state != ClientState::STOPPED) {
+    return ESP_FAIL;
+  }
+  client->state = ClientState::WAIT_RECONNECT;
+  schedule_reconnect(client, 0);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+  if (client->state == ClientState::STOPPED) {
+    return ESP_FAIL;
+  }
+  cancel_reconnect(client);
+  client->connection++;
+  client->is_link_up = false;
+  detach_session(client);
+  client->state = ClientState::STOPPED;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_mqtt_client_reconnect(
+    esp_mqtt_client_handle_t client) {
+  if (client->state != ClientState::WAIT_RECONNECT) {
+    return ESP_FAIL;
+  }
+  cancel_reconnect(client);
+  schedule_reconnect(client, 0);
+  return ESP_OK;
+}
+
+extern "C" int esp_mqtt_client_publish(esp_mqtt_client_handle_t client,
+                                       const char* topic, const char* data,
+                                       int len, int qos, int retain) {
+  OutboxMessage message = {0, topic,
+                           std::string(data, len > 0 ? len : strlen(data)),
+                           qos};
+
+  // QoS 0 is only sent on a connection, and lost if the link is down
+  if (qos == 0) {
+    if (client->state != ClientState::CONNECTED) {
+      return -1;
+    }
+    if (client->is_link_up) {
+      send(client, message);
+    }
+    return 0;
+  }
+
+  size_t size = message.topic.size() + message.payload.size();
+  if (client->outbox_limit > 0 &&
+      esp_mqtt_client_get_outbox_size(client) + size > client->outbox_limit) {
+    return -2;
+  }
+
+  message.msg_id = next_msg_id(client);
+  client->outbox.push_back(message);
+  int msg_id = message.msg_id;
+  schedule_on(client->node, OUTBOX_EXPIRED_TIMEOUT_US, [client, msg_id]() {
+    if (remove_from_outbox(client, msg_id)) {
+      esp_mqtt_event_t event = {};
+      event.msg_id = msg_id;
+      dispatch(client, MQTT_EVENT_DELETED, event);
+    }
+  });
+
+  if (client->state == ClientState::CONNECTED && client->is_link_up) {
+    send(client, message);
+  }
+  return msg_id;
+}
+
+extern "C" int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client,
+                                         const char* topic, int qos) {
+  if (client->state != ClientState::CONNECTED) {
+    return -1;
+  }
+
+  int msg_id = next_msg_id(client);
+  if (!client->is_link_up) {
+    return msg_id;
+  }
+
+  uint64_t connection = client->connection;
+  Subscription subscription = {topic, qos};
+  schedule_on(nullptr, SIM_BROKER_LATENCY_US, [client, connection, subscription,
+                                           msg_id]() {
+    Session* session = find_session(client);
+    if (session == nullptr) {
+      return;
+    }
+    auto& subscriptions = session->subscriptions;
+    subscriptions.erase(
+        std::remove_if(subscriptions.begin(), subscriptions.end(),
+                       [&](const Subscription& existing) {
+                         return existing.filter == subscription.filter;
+                       }),
+        subscriptions.end());
+    subscriptions.push_back(subscription);
+
+    schedule_on(client->node, SIM_BROKER_LATENCY_US, [client, connection,
+                                                  msg_id]() {
+      if (client->connection != connection) {
+        return;
+      }
+      esp_mqtt_event_t event = {};
+      event.msg_id = msg_id;
+      dispatch(client, MQTT_EVENT_SUBSCRIBED, event);
+    });
+  });
+  return msg_id;
+}
+
+extern "C" int esp_mqtt_client_get_outbox_size(
+    esp_mqtt_client_handle_t client) {
+  size_t size = 0;
+  for (const auto& message : client->outbox) {
+    size += message.topic.size() + message.payload.size();
+  }
+  return static_cast<int>(size);
+}
@@ -0,0 +1,82 @@
+#ifndef NETWORK_SIM_HPP
+#define NETWORK_SIM_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Virtual time and a simulated network for the host tests. esp_timer, the
+// FreeRTOS tick, the Wi-Fi station, the event loop and the esp-mqtt client
+// of stubs/ all run on one event queue, and an in-process broker stands in
+// for the real one. Nothing happens until the clock is moved with
+// sim_run_for() or sim_run_until().
+//
+// The broker is reached at SIM_BROKER_URI only. It refuses connects while it
+// is down and resets the connections it had, keeps the sessions of clients
+// without clean session and queues their QoS>0 messages, and has no retained
+// messages.
+//
+// Every simulated device is a SimNode with its own station and event loop,
+// so several controllers can share the broker. Whatever a node schedules
+// runs on that node again, and the CPU time it takes is counted there.
+
+constexpr const char* SIM_BROKER_URI = "mqtt://broker.sim";
+
+// Roughly a home access point and a broker on the internet
+constexpr int64_t SIM_BOOT_TIME_US = 1000 * 1000;
+constexpr int64_t SIM_BROKER_LATENCY_US = 20 * 1000;  // One way
+constexpr int64_t SIM_BROKER_CONNECT_US = 300 * 1000;  // TCP, TLS, CONNACK
+constexpr int64_t SIM_WIFI_FAST_CONNECT_US = 300 * 1000;   // Known BSSID
+constexpr int64_t SIM_WIFI_SCAN_CONNECT_US = 2500 * 1000;  // Full scan first
+constexpr int64_t SIM_WIFI_BEACON_TIMEOUT_US = 6 * 1000 * 1000;
+
+struct SimNode;
+
+struct SimNodeStats {
+  int64_t cpu_ns;
+  uint32_t events;
+};
+
+// A message as the broker received it
+struct SimMessage {
+  int64_t at_us;
+  std::string client_id;
+  std::string topic;
+  std::string payload;
+  int qos;
+};
+
+// Clears the queue, the nodes and the broker and restarts the clock. The
+// seed is used by esp_random().
+void sim_reset(uint32_t seed = 1);
+
+// The node created by sim_reset(), current unless another one runs
+SimNode* sim_default_node();
+// context is what sim_current_context() returns while the node runs
+SimNode* sim_add_node(void* context);
+void* sim_current_context();
+// Runs callback on node right away, e.g. to initialize its managers
+void sim_run_on(SimNode* node, const std::function<void()>& callback);
+SimNodeStats sim_node_stats(SimNode* node);
+// Work of the broker, which runs on no node
+SimNodeStats sim_broker_stats();
+
+// Scheduled on the current node
+void sim_schedule(int64_t delay_us, std::function<void()> callback);
+void sim_repeat(int64_t period_us, std::function<void()> callback);
+
+void sim_run_for(int64_t duration_us);
+// Returns false if condition did not hold within timeout_us
+bool sim_run_until(const std::function<bool()>& condition,
+                   int64_t timeout_us);
+
+// The access point all stations connect to
+void sim_set_access_point(bool is_available);
+void sim_set_broker(bool is_available);
+
+// Published by a client that is always connected, e.g. the backend
+void sim_broker_publish(const char* topic, const char* payload, int qos);
+const std::vector<SimMessage>& sim_broker_messages();
+
+#endif
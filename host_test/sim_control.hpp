@@ -0,0 +1,27 @@
+#ifndef SIM_CONTROL_HPP
+#define SIM_CONTROL_HPP
+
+#include "ControlEngine.hpp"
+
+enum class SimControl { OFF, HYSTERESIS, PID };
+
+// The control engine of CONFIG_CONTROL_ENGINE with the Kconfig defaults, a
+// hysteresis engine stands in for OFF so there is always one to hold
+inline ControlEngine make_control_engine(SimControl control) {
+  constexpr float FILTER_ALPHA = 0.3f;
+  constexpr float HYSTERESIS = 0.5f;
+  constexpr ControlGains PID_GAINS = {1.5f, 0.05f, 0};
+  constexpr int MAX_SETPOINT_OFFSET = 3;
+  constexpr uint32_t MIN_DWELL_MS = 600000;
+  constexpr uint32_t MIN_COMMAND_INTERVAL_MS = 300000;
+
+  if (control == SimControl::PID) {
+    return ControlEngine(ControlAlgorithm::PID, FILTER_ALPHA, 0, PID_GAINS,
+                         MAX_SETPOINT_OFFSET, MIN_DWELL_MS,
+                         MIN_COMMAND_INTERVAL_MS);
+  }
+  return ControlEngine(ControlAlgorithm::HYSTERESIS, FILTER_ALPHA, HYSTERESIS,
+                       {0, 0, 0}, 0, MIN_DWELL_MS, MIN_COMMAND_INTERVAL_MS);
+}
+
+#endif
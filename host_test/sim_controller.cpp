@@ -0,0 +1,303 @@
+#include "sim_controller.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include "OperatingState.hpp"
+#include "cJSON.h"
+#include "esp_timer.h"
+
+// Kconfig defaults, as in app_main.cpp
+constexpr uint32_t MAIN_LOOP_DELAY_MS = 100;
+constexpr int MQTT_QOS = 1;
+constexpr int MQTT_TELEMETRY_QOS = 0;
+constexpr int MQTT_STATE_QOS = 1;
+constexpr int MQTT_OUTBOX_LIMIT_BYTES = 8192;
+constexpr uint32_t COMMAND_SETTLE_MS = 300;
+constexpr uint32_t COMMAND_MAX_DELAY_MS = 2000;
+constexpr uint32_t COMMAND_MIN_INTERVAL_MS = 1000;
+
+// The clock is never set in the simulation
+constexpr const char* TIMESTAMP = "2026-01-01T00:00:00Z";
+
+esp_err_t SimSensor::collect(SensorSample& sample) {
+  if (is_failing) {
+    return ESP_ERR_TIMEOUT;
+  }
+  sample = {temperature, humidity, true};
+  return ESP_OK;
+}
+
+SimController::SimController(const char* device_id, SimControl control)
+    : device_id(device_id),
+      wifi("sim", "password", SIM_WIFI_BACKOFF_MIN_MS, SIM_WIFI_BACKOFF_MAX_MS),
+      mqtt(SIM_BROKER_URI, device_id, MQTT_QOS, 0,
+           SIM_MQTT_RECONNECT_TIMEOUT_MS, MQTT_OUTBOX_LIMIT_BYTES),
+      heatpump("HEAT", 21),
+      command_shaper(COMMAND_SETTLE_MS, COMMAND_MAX_DELAY_MS,
+                     COMMAND_MIN_INTERVAL_MS),
+      control_engine(make_control_engine(control)),
+      temperature_sensor(SensorFusion::AVERAGE),
+      is_control_enabled(control != SimControl::OFF),
+      node(sim_add_node(this)),
+      loop_manager(SIM_TEMPERATURE_CHECK_INTERVAL_MS),
+      diagnostics_loop(SIM_DIAGNOSTICS_INTERVAL_MS),
+      diagnostics(MAIN_LOOP_DELAY_MS),
+      commanded_state_topic{},
+      should_publish_commanded_state(true),
+      is_wifi_up(false),
+      stats({}) {}
+
+esp_err_t SimController::start() {
+  esp_err_t err = ESP_OK;
+  run([&]() {
+    err = wifi.init();
+    if (err != ESP_OK) {
+      return;
+    }
+    err = mqtt.init();
+    if (err != ESP_OK) {
+      return;
+    }
+    temperature_sensor.add_sensor(&sensor);
+    err = temperature_sensor.init();
+    if (err != ESP_OK) {
+      return;
+    }
+
+    wifi.on_connect([]() {
+      esp_err_t err = current()->mqtt.start();
+      if (err != ESP_OK) {
+        printf("Error starting MQTT client: %s\n", esp_err_to_name(err));
+      }
+    });
+    wifi.on_connect([]() { current()->is_wifi_up = true; });
+    wifi.on_disconnect([]() { current()->is_wifi_up = false; });
+
+    snprintf(commanded_state_topic, sizeof(commanded_state_topic), "%s/%s",
+             SIM_COMMANDED_STATE_TOPIC, device_id);
+    mqtt.set_topic_options(SIM_CURRENT_STATE_TOPIC, MQTT_TELEMETRY_QOS, false);
+    mqtt.set_topic_options(SIM_DIAGNOSTICS_TOPIC, MQTT_TELEMETRY_QOS, false);
+    mqtt.set_topic_options(commanded_state_topic, MQTT_STATE_QOS, true);
+    mqtt.subscribe(SIM_TARGET_STATE_TOPIC, &handle_target_state);
+    mqtt.on_connect(
+        []() { current()->should_publish_commanded_state = true; });
+
+    reset_control_engine();
+    transmit_state();
+    sim_repeat(MAIN_LOOP_DELAY_MS * 1000, [this]() { run_loop(); });
+  });
+  return err;
+}
+
+void SimController::run(const std::function<void()>& callback) {
+  sim_run_on(node, callback);
+}
+
+SimNode* SimController::get_node() { return node; }
+
+SimControllerStats SimController::get_stats() { return stats; }
+
+bool SimController::is_wifi_connected() { return is_wifi_up; }
+
+// The callbacks of the managers take no argument, they run on the node of
+// their controller
+SimController* SimController::current() {
+  return static_cast<SimController*>(sim_current_context());
+}
+
+// handle_target_state() and apply_target_state()
+void SimController::handle_target_state(const char* message) {
+  SimController* self = current();
+
+  cJSON* root = cJSON_Parse(message);
+  if (root == nullptr) {
+    return;
+  }
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  bool is_for_this_device =
+      cJSON_IsString(device_id_item) &&
+      strcmp(device_id_item->valuestring, self->device_id) == 0;
+  cJSON_Delete(root);
+  if (!is_for_this_device) {
+    self->stats.foreign_commands++;
+    return;
+  }
+
+  HeatpumpUpdate update;
+  if (Heatpump::parse_update(message, update) != ESP_OK) {
+    return;
+  }
+  self->command_shaper.submit(update);
+}
+
+// One pass of the main loop
+void SimController::run_loop() {
+  diagnostics.record_loop_iteration();
+  mqtt.expire_stale_publishes();
+
+  HeatpumpUpdate update;
+  if (command_shaper.poll(update)) {
+    apply_update(update);
+  }
+
+  // Cleared first, so a reconnect while publishing triggers another one
+  if (should_publish_commanded_state) {
+    should_publish_commanded_state = false;
+    publish_commanded_state();
+  }
+
+  if (loop_manager.should_run()) {
+    temperature_sensor.start();
+  }
+
+  TemperatureReading reading;
+  if (temperature_sensor.collect(reading)) {
+    publish_current_state(reading);
+  }
+
+  if (diagnostics_loop.should_run()) {
+    publish_diagnostics();
+  }
+}
+
+void SimController::apply_update(const HeatpumpUpdate& update) {
+  bool changed;
+  esp_err_t err = heatpump.apply(update, changed);
+  if (err != ESP_OK) {
+    stats.commands_failed++;
+    return;
+  }
+  stats.commands_applied++;
+  stats.last_command_applied_at = esp_timer_get_time();
+
+  loop_manager.force_run();
+  if (changed) {
+    reset_control_engine();
+  }
+  transmit_state();
+
+  if (changed) {
+    should_publish_commanded_state = true;
+  }
+}
+
+void SimController::transmit_state() {
+  if (is_control_enabled) {
+    ControlOutput output = control_engine.get_output();
+    heatpump.to_binary_state(output.is_on, output.target_temperature,
+                             output.fan_speed);
+  } else {
+    heatpump.to_binary_state();
+  }
+  stats.ir_frames++;
+}
+
+void SimController::reset_control_engine() {
+  if (is_control_enabled) {
+    control_engine.reset(heatpump.get_mode(),
+                         heatpump.get_target_temperature(),
+                         heatpump.get_fan_speed());
+  }
+}
+
+void SimController::publish_commanded_state() {
+  char message[160];
+  snprintf(message, sizeof(message),
+           "{\"deviceId\":\"%s\",\"version\":%lu,\"mode\":\"%s\","
+           "\"targetTemperature\":%d,\"fanSpeed\":%d,\"timestamp\":\"%s\"}",
+           device_id, static_cast<unsigned long>(heatpump.get_version()),
+           mode_to_str(heatpump.get_mode()), heatpump.get_target_temperature(),
+           heatpump.get_fan_speed(), TIMESTAMP);
+  mqtt.publish(commanded_state_topic, message, [](int msg_id, bool delivered) {
+    if (!delivered) {
+      current()->should_publish_commanded_state = true;
+    }
+  });
+}
+
+void SimController::publish_current_state(const TemperatureReading& reading) {
+  bool is_on = true;
+  if (is_control_enabled) {
+    if (reading.is_valid && control_engine.update(reading.temperature)) {
+      transmit_state();
+    }
+    is_on = control_engine.get_output().is_on;
+  }
+
+  OperatingState operating_state =
+      is_on && reading.temperature < heatpump.get_target_temperature()
+          ? OperatingState::HEATING
+          : OperatingState::IDLE;
+
+  char message[165];
+  snprintf(message, sizeof(message),
+           "{\"deviceId\":\"%s\",\"operatingState\":\"%s\","
+           "\"currentTemperature\":%.1f,\"currentHumidity\":%.1f,"
+           "\"timestamp\":\"%s\"}",
+           device_id, operating_state_to_str(operating_state),
+           reading.temperature, reading.humidity, TIMESTAMP);
+
+  if (reading.is_valid) {
+    stats.last_valid_reading_at = esp_timer_get_time();
+  }
+  if (mqtt.publish(SIM_CURRENT_STATE_TOPIC, message) >= 0) {
+    stats.telemetry_published++;
+  }
+}
+
+// The parts of publish_diagnostics() the simulation has
+void SimController::publish_diagnostics() {
+  DiagnosticsReport report = {};
+  diagnostics.collect(report);
+
+  report.wifi_reconnects = wifi.get_stats().reconnects;
+
+  MQTTStats mqtt_stats = mqtt.get_stats();
+  report.mqtt_reconnects = mqtt_stats.reconnects;
+  report.mqtt_publish_failures = mqtt_stats.publish_failures;
+  report.mqtt_messages_received = mqtt_stats.messages_received;
+  report.mqtt_messages_published = mqtt_stats.messages_published;
+  report.mqtt_bytes_received = mqtt_stats.bytes_received;
+  report.mqtt_bytes_published = mqtt_stats.bytes_published;
+  report.mqtt_connects = mqtt_stats.connects;
+  report.mqtt_connect_failures = mqtt_stats.connect_failures;
+  report.mqtt_last_connect_ms = mqtt_stats.last_connect_ms;
+  report.mqtt_max_connect_ms = mqtt_stats.max_connect_ms;
+  report.mqtt_publishes_acked = mqtt_stats.publishes_acked;
+  report.mqtt_publishes_expired = mqtt_stats.publishes_expired;
+  report.mqtt_publishes_untracked = mqtt_stats.publishes_untracked;
+  report.mqtt_last_ack_ms = mqtt_stats.last_ack_ms;
+  report.mqtt_max_ack_ms = mqtt_stats.max_ack_ms;
+  report.mqtt_publishes_pending = mqtt_stats.publishes_pending;
+  report.mqtt_outbox_bytes = mqtt_stats.outbox_bytes;
+  report.foreign_commands = stats.foreign_commands;
+
+  TemperatureSensorStats sensor_stats = temperature_sensor.get_stats();
+  report.sensor_reads = sensor_stats.reads;
+  report.sensor_errors = sensor_stats.errors;
+  report.sensor_count = temperature_sensor.get_sensor_count();
+  for (size_t i = 0; i < report.sensor_count; i++) {
+    report.sensors[i] = temperature_sensor.get_sensor_status(i);
+  }
+
+  report.nvs_commits = heatpump.get_stats().nvs_commits;
+
+  CommandShaperStats command_stats = command_shaper.get_stats();
+  report.commands_received = command_stats.received;
+  report.commands_merged = command_stats.merged;
+  report.commands_applied = command_stats.applied;
+  report.ir_frames_sent = stats.ir_frames;
+
+  ControlStats control_stats = control_engine.get_stats();
+  report.control_commands = control_stats.commands;
+  report.control_rate_limited = control_stats.rate_limited;
+  report.control_dwell_limited = control_stats.dwell_limited;
+
+  char message[1280];
+  if (diagnostics.to_json(report, device_id, message, sizeof(message)) !=
+      ESP_OK) {
+    return;
+  }
+  mqtt.publish(SIM_DIAGNOSTICS_TOPIC, message);
+}
@@ -0,0 +1,103 @@
+#ifndef SIM_CONTROLLER_HPP
+#define SIM_CONTROLLER_HPP
+
+#include <cstdint>
+#include <functional>
+
+#include "CommandShaper.hpp"
+#include "ControlEngine.hpp"
+#include "Diagnostics.hpp"
+#include "Heatpump.hpp"
+#include "LoopManager.hpp"
+#include "MQTTManager.hpp"
+#include "SensorBackend.hpp"
+#include "TemperatureSensor.hpp"
+#include "WiFiManager.hpp"
+#include "network_sim.hpp"
+#include "sim_control.hpp"
+
+// Topics and settings are the Kconfig defaults
+constexpr const char* SIM_CURRENT_STATE_TOPIC = "thermostat/current-state";
+constexpr const char* SIM_TARGET_STATE_TOPIC = "thermostat/set/target-state";
+constexpr const char* SIM_COMMANDED_STATE_TOPIC = "thermostat/commanded-state";
+constexpr const char* SIM_DIAGNOSTICS_TOPIC = "thermostat/diagnostics";
+constexpr uint32_t SIM_MQTT_RECONNECT_TIMEOUT_MS = 2000;
+constexpr uint32_t SIM_WIFI_BACKOFF_MIN_MS = 500;
+constexpr uint32_t SIM_WIFI_BACKOFF_MAX_MS = 60000;
+constexpr uint32_t SIM_TEMPERATURE_CHECK_INTERVAL_MS = 30000;
+constexpr uint32_t SIM_DIAGNOSTICS_INTERVAL_MS = 60000;
+
+// A sensor whose readings and failures the test sets
+class SimSensor : public SensorBackend {
+ public:
+  float temperature = 21;
+  float humidity = 45;
+  bool is_failing = false;
+
+  const char* name() override { return "sim"; }
+  esp_err_t init() override { return ESP_OK; }
+  esp_err_t start() override { return ESP_OK; }
+  uint32_t conversion_time_ms() override { return 750; }
+  esp_err_t collect(SensorSample& sample) override;
+};
+
+struct SimControllerStats {
+  uint32_t commands_applied;
+  uint32_t commands_failed;
+  uint32_t foreign_commands;
+  uint32_t telemetry_published;
+  uint32_t ir_frames;
+  int64_t last_command_applied_at;
+  int64_t last_valid_reading_at;
+};
+
+// The network, command and telemetry path of app_main() on its own simulated
+// node: the real WiFiManager, MQTTManager, CommandShaper, Heatpump,
+// ControlEngine, TemperatureSensor and Diagnostics, wired up and looped like
+// on the unit. IR frames are encoded but go nowhere.
+class SimController {
+ public:
+  explicit SimController(const char* device_id,
+                         SimControl control = SimControl::OFF);
+
+  esp_err_t start();
+
+  // On the node of the controller, like the main task
+  void run(const std::function<void()>& callback);
+  SimNode* get_node();
+  SimControllerStats get_stats();
+  bool is_wifi_connected();
+
+  const char* const device_id;
+  WiFiManager wifi;
+  MQTTManager mqtt;
+  Heatpump heatpump;
+  CommandShaper command_shaper;
+  ControlEngine control_engine;
+  TemperatureSensor temperature_sensor;
+  SimSensor sensor;
+
+ private:
+  const bool is_control_enabled;
+  SimNode* const node;
+  LoopManager loop_manager;
+  LoopManager diagnostics_loop;
+  Diagnostics diagnostics;
+  char commanded_state_topic[128];
+  bool should_publish_commanded_state;
+  bool is_wifi_up;
+  SimControllerStats stats;
+
+  static SimController* current();
+  static void handle_target_state(const char* message);
+
+  void run_loop();
+  void apply_update(const HeatpumpUpdate& update);
+  void transmit_state();
+  void reset_control_engine();
+  void publish_commanded_state();
+  void publish_current_state(const TemperatureReading& reading);
+  void publish_diagnostics();
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "CommandShaper.hpp"
+#include "ControlEngine.hpp"
+#include "HeapMonitor.hpp"
+#include "Heatpump.hpp"
+#include "JsonArena.hpp"
+#include "cJSON.h"
+
+// Runs the command and telemetry path of the main loop with the heap hooks
+// of CONFIG_HEAP_USE_HOOKS emulated on malloc, and checks that nothing in a
+// steady-state section allocates once init is sealed.
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+
+void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps);
+
+// Replaces the glibc allocator for the whole process, operator new and the
+// C++ runtime included
+void* malloc(size_t size) {
+  void* ptr = __libc_malloc(size);
+  esp_heap_trace_alloc_hook(ptr, size, 0);
+  return ptr;
+}
+
+void* calloc(size_t count, size_t size) {
+  void* ptr = __libc_calloc(count, size);
+  esp_heap_trace_alloc_hook(ptr, count * size, 0);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+  void* result = __libc_realloc(ptr, size);
+  esp_heap_trace_alloc_hook(result, size, 0);
+  return result;
+}
+
+void free(void* ptr) { __libc_free(ptr); }
+}
+
+static int64_t now_us = 1;
+extern "C" int64_t esp_timer_get_time() { return now_us; }
+
+constexpr const char* DEVICE_ID = "heatpump-controller";
+constexpr int64_t LOOP_INTERVAL_US = 30 * 1000000LL;
+
+// Kconfig defaults
+constexpr uint32_t COMMAND_SETTLE_MS = 300;
+constexpr uint32_t COMMAND_MAX_DELAY_MS = 2000;
+constexpr uint32_t COMMAND_MIN_INTERVAL_MS = 1000;
+
+class SteadyStateHeapTest : public ::testing::Test {
+ protected:
+  Heatpump heatpump{"heat", 21};
+  CommandShaper command_shaper{COMMAND_SETTLE_MS, COMMAND_MAX_DELAY_MS,
+                               COMMAND_MIN_INTERVAL_MS};
+  ControlEngine control_engine{ControlAlgorithm::PID, 0.3f, 0, {1.5f, 0.05f, 0},
+                               3, 600000, 300000};
+  uint32_t iteration = 0;
+
+  void SetUp() override {
+    ASSERT_EQ(json_arena_init(), ESP_OK);
+    control_engine.reset(Mode::HEAT, 21, 0);
+  }
+
+  // handle_target_state() and apply_target_state()
+  void receive_command(const char* message) {
+    SteadyStateScope steady_state;
+
+    cJSON* root = cJSON_Parse(message);
+    ASSERT_NE(root, nullptr);
+    cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+    bool is_for_this_device =
+        cJSON_IsString(device_id_item) &&
+        strcmp(device_id_item->valuestring, DEVICE_ID) == 0;
+    cJSON_Delete(root);
+    ASSERT_TRUE(is_for_this_device);
+
+    HeatpumpUpdate update;
+    ASSERT_EQ(Heatpump::parse_update(message, update), ESP_OK);
+    command_shaper.submit(update);
+  }
+
+  // One iteration of the main loop, with a command applied and telemetry
+  // published
+  void run_loop(float temperature) {
+    SteadyStateScope steady_state;
+
+    HeatpumpUpdate update;
+    if (command_shaper.poll(update)) {
+      bool changed;
+      ASSERT_EQ(heatpump.apply(update, changed), ESP_OK);
+      if (changed) {
+        control_engine.reset(heatpump.get_mode(),
+                             heatpump.get_target_temperature(),
+                             heatpump.get_fan_speed());
+      }
+      heatpump.to_binary_state();
+    }
+
+    if (control_engine.update(temperature)) {
+      ControlOutput output = control_engine.get_output();
+      heatpump.to_binary_state(output.is_on, output.target_temperature,
+                               output.fan_speed);
+    }
+
+    char message[165];
+    snprintf(message, sizeof(message),
+             "{\"deviceId\":\"%s\",\"operatingState\":\"%s\","
+             "\"currentTemperature\":%.1f,\"currentHumidity\":%.1f,"
+             "\"timestamp\":\"%s\"}",
+             DEVICE_ID, "heating", temperature, 45.0f,
+             "2026-01-01T00:00:00Z");
+  }
+
+  void run_cycle() {
+    char command[128];
+    snprintf(command, sizeof(command),
+             "{\"deviceId\":\"%s\",\"mode\":\"heat\","
+             "\"targetTemperature\":%d,\"fanSpeed\":%d}",
+             DEVICE_ID, 20 + iteration % 3, iteration % 2 ? 40 : 0);
+    receive_command(command);
+
+    now_us += LOOP_INTERVAL_US;
+    run_loop(19.5f + (iteration % 5) * 0.3f);
+    iteration++;
+  }
+};
+
+TEST_F(SteadyStateHeapTest, CommandAndTelemetryCycleAllocatesNothing) {
+  heap_monitor_seal();
+
+  // The first section of a task is its warm-up
+  run_cycle();
+  HeapMonitorStats before = heap_monitor_get_stats();
+  for (int i = 0; i < 100; i++) {
+    run_cycle();
+  }
+  HeapMonitorStats after = heap_monitor_get_stats();
+
+  EXPECT_EQ(after.allocations - before.allocations, 0u);
+  EXPECT_EQ(after.bytes - before.bytes, 0u);
+  EXPECT_EQ(heatpump.get_version(), 101u);
+
+  // cJSON went through the arena, which rewound after every message
+  JsonArenaStats arena = json_arena_get_stats();
+  EXPECT_GT(arena.high_water, 0u);
+  EXPECT_LT(arena.high_water, static_cast<size_t>(512));
+  EXPECT_EQ(arena.overflows, 0u);
+}
+
+TEST_F(SteadyStateHeapTest, CountsAllocationsInSteadyState) {
+  heap_monitor_seal();
+  run_cycle();
+
+  // Without the arena every message allocates its cJSON tree
+  cJSON_InitHooks(nullptr);
+  HeapMonitorStats before = heap_monitor_get_stats();
+  run_cycle();
+  HeapMonitorStats after = heap_monitor_get_stats();
+  json_arena_init();
+
+  EXPECT_GT(after.allocations - before.allocations, 0u);
+  EXPECT_GT(after.bytes - before.bytes, 0u);
+}
+
+TEST_F(SteadyStateHeapTest, IgnoresAllocationsOutsideSteadyState) {
+  heap_monitor_seal();
+  run_cycle();
+
+  HeapMonitorStats before = heap_monitor_get_stats();
+  void* volatile ptr = malloc(64);
+  free(ptr);
+  HeapMonitorStats after = heap_monitor_get_stats();
+
+  EXPECT_EQ(after.allocations, before.allocations);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+// The subset of the cJSON API main/ uses, implemented by cjson_fake.cpp
+#define cJSON_Invalid 0
+#define cJSON_False (1 << 0)
+#define cJSON_True (1 << 1)
+#define cJSON_NULL (1 << 2)
+#define cJSON_Number (1 << 3)
+#define cJSON_String (1 << 4)
+#define cJSON_Array (1 << 5)
+#define cJSON_Object (1 << 6)
+
+typedef struct cJSON {
+  struct cJSON* next;
+  struct cJSON* child;
+  int type;
+  char* valuestring;
+  int valueint;
+  double valuedouble;
+  char* string;
+} cJSON;
+
+typedef struct cJSON_Hooks {
+  void* (*malloc_fn)(size_t size);
+  void (*free_fn)(void* ptr);
+} cJSON_Hooks;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void cJSON_InitHooks(cJSON_Hooks* hooks);
+cJSON* cJSON_Parse(const char* value);
+void cJSON_Delete(cJSON* item);
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* string);
+int cJSON_IsString(const cJSON* item);
+int cJSON_IsNumber(const cJSON* item);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Handlers run on the simulated event loop of network_sim.cpp
+typedef const char* esp_event_base_t;
+typedef void (*esp_event_handler_t)(void* arg, esp_event_base_t event_base,
+                                    int32_t event_id, void* event_data);
+
+#define ESP_EVENT_ANY_ID -1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+esp_err_t esp_event_loop_create_default(void);
+esp_err_t esp_event_handler_register(esp_event_base_t event_base,
+                                     int32_t event_id,
+                                     esp_event_handler_t event_handler,
+                                     void* event_handler_arg);
+#ifdef __cplusplus
+}
+#endif
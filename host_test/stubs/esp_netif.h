@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+#define ESP_ERR_ESP_NETIF_INIT_FAILED 0x5007
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct {
+  uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+  esp_ip4_addr_t ip;
+  esp_ip4_addr_t netmask;
+  esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct {
+  esp_netif_t* esp_netif;
+  esp_netif_ip_info_t ip_info;
+  bool ip_changed;
+} ip_event_got_ip_t;
+
+enum { IP_EVENT_STA_GOT_IP = 0, IP_EVENT_STA_LOST_IP = 1 };
+
+#define IP2STR(ipaddr)                                       \
+  (int)(((ipaddr)->addr >> 0) & 0xff),                       \
+      (int)(((ipaddr)->addr >> 8) & 0xff),                   \
+      (int)(((ipaddr)->addr >> 16) & 0xff),                  \
+      (int)(((ipaddr)->addr >> 24) & 0xff)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern esp_event_base_t const IP_EVENT;
+
+esp_err_t esp_netif_init(void);
+esp_netif_t* esp_netif_create_default_wifi_sta(void);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Seeded by sim_reset(), so a simulated run is repeatable
+uint32_t esp_random(void);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+// Like esp_heap_caps.h, what a unit reports after init
+static inline uint32_t esp_get_free_heap_size(void) { return 180 * 1024; }
+
+static inline uint32_t esp_get_minimum_free_heap_size(void) {
+  return 165 * 1024;
+}
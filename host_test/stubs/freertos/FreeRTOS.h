@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// The host tests are single threaded, critical sections do nothing
+typedef struct {
+  int owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+// Ticks of the default 100 Hz FreeRTOS tick, counted by network_sim.cpp
+typedef uint32_t TickType_t;
+
+#define portTICK_PERIOD_MS 10
+#define pdMS_TO_TICKS(ms) ((TickType_t)((ms) / portTICK_PERIOD_MS))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+TickType_t xTaskGetTickCount(void);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+
+// Every host thread stands in for one task
+static inline TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  static thread_local char task;
+  return &task;
+}
+
+static inline const char* pcTaskGetName(TaskHandle_t task) {
+  (void)task;
+  return "host";
+}
+
+typedef uint32_t UBaseType_t;
+
+// Diagnostics finds no tasks to report on the host
+static inline TaskHandle_t xTaskGetHandle(const char* name) {
+  (void)name;
+  return NULL;
+}
+
+static inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  (void)task;
+  return 0;
+}
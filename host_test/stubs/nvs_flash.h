@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE 0x1105
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+// An always empty store that accepts every write. Tests set
+// nvs_commit_result to fail commits, like a full or worn out flash.
+inline esp_err_t nvs_commit_result = ESP_OK;
+
+static inline esp_err_t nvs_open(const char* name, nvs_open_mode_t mode,
+                                 nvs_handle_t* handle) {
+  (void)name;
+  (void)mode;
+  *handle = 1;
+  return ESP_OK;
+}
+
+static inline void nvs_close(nvs_handle_t handle) { (void)handle; }
+
+static inline esp_err_t nvs_commit(nvs_handle_t handle) {
+  (void)handle;
+  return nvs_commit_result;
+}
+
+static inline esp_err_t nvs_get_str(nvs_handle_t handle, const char* key,
+                                    char* value, size_t* length) {
+  (void)handle;
+  (void)key;
+  (void)value;
+  (void)length;
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key,
+                                    int32_t* value) {
+  (void)handle;
+  (void)key;
+  (void)value;
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key,
+                                    uint32_t* value) {
+  (void)handle;
+  (void)key;
+  (void)value;
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key,
+                                     void* value, size_t* length) {
+  (void)handle;
+  (void)key;
+  (void)value;
+  (void)length;
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline esp_err_t nvs_set_str(nvs_handle_t handle, const char* key,
+                                    const char* value) {
+  (void)handle;
+  (void)key;
+  (void)value;
+  return ESP_OK;
+}
+
+static inline esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key,
+                                    int32_t value) {
+  (void)handle;
+  (void)key;
+  (void)value;
+  return ESP_OK;
+}
+
+static inline esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key,
+                                    uint32_t value) {
+  (void)handle;
+  (void)key;
+  (void)value;
+  return ESP_OK;
+}
+
+static inline esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key,
+                                     const void* value, size_t length) {
+  (void)handle;
+  (void)key;
+  (void)value;
+  (void)length;
+  return ESP_OK;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Options the host tests build main/ with
+#define CONFIG_STATIC_MEMORY_MODE 1
+#define CONFIG_STATIC_MEMORY_JSON_ARENA_SIZE 4096
+#define CONFIG_WIFI_MAX_CALLBACKS 4
+#define CONFIG_WIFI_FAST_RECONNECT 1
+#define CONFIG_MQTT_MAX_SUBSCRIPTIONS 8
+#define CONFIG_MQTT_MAX_MESSAGE_SIZE 512
+#define CONFIG_MQTT_PERSISTENT_SESSION 1
+#define CONFIG_TRACE_ENABLED 1
+#define CONFIG_TRACE_BUFFER_SIZE 8192
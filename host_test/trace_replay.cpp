@@ -0,0 +1,217 @@
+#include "trace_replay.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_timer.h"
+
+// Kconfig defaults, as in app_main.cpp
+constexpr uint32_t COMMAND_SETTLE_MS = 300;
+constexpr uint32_t COMMAND_MAX_DELAY_MS = 2000;
+constexpr uint32_t COMMAND_MIN_INTERVAL_MS = 1000;
+
+// Frames still follow the last input while the command shaper holds a
+// command back
+constexpr int64_t REPLAY_TAIL_US =
+    (COMMAND_MAX_DELAY_MS + COMMAND_MIN_INTERVAL_MS) * 1000 +
+    REPLAY_MAIN_LOOP_DELAY_MS * 1000;
+
+TraceReplayController::TraceReplayController(
+    const TraceReplayOptions& options)
+    : heatpump(options.mode, options.target_temperature),
+      command_shaper(COMMAND_SETTLE_MS, COMMAND_MAX_DELAY_MS,
+                     COMMAND_MIN_INTERVAL_MS),
+      control_engine(make_control_engine(options.control)),
+      is_control_enabled(options.control != SimControl::OFF),
+      node(sim_add_node(this)),
+      replayed_temperature(0),
+      replayed_humidity(0),
+      replayed_telemetry_timer(false) {}
+
+void TraceReplayController::run(const std::function<void()>& callback) {
+  sim_run_on(node, callback);
+}
+
+void TraceReplayController::start() {
+  run([this]() {
+    reset_control_engine();
+    recorder.start();
+    sim_repeat(REPLAY_MAIN_LOOP_DELAY_MS * 1000, [this]() { run_loop(); });
+  });
+}
+
+// replay_message() and apply_target_state()
+void TraceReplayController::handle_message(const char* topic,
+                                           const char* payload) {
+  if (strcmp(topic, REPLAY_TARGET_STATE_TOPIC) != 0) {
+    return;
+  }
+  recorder.record_message(topic, payload);
+
+  HeatpumpUpdate update;
+  if (Heatpump::parse_update(payload, update) != ESP_OK) {
+    return;
+  }
+  command_shaper.submit(update);
+}
+
+void TraceReplayController::handle_sensor_reading(float temperature,
+                                                  float humidity) {
+  replayed_temperature = temperature;
+  replayed_humidity = humidity;
+}
+
+// The diagnostics timer drives nothing a trace records
+void TraceReplayController::handle_timer(TraceTimer timer) {
+  if (timer == TraceTimer::TELEMETRY) {
+    replayed_telemetry_timer = true;
+  }
+}
+
+std::vector<uint8_t> TraceReplayController::get_trace() {
+  return std::vector<uint8_t>(recorder.data(),
+                              recorder.data() + recorder.size());
+}
+
+// The replay half of the main loop
+void TraceReplayController::run_loop() {
+  HeatpumpUpdate update;
+  if (command_shaper.poll(update)) {
+    apply_update(update);
+  }
+
+  if (!replayed_telemetry_timer) {
+    return;
+  }
+  replayed_telemetry_timer = false;
+
+  // publish_current_state()
+  recorder.record_sensor_reading(replayed_temperature, replayed_humidity);
+  recorder.record_timer(TraceTimer::TELEMETRY);
+  if (is_control_enabled && control_engine.update(replayed_temperature)) {
+    transmit_state();
+  }
+}
+
+void TraceReplayController::apply_update(const HeatpumpUpdate& update) {
+  bool changed;
+  if (heatpump.apply(update, changed) != ESP_OK) {
+    return;
+  }
+  if (changed) {
+    reset_control_engine();
+  }
+  transmit_state();
+}
+
+void TraceReplayController::transmit_state() {
+  const char* signal;
+  if (is_control_enabled) {
+    ControlOutput output = control_engine.get_output();
+    signal = heatpump.to_binary_state(output.is_on, output.target_temperature,
+                                      output.fan_speed);
+  } else {
+    signal = heatpump.to_binary_state();
+  }
+  recorder.record_ir_frame(signal);
+}
+
+void TraceReplayController::reset_control_engine() {
+  if (is_control_enabled) {
+    control_engine.reset(heatpump.get_mode(),
+                         heatpump.get_target_temperature(),
+                         heatpump.get_fan_speed());
+  }
+}
+
+// The sink gets no context, it runs on the node of its controller
+static const TraceSink REPLAY_SINK = {
+    [](const char* topic, const char* payload) {
+      static_cast<TraceReplayController*>(sim_current_context())
+          ->handle_message(topic, payload);
+    },
+    [](float temperature, float humidity) {
+      static_cast<TraceReplayController*>(sim_current_context())
+          ->handle_sensor_reading(temperature, humidity);
+    },
+    [](TraceTimer timer) {
+      static_cast<TraceReplayController*>(sim_current_context())
+          ->handle_timer(timer);
+    },
+};
+
+std::vector<uint8_t> replay_trace(const std::vector<uint8_t>& trace,
+                                  const TraceReplayOptions& options) {
+  sim_reset();
+  TraceReplayController controller(options);
+  controller.start();
+
+  // Scheduled up front, the replay task of the unit sleeps until each
+  // record is due instead
+  size_t offset = 0;
+  uint32_t timestamp_ms = 0;
+  TraceRecord record;
+  controller.run([&]() {
+    while (trace_next_record(trace.data(), trace.size(), offset, timestamp_ms,
+                             record)) {
+      sim_schedule(static_cast<int64_t>(record.timestamp_ms) * 1000,
+                   [record]() { trace_replay_input(record, REPLAY_SINK); });
+    }
+  });
+
+  sim_run_for(static_cast<int64_t>(timestamp_ms) * 1000 + REPLAY_TAIL_US);
+  return controller.get_trace();
+}
+
+std::vector<TraceFrame> trace_frames(const std::vector<uint8_t>& trace) {
+  std::vector<TraceFrame> frames;
+  size_t offset = 0;
+  uint32_t timestamp_ms = 0;
+  int64_t last_message_at = -1;
+  TraceRecord record;
+
+  while (trace_next_record(trace.data(), trace.size(), offset, timestamp_ms,
+                           record)) {
+    if (record.type == TraceRecordType::MQTT_MESSAGE) {
+      last_message_at = record.timestamp_ms;
+    } else if (record.type == TraceRecordType::IR_FRAME &&
+               record.length > 0) {
+      size_t bits = record.payload[0];
+      if (record.length < 1 + (bits + 7) / 8) {
+        continue;
+      }
+      std::string signal(bits, '0');
+      for (size_t i = 0; i < bits; i++) {
+        if (record.payload[1 + i / 8] & (0x80 >> (i % 8))) {
+          signal[i] = '1';
+        }
+      }
+      int64_t latency_ms =
+          last_message_at >= 0 ? record.timestamp_ms - last_message_at : -1;
+      frames.push_back({record.timestamp_ms, signal, latency_ms});
+    }
+  }
+  return frames;
+}
+
+TraceDiff diff_traces(const std::vector<uint8_t>& base,
+                      const std::vector<uint8_t>& other) {
+  std::vector<TraceFrame> base_frames = trace_frames(base);
+  std::vector<TraceFrame> other_frames = trace_frames(other);
+
+  TraceDiff diff = {base_frames.size(), other_frames.size(), 0, 0};
+  size_t frames = std::max(base_frames.size(), other_frames.size());
+  for (size_t i = 0; i < frames; i++) {
+    if (i >= base_frames.size() || i >= other_frames.size() ||
+        base_frames[i].signal != other_frames[i].signal) {
+      diff.mismatched++;
+      continue;
+    }
+    uint32_t skew_ms = static_cast<uint32_t>(
+        std::abs(static_cast<int64_t>(base_frames[i].timestamp_ms) -
+                 other_frames[i].timestamp_ms));
+    diff.max_skew_ms = std::max(diff.max_skew_ms, skew_ms);
+  }
+  return diff;
+}
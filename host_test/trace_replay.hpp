@@ -0,0 +1,94 @@
+#ifndef TRACE_REPLAY_HPP
+#define TRACE_REPLAY_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "CommandShaper.hpp"
+#include "ControlEngine.hpp"
+#include "Heatpump.hpp"
+#include "TraceRecorder.hpp"
+#include "network_sim.hpp"
+#include "sim_control.hpp"
+
+constexpr const char* REPLAY_TARGET_STATE_TOPIC = "thermostat/set/target-state";
+constexpr uint32_t REPLAY_MAIN_LOOP_DELAY_MS = 100;
+
+// How the recording unit was set up. A trace does not carry the state the
+// unit was in when recording started, it is given here.
+struct TraceReplayOptions {
+  const char* mode;
+  int target_temperature;
+  SimControl control;
+};
+
+// Kconfig defaults
+constexpr TraceReplayOptions DEFAULT_REPLAY_OPTIONS = {"OFF", 20,
+                                                       SimControl::OFF};
+
+// The part of app_main() a trace replay drives: target-state messages go
+// through CommandShaper into Heatpump, the telemetry timer feeds the
+// replayed reading to ControlEngine, and every IR frame is recorded along
+// with the inputs, like on the unit during a replay.
+class TraceReplayController {
+ public:
+  explicit TraceReplayController(const TraceReplayOptions& options);
+
+  // On the node of the controller, like the main task
+  void run(const std::function<void()>& callback);
+  // Starts the main loop and recording, the unit's boot frame is not part
+  // of a trace and is not recorded
+  void start();
+
+  void handle_message(const char* topic, const char* payload);
+  void handle_sensor_reading(float temperature, float humidity);
+  void handle_timer(TraceTimer timer);
+
+  std::vector<uint8_t> get_trace();
+
+  Heatpump heatpump;
+  CommandShaper command_shaper;
+  ControlEngine control_engine;
+
+ private:
+  const bool is_control_enabled;
+  SimNode* const node;
+  TraceRecorder recorder;
+  float replayed_temperature;
+  float replayed_humidity;
+  bool replayed_telemetry_timer;
+
+  void run_loop();
+  void apply_update(const HeatpumpUpdate& update);
+  void transmit_state();
+  void reset_control_engine();
+};
+
+// Feeds the inputs of trace through a fresh controller in virtual time,
+// with their original timing, and returns the trace recorded meanwhile
+std::vector<uint8_t> replay_trace(const std::vector<uint8_t>& trace,
+                                  const TraceReplayOptions& options);
+
+struct TraceFrame {
+  uint32_t timestamp_ms;
+  std::string signal;
+  // Since the last target-state message, -1 without one
+  int64_t latency_ms;
+};
+
+std::vector<TraceFrame> trace_frames(const std::vector<uint8_t>& trace);
+
+// IR frames are compared in order, by their bits and their time
+struct TraceDiff {
+  size_t base_frames;
+  size_t other_frames;
+  size_t mismatched;
+  uint32_t max_skew_ms;
+};
+
+TraceDiff diff_traces(const std::vector<uint8_t>& base,
+                      const std::vector<uint8_t>& other);
+
+#endif
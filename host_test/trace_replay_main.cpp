@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include "trace_replay.hpp"
+
+// Replays a trace dumped by a unit through the controller logic built from
+// main/ and compares the IR frames with the recorded ones:
+//
+//   trace_replay dump.log [--mode HEAT] [--target 21]
+//                [--control off|hysteresis|pid] [--dump replay.log]
+//
+// The dump is read like tools/trace_tool.py reads it. --dump writes the
+// replayed trace in the same form, e.g. for `trace_tool.py show`.
+
+constexpr size_t DUMP_CHUNK_SIZE = 256;
+
+static bool read_number(const std::string& line, const char* key,
+                        size_t& value) {
+  size_t at = line.find(key);
+  if (at == std::string::npos) {
+    return false;
+  }
+  value = strtoul(line.c_str() + at + strlen(key), nullptr, 10);
+  return true;
+}
+
+static bool read_dump(const char* path, std::vector<uint8_t>& trace) {
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+
+  std::map<size_t, std::string> chunks;
+  size_t size = 0;
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t offset;
+    size_t data_at = line.find("\"data\":\"");
+    if (data_at == std::string::npos ||
+        !read_number(line, "\"offset\":", offset) ||
+        !read_number(line, "\"size\":", size)) {
+      continue;
+    }
+    data_at += strlen("\"data\":\"");
+    chunks[offset] = line.substr(data_at, line.find('"', data_at) - data_at);
+  }
+
+  trace.assign(size, 0);
+  size_t received = 0;
+  for (const auto& [offset, hex] : chunks) {
+    for (size_t i = 0; i + 1 < hex.size() && offset + i / 2 < size; i += 2) {
+      trace[offset + i / 2] =
+          static_cast<uint8_t>(strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+      received++;
+    }
+  }
+  if (size == 0 || received < size) {
+    fprintf(stderr, "%s: incomplete dump (%zu/%zu bytes)\n", path, received,
+            size);
+    return false;
+  }
+  return true;
+}
+
+static bool write_dump(const char* path, const std::vector<uint8_t>& trace) {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+  for (size_t offset = 0; offset < trace.size(); offset += DUMP_CHUNK_SIZE) {
+    fprintf(file, "TRACE {\"offset\":%zu,\"size\":%zu,\"data\":\"", offset,
+            trace.size());
+    size_t end = std::min(offset + DUMP_CHUNK_SIZE, trace.size());
+    for (size_t i = offset; i < end; i++) {
+      fprintf(file, "%02x", trace[i]);
+    }
+    fprintf(file, "\"}\n");
+  }
+  fclose(file);
+  return true;
+}
+
+static std::string latency_summary(const std::vector<TraceFrame>& frames) {
+  std::vector<int64_t> latencies;
+  for (const auto& frame : frames) {
+    if (frame.latency_ms >= 0) {
+      latencies.push_back(frame.latency_ms);
+    }
+  }
+  if (latencies.empty()) {
+    return "n/a";
+  }
+  std::sort(latencies.begin(), latencies.end());
+  char summary[64];
+  snprintf(summary, sizeof(summary), "p50=%lldms max=%lldms n=%zu",
+           static_cast<long long>(latencies[latencies.size() / 2]),
+           static_cast<long long>(latencies.back()), latencies.size());
+  return summary;
+}
+
+static bool parse_control(const char* value, SimControl& control) {
+  if (strcmp(value, "off") == 0) {
+    control = SimControl::OFF;
+  } else if (strcmp(value, "hysteresis") == 0) {
+    control = SimControl::HYSTERESIS;
+  } else if (strcmp(value, "pid") == 0) {
+    control = SimControl::PID;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: trace_replay DUMP [--mode MODE] [--target C] "
+          "[--control off|hysteresis|pid] [--dump PATH]\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc % 2 != 0) {
+    usage();
+    return 2;
+  }
+
+  TraceReplayOptions options = DEFAULT_REPLAY_OPTIONS;
+  const char* dump_path = nullptr;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    const char* value = argv[i + 1];
+    if (strcmp(argv[i], "--mode") == 0) {
+      options.mode = value;
+    } else if (strcmp(argv[i], "--target") == 0) {
+      options.target_temperature = atoi(value);
+    } else if (strcmp(argv[i], "--control") == 0) {
+      if (!parse_control(value, options.control)) {
+        usage();
+        return 2;
+      }
+    } else if (strcmp(argv[i], "--dump") == 0) {
+      dump_path = value;
+    } else {
+      usage();
+      return 2;
+    }
+  }
+
+  std::vector<uint8_t> recorded;
+  if (!read_dump(argv[1], recorded)) {
+    return 2;
+  }
+  std::vector<uint8_t> replayed = replay_trace(recorded, options);
+  if (dump_path != nullptr && !write_dump(dump_path, replayed)) {
+    return 2;
+  }
+
+  std::vector<TraceFrame> base = trace_frames(recorded);
+  std::vector<TraceFrame> other = trace_frames(replayed);
+  for (size_t i = 0; i < std::max(base.size(), other.size()); i++) {
+    const char* a = i < base.size() ? base[i].signal.c_str() : "None";
+    const char* b = i < other.size() ? other[i].signal.c_str() : "None";
+    if (strcmp(a, b) != 0) {
+      printf("frame %zu: %s != %s\n", i, a, b);
+    }
+  }
+
+  TraceDiff diff = diff_traces(recorded, replayed);
+  printf("frames: %zu vs %zu, %zu mismatched, max skew %lums\n",
+         diff.base_frames, diff.other_frames, diff.mismatched,
+         static_cast<unsigned long>(diff.max_skew_ms));
+  printf("command->IR latency base:  %s\n", latency_summary(base).c_str());
+  printf("command->IR latency other: %s\n", latency_summary(other).c_str());
+  return diff.mismatched > 0 ? 1 : 0;
+}
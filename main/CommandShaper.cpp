@@ -0,0 +1,79 @@
+#include "CommandShaper.hpp"
+
+#include "esp_timer.h"
+
+CommandShaper::CommandShaper(const uint32_t settle_ms,
+                             const uint32_t max_delay_ms,
+                             const uint32_t min_interval_ms)
+    : settle_us(static_cast<int64_t>(settle_ms) * 1000),
+      max_delay_us(static_cast<int64_t>(max_delay_ms) * 1000),
+      min_interval_us(static_cast<int64_t>(min_interval_ms) * 1000),
+      pending({}),
+      has_pending(false),
+      first_submit_at(0),
+      last_submit_at(0),
+      last_release_at(0),
+      stats({}),
+      lock(portMUX_INITIALIZER_UNLOCKED) {}
+
+void CommandShaper::submit(const HeatpumpUpdate& update) {
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&lock);
+  stats.received++;
+
+  if (has_pending) {
+    stats.merged++;
+  } else {
+    pending = {};
+    first_submit_at = now;
+    has_pending = true;
+  }
+
+  // Later commands win per field, so a mode-only command does not undo an
+  // earlier temperature change
+  if (update.has_mode) {
+    pending.has_mode = true;
+    pending.mode = update.mode;
+  }
+  if (update.has_target_temperature) {
+    pending.has_target_temperature = true;
+    pending.target_temperature = update.target_temperature;
+  }
+  if (update.has_fan_speed) {
+    pending.has_fan_speed = true;
+    pending.fan_speed = update.fan_speed;
+  }
+
+  last_submit_at = now;
+  portEXIT_CRITICAL(&lock);
+}
+
+bool CommandShaper::poll(HeatpumpUpdate& update) {
+  int64_t now = esp_timer_get_time();
+  bool released = false;
+
+  portENTER_CRITICAL(&lock);
+  bool settled = now - last_submit_at >= settle_us ||
+                 now - first_submit_at >= max_delay_us;
+  bool rate_limited =
+      last_release_at != 0 && now - last_release_at < min_interval_us;
+
+  if (has_pending && settled && !rate_limited) {
+    update = pending;
+    has_pending = false;
+    last_release_at = now;
+    stats.applied++;
+    released = true;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  return released;
+}
+
+CommandShaperStats CommandShaper::get_stats() {
+  portENTER_CRITICAL(&lock);
+  CommandShaperStats result = stats;
+  portEXIT_CRITICAL(&lock);
+  return result;
+}
@@ -0,0 +1,42 @@
+#ifndef COMMAND_SHAPER_HPP
+#define COMMAND_SHAPER_HPP
+
+#include <cstdint>
+
+#include "Heatpump.hpp"
+#include "freertos/FreeRTOS.h"
+
+struct CommandShaperStats {
+  uint32_t received;
+  uint32_t merged;
+  uint32_t applied;
+};
+
+// Merges bursts of target-state commands into one update. A pending update is
+// released once no new command arrived for the settle window (or it has been
+// pending for max_delay_ms), and no sooner than min_interval_ms after the
+// previous release.
+class CommandShaper {
+ public:
+  CommandShaper(const uint32_t settle_ms, const uint32_t max_delay_ms,
+                const uint32_t min_interval_ms);
+
+  void submit(const HeatpumpUpdate& update);
+  bool poll(HeatpumpUpdate& update);
+
+  CommandShaperStats get_stats();
+
+ private:
+  const int64_t settle_us;
+  const int64_t max_delay_us;
+  const int64_t min_interval_us;
+  HeatpumpUpdate pending;
+  bool has_pending;
+  int64_t first_submit_at;
+  int64_t last_submit_at;
+  int64_t last_release_at;
+  CommandShaperStats stats;
+  portMUX_TYPE lock;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "ControlEngine.hpp"
+
+#include <cmath>
+
+#include "Heatpump.hpp"
+
+ControlEngine::ControlEngine(const ControlAlgorithm algorithm,
+                             const float filter_alpha, const float hysteresis,
+                             const ControlGains gains,
+                             const int max_setpoint_offset,
+                             const uint32_t min_dwell_ms,
+                             const uint32_t min_command_interval_ms,
+                             const ControlClock clock)
+    : algorithm(algorithm),
+      filter_alpha(filter_alpha),
+      hysteresis(hysteresis),
+      gains(gains),
+      max_setpoint_offset(max_setpoint_offset),
+      min_dwell_us(static_cast<int64_t>(min_dwell_ms) * 1000),
+      min_command_interval_us(static_cast<int64_t>(min_command_interval_ms) *
+                              1000),
+      clock(clock),
+      mode(Mode::OFF),
+      target_temperature(MIN_TARGET_TEMPERATURE),
+      fan_speed(0),
+      has_filtered(false),
+      filtered_temperature(0),
+      previous_temperature(0),
+      integral(0),
+      last_update_at(0),
+      output({false, MIN_TARGET_TEMPERATURE, 0}),
+      last_command_at(0),
+      last_toggle_at(0),
+      stats({}) {}
+
+void ControlEngine::reset(const Mode mode, const int target_temperature,
+                          const int fan_speed) {
+  this->mode = mode;
+  this->target_temperature = target_temperature;
+  this->fan_speed = fan_speed;
+
+  // The user's command is transmitted as is and restarts both limits
+  int64_t now = clock();
+  output = {mode != Mode::OFF, target_temperature, fan_speed};
+  integral = 0;
+  last_command_at = now;
+  last_toggle_at = now;
+}
+
+bool ControlEngine::update(const float temperature) {
+  int64_t now = clock();
+
+  if (!has_filtered) {
+    filtered_temperature = temperature;
+    has_filtered = true;
+  }
+  previous_temperature = filtered_temperature;
+  filtered_temperature += filter_alpha * (temperature - filtered_temperature);
+
+  float elapsed_min =
+      last_update_at != 0 ? static_cast<float>(now - last_update_at) / 60e6f
+                          : 0;
+  last_update_at = now;
+
+  // Only a fixed direction can be steered, AUTO is left to the heatpump
+  if (mode != Mode::HEAT && mode != Mode::COOL) {
+    return false;
+  }
+
+  // Positive error and rate mean more heating (or cooling) is needed
+  float direction = mode == Mode::HEAT ? 1 : -1;
+  float error = direction * (target_temperature - filtered_temperature);
+  float rate =
+      elapsed_min > 0
+          ? direction * (previous_temperature - filtered_temperature) /
+                elapsed_min
+          : 0;
+
+  ControlOutput next = algorithm == ControlAlgorithm::PID
+                           ? compute_pid(error, rate, elapsed_min)
+                           : compute_hysteresis(error);
+
+  if (next.is_on != output.is_on && now - last_toggle_at < min_dwell_us) {
+    stats.dwell_limited++;
+    next.is_on = output.is_on;
+  }
+
+  if (next.is_on == output.is_on &&
+      next.target_temperature == output.target_temperature &&
+      next.fan_speed == output.fan_speed) {
+    return false;
+  }
+
+  if (now - last_command_at < min_command_interval_us) {
+    stats.rate_limited++;
+    return false;
+  }
+
+  if (next.is_on != output.is_on) {
+    last_toggle_at = now;
+  }
+  output = next;
+  last_command_at = now;
+  stats.commands++;
+  return true;
+}
+
+ControlOutput ControlEngine::get_output() { return output; }
+
+float ControlEngine::get_filtered_temperature() {
+  return filtered_temperature;
+}
+
+ControlStats ControlEngine::get_stats() { return stats; }
+
+ControlOutput ControlEngine::compute_hysteresis(const float error) {
+  bool is_on = output.is_on;
+  if (error > hysteresis) {
+    is_on = true;
+  } else if (error < -hysteresis) {
+    is_on = false;
+  }
+
+  return {is_on, target_temperature, fan_speed};
+}
+
+ControlOutput ControlEngine::compute_pid(const float error, const float rate,
+                                         const float elapsed_min) {
+  // Clamp the integral so its term alone cannot exceed the offset range
+  integral += error * elapsed_min;
+  if (gains.ki > 0) {
+    float limit = max_setpoint_offset / gains.ki;
+    integral = fminf(fmaxf(integral, -limit), limit);
+  }
+
+  float effort = gains.kp * error + gains.ki * integral + gains.kd * rate;
+
+  // Setpoints are whole degrees, hold the current one until the effort is a
+  // full degree away so the output does not dither between neighbours
+  int direction = mode == Mode::HEAT ? 1 : -1;
+  int offset = direction * (output.target_temperature - target_temperature);
+  if (fabsf(effort - offset) >= 1) {
+    offset = static_cast<int>(lroundf(effort));
+  }
+  if (offset > max_setpoint_offset) {
+    offset = max_setpoint_offset;
+  } else if (offset < -max_setpoint_offset) {
+    offset = -max_setpoint_offset;
+  }
+
+  int setpoint = target_temperature + direction * offset;
+  if (setpoint < MIN_TARGET_TEMPERATURE) {
+    setpoint = MIN_TARGET_TEMPERATURE;
+  } else if (setpoint > MAX_TARGET_TEMPERATURE) {
+    setpoint = MAX_TARGET_TEMPERATURE;
+  }
+
+  // Run the fan at full speed while even the largest offset is not enough,
+  // not when the room overshot and the offset is saturated the other way
+  int fan = effort >= max_setpoint_offset ? MAX_FAN_SPEED : fan_speed;
+
+  return {true, setpoint, fan};
+}
@@ -0,0 +1,90 @@
+#ifndef CONTROL_ENGINE_HPP
+#define CONTROL_ENGINE_HPP
+
+#include <cstdint>
+
+#include "Mode.hpp"
+#include "esp_timer.h"
+
+enum class ControlAlgorithm { HYSTERESIS, PID };
+
+// Setpoint offset in degrees per degree of error (kp), per degree-minute of
+// accumulated error (ki) and per degree/minute of temperature change (kd)
+struct ControlGains {
+  float kp;
+  float ki;
+  float kd;
+};
+
+// What is sent to the heatpump, which may differ from the user's target state
+struct ControlOutput {
+  bool is_on;
+  int target_temperature;
+  int fan_speed;
+};
+
+// Monotonic time in microseconds, esp_timer_get_time() on the device
+typedef int64_t (*ControlClock)();
+
+struct ControlStats {
+  uint32_t commands;
+  uint32_t rate_limited;
+  uint32_t dwell_limited;
+};
+
+// Steers the heatpump's own thermostat towards the user's target using the
+// room sensor. Readings are smoothed with an exponential moving average, then
+// either switch the unit on and off around the target (hysteresis) or offset
+// its setpoint and fan speed (PID). Each update is constant time.
+class ControlEngine {
+ public:
+  ControlEngine(const ControlAlgorithm algorithm, const float filter_alpha,
+                const float hysteresis, const ControlGains gains,
+                const int max_setpoint_offset, const uint32_t min_dwell_ms,
+                const uint32_t min_command_interval_ms,
+                const ControlClock clock = &esp_timer_get_time);
+
+  // Starts over from the user's target state, called whenever it changes
+  void reset(const Mode mode, const int target_temperature,
+             const int fan_speed);
+
+  // Feeds a sensor reading, returns true when the output changed and should
+  // be transmitted
+  bool update(const float temperature);
+
+  ControlOutput get_output();
+  float get_filtered_temperature();
+
+  ControlStats get_stats();
+
+ private:
+  const ControlAlgorithm algorithm;
+  const float filter_alpha;
+  const float hysteresis;
+  const ControlGains gains;
+  const int max_setpoint_offset;
+  const int64_t min_dwell_us;
+  const int64_t min_command_interval_us;
+  const ControlClock clock;
+
+  Mode mode;
+  int target_temperature;
+  int fan_speed;
+
+  bool has_filtered;
+  float filtered_temperature;
+  float previous_temperature;
+  float integral;
+  int64_t last_update_at;
+
+  ControlOutput output;
+  int64_t last_command_at;
+  int64_t last_toggle_at;
+  ControlStats stats;
+
+  ControlOutput compute_hysteresis(const float error);
+  ControlOutput compute_pid(const float error, const float rate,
+                            const float elapsed_min);
+};
+
+#endif
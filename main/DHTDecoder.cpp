@@ -0,0 +1,88 @@
+#include "DHTDecoder.hpp"
+
+constexpr size_t FRAME_BITS = 40;
+
+// Generous bounds, the sensor's own oscillator drifts with temperature
+constexpr uint16_t RESPONSE_MIN_US = 55;
+constexpr uint16_t RESPONSE_MAX_US = 110;
+constexpr uint16_t BIT_LOW_MIN_US = 30;
+constexpr uint16_t BIT_LOW_MAX_US = 90;
+constexpr uint16_t BIT_HIGH_MIN_US = 10;
+constexpr uint16_t BIT_HIGH_MAX_US = 100;
+constexpr uint16_t BIT_ONE_MIN_US = 48;
+
+// Walks the capture merging adjacent pulses with the same level
+class PulseReader {
+ public:
+  PulseReader(const DHTPulse* pulses, size_t count)
+      : pulses(pulses), count(count), index(0) {}
+
+  bool next(DHTPulse& pulse) {
+    if (index >= count) {
+      return false;
+    }
+
+    pulse = pulses[index++];
+    while (index < count && pulses[index].level == pulse.level) {
+      uint32_t duration = pulse.duration_us + pulses[index++].duration_us;
+      pulse.duration_us = duration > UINT16_MAX ? UINT16_MAX : duration;
+    }
+    return true;
+  }
+
+ private:
+  const DHTPulse* pulses;
+  const size_t count;
+  size_t index;
+};
+
+static bool is_within(const DHTPulse& pulse, const uint8_t level,
+                      const uint16_t min_us, const uint16_t max_us) {
+  return pulse.level == level && pulse.duration_us >= min_us &&
+         pulse.duration_us <= max_us;
+}
+
+esp_err_t dht_decode_frame(const DHTPulse* pulses, const size_t count,
+                           int16_t& temperature_x10, uint16_t& humidity_x10) {
+  PulseReader reader(pulses, count);
+
+  // Skip the end of the start pulse and the pull-up until the response
+  DHTPulse low;
+  DHTPulse high;
+  if (!reader.next(low)) {
+    return ESP_ERR_TIMEOUT;
+  }
+  while (true) {
+    if (!reader.next(high)) {
+      return ESP_ERR_TIMEOUT;
+    }
+    if (is_within(low, 0, RESPONSE_MIN_US, RESPONSE_MAX_US) &&
+        is_within(high, 1, RESPONSE_MIN_US, RESPONSE_MAX_US)) {
+      break;
+    }
+    low = high;
+  }
+
+  uint8_t data[FRAME_BITS / 8] = {};
+  for (size_t bit = 0; bit < FRAME_BITS; bit++) {
+    if (!reader.next(low) || !reader.next(high) ||
+        !is_within(low, 0, BIT_LOW_MIN_US, BIT_LOW_MAX_US) ||
+        !is_within(high, 1, BIT_HIGH_MIN_US, BIT_HIGH_MAX_US)) {
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (high.duration_us >= BIT_ONE_MIN_US) {
+      data[bit / 8] |= 0x80 >> (bit % 8);
+    }
+  }
+
+  uint8_t checksum = data[0] + data[1] + data[2] + data[3];
+  if (checksum != data[4]) {
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  // Temperature is sign and magnitude, not two's complement
+  humidity_x10 = data[0] << 8 | data[1];
+  int16_t magnitude = (data[2] & 0x7F) << 8 | data[3];
+  temperature_x10 = data[2] & 0x80 ? -magnitude : magnitude;
+  return ESP_OK;
+}
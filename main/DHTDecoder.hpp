@@ -0,0 +1,24 @@
+#ifndef DHT_DECODER_HPP
+#define DHT_DECODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_err.h"
+
+// A level held on the data line, as captured by the RMT receiver
+struct DHTPulse {
+  uint8_t level;
+  uint16_t duration_us;
+};
+
+// Decodes an AM2301 frame from the captured levels. The sensor answers the
+// start pulse with 80 us low and 80 us high, then sends 40 bits MSB first,
+// each 50 us low followed by 26 us (0) or 70 us (1) high. Adjacent pulses
+// with the same level are merged, so the capture may be split anywhere.
+// Returns ESP_ERR_TIMEOUT without a response, ESP_ERR_INVALID_RESPONSE on
+// out-of-range timings and ESP_ERR_INVALID_CRC on a checksum mismatch.
+esp_err_t dht_decode_frame(const DHTPulse* pulses, size_t count,
+                           int16_t& temperature_x10, uint16_t& humidity_x10);
+
+#endif
@@ -0,0 +1,166 @@
+#include "DHTRmtSensor.hpp"
+
+#include "DHTDecoder.hpp"
+#include "esp_attr.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+
+// 1 us ticks, the shortest level in a frame is about 26 us
+constexpr uint32_t RMT_RESOLUTION_HZ = 1000000;
+// Filters glitches shorter than this
+constexpr uint32_t RMT_MIN_PULSE_NS = 1000;
+// The line idles high after the last bit, which ends the capture
+constexpr uint32_t RMT_IDLE_NS = 200000;
+
+// The sensor needs the line held low for at least 1 ms to wake up
+constexpr uint32_t START_PULSE_US = 1100;
+// Response and 40 bits take about 5 ms
+constexpr uint32_t FRAME_TIME_MS = 10;
+
+DHTRmtSensor::DHTRmtSensor(const int gpio_pin)
+    : gpio(static_cast<gpio_num_t>(gpio_pin)),
+      channel(nullptr),
+      done_queue(nullptr),
+      symbols(),
+      is_receiving(false),
+      stats({}) {}
+
+const char* DHTRmtSensor::name() { return "dht"; }
+
+esp_err_t DHTRmtSensor::init() {
+  done_queue = xQueueCreate(1, sizeof(rmt_rx_done_event_data_t));
+  if (done_queue == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  rmt_rx_channel_config_t config = {};
+  config.gpio_num = gpio;
+  config.clk_src = RMT_CLK_SRC_DEFAULT;
+  config.resolution_hz = RMT_RESOLUTION_HZ;
+  config.mem_block_symbols = DHT_RMT_MAX_SYMBOLS;
+
+  esp_err_t err = rmt_new_rx_channel(&config, &channel);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  rmt_rx_event_callbacks_t callbacks = {};
+  callbacks.on_recv_done = &DHTRmtSensor::on_receive_done;
+  err = rmt_rx_register_event_callbacks(channel, &callbacks, done_queue);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  err = rmt_enable(channel);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  // The receiver keeps its input, open drain lets us also pull the line low
+  // for the start pulse while the pull-up releases it
+  err = gpio_set_direction(gpio, GPIO_MODE_INPUT_OUTPUT_OD);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = gpio_set_pull_mode(gpio, GPIO_PULLUP_ONLY);
+  if (err != ESP_OK) {
+    return err;
+  }
+  return gpio_set_level(gpio, 1);
+}
+
+esp_err_t DHTRmtSensor::start() {
+  // A frame that was never collected would be reported as the next one
+  xQueueReset(done_queue);
+  if (is_receiving) {
+    rmt_disable(channel);
+    rmt_enable(channel);
+    is_receiving = false;
+  }
+
+  gpio_set_level(gpio, 0);
+  esp_rom_delay_us(START_PULSE_US);
+
+  rmt_receive_config_t config = {};
+  config.signal_range_min_ns = RMT_MIN_PULSE_NS;
+  config.signal_range_max_ns = RMT_IDLE_NS;
+  esp_err_t err = rmt_receive(channel, symbols, sizeof(symbols), &config);
+
+  // Released right after arming, the sensor answers 20-40 us later
+  gpio_set_level(gpio, 1);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  is_receiving = true;
+  return ESP_OK;
+}
+
+uint32_t DHTRmtSensor::conversion_time_ms() { return FRAME_TIME_MS; }
+
+esp_err_t DHTRmtSensor::collect(SensorSample& sample) {
+  stats.reads++;
+
+  rmt_rx_done_event_data_t event;
+  if (!is_receiving || xQueueReceive(done_queue, &event, 0) != pdTRUE) {
+    stats.timeouts++;
+    return ESP_ERR_TIMEOUT;
+  }
+  is_receiving = false;
+
+  int64_t started_at = esp_timer_get_time();
+
+  // Each symbol holds two levels, a zero duration marks the end
+  static DHTPulse pulses[DHT_RMT_MAX_SYMBOLS * 2];
+  size_t count = 0;
+  for (size_t i = 0; i < event.num_symbols; i++) {
+    const rmt_symbol_word_t& symbol = event.received_symbols[i];
+    if (symbol.duration0 == 0) {
+      break;
+    }
+    pulses[count++] = {static_cast<uint8_t>(symbol.level0),
+                       static_cast<uint16_t>(symbol.duration0)};
+    if (symbol.duration1 == 0) {
+      break;
+    }
+    pulses[count++] = {static_cast<uint8_t>(symbol.level1),
+                       static_cast<uint16_t>(symbol.duration1)};
+  }
+
+  int16_t temperature_x10;
+  uint16_t humidity_x10;
+  esp_err_t err =
+      dht_decode_frame(pulses, count, temperature_x10, humidity_x10);
+
+  uint32_t decode_us = static_cast<uint32_t>(esp_timer_get_time() - started_at);
+  stats.last_decode_us = decode_us;
+  if (decode_us > stats.max_decode_us) {
+    stats.max_decode_us = decode_us;
+  }
+
+  if (err == ESP_ERR_TIMEOUT) {
+    stats.timeouts++;
+  } else if (err == ESP_ERR_INVALID_CRC) {
+    stats.checksum_errors++;
+  } else if (err != ESP_OK) {
+    stats.timing_errors++;
+  }
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  stats.decoded++;
+  sample = {static_cast<float>(temperature_x10) / 10,
+            static_cast<float>(humidity_x10) / 10, true};
+  return ESP_OK;
+}
+
+DHTCaptureStats DHTRmtSensor::get_stats() { return stats; }
+
+bool IRAM_ATTR DHTRmtSensor::on_receive_done(
+    rmt_channel_handle_t channel, const rmt_rx_done_event_data_t* event,
+    void* context) {
+  BaseType_t woken = pdFALSE;
+  xQueueSendFromISR(static_cast<QueueHandle_t>(context), event, &woken);
+  return woken == pdTRUE;
+}
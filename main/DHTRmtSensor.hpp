@@ -0,0 +1,55 @@
+#ifndef DHT_RMT_SENSOR_HPP
+#define DHT_RMT_SENSOR_HPP
+
+#include <cstdint>
+
+#include "SensorBackend.hpp"
+#include "driver/gpio.h"
+#include "driver/rmt_rx.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// Enough for the response and 40 bits with room for glitches, one RMT block
+constexpr size_t DHT_RMT_MAX_SYMBOLS = 64;
+
+struct DHTCaptureStats {
+  uint32_t reads;
+  uint32_t decoded;
+  uint32_t timeouts;
+  uint32_t timing_errors;
+  uint32_t checksum_errors;
+  uint32_t last_decode_us;
+  uint32_t max_decode_us;
+};
+
+// AM2301 with the response captured by the RMT receiver. start() sends the
+// start pulse and arms the receiver, the frame is then recorded in hardware
+// and decoded in collect() from the edge timings, so interrupts stay enabled
+// throughout.
+class DHTRmtSensor : public SensorBackend {
+ public:
+  DHTRmtSensor(const int gpio_pin);
+
+  const char* name() override;
+  esp_err_t init() override;
+
+  esp_err_t start() override;
+  uint32_t conversion_time_ms() override;
+  esp_err_t collect(SensorSample& sample) override;
+
+  DHTCaptureStats get_stats();
+
+ private:
+  const gpio_num_t gpio;
+  rmt_channel_handle_t channel;
+  QueueHandle_t done_queue;
+  rmt_symbol_word_t symbols[DHT_RMT_MAX_SYMBOLS];
+  bool is_receiving;
+  DHTCaptureStats stats;
+
+  static bool on_receive_done(rmt_channel_handle_t channel,
+                              const rmt_rx_done_event_data_t* event,
+                              void* context);
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include "DHTSensor.hpp"
+
+#include <cstdint>
+
+#include "dht.h"
+
+DHTSensor::DHTSensor(const int gpio_pin)
+    : gpio(static_cast<gpio_num_t>(gpio_pin)) {}
+
+const char* DHTSensor::name() { return "dht"; }
+
+esp_err_t DHTSensor::init() {
+  gpio_config_t config = {};
+  config.mode = GPIO_MODE_INPUT;
+  config.pin_bit_mask = 1ULL << gpio;
+
+  return gpio_config(&config);
+}
+
+esp_err_t DHTSensor::start() { return ESP_OK; }
+
+uint32_t DHTSensor::conversion_time_ms() { return 0; }
+
+esp_err_t DHTSensor::collect(SensorSample& sample) {
+  int16_t temperature;
+  int16_t humidity;
+  esp_err_t err = dht_read_data(DHT_TYPE_AM2301, gpio, &humidity, &temperature);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  sample = {static_cast<float>(temperature) / 10,
+            static_cast<float>(humidity) / 10, true};
+  return ESP_OK;
+}
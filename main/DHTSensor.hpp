@@ -0,0 +1,24 @@
+#ifndef DHT_SENSOR_HPP
+#define DHT_SENSOR_HPP
+
+#include "SensorBackend.hpp"
+#include "driver/gpio.h"
+
+// AM2301 on a single GPIO. The protocol has no separate conversion step, the
+// whole read happens in collect() with interrupts disabled for a few ms.
+class DHTSensor : public SensorBackend {
+ public:
+  DHTSensor(const int gpio_pin);
+
+  const char* name() override;
+  esp_err_t init() override;
+
+  esp_err_t start() override;
+  uint32_t conversion_time_ms() override;
+  esp_err_t collect(SensorSample& sample) override;
+
+ private:
+  const gpio_num_t gpio;
+};
+
+#endif
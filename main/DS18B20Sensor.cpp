@@ -0,0 +1,39 @@
+#include "DS18B20Sensor.hpp"
+
+#include "ds18x20.h"
+
+// Conversion time at the power-on default of 12 bits
+constexpr uint32_t CONVERSION_TIME_MS = 750;
+
+DS18B20Sensor::DS18B20Sensor(const int gpio_pin)
+    : gpio(static_cast<gpio_num_t>(gpio_pin)) {}
+
+const char* DS18B20Sensor::name() { return "ds18b20"; }
+
+esp_err_t DS18B20Sensor::init() {
+  // The bus needs a pull-up, the internal one is enough for short cables
+  gpio_config_t config = {};
+  config.mode = GPIO_MODE_INPUT_OUTPUT_OD;
+  config.pull_up_en = GPIO_PULLUP_ENABLE;
+  config.pin_bit_mask = 1ULL << gpio;
+
+  return gpio_config(&config);
+}
+
+esp_err_t DS18B20Sensor::start() {
+  // Do not wait for the conversion, it is collected later
+  return ds18x20_measure(gpio, ds18x20_ANY, false);
+}
+
+uint32_t DS18B20Sensor::conversion_time_ms() { return CONVERSION_TIME_MS; }
+
+esp_err_t DS18B20Sensor::collect(SensorSample& sample) {
+  float temperature;
+  esp_err_t err = ds18x20_read_temperature(gpio, ds18x20_ANY, &temperature);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  sample = {temperature, 0, false};
+  return ESP_OK;
+}
@@ -0,0 +1,23 @@
+#ifndef DS18B20_SENSOR_HPP
+#define DS18B20_SENSOR_HPP
+
+#include "SensorBackend.hpp"
+#include "driver/gpio.h"
+
+// Single DS18B20 on a 1-Wire bus, converting at 12-bit resolution
+class DS18B20Sensor : public SensorBackend {
+ public:
+  DS18B20Sensor(const int gpio_pin);
+
+  const char* name() override;
+  esp_err_t init() override;
+
+  esp_err_t start() override;
+  uint32_t conversion_time_ms() override;
+  esp_err_t collect(SensorSample& sample) override;
+
+ private:
+  const gpio_num_t gpio;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "DeltaDecoder.hpp"
+
+#include <cstring>
+
+constexpr uint8_t OPCODE_COPY = 0x01;
+constexpr uint8_t OPCODE_INSERT = 0x02;
+
+constexpr size_t COPY_BUFFER_SIZE = 512;
+
+// Copies go through flash on both sides, keep the buffer off the stack
+static uint8_t copy_buffer[COPY_BUFFER_SIZE];
+
+static uint32_t read_u32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 |
+         static_cast<uint32_t>(data[3]) << 24;
+}
+
+DeltaDecoder::DeltaDecoder(const DeltaIO io)
+    : io(io),
+      state(State::HEADER),
+      error(ESP_OK),
+      header_length(0),
+      header({}),
+      varint(0),
+      varint_shift(0),
+      copy_offset(0),
+      insert_remaining(0),
+      written(0) {}
+
+void DeltaDecoder::reset() {
+  state = State::HEADER;
+  error = ESP_OK;
+  header_length = 0;
+  header = {};
+  varint = 0;
+  varint_shift = 0;
+  copy_offset = 0;
+  insert_remaining = 0;
+  written = 0;
+}
+
+esp_err_t DeltaDecoder::feed(const uint8_t* data, const size_t size) {
+  size_t i = 0;
+  while (i < size) {
+    esp_err_t err = ESP_OK;
+    switch (state) {
+      case State::HEADER: {
+        size_t length = DELTA_HEADER_SIZE - header_length;
+        if (length > size - i) {
+          length = size - i;
+        }
+        memcpy(header_buffer + header_length, data + i, length);
+        header_length += length;
+        i += length;
+        if (header_length == DELTA_HEADER_SIZE) {
+          err = parse_header();
+          state = State::OPCODE;
+        }
+        break;
+      }
+
+      case State::OPCODE:
+        if (written == header.target_size) {
+          return fail(ESP_ERR_INVALID_SIZE);
+        }
+        if (data[i] == OPCODE_COPY) {
+          state = State::COPY_OFFSET;
+        } else if (data[i] == OPCODE_INSERT) {
+          state = State::INSERT_LENGTH;
+        } else {
+          return fail(ESP_ERR_INVALID_ARG);
+        }
+        i++;
+        break;
+
+      case State::COPY_OFFSET:
+        if (feed_varint(data[i++], err)) {
+          copy_offset = varint;
+          state = State::COPY_LENGTH;
+        }
+        break;
+
+      case State::COPY_LENGTH:
+        if (feed_varint(data[i++], err)) {
+          err = copy(copy_offset, varint);
+          state = State::OPCODE;
+        }
+        break;
+
+      case State::INSERT_LENGTH:
+        if (feed_varint(data[i++], err)) {
+          if (varint > header.target_size - written) {
+            err = ESP_ERR_INVALID_SIZE;
+          }
+          insert_remaining = varint;
+          state = insert_remaining > 0 ? State::INSERT_DATA : State::OPCODE;
+        }
+        break;
+
+      case State::INSERT_DATA: {
+        // Inserted bytes go straight from the input to the target
+        size_t length = insert_remaining;
+        if (length > size - i) {
+          length = size - i;
+        }
+        err = io.write_target(io.context, data + i, length);
+        written += length;
+        insert_remaining -= length;
+        i += length;
+        if (insert_remaining == 0) {
+          state = State::OPCODE;
+        }
+        break;
+      }
+
+      case State::FAILED:
+        return error;
+    }
+
+    if (err != ESP_OK) {
+      return fail(err);
+    }
+  }
+
+  return state == State::FAILED ? error : ESP_OK;
+}
+
+bool DeltaDecoder::has_header() { return header_length == DELTA_HEADER_SIZE; }
+
+const DeltaHeader& DeltaDecoder::get_header() { return header; }
+
+bool DeltaDecoder::is_complete() {
+  return state == State::OPCODE && written == header.target_size;
+}
+
+size_t DeltaDecoder::get_written() { return written; }
+
+esp_err_t DeltaDecoder::parse_header() {
+  if (memcmp(header_buffer, DELTA_MAGIC, sizeof(DELTA_MAGIC)) != 0) {
+    return ESP_ERR_INVALID_VERSION;
+  }
+
+  const uint8_t* cursor = header_buffer + sizeof(DELTA_MAGIC);
+  header.source_size = read_u32(cursor);
+  header.target_size = read_u32(cursor + sizeof(uint32_t));
+  memcpy(header.target_sha256, cursor + 2 * sizeof(uint32_t),
+         DELTA_SHA256_SIZE);
+  return ESP_OK;
+}
+
+bool DeltaDecoder::feed_varint(const uint8_t byte, esp_err_t& err) {
+  if (varint_shift == 0) {
+    varint = 0;
+  }
+
+  // Five bytes cover 32 bits, anything longer is corrupt
+  if (varint_shift > 28) {
+    err = ESP_ERR_INVALID_ARG;
+    return false;
+  }
+
+  varint |= static_cast<uint32_t>(byte & 0x7F) << varint_shift;
+  if (byte & 0x80) {
+    varint_shift += 7;
+    return false;
+  }
+
+  varint_shift = 0;
+  return true;
+}
+
+esp_err_t DeltaDecoder::copy(const uint32_t offset, const uint32_t length) {
+  if (offset > header.source_size || length > header.source_size - offset ||
+      length > header.target_size - written) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  uint32_t copied = 0;
+  while (copied < length) {
+    size_t chunk = length - copied;
+    if (chunk > COPY_BUFFER_SIZE) {
+      chunk = COPY_BUFFER_SIZE;
+    }
+
+    esp_err_t err =
+        io.read_source(io.context, offset + copied, copy_buffer, chunk);
+    if (err != ESP_OK) {
+      return err;
+    }
+    err = io.write_target(io.context, copy_buffer, chunk);
+    if (err != ESP_OK) {
+      return err;
+    }
+
+    copied += chunk;
+    written += chunk;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t DeltaDecoder::fail(const esp_err_t err) {
+  state = State::FAILED;
+  error = err;
+  return err;
+}
@@ -0,0 +1,82 @@
+#ifndef DELTA_DECODER_HPP
+#define DELTA_DECODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_err.h"
+
+// A delta rebuilds the target image from the running one:
+//   header: ["HPD1"][source size:u32][target size:u32][target sha256:32]
+//   COPY:   [0x01][source offset:varint][length:varint]
+//   INSERT: [0x02][length:varint][bytes]
+// Integers are little endian. A delta without COPY operations is a full
+// image, see tools/make_delta.py.
+constexpr uint8_t DELTA_MAGIC[] = {'H', 'P', 'D', '1'};
+constexpr size_t DELTA_SHA256_SIZE = 32;
+constexpr size_t DELTA_HEADER_SIZE =
+    sizeof(DELTA_MAGIC) + 2 * sizeof(uint32_t) + DELTA_SHA256_SIZE;
+
+struct DeltaHeader {
+  uint32_t source_size;
+  uint32_t target_size;
+  uint8_t target_sha256[DELTA_SHA256_SIZE];
+};
+
+// Where COPY reads from and where the rebuilt image goes, in order
+struct DeltaIO {
+  esp_err_t (*read_source)(void* context, size_t offset, uint8_t* data,
+                           size_t size);
+  esp_err_t (*write_target)(void* context, const uint8_t* data, size_t size);
+  void* context;
+};
+
+// Applies a delta as it streams in, the input may be split anywhere and
+// nothing but a small copy buffer is held in memory. The first error is
+// sticky until reset().
+class DeltaDecoder {
+ public:
+  DeltaDecoder(const DeltaIO io);
+
+  void reset();
+  esp_err_t feed(const uint8_t* data, size_t size);
+
+  bool has_header();
+  const DeltaHeader& get_header();
+  // True once the whole target has been written at an operation boundary
+  bool is_complete();
+  size_t get_written();
+
+ private:
+  enum class State {
+    HEADER,
+    OPCODE,
+    COPY_OFFSET,
+    COPY_LENGTH,
+    INSERT_LENGTH,
+    INSERT_DATA,
+    FAILED
+  };
+
+  const DeltaIO io;
+  State state;
+  esp_err_t error;
+
+  uint8_t header_buffer[DELTA_HEADER_SIZE];
+  size_t header_length;
+  DeltaHeader header;
+
+  uint32_t varint;
+  uint8_t varint_shift;
+  uint32_t copy_offset;
+  uint32_t insert_remaining;
+  size_t written;
+
+  esp_err_t parse_header();
+  // Returns true once the varint is complete, errors on overlong encodings
+  bool feed_varint(uint8_t byte, esp_err_t& err);
+  esp_err_t copy(uint32_t offset, uint32_t length);
+  esp_err_t fail(esp_err_t err);
+};
+
+#endif
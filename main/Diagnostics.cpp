@@ -0,0 +1,214 @@
+#include "Diagnostics.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+Diagnostics::Diagnostics(const uint32_t loop_period_ms)
+    : loop_period_ms(loop_period_ms),
+      task_names{},
+      task_count(0),
+      last_loop_at(0),
+      last_jitter_ms(0),
+      max_jitter_ms(0) {}
+
+void Diagnostics::track_task(const char* name) {
+  if (task_count >= DIAGNOSTICS_MAX_TASKS) {
+    printf("Error tracking task %s: task table is full\n", name);
+    return;
+  }
+  task_names[task_count++] = name;
+}
+
+void Diagnostics::record_loop_iteration() {
+  int64_t now = esp_timer_get_time();
+  if (last_loop_at != 0) {
+    int64_t period_ms = (now - last_loop_at) / 1000;
+    last_jitter_ms = static_cast<uint32_t>(llabs(period_ms - loop_period_ms));
+    if (last_jitter_ms > max_jitter_ms) {
+      max_jitter_ms = last_jitter_ms;
+    }
+  }
+  last_loop_at = now;
+}
+
+void Diagnostics::collect(DiagnosticsReport& report) {
+  report.uptime_s = static_cast<uint32_t>(esp_timer_get_time() / 1000000);
+  report.free_heap = esp_get_free_heap_size();
+  report.min_free_heap = esp_get_minimum_free_heap_size();
+  report.largest_free_block =
+      heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+
+  report.stack_count = 0;
+  for (size_t i = 0; i < task_count; i++) {
+    TaskHandle_t task = xTaskGetHandle(task_names[i]);
+    if (task == nullptr) {
+      continue;
+    }
+    report.stacks[report.stack_count++] = {
+        task_names[i],
+        static_cast<uint32_t>(uxTaskGetStackHighWaterMark(task))};
+  }
+
+  // Max jitter is reported per interval
+  report.loop_jitter_ms = last_jitter_ms;
+  report.max_loop_jitter_ms = max_jitter_ms;
+  max_jitter_ms = 0;
+
+  int rssi = 0;
+  if (esp_wifi_sta_get_rssi(&rssi) != ESP_OK) {
+    rssi = 0;
+  }
+  report.rssi = rssi;
+}
+
+esp_err_t Diagnostics::to_json(const DiagnosticsReport& report,
+                               const char* device_id, char* buffer,
+                               size_t size) {
+  // Related values are packed into arrays to keep the payload small:
+  // heap=[free, min free, largest block, allocations after init],
+  // jitter=[last, max], sensor=[reads, errors],
+  // traffic=[received, published, bytes received, bytes published,
+  //          commands for other devices],
+  // conn=[connects, failures, last connect ms, max connect ms],
+  // acks=[acked, expired, untracked, last ack ms, max ack ms, pending,
+  // outbox bytes] of QoS>0 publishes,
+  // cmd=[received, merged, applied], ir=[sent, suppressed, repeated,
+  // unconfirmed], sched=[entries, transitions], ctl=[commands, rate limited,
+  // dwell limited], lan=[requests, rejected, failed, last latency us,
+  // max latency us], hist=[samples, sector erases, write errors, queries],
+  // ota=[downloaded bytes, image bytes, apply ms, updates, failures,
+  // rollbacks] of the last update, dht=[reads, decoded, timeouts, timing
+  // errors, checksum errors, last decode us, max decode us],
+  // sensors=[valid, latency ms, busy us, errors] per sensor,
+  // stack=free bytes per task
+  size_t offset = 0;
+  bool ok =
+      append(buffer, size, offset, "{\"deviceId\":\"%s\",\"up\":%lu", device_id,
+             static_cast<unsigned long>(report.uptime_s)) &&
+      append(buffer, size, offset, ",\"heap\":[%lu,%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.free_heap),
+             static_cast<unsigned long>(report.min_free_heap),
+             static_cast<unsigned long>(report.largest_free_block),
+             static_cast<unsigned long>(report.heap_allocations)) &&
+      append(buffer, size, offset, ",\"jitter\":[%lu,%lu],\"rssi\":%d",
+             static_cast<unsigned long>(report.loop_jitter_ms),
+             static_cast<unsigned long>(report.max_loop_jitter_ms),
+             report.rssi) &&
+      append(buffer, size, offset,
+             ",\"wifiRec\":%lu,\"mqttRec\":%lu,\"pubFail\":%lu",
+             static_cast<unsigned long>(report.wifi_reconnects),
+             static_cast<unsigned long>(report.mqtt_reconnects),
+             static_cast<unsigned long>(report.mqtt_publish_failures)) &&
+      append(buffer, size, offset, ",\"traffic\":[%lu,%lu,%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.mqtt_messages_received),
+             static_cast<unsigned long>(report.mqtt_messages_published),
+             static_cast<unsigned long>(report.mqtt_bytes_received),
+             static_cast<unsigned long>(report.mqtt_bytes_published),
+             static_cast<unsigned long>(report.foreign_commands)) &&
+      append(buffer, size, offset, ",\"conn\":[%lu,%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.mqtt_connects),
+             static_cast<unsigned long>(report.mqtt_connect_failures),
+             static_cast<unsigned long>(report.mqtt_last_connect_ms),
+             static_cast<unsigned long>(report.mqtt_max_connect_ms)) &&
+      append(buffer, size, offset, ",\"acks\":[%lu,%lu,%lu,%lu,%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.mqtt_publishes_acked),
+             static_cast<unsigned long>(report.mqtt_publishes_expired),
+             static_cast<unsigned long>(report.mqtt_publishes_untracked),
+             static_cast<unsigned long>(report.mqtt_last_ack_ms),
+             static_cast<unsigned long>(report.mqtt_max_ack_ms),
+             static_cast<unsigned long>(report.mqtt_publishes_pending),
+             static_cast<unsigned long>(report.mqtt_outbox_bytes)) &&
+      append(buffer, size, offset, ",\"sensor\":[%lu,%lu],\"nvsCommits\":%lu",
+             static_cast<unsigned long>(report.sensor_reads),
+             static_cast<unsigned long>(report.sensor_errors),
+             static_cast<unsigned long>(report.nvs_commits)) &&
+      append(buffer, size, offset, ",\"cmd\":[%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.commands_received),
+             static_cast<unsigned long>(report.commands_merged),
+             static_cast<unsigned long>(report.commands_applied)) &&
+      append(buffer, size, offset, ",\"ir\":[%lu,%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.ir_frames_sent),
+             static_cast<unsigned long>(report.ir_frames_suppressed),
+             static_cast<unsigned long>(report.ir_frames_repeated),
+             static_cast<unsigned long>(report.ir_frames_unconfirmed)) &&
+      append(buffer, size, offset, ",\"sched\":[%lu,%lu]",
+             static_cast<unsigned long>(report.schedule_entries),
+             static_cast<unsigned long>(report.schedule_transitions)) &&
+      append(buffer, size, offset, ",\"ctl\":[%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.control_commands),
+             static_cast<unsigned long>(report.control_rate_limited),
+             static_cast<unsigned long>(report.control_dwell_limited)) &&
+      append(buffer, size, offset, ",\"lan\":[%lu,%lu,%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.local_requests),
+             static_cast<unsigned long>(report.local_rejected),
+             static_cast<unsigned long>(report.local_failed),
+             static_cast<unsigned long>(report.local_last_latency_us),
+             static_cast<unsigned long>(report.local_max_latency_us)) &&
+      append(buffer, size, offset, ",\"hist\":[%lu,%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.history_samples),
+             static_cast<unsigned long>(report.history_sector_erases),
+             static_cast<unsigned long>(report.history_write_errors),
+             static_cast<unsigned long>(report.history_queries)) &&
+      append(buffer, size, offset, ",\"ota\":[%lu,%lu,%lu,%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.ota_downloaded_bytes),
+             static_cast<unsigned long>(report.ota_image_bytes),
+             static_cast<unsigned long>(report.ota_apply_ms),
+             static_cast<unsigned long>(report.ota_updates),
+             static_cast<unsigned long>(report.ota_failures),
+             static_cast<unsigned long>(report.ota_rollbacks)) &&
+      append(buffer, size, offset, ",\"dht\":[%lu,%lu,%lu,%lu,%lu,%lu,%lu]",
+             static_cast<unsigned long>(report.dht_reads),
+             static_cast<unsigned long>(report.dht_decoded),
+             static_cast<unsigned long>(report.dht_timeouts),
+             static_cast<unsigned long>(report.dht_timing_errors),
+             static_cast<unsigned long>(report.dht_checksum_errors),
+             static_cast<unsigned long>(report.dht_last_decode_us),
+             static_cast<unsigned long>(report.dht_max_decode_us)) &&
+      append(buffer, size, offset, ",\"sensors\":{");
+
+  for (size_t i = 0; ok && i < report.sensor_count; i++) {
+    const SensorStatus& sensor = report.sensors[i];
+    ok = append(buffer, size, offset, "%s\"%s\":[%d,%lu,%lu,%lu]",
+                i > 0 ? "," : "", sensor.name, sensor.is_valid ? 1 : 0,
+                static_cast<unsigned long>(sensor.latency_ms),
+                static_cast<unsigned long>(sensor.busy_us),
+                static_cast<unsigned long>(sensor.errors));
+  }
+
+  ok = ok && append(buffer, size, offset, "},\"stack\":{");
+
+  for (size_t i = 0; ok && i < report.stack_count; i++) {
+    ok = append(buffer, size, offset, "%s\"%s\":%lu", i > 0 ? "," : "",
+                report.stacks[i].name,
+                static_cast<unsigned long>(report.stacks[i].free_bytes));
+  }
+
+  if (!ok || !append(buffer, size, offset, "}}")) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  return ESP_OK;
+}
+
+bool Diagnostics::append(char* buffer, size_t size, size_t& offset,
+                         const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(buffer + offset, size - offset, format, args);
+  va_end(args);
+
+  if (written < 0 || offset + written >= size) {
+    return false;
+  }
+
+  offset += written;
+  return true;
+}
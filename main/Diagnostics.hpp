@@ -0,0 +1,116 @@
+#ifndef DIAGNOSTICS_HPP
+#define DIAGNOSTICS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "TemperatureSensor.hpp"
+#include "esp_err.h"
+
+constexpr size_t DIAGNOSTICS_MAX_TASKS = 6;
+
+struct TaskStackUsage {
+  const char* name;
+  uint32_t free_bytes;
+};
+
+struct DiagnosticsReport {
+  // System
+  uint32_t uptime_s;
+  uint32_t free_heap;
+  uint32_t min_free_heap;
+  uint32_t largest_free_block;
+  uint32_t heap_allocations;
+  TaskStackUsage stacks[DIAGNOSTICS_MAX_TASKS];
+  size_t stack_count;
+  uint32_t loop_jitter_ms;
+  uint32_t max_loop_jitter_ms;
+  int rssi;
+
+  // Modules
+  uint32_t wifi_reconnects;
+  uint32_t mqtt_reconnects;
+  uint32_t mqtt_publish_failures;
+  uint32_t mqtt_messages_received;
+  uint32_t mqtt_messages_published;
+  uint32_t mqtt_bytes_received;
+  uint32_t mqtt_bytes_published;
+  uint32_t mqtt_connects;
+  uint32_t mqtt_connect_failures;
+  uint32_t mqtt_last_connect_ms;
+  uint32_t mqtt_max_connect_ms;
+  uint32_t mqtt_publishes_acked;
+  uint32_t mqtt_publishes_expired;
+  uint32_t mqtt_publishes_untracked;
+  uint32_t mqtt_last_ack_ms;
+  uint32_t mqtt_max_ack_ms;
+  uint32_t mqtt_publishes_pending;
+  uint32_t mqtt_outbox_bytes;
+  uint32_t foreign_commands;
+  uint32_t sensor_reads;
+  uint32_t sensor_errors;
+  SensorStatus sensors[TEMPERATURE_SENSOR_MAX_BACKENDS];
+  size_t sensor_count;
+  uint32_t nvs_commits;
+  uint32_t commands_received;
+  uint32_t commands_merged;
+  uint32_t commands_applied;
+  uint32_t ir_frames_sent;
+  uint32_t ir_frames_suppressed;
+  uint32_t ir_frames_repeated;
+  uint32_t ir_frames_unconfirmed;
+  uint32_t schedule_entries;
+  uint32_t schedule_transitions;
+  uint32_t control_commands;
+  uint32_t control_rate_limited;
+  uint32_t control_dwell_limited;
+  uint32_t local_requests;
+  uint32_t local_rejected;
+  uint32_t local_failed;
+  uint32_t local_last_latency_us;
+  uint32_t local_max_latency_us;
+  uint32_t history_samples;
+  uint32_t history_sector_erases;
+  uint32_t history_write_errors;
+  uint32_t history_queries;
+  uint32_t ota_downloaded_bytes;
+  uint32_t ota_image_bytes;
+  uint32_t ota_apply_ms;
+  uint32_t ota_updates;
+  uint32_t ota_failures;
+  uint32_t ota_rollbacks;
+  uint32_t dht_reads;
+  uint32_t dht_decoded;
+  uint32_t dht_timeouts;
+  uint32_t dht_timing_errors;
+  uint32_t dht_checksum_errors;
+  uint32_t dht_last_decode_us;
+  uint32_t dht_max_decode_us;
+};
+
+class Diagnostics {
+ public:
+  Diagnostics(const uint32_t loop_period_ms);
+
+  void track_task(const char* name);
+  void record_loop_iteration();
+
+  // Fills in the system metrics, module metrics are left to the caller
+  void collect(DiagnosticsReport& report);
+  esp_err_t to_json(const DiagnosticsReport& report, const char* device_id,
+                    char* buffer, size_t size);
+
+ private:
+  const uint32_t loop_period_ms;
+  const char* task_names[DIAGNOSTICS_MAX_TASKS];
+  size_t task_count;
+  int64_t last_loop_at;
+  uint32_t last_jitter_ms;
+  uint32_t max_jitter_ms;
+
+  static bool append(char* buffer, size_t size, size_t& offset,
+                     const char* format, ...)
+      __attribute__((format(printf, 4, 5)));
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "FaultInjector.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef CONFIG_FAULT_INJECTION
+std::atomic<Fault> injected_fault(Fault::NONE);
+#endif
+
+const char* fault_to_str(Fault fault) {
+  if (fault == Fault::WIFI) return "wifi";
+  if (fault == Fault::MQTT) return "mqtt";
+  if (fault == Fault::NVS) return "nvs";
+  if (fault == Fault::SENSOR) return "sensor";
+
+  // Default
+  return "none";
+}
+
+Fault str_to_fault(const char* str) {
+  if (strcmp(str, "wifi") == 0) return Fault::WIFI;
+  if (strcmp(str, "mqtt") == 0) return Fault::MQTT;
+  if (strcmp(str, "nvs") == 0) return Fault::NVS;
+  if (strcmp(str, "sensor") == 0) return Fault::SENSOR;
+
+  // Default
+  return Fault::NONE;
+}
+
+FaultInjector::FaultInjector(const uint32_t recovery_timeout_ms,
+                             const FaultActions actions)
+    : recovery_timeout_ms(recovery_timeout_ms),
+      actions(actions),
+      clear_timer(nullptr),
+      state(State::IDLE),
+      fault(Fault::NONE),
+      duration_ms(0),
+      cleared_at(0),
+      recovered_at(0),
+      last_telemetry_at(0),
+      telemetry_gap_ms(0),
+      commands_received(0),
+      commands_failed(0),
+      lock(portMUX_INITIALIZER_UNLOCKED) {}
+
+esp_err_t FaultInjector::init() {
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = &FaultInjector::clear_callback;
+  timer_args.arg = this;
+  timer_args.dispatch_method = ESP_TIMER_TASK;
+  timer_args.name = "fault_clear";
+
+  return esp_timer_create(&timer_args, &clear_timer);
+}
+
+esp_err_t FaultInjector::start(const Fault fault, const uint32_t duration_ms) {
+  if (fault == Fault::NONE) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  portENTER_CRITICAL(&lock);
+  if (state != State::IDLE) {
+    portEXIT_CRITICAL(&lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // Injected from the main loop, start() runs on the MQTT task which some
+  // faults have to stop
+  this->fault = fault;
+  this->duration_ms = duration_ms;
+  telemetry_gap_ms = 0;
+  commands_received = 0;
+  commands_failed = 0;
+  state = State::PENDING;
+  portEXIT_CRITICAL(&lock);
+
+  return ESP_OK;
+}
+
+bool FaultInjector::is_running() { return state != State::IDLE; }
+
+void FaultInjector::record_command_received() {
+  portENTER_CRITICAL(&lock);
+  if (state != State::IDLE) {
+    commands_received++;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void FaultInjector::record_command_failed() {
+  portENTER_CRITICAL(&lock);
+  if (state != State::IDLE) {
+    commands_failed++;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void FaultInjector::record_telemetry() {
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&lock);
+  if (state != State::IDLE && last_telemetry_at != 0) {
+    telemetry_gap_ms =
+        std::max(telemetry_gap_ms,
+                 static_cast<uint32_t>((now - last_telemetry_at) / 1000));
+  }
+  last_telemetry_at = now;
+  portEXIT_CRITICAL(&lock);
+}
+
+bool FaultInjector::poll(FaultReport& report) {
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&lock);
+  State current = state;
+  portEXIT_CRITICAL(&lock);
+
+  bool is_timed_out =
+      now - cleared_at > static_cast<int64_t>(recovery_timeout_ms) * 1000;
+
+  if (current == State::PENDING) {
+    printf("Injecting %s fault for %lu ms\n", fault_to_str(fault),
+           static_cast<unsigned long>(duration_ms));
+    portENTER_CRITICAL(&lock);
+    state = State::ACTIVE;
+    portEXIT_CRITICAL(&lock);
+
+#ifdef CONFIG_FAULT_INJECTION
+    injected_fault = fault;
+#endif
+    if (actions.inject != nullptr) {
+      actions.inject(fault);
+    }
+    esp_timer_start_once(clear_timer,
+                         static_cast<uint64_t>(duration_ms) * 1000);
+    return false;
+  }
+
+  if (current == State::RECOVERING) {
+    int64_t at = actions.recovered_at(fault, cleared_at);
+    if (at != 0) {
+      portENTER_CRITICAL(&lock);
+      recovered_at = at;
+      state = State::RECOVERED;
+      portEXIT_CRITICAL(&lock);
+      return false;
+    }
+    if (is_timed_out) {
+      finish(report, false, now);
+      return true;
+    }
+    return false;
+  }
+
+  // Wait for valid telemetry after the recovery, so the gap is closed
+  if (current == State::RECOVERED &&
+      (last_telemetry_at >= recovered_at || is_timed_out)) {
+    finish(report, true, now);
+    return true;
+  }
+
+  return false;
+}
+
+void FaultInjector::clear_callback(void* arg) {
+  auto* self = static_cast<FaultInjector*>(arg);
+
+#ifdef CONFIG_FAULT_INJECTION
+  injected_fault = Fault::NONE;
+#endif
+  if (self->actions.clear != nullptr) {
+    self->actions.clear(self->fault);
+  }
+
+  portENTER_CRITICAL(&self->lock);
+  self->cleared_at = esp_timer_get_time();
+  self->state = State::RECOVERING;
+  portEXIT_CRITICAL(&self->lock);
+}
+
+void FaultInjector::finish(FaultReport& report, bool recovered, int64_t now) {
+  portENTER_CRITICAL(&lock);
+  uint32_t gap_ms = telemetry_gap_ms;
+  if (last_telemetry_at != 0) {
+    gap_ms = std::max(
+        gap_ms, static_cast<uint32_t>((now - last_telemetry_at) / 1000));
+  }
+
+  report.fault = fault;
+  report.duration_ms = duration_ms;
+  report.recovered = recovered;
+  report.recovery_ms =
+      recovered ? static_cast<uint32_t>((recovered_at - cleared_at) / 1000) : 0;
+  report.commands_received = commands_received;
+  report.commands_failed = commands_failed;
+  report.telemetry_gap_ms = gap_ms;
+  state = State::IDLE;
+  portEXIT_CRITICAL(&lock);
+}
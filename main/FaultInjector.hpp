@@ -0,0 +1,92 @@
+#ifndef FAULT_INJECTOR_HPP
+#define FAULT_INJECTOR_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+enum class Fault : uint8_t { NONE, WIFI, MQTT, NVS, SENSOR };
+
+const char* fault_to_str(Fault fault);
+Fault str_to_fault(const char* str);
+
+// Checked by the code a fault stands in for, e.g. Heatpump fails its NVS
+// commit while Fault::NVS is active. Compiles to false without
+// CONFIG_FAULT_INJECTION.
+#ifdef CONFIG_FAULT_INJECTION
+extern std::atomic<Fault> injected_fault;
+inline bool fault_is_active(Fault fault) { return injected_fault == fault; }
+#else
+inline bool fault_is_active(Fault fault) { return false; }
+#endif
+
+struct FaultActions {
+  // Run on the main loop when the fault starts and on the timer task when it
+  // ends, for faults that need more than the fault_is_active() checks
+  void (*inject)(Fault fault);
+  void (*clear)(Fault fault);
+  // Returns when the unit became usable again after since, 0 while it is not
+  int64_t (*recovered_at)(Fault fault, int64_t since);
+};
+
+struct FaultReport {
+  Fault fault;
+  uint32_t duration_ms;
+  bool recovered;
+  // From the end of the fault until recovered_at()
+  uint32_t recovery_ms;
+  uint32_t commands_received;
+  uint32_t commands_failed;
+  // Longest time without valid telemetry, including the gap the fault
+  // started in
+  uint32_t telemetry_gap_ms;
+};
+
+// Runs one fault scenario at a time: injects the fault, clears it after the
+// requested duration and waits for the unit to recover and publish valid
+// telemetry again, or for recovery_timeout_ms.
+class FaultInjector {
+ public:
+  FaultInjector(const uint32_t recovery_timeout_ms,
+                const FaultActions actions);
+  esp_err_t init();
+
+  esp_err_t start(const Fault fault, const uint32_t duration_ms);
+  bool is_running();
+
+  void record_command_received();
+  void record_command_failed();
+  // Valid telemetry was handed to the MQTT client
+  void record_telemetry();
+
+  // Called from the main loop, returns true once per finished scenario
+  bool poll(FaultReport& report);
+
+ private:
+  enum class State { IDLE, PENDING, ACTIVE, RECOVERING, RECOVERED };
+
+  const uint32_t recovery_timeout_ms;
+  const FaultActions actions;
+  esp_timer_handle_t clear_timer;
+
+  State state;
+  Fault fault;
+  uint32_t duration_ms;
+  int64_t cleared_at;
+  int64_t recovered_at;
+  int64_t last_telemetry_at;
+  uint32_t telemetry_gap_ms;
+  uint32_t commands_received;
+  uint32_t commands_failed;
+  portMUX_TYPE lock;
+
+  static void clear_callback(void* arg);
+
+  void finish(FaultReport& report, bool recovered, int64_t now);
+};
+
+#endif
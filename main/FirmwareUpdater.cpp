@@ -0,0 +1,415 @@
+#include "FirmwareUpdater.hpp"
+
+#include <stdio.h>
+
+#include <cinttypes>
+#include <cstring>
+
+#include "esp_http_client.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/constant_time.h"
+#include "mbedtls/md.h"
+#include "nvs_flash.h"
+
+constexpr const char* NVS_NAMESPACE = "ota";
+constexpr const char* STATS_NVS_KEY = "stats";
+// Label of the partition an update switched to, cleared on the next boot
+constexpr const char* EXPECTED_NVS_KEY = "expected";
+// Highest accepted request nonce, so requests cannot be replayed
+constexpr const char* NONCE_NVS_KEY = "nonce";
+
+constexpr const char* REQUEST_MAC_TAG = "heatpump-ota-request";
+constexpr const char* URL_SCHEME = "https://";
+
+// TLS handshakes need a large stack
+constexpr uint32_t UPDATE_TASK_STACK_SIZE = 8192;
+constexpr UBaseType_t UPDATE_TASK_PRIORITY = 4;
+
+constexpr int HTTP_TIMEOUT_MS = 10000;
+constexpr size_t DOWNLOAD_BUFFER_SIZE = 1024;
+
+static uint8_t download_buffer[DOWNLOAD_BUFFER_SIZE];
+
+// Embedded from main/certs, see CMakeLists.txt
+extern const char ota_ca_pem_start[] asm("_binary_ota_ca_pem_start");
+
+static bool parse_hex(const char* hex, uint8_t* data, size_t size) {
+  if (strlen(hex) != size * 2) {
+    return false;
+  }
+
+  for (size_t i = 0; i < size * 2; i++) {
+    char c = hex[i];
+    uint8_t nibble;
+    if (c >= '0' && c <= '9') {
+      nibble = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      nibble = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      nibble = c - 'A' + 10;
+    } else {
+      return false;
+    }
+    data[i / 2] = i % 2 == 0 ? nibble << 4 : data[i / 2] | nibble;
+  }
+  return true;
+}
+
+FirmwareUpdater::FirmwareUpdater(const uint32_t rollback_timeout_ms,
+                                 const char* device_id, const char* secret)
+    : rollback_timeout_ms(rollback_timeout_ms),
+      device_id(device_id),
+      secret(secret),
+      last_nonce(0),
+      url(),
+      expected_sha256(),
+      is_active(false),
+      is_pending(false),
+      rollback_timer(nullptr),
+      source_partition(nullptr),
+      ota_handle(0),
+      sha256(),
+      decoder({&FirmwareUpdater::read_source, &FirmwareUpdater::write_target,
+               this}),
+      stats({}) {}
+
+esp_err_t FirmwareUpdater::init() {
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = &FirmwareUpdater::rollback_callback;
+  timer_args.arg = this;
+  timer_args.dispatch_method = ESP_TIMER_TASK;
+  timer_args.name = "ota_rollback";
+
+  esp_err_t err = esp_timer_create(&timer_args, &rollback_timer);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  const esp_partition_t* running = esp_ota_get_running_partition();
+
+  nvs_handle_t nvs_storage;
+  err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  size_t stats_size = sizeof(stats);
+  if (nvs_get_blob(nvs_storage, STATS_NVS_KEY, &stats, &stats_size) !=
+          ESP_OK ||
+      stats_size != sizeof(stats)) {
+    stats = {};
+  }
+
+  if (nvs_get_u64(nvs_storage, NONCE_NVS_KEY, &last_nonce) != ESP_OK) {
+    last_nonce = 0;
+  }
+
+  // Booting anything but the partition the last update switched to means
+  // the bootloader went back to the previous image
+  char expected[sizeof(running->label)];
+  size_t expected_size = sizeof(expected);
+  if (nvs_get_str(nvs_storage, EXPECTED_NVS_KEY, expected, &expected_size) ==
+      ESP_OK) {
+    if (strcmp(expected, running->label) != 0) {
+      printf("Firmware update rolled back to %s\n", running->label);
+      stats.rollbacks++;
+      nvs_set_blob(nvs_storage, STATS_NVS_KEY, &stats, sizeof(stats));
+    }
+    nvs_erase_key(nvs_storage, EXPECTED_NVS_KEY);
+    nvs_commit(nvs_storage);
+  }
+  nvs_close(nvs_storage);
+
+  esp_ota_img_states_t state;
+  if (esp_ota_get_state_partition(running, &state) == ESP_OK &&
+      state == ESP_OTA_IMG_PENDING_VERIFY) {
+    printf("Running new firmware from %s, waiting for confirmation\n",
+           running->label);
+    is_pending = true;
+    return esp_timer_start_once(
+        rollback_timer, static_cast<uint64_t>(rollback_timeout_ms) * 1000);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t FirmwareUpdater::start(const FirmwareRequest& request) {
+  // Never accept unauthenticated updates
+  if (strlen(secret) == 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (is_active || is_pending) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (strncmp(request.url, URL_SCHEME, strlen(URL_SCHEME)) != 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (strlen(request.url) >= sizeof(url)) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (!is_authentic(request) || request.nonce <= last_nonce) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // Stored before the update starts, a request that cannot be recorded is
+  // not executed
+  esp_err_t err = save_nonce(request.nonce);
+  if (err != ESP_OK) {
+    return err;
+  }
+  strcpy(url, request.url);
+
+  is_active = true;
+  BaseType_t result =
+      xTaskCreate(&FirmwareUpdater::update_task, "ota",
+                  UPDATE_TASK_STACK_SIZE, this, UPDATE_TASK_PRIORITY, nullptr);
+  if (result != pdPASS) {
+    is_active = false;
+    return ESP_ERR_NO_MEM;
+  }
+
+  return ESP_OK;
+}
+
+bool FirmwareUpdater::is_running() { return is_active; }
+
+void FirmwareUpdater::confirm() {
+  if (!is_pending) {
+    return;
+  }
+
+  esp_timer_stop(rollback_timer);
+  esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+  if (err != ESP_OK) {
+    printf("Error confirming firmware: %s\n", esp_err_to_name(err));
+    return;
+  }
+
+  printf("Confirmed new firmware\n");
+  is_pending = false;
+}
+
+bool FirmwareUpdater::is_pending_confirmation() { return is_pending; }
+
+FirmwareUpdateStats FirmwareUpdater::get_stats() { return stats; }
+
+bool FirmwareUpdater::is_authentic(const FirmwareRequest& request) {
+  uint8_t mac[FIRMWARE_UPDATER_MAC_SIZE];
+  if (!parse_hex(request.sha256, expected_sha256, sizeof(expected_sha256)) ||
+      !parse_hex(request.mac, mac, sizeof(mac))) {
+    return false;
+  }
+
+  static char message[FIRMWARE_UPDATER_MAX_URL_SIZE + 160];
+  int length = snprintf(message, sizeof(message), "%s\n%s\n%" PRIu64 "\n%s\n%s",
+                        REQUEST_MAC_TAG, device_id, request.nonce,
+                        request.sha256, request.url);
+  if (length < 0 || static_cast<size_t>(length) >= sizeof(message)) {
+    return false;
+  }
+
+  uint8_t expected_mac[FIRMWARE_UPDATER_MAC_SIZE];
+  int err = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                            reinterpret_cast<const uint8_t*>(secret),
+                            strlen(secret),
+                            reinterpret_cast<const uint8_t*>(message), length,
+                            expected_mac);
+  if (err != 0) {
+    return false;
+  }
+
+  return mbedtls_ct_memcmp(mac, expected_mac, sizeof(mac)) == 0;
+}
+
+esp_err_t FirmwareUpdater::save_nonce(uint64_t nonce) {
+  nvs_handle_t nvs_storage;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  err = nvs_set_u64(nvs_storage, NONCE_NVS_KEY, nonce);
+  if (err == ESP_OK) {
+    err = nvs_commit(nvs_storage);
+  }
+  nvs_close(nvs_storage);
+
+  if (err == ESP_OK) {
+    last_nonce = nonce;
+  }
+  return err;
+}
+
+void FirmwareUpdater::update_task(void* arg) {
+  auto* self = static_cast<FirmwareUpdater*>(arg);
+
+  esp_err_t err = self->update();
+  if (err == ESP_OK) {
+    printf("Firmware update applied in %lu ms, restarting\n",
+           static_cast<unsigned long>(self->stats.apply_ms));
+    esp_restart();
+  }
+
+  printf("Error updating firmware from %s: %s\n", self->url,
+         esp_err_to_name(err));
+  self->stats.failures++;
+  self->save_stats();
+  self->is_active = false;
+  vTaskDelete(nullptr);
+}
+
+void FirmwareUpdater::rollback_callback(void* arg) {
+  // Never reached the broker, the next boot counts the rollback
+  printf("New firmware was not confirmed in time, rolling back\n");
+  esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+esp_err_t FirmwareUpdater::read_source(void* context, size_t offset,
+                                       uint8_t* data, size_t size) {
+  auto* self = static_cast<FirmwareUpdater*>(context);
+  if (offset + size > self->source_partition->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return esp_partition_read(self->source_partition, offset, data, size);
+}
+
+esp_err_t FirmwareUpdater::write_target(void* context, const uint8_t* data,
+                                        size_t size) {
+  auto* self = static_cast<FirmwareUpdater*>(context);
+  mbedtls_sha256_update(&self->sha256, data, size);
+  return esp_ota_write(self->ota_handle, data, size);
+}
+
+esp_err_t FirmwareUpdater::update() {
+  int64_t started_at = esp_timer_get_time();
+
+  const esp_partition_t* target_partition =
+      esp_ota_get_next_update_partition(nullptr);
+  if (target_partition == nullptr) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  source_partition = esp_ota_get_running_partition();
+
+  // Sectors are erased as the image is written, not all up front
+  esp_err_t err = esp_ota_begin(target_partition, OTA_WITH_SEQUENTIAL_WRITES,
+                                &ota_handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  stats.downloaded_bytes = 0;
+  stats.image_bytes = 0;
+  decoder.reset();
+  mbedtls_sha256_init(&sha256);
+  mbedtls_sha256_starts(&sha256, 0);
+
+  err = download();
+  if (err == ESP_OK && !decoder.is_complete()) {
+    err = ESP_ERR_INVALID_SIZE;
+  }
+
+  uint8_t digest[DELTA_SHA256_SIZE];
+  mbedtls_sha256_finish(&sha256, digest);
+  mbedtls_sha256_free(&sha256);
+  if (err == ESP_OK &&
+      memcmp(digest, expected_sha256, sizeof(digest)) != 0) {
+    err = ESP_ERR_INVALID_CRC;
+  }
+
+  if (err != ESP_OK) {
+    esp_ota_abort(ota_handle);
+    return err;
+  }
+
+  // Also checks the image header and the checksum appended to the image
+  err = esp_ota_end(ota_handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  err = esp_ota_set_boot_partition(target_partition);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  stats.image_bytes = decoder.get_written();
+  stats.apply_ms = (esp_timer_get_time() - started_at) / 1000;
+  stats.updates++;
+  save_stats();
+
+  nvs_handle_t nvs_storage;
+  if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage) == ESP_OK) {
+    nvs_set_str(nvs_storage, EXPECTED_NVS_KEY, target_partition->label);
+    nvs_commit(nvs_storage);
+    nvs_close(nvs_storage);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t FirmwareUpdater::download() {
+  esp_http_client_config_t config = {};
+  config.url = url;
+  config.timeout_ms = HTTP_TIMEOUT_MS;
+  config.cert_pem = ota_ca_pem_start;
+
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  if (client == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  esp_err_t err = esp_http_client_open(client, 0);
+  if (err != ESP_OK) {
+    esp_http_client_cleanup(client);
+    return err;
+  }
+
+  if (esp_http_client_fetch_headers(client) < 0) {
+    err = ESP_FAIL;
+  } else if (esp_http_client_get_status_code(client) != 200) {
+    err = ESP_ERR_INVALID_RESPONSE;
+  }
+
+  while (err == ESP_OK) {
+    int length = esp_http_client_read(
+        client, reinterpret_cast<char*>(download_buffer),
+        sizeof(download_buffer));
+    if (length < 0) {
+      err = ESP_FAIL;
+    } else if (length == 0) {
+      if (!esp_http_client_is_complete_data_received(client)) {
+        err = ESP_ERR_INVALID_SIZE;
+      }
+      break;
+    } else {
+      stats.downloaded_bytes += length;
+      err = decoder.feed(download_buffer, length);
+      // Stop early on a delta for another image than the requested one
+      if (err == ESP_OK && decoder.has_header() &&
+          memcmp(decoder.get_header().target_sha256, expected_sha256,
+                 sizeof(expected_sha256)) != 0) {
+        err = ESP_ERR_INVALID_CRC;
+      }
+    }
+  }
+
+  esp_http_client_close(client);
+  esp_http_client_cleanup(client);
+  return err;
+}
+
+void FirmwareUpdater::save_stats() {
+  nvs_handle_t nvs_storage;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage);
+  if (err != ESP_OK) {
+    return;
+  }
+
+  if (nvs_set_blob(nvs_storage, STATS_NVS_KEY, &stats, sizeof(stats)) ==
+      ESP_OK) {
+    nvs_commit(nvs_storage);
+  }
+  nvs_close(nvs_storage);
+}
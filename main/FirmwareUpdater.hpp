@@ -0,0 +1,95 @@
+#ifndef FIRMWARE_UPDATER_HPP
+#define FIRMWARE_UPDATER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "DeltaDecoder.hpp"
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+
+constexpr size_t FIRMWARE_UPDATER_MAX_URL_SIZE = 256;
+constexpr size_t FIRMWARE_UPDATER_MAC_SIZE = 32;
+
+// An update request. mac is HMAC-SHA256 with the shared secret over
+//   "heatpump-ota-request\n<device id>\n<nonce>\n<sha256>\n<url>"
+// and sha256 is the hash of the rebuilt image, both hex encoded. Nonces
+// have to increase, see tools/make_delta.py.
+struct FirmwareRequest {
+  const char* url;
+  const char* sha256;
+  uint64_t nonce;
+  const char* mac;
+};
+
+// Kept in NVS, so the result of an update is still reported after the
+// reboot into the new image
+struct FirmwareUpdateStats {
+  uint32_t downloaded_bytes;
+  uint32_t image_bytes;
+  uint32_t apply_ms;
+  uint32_t updates;
+  uint32_t failures;
+  uint32_t rollbacks;
+};
+
+// Downloads a delta (see DeltaDecoder) over HTTPS from a server signed by
+// the pinned CA in main/certs/ota_ca.pem and rebuilds the new image from the
+// running one straight into the inactive OTA partition, hashing it on the
+// way. The image has to match the hash in the authenticated request. A new
+// image has to confirm() within rollback_timeout_ms, otherwise the
+// bootloader goes back to the previous one.
+class FirmwareUpdater {
+ public:
+  FirmwareUpdater(const uint32_t rollback_timeout_ms, const char* device_id,
+                  const char* secret);
+  esp_err_t init();
+
+  // Checks the request and runs the update on its own task, the device
+  // restarts when it succeeds. Returns ESP_ERR_INVALID_ARG for requests that
+  // are malformed, not authentic or replayed.
+  esp_err_t start(const FirmwareRequest& request);
+  bool is_running();
+
+  // Marks a new image as good, called once it reached the broker
+  void confirm();
+  bool is_pending_confirmation();
+
+  FirmwareUpdateStats get_stats();
+
+ private:
+  const uint32_t rollback_timeout_ms;
+  const char* device_id;
+  const char* secret;
+  uint64_t last_nonce;
+  char url[FIRMWARE_UPDATER_MAX_URL_SIZE];
+  uint8_t expected_sha256[DELTA_SHA256_SIZE];
+  bool is_active;
+  bool is_pending;
+  esp_timer_handle_t rollback_timer;
+
+  const esp_partition_t* source_partition;
+  esp_ota_handle_t ota_handle;
+  mbedtls_sha256_context sha256;
+  DeltaDecoder decoder;
+
+  FirmwareUpdateStats stats;
+
+  static void update_task(void* arg);
+  static void rollback_callback(void* arg);
+  static esp_err_t read_source(void* context, size_t offset, uint8_t* data,
+                               size_t size);
+  static esp_err_t write_target(void* context, const uint8_t* data,
+                                size_t size);
+
+  bool is_authentic(const FirmwareRequest& request);
+  esp_err_t save_nonce(uint64_t nonce);
+  esp_err_t update();
+  esp_err_t download();
+  void save_stats();
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef FIXED_VECTOR_HPP
+#define FIXED_VECTOR_HPP
+
+#include <cstddef>
+
+// Vector with a compile-time capacity and inline storage, so it never
+// allocates on the heap.
+template <typename T, size_t N>
+class FixedVector {
+ public:
+  FixedVector() : count(0) {}
+
+  bool push_back(const T& item) {
+    if (count >= N) {
+      return false;
+    }
+    items[count++] = item;
+    return true;
+  }
+
+  // Moves the last item into the gap, so the order is not preserved
+  void erase(size_t i) { items[i] = items[--count]; }
+
+  void clear() { count = 0; }
+
+  size_t size() const { return count; }
+  bool full() const { return count >= N; }
+  static constexpr size_t capacity() { return N; }
+
+  T& operator[](size_t i) { return items[i]; }
+  const T& operator[](size_t i) const { return items[i]; }
+
+  T* begin() { return items; }
+  T* end() { return items + count; }
+  const T* begin() const { return items; }
+  const T* end() const { return items + count; }
+
+ private:
+  T items[N];
+  size_t count;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "HeapMonitor.hpp"
+
+#include <atomic>
+#include <cstdlib>
+
+#include "esp_attr.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_STATIC_MEMORY_MODE
+
+constexpr size_t MAX_TRACKED_TASKS = 4;
+
+struct TrackedTask {
+  TaskHandle_t task;
+  uint32_t depth;
+  bool warmed_up;
+};
+
+static TrackedTask tracked_tasks[MAX_TRACKED_TASKS] = {};
+static portMUX_TYPE tracked_tasks_lock = portMUX_INITIALIZER_UNLOCKED;
+static std::atomic<bool> sealed(false);
+static std::atomic<uint32_t> allocations(0);
+static std::atomic<uint32_t> allocated_bytes(0);
+
+static TrackedTask* find_task(TaskHandle_t task) {
+  for (auto& tracked : tracked_tasks) {
+    if (tracked.task == task) {
+      return &tracked;
+    }
+  }
+  return nullptr;
+}
+
+void heap_monitor_seal() { sealed = true; }
+
+void heap_monitor_enter() {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+  portENTER_CRITICAL(&tracked_tasks_lock);
+  TrackedTask* tracked = find_task(task);
+  if (tracked == nullptr) {
+    tracked = find_task(nullptr);
+    if (tracked != nullptr) {
+      tracked->task = task;
+    }
+  }
+  if (tracked != nullptr) {
+    tracked->depth++;
+  }
+  portEXIT_CRITICAL(&tracked_tasks_lock);
+}
+
+void heap_monitor_exit() {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+  portENTER_CRITICAL(&tracked_tasks_lock);
+  TrackedTask* tracked = find_task(task);
+  if (tracked != nullptr && tracked->depth > 0) {
+    tracked->depth--;
+    if (tracked->depth == 0 && sealed) {
+      tracked->warmed_up = true;
+    }
+  }
+  portEXIT_CRITICAL(&tracked_tasks_lock);
+}
+
+HeapMonitorStats heap_monitor_get_stats() {
+  return HeapMonitorStats{allocations.load(), allocated_bytes.load()};
+}
+
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void* ptr, size_t size,
+                                                    uint32_t caps) {
+  if (!sealed || ptr == nullptr) {
+    return;
+  }
+
+  // Reading the table without the lock is fine here, a task only changes its
+  // own entry and the hook runs on the allocating task
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  const TrackedTask* tracked = find_task(task);
+  if (tracked == nullptr || tracked->depth == 0 || !tracked->warmed_up) {
+    return;
+  }
+
+  allocations++;
+  allocated_bytes += size;
+
+#ifdef CONFIG_STATIC_MEMORY_ASSERT
+  esp_rom_printf("Heap allocation of %u bytes after init in task %s\n",
+                 static_cast<unsigned>(size), pcTaskGetName(task));
+  abort();
+#endif
+}
+
+extern "C" IRAM_ATTR void esp_heap_trace_free_hook(void* ptr) {}
+
+#else
+
+void heap_monitor_seal() {}
+void heap_monitor_enter() {}
+void heap_monitor_exit() {}
+HeapMonitorStats heap_monitor_get_stats() { return HeapMonitorStats{}; }
+
+#endif
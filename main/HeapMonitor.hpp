@@ -0,0 +1,30 @@
+#ifndef HEAP_MONITOR_HPP
+#define HEAP_MONITOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+struct HeapMonitorStats {
+  uint32_t allocations;
+  uint32_t bytes;
+};
+
+// Counts heap allocations made inside steady-state sections once the init
+// phase is sealed. Each task's first section is treated as warm-up, since
+// newlib lazily allocates its per-task buffers on first use.
+void heap_monitor_seal();
+void heap_monitor_enter();
+void heap_monitor_exit();
+HeapMonitorStats heap_monitor_get_stats();
+
+// Marks the enclosing block as a steady-state section
+class SteadyStateScope {
+ public:
+  SteadyStateScope() { heap_monitor_enter(); }
+  ~SteadyStateScope() { heap_monitor_exit(); }
+
+  SteadyStateScope(const SteadyStateScope&) = delete;
+  SteadyStateScope& operator=(const SteadyStateScope&) = delete;
+};
+
+#endif
@@ -3,6 +3,8 @@
 #include <bitset>
 #include <cstdint>
 
+#include "FaultInjector.hpp"
+#include "Timeline.hpp"
 #include "cJSON.h"
 #include "nvs_flash.h"
 
@@ -17,6 +19,8 @@ constexpr const char* TARGET_TEMPERATURE_JSON_KEY = "targetTemperature";
 constexpr const char* FAN_SPEED_NVS_KEY = "fan_speed";
 constexpr const char* FAN_SPEED_JSON_KEY = "fanSpeed";
 
+constexpr const char* VERSION_NVS_KEY = "version";
+
 constexpr const char* BINARY_HEADER =
     "1111001000001101000000111111110000000001";
 
@@ -24,7 +28,9 @@ Heatpump::Heatpump(const char* default_mode,
                    const int default_target_temperature)
     : mode(str_to_mode(default_mode)),
       target_temperature(default_target_temperature),
-      fan_speed(0) {}
+      fan_speed(0),
+      version(0),
+      stats({}) {}
 
 esp_err_t Heatpump::init() {
   nvs_handle_t nvs_storage;
@@ -45,11 +51,22 @@ esp_err_t Heatpump::init() {
     this->target_temperature = target_temperature;
   }
 
+  int32_t fan_speed;
+  if (nvs_get_i32(nvs_storage, FAN_SPEED_NVS_KEY, &fan_speed) == ESP_OK) {
+    this->fan_speed = fan_speed;
+  }
+
+  uint32_t version;
+  if (nvs_get_u32(nvs_storage, VERSION_NVS_KEY, &version) == ESP_OK) {
+    this->version = version;
+  }
+
   nvs_close(nvs_storage);
   return ESP_OK;
 }
 
 esp_err_t Heatpump::set_mode(const Mode mode) {
+  TimelineScope scope(TimelineEvent::HEATPUMP_SET);
   nvs_handle_t nvs_storage;
   esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage);
   if (err != ESP_OK) {
@@ -62,11 +79,14 @@ esp_err_t Heatpump::set_mode(const Mode mode) {
     return err;
   }
 
+  timeline_begin(TimelineEvent::NVS_COMMIT);
   err = nvs_commit(nvs_storage);
+  timeline_end(TimelineEvent::NVS_COMMIT);
   if (err != ESP_OK) {
     nvs_close(nvs_storage);
     return err;
   }
+  stats.nvs_commits++;
 
   this->mode = mode;
 
@@ -77,7 +97,9 @@ esp_err_t Heatpump::set_mode(const Mode mode) {
 Mode Heatpump::get_mode() { return mode; }
 
 esp_err_t Heatpump::set_target_temperature(const int target_temperature) {
-  if (target_temperature < 17 || target_temperature > 30) {
+  TimelineScope scope(TimelineEvent::HEATPUMP_SET);
+  if (target_temperature < MIN_TARGET_TEMPERATURE ||
+      target_temperature > MAX_TARGET_TEMPERATURE) {
     return ESP_ERR_INVALID_ARG;
   }
 
@@ -94,11 +116,14 @@ esp_err_t Heatpump::set_target_temperature(const int target_temperature) {
     return err;
   }
 
+  timeline_begin(TimelineEvent::NVS_COMMIT);
   err = nvs_commit(nvs_storage);
+  timeline_end(TimelineEvent::NVS_COMMIT);
   if (err != ESP_OK) {
     nvs_close(nvs_storage);
     return err;
   }
+  stats.nvs_commits++;
 
   this->target_temperature = target_temperature;
 
@@ -109,7 +134,8 @@ esp_err_t Heatpump::set_target_temperature(const int target_temperature) {
 int Heatpump::get_target_temperature() { return target_temperature; }
 
 esp_err_t Heatpump::set_fan_speed(const int fan_speed) {
-  if (fan_speed < 0 || fan_speed > 100) {
+  TimelineScope scope(TimelineEvent::HEATPUMP_SET);
+  if (fan_speed < MIN_FAN_SPEED || fan_speed > MAX_FAN_SPEED) {
     return ESP_ERR_INVALID_ARG;
   }
 
@@ -125,11 +151,14 @@ esp_err_t Heatpump::set_fan_speed(const int fan_speed) {
     return err;
   }
 
+  timeline_begin(TimelineEvent::NVS_COMMIT);
   err = nvs_commit(nvs_storage);
+  timeline_end(TimelineEvent::NVS_COMMIT);
   if (err != ESP_OK) {
     nvs_close(nvs_storage);
     return err;
   }
+  stats.nvs_commits++;
 
   this->fan_speed = fan_speed;
 
@@ -139,44 +168,143 @@ esp_err_t Heatpump::set_fan_speed(const int fan_speed) {
 
 int Heatpump::get_fan_speed() { return fan_speed; }
 
+HeatpumpStats Heatpump::get_stats() { return stats; }
+
 esp_err_t Heatpump::populate_from_json(const char* json_str) {
+  HeatpumpUpdate update;
+  esp_err_t err = parse_update(json_str, update);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  bool changed;
+  return apply(update, changed);
+}
+
+esp_err_t Heatpump::parse_update(const char* json_str,
+                                 HeatpumpUpdate& update) {
   cJSON* root = cJSON_Parse(json_str);
   if (!root) {
+    update = {};
     return ESP_ERR_INVALID_ARG;
   }
 
+  esp_err_t err = parse_update(root, update);
+  cJSON_Delete(root);
+  return err;
+}
+
+esp_err_t Heatpump::parse_update(const cJSON* root, HeatpumpUpdate& update) {
+  update = {};
+
   cJSON* mode_item = cJSON_GetObjectItem(root, MODE_JSON_KEY);
   if (cJSON_IsString(mode_item)) {
-    esp_err_t err = set_mode(str_to_mode(mode_item->valuestring));
-    if (err != ESP_OK) {
-      cJSON_Delete(root);
-      return err;
-    }
+    update.has_mode = true;
+    update.mode = str_to_mode(mode_item->valuestring);
   }
 
   cJSON* target_temp_item =
       cJSON_GetObjectItem(root, TARGET_TEMPERATURE_JSON_KEY);
   if (cJSON_IsNumber(target_temp_item)) {
-    esp_err_t err = set_target_temperature(target_temp_item->valueint);
-    if (err != ESP_OK) {
-      cJSON_Delete(root);
-      return err;
-    }
+    update.has_target_temperature = true;
+    update.target_temperature = target_temp_item->valueint;
   }
 
   cJSON* fan_speed_item = cJSON_GetObjectItem(root, FAN_SPEED_JSON_KEY);
   if (cJSON_IsNumber(fan_speed_item)) {
-    esp_err_t err = set_fan_speed(fan_speed_item->valueint);
-    if (err != ESP_OK) {
-      cJSON_Delete(root);
-      return err;
-    }
+    update.has_fan_speed = true;
+    update.fan_speed = fan_speed_item->valueint;
   }
 
-  cJSON_Delete(root);
+  if (!is_valid(update)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  return ESP_OK;
+}
+
+bool Heatpump::is_valid(const HeatpumpUpdate& update) {
+  if (update.has_target_temperature &&
+      (update.target_temperature < MIN_TARGET_TEMPERATURE ||
+       update.target_temperature > MAX_TARGET_TEMPERATURE)) {
+    return false;
+  }
+
+  if (update.has_fan_speed &&
+      (update.fan_speed < MIN_FAN_SPEED || update.fan_speed > MAX_FAN_SPEED)) {
+    return false;
+  }
+
+  return true;
+}
+
+esp_err_t Heatpump::apply(const HeatpumpUpdate& update, bool& changed) {
+  bool mode_changed = update.has_mode && update.mode != mode;
+  bool target_temperature_changed =
+      update.has_target_temperature &&
+      update.target_temperature != target_temperature;
+  bool fan_speed_changed =
+      update.has_fan_speed && update.fan_speed != fan_speed;
+
+  changed = mode_changed || target_temperature_changed || fan_speed_changed;
+  if (!changed) {
+    return ESP_OK;
+  }
+
+  // Write all changed fields with a single commit
+  TimelineScope scope(TimelineEvent::HEATPUMP_APPLY);
+  if (fault_is_active(Fault::NVS)) {
+    changed = false;
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+  }
+  nvs_handle_t nvs_storage;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  if (mode_changed) {
+    err = nvs_set_str(nvs_storage, MODE_NVS_KEY, mode_to_str(update.mode));
+  }
+  if (err == ESP_OK && target_temperature_changed) {
+    err = nvs_set_i32(nvs_storage, TARGET_TEMPERATURE_NVS_KEY,
+                      update.target_temperature);
+  }
+  if (err == ESP_OK && fan_speed_changed) {
+    err = nvs_set_i32(nvs_storage, FAN_SPEED_NVS_KEY, update.fan_speed);
+  }
+  if (err == ESP_OK) {
+    err = nvs_set_u32(nvs_storage, VERSION_NVS_KEY, version + 1);
+  }
+  if (err == ESP_OK) {
+    timeline_begin(TimelineEvent::NVS_COMMIT);
+    err = nvs_commit(nvs_storage);
+    timeline_end(TimelineEvent::NVS_COMMIT);
+  }
+
+  nvs_close(nvs_storage);
+  if (err != ESP_OK) {
+    changed = false;
+    return err;
+  }
+  stats.nvs_commits++;
+
+  if (mode_changed) {
+    this->mode = update.mode;
+  }
+  if (target_temperature_changed) {
+    this->target_temperature = update.target_temperature;
+  }
+  if (fan_speed_changed) {
+    this->fan_speed = update.fan_speed;
+  }
+  version++;
+
   return ESP_OK;
 }
 
+uint32_t Heatpump::get_version() { return version; }
+
 void int_to_bin(char* dest, uint32_t value, int bits) {
   for (int i = bits - 1; i >= 0; --i) {
     *dest++ = ((value >> i) & 1) ? '1' : '0';
@@ -185,6 +313,12 @@ void int_to_bin(char* dest, uint32_t value, int bits) {
 }
 
 const char* Heatpump::to_binary_state() {
+  return to_binary_state(mode != Mode::OFF, target_temperature, fan_speed);
+}
+
+const char* Heatpump::to_binary_state(const bool is_on,
+                                      const int target_temperature,
+                                      const int fan_speed) {
   // Temperature range conversion: [17-30] to [0-13]
   int temp = target_temperature - 17;
 
@@ -196,10 +330,10 @@ const char* Heatpump::to_binary_state() {
   }
 
   // Power is inverted: 0=ON, 1=OFF
-  int p = (mode == Mode::OFF) ? 1 : 0;
+  int p = is_on ? 0 : 1;
 
   int mo = 0;
-  switch (mode) {
+  switch (is_on ? mode : Mode::OFF) {
     case Mode::AUTO:
       mo = 0;
       break;
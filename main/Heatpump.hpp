@@ -1,9 +1,31 @@
 #ifndef HEATPUMP_HPP
 #define HEATPUMP_HPP
 
+#include <cstdint>
+
 #include "Mode.hpp"
+#include "cJSON.h"
 #include "esp_err.h"
 
+constexpr int MIN_TARGET_TEMPERATURE = 17;
+constexpr int MAX_TARGET_TEMPERATURE = 30;
+constexpr int MIN_FAN_SPEED = 0;
+constexpr int MAX_FAN_SPEED = 100;
+
+// Partial state change, only fields with their has_ flag set are changed
+struct HeatpumpUpdate {
+  bool has_mode;
+  Mode mode;
+  bool has_target_temperature;
+  int target_temperature;
+  bool has_fan_speed;
+  int fan_speed;
+};
+
+struct HeatpumpStats {
+  uint32_t nvs_commits;
+};
+
 class Heatpump {
  public:
   Heatpump(const char* default_mode, const int default_target_temperature);
@@ -20,12 +42,29 @@ class Heatpump {
 
   esp_err_t populate_from_json(const char* json);
 
+  static esp_err_t parse_update(const char* json, HeatpumpUpdate& update);
+  static esp_err_t parse_update(const cJSON* root, HeatpumpUpdate& update);
+  static bool is_valid(const HeatpumpUpdate& update);
+  esp_err_t apply(const HeatpumpUpdate& update, bool& changed);
+  // Bumped and persisted by every apply() that changes the state, so
+  // clients can order the states they see across reboots
+  uint32_t get_version();
+
   const char* to_binary_state();
 
+  // Encodes the current mode with a different power state, setpoint and fan
+  // speed, used when the control engine steers the heatpump
+  const char* to_binary_state(const bool is_on, const int target_temperature,
+                              const int fan_speed);
+
+  HeatpumpStats get_stats();
+
  private:
   Mode mode;
   int target_temperature;
   int fan_speed;
+  uint32_t version;
+  HeatpumpStats stats;
 };
 
 #endif
@@ -0,0 +1,385 @@
+#include "History.hpp"
+
+#include <cstring>
+
+#include "Varint.hpp"
+
+constexpr size_t SECTOR_SIZE = 4096;
+constexpr uint8_t SECTOR_MAGIC[] = {'H', 'P', 'H', '1'};
+constexpr size_t SECTOR_HEADER_SIZE =
+    sizeof(SECTOR_MAGIC) + sizeof(uint32_t) + HISTORY_FULL_SAMPLE_SIZE;
+
+constexpr uint8_t OPERATING_STATE_MASK = 0x03;
+constexpr uint8_t MODE_SHIFT = 2;
+constexpr uint8_t MODE_MASK = 0x03;
+constexpr uint8_t HAS_COMMAND_BIT = 0x10;
+constexpr uint8_t RESERVED_BITS = 0xE0;
+
+// Shared by recovery and queries, both run on the main task
+static uint8_t sector_buffer[SECTOR_SIZE];
+
+static void write_u16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+}
+
+static void write_u32(uint8_t* out, uint32_t value) {
+  for (size_t i = 0; i < 4; i++) {
+    out[i] = (value >> (8 * i)) & 0xFF;
+  }
+}
+
+static uint16_t read_u16(const uint8_t* data) { return data[0] | data[1] << 8; }
+
+static uint32_t read_u32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 |
+         static_cast<uint32_t>(data[3]) << 24;
+}
+
+static uint8_t encode_state(const HistorySample& sample) {
+  return static_cast<uint8_t>(sample.operating_state) |
+         static_cast<uint8_t>(sample.mode) << MODE_SHIFT;
+}
+
+static void decode_state(uint8_t state, HistorySample& sample) {
+  sample.operating_state =
+      static_cast<OperatingState>(state & OPERATING_STATE_MASK);
+  sample.mode = static_cast<Mode>((state >> MODE_SHIFT) & MODE_MASK);
+}
+
+size_t history_encode_full(const HistorySample& sample, uint8_t* out) {
+  write_u32(out, sample.timestamp);
+  write_u16(out + 4, static_cast<uint16_t>(sample.temperature_x10));
+  write_u16(out + 6, sample.humidity_x10);
+  out[8] = encode_state(sample);
+  out[9] = sample.target_temperature;
+  out[10] = sample.fan_speed;
+  out[11] = 0;
+  return HISTORY_FULL_SAMPLE_SIZE;
+}
+
+bool history_decode_full(const uint8_t* data, HistorySample& sample) {
+  if (data[8] & (HAS_COMMAND_BIT | RESERVED_BITS)) {
+    return false;
+  }
+
+  sample.timestamp = read_u32(data);
+  sample.temperature_x10 = static_cast<int16_t>(read_u16(data + 4));
+  sample.humidity_x10 = read_u16(data + 6);
+  decode_state(data[8], sample);
+  sample.target_temperature = data[9];
+  sample.fan_speed = data[10];
+  return true;
+}
+
+size_t history_encode_record(const HistorySample& previous,
+                             const HistorySample& sample, uint8_t* out) {
+  bool has_command = sample.target_temperature != previous.target_temperature ||
+                     sample.fan_speed != previous.fan_speed;
+
+  size_t size = 0;
+  out[size++] = encode_state(sample) | (has_command ? HAS_COMMAND_BIT : 0);
+  size += encode_varint(sample.timestamp - previous.timestamp, out + size);
+  size += encode_varint(
+      zigzag_encode(sample.temperature_x10 - previous.temperature_x10),
+      out + size);
+  size += encode_varint(
+      zigzag_encode(sample.humidity_x10 - previous.humidity_x10), out + size);
+  if (has_command) {
+    out[size++] = sample.target_temperature;
+    out[size++] = sample.fan_speed;
+  }
+  return size;
+}
+
+bool history_decode_record(const uint8_t* data, size_t size, size_t& offset,
+                           HistorySample& sample) {
+  if (offset >= size || (data[offset] & RESERVED_BITS)) {
+    return false;
+  }
+
+  size_t cursor = offset;
+  uint8_t state = data[cursor++];
+  uint32_t dt;
+  uint32_t dtemperature;
+  uint32_t dhumidity;
+  if (!decode_varint(data, size, cursor, dt) ||
+      !decode_varint(data, size, cursor, dtemperature) ||
+      !decode_varint(data, size, cursor, dhumidity)) {
+    return false;
+  }
+
+  HistorySample next = sample;
+  if (state & HAS_COMMAND_BIT) {
+    if (cursor + 2 > size) {
+      return false;
+    }
+    next.target_temperature = data[cursor++];
+    next.fan_speed = data[cursor++];
+  }
+
+  decode_state(state, next);
+  next.timestamp += dt;
+  next.temperature_x10 += zigzag_decode(dtemperature);
+  next.humidity_x10 += zigzag_decode(dhumidity);
+
+  sample = next;
+  offset = cursor;
+  return true;
+}
+
+History::History(const char* partition_label, const uint32_t interval_s)
+    : partition_label(partition_label),
+      interval_s(interval_s),
+      partition(nullptr),
+      sector_count(0),
+      sector(0),
+      sequence(0),
+      offset(0),
+      last_sample({}),
+      has_last_sample(false),
+      is_query_active(false),
+      query_from(0),
+      query_to(0),
+      query_first_sector(0),
+      query_sector_index(0),
+      query_offset(0),
+      is_query_sector_loaded(false),
+      query_sample({}),
+      query_lock(portMUX_INITIALIZER_UNLOCKED),
+      stats({}) {}
+
+esp_err_t History::init() {
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                       ESP_PARTITION_SUBTYPE_ANY,
+                                       partition_label);
+  if (partition == nullptr) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  sector_count = partition->size / SECTOR_SIZE;
+  if (sector_count < 2) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  recover();
+  return ESP_OK;
+}
+
+void History::record(const HistorySample& sample) {
+  if (partition == nullptr) {
+    return;
+  }
+
+  // Samples must be in order for the deltas, skip them while the clock
+  // jumped backwards
+  if (has_last_sample &&
+      (sample.timestamp < last_sample.timestamp ||
+       sample.timestamp - last_sample.timestamp < interval_s)) {
+    return;
+  }
+
+  uint8_t record[HISTORY_MAX_RECORD_SIZE];
+  size_t size = has_last_sample
+                    ? history_encode_record(last_sample, sample, record)
+                    : 0;
+  if (!has_last_sample || offset + size > SECTOR_SIZE) {
+    if (start_sector(sample) != ESP_OK) {
+      stats.write_errors++;
+    }
+    return;
+  }
+
+  esp_err_t err = esp_partition_write(partition, sector * SECTOR_SIZE + offset,
+                                      record, size);
+  if (err != ESP_OK) {
+    // The sector may hold a partial record now, continue in a fresh one
+    stats.write_errors++;
+    offset = SECTOR_SIZE;
+    return;
+  }
+
+  offset += size;
+  last_sample = sample;
+  stats.samples++;
+}
+
+esp_err_t History::start_query(const uint32_t from, const uint32_t to) {
+  if (partition == nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  portENTER_CRITICAL(&query_lock);
+  if (is_query_active) {
+    portEXIT_CRITICAL(&query_lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+  query_from = from;
+  query_to = to;
+  // The oldest sector follows the one being written
+  query_first_sector = (sector + 1) % sector_count;
+  query_sector_index = 0;
+  is_query_sector_loaded = false;
+  is_query_active = true;
+  stats.queries++;
+  portEXIT_CRITICAL(&query_lock);
+
+  return ESP_OK;
+}
+
+bool History::is_querying() { return is_query_active; }
+
+bool History::next_chunk(uint8_t* buffer, size_t size, size_t& length,
+                         bool& is_last) {
+  if (!is_query_active) {
+    return false;
+  }
+
+  // Every chunk starts with a full sample so it decodes on its own
+  length = 0;
+  is_last = false;
+  HistorySample previous = {};
+  HistorySample sample;
+  while (length + HISTORY_FULL_SAMPLE_SIZE <= size) {
+    if (!next_sample(sample) || sample.timestamp > query_to) {
+      is_last = true;
+      break;
+    }
+    if (sample.timestamp < query_from) {
+      continue;
+    }
+
+    length += length == 0 ? history_encode_full(sample, buffer)
+                          : history_encode_record(previous, sample,
+                                                  buffer + length);
+    previous = sample;
+
+    if (length + HISTORY_MAX_RECORD_SIZE > size) {
+      break;
+    }
+  }
+
+  if (is_last) {
+    is_query_active = false;
+  }
+  return true;
+}
+
+HistoryStats History::get_stats() { return stats; }
+
+bool History::read_header(size_t index, uint32_t& sequence,
+                          HistorySample& sample) {
+  uint8_t header[SECTOR_HEADER_SIZE];
+  if (esp_partition_read(partition, index * SECTOR_SIZE, header,
+                         sizeof(header)) != ESP_OK ||
+      memcmp(header, SECTOR_MAGIC, sizeof(SECTOR_MAGIC)) != 0) {
+    return false;
+  }
+
+  sequence = read_u32(header + sizeof(SECTOR_MAGIC));
+  return history_decode_full(header + sizeof(SECTOR_MAGIC) + sizeof(uint32_t),
+                             sample);
+}
+
+void History::recover() {
+  // The newest sector is the one with the highest sequence number
+  bool found = false;
+  for (size_t i = 0; i < sector_count; i++) {
+    uint32_t header_sequence;
+    HistorySample header_sample;
+    if (read_header(i, header_sequence, header_sample) &&
+        (!found || header_sequence > sequence)) {
+      found = true;
+      sector = i;
+      sequence = header_sequence;
+      last_sample = header_sample;
+    }
+  }
+
+  if (!found) {
+    return;
+  }
+
+  // Replay its records to find the write position and the last sample
+  if (esp_partition_read(partition, sector * SECTOR_SIZE, sector_buffer,
+                         SECTOR_SIZE) != ESP_OK) {
+    return;
+  }
+  offset = SECTOR_HEADER_SIZE;
+  while (offset < SECTOR_SIZE && sector_buffer[offset] != 0xFF &&
+         history_decode_record(sector_buffer, SECTOR_SIZE, offset,
+                               last_sample)) {
+  }
+
+  // A record torn by a reset cannot be appended to, move on to a new sector
+  if (offset < SECTOR_SIZE && sector_buffer[offset] != 0xFF) {
+    offset = SECTOR_SIZE;
+  }
+  has_last_sample = true;
+}
+
+esp_err_t History::start_sector(const HistorySample& sample) {
+  size_t next = has_last_sample ? (sector + 1) % sector_count : sector;
+
+  esp_err_t err =
+      esp_partition_erase_range(partition, next * SECTOR_SIZE, SECTOR_SIZE);
+  if (err != ESP_OK) {
+    return err;
+  }
+  stats.sector_erases++;
+
+  uint8_t header[SECTOR_HEADER_SIZE];
+  memcpy(header, SECTOR_MAGIC, sizeof(SECTOR_MAGIC));
+  write_u32(header + sizeof(SECTOR_MAGIC), sequence + 1);
+  history_encode_full(sample, header + sizeof(SECTOR_MAGIC) + sizeof(uint32_t));
+
+  err = esp_partition_write(partition, next * SECTOR_SIZE, header,
+                            sizeof(header));
+  sector = next;
+  sequence++;
+  if (err != ESP_OK) {
+    // Leave the sector half written, the next sample moves on again
+    offset = SECTOR_SIZE;
+    has_last_sample = true;
+    return err;
+  }
+
+  offset = SECTOR_HEADER_SIZE;
+  last_sample = sample;
+  has_last_sample = true;
+  stats.samples++;
+  return ESP_OK;
+}
+
+bool History::next_sample(HistorySample& sample) {
+  while (query_sector_index < sector_count) {
+    size_t query_sector =
+        (query_first_sector + query_sector_index) % sector_count;
+
+    if (!is_query_sector_loaded) {
+      uint32_t header_sequence;
+      if (!read_header(query_sector, header_sequence, query_sample) ||
+          esp_partition_read(partition, query_sector * SECTOR_SIZE,
+                             sector_buffer, SECTOR_SIZE) != ESP_OK) {
+        query_sector_index++;
+        continue;
+      }
+      query_offset = SECTOR_HEADER_SIZE;
+      is_query_sector_loaded = true;
+      sample = query_sample;
+      return true;
+    }
+
+    if (query_offset < SECTOR_SIZE && sector_buffer[query_offset] != 0xFF &&
+        history_decode_record(sector_buffer, SECTOR_SIZE, query_offset,
+                              query_sample)) {
+      sample = query_sample;
+      return true;
+    }
+
+    is_query_sector_loaded = false;
+    query_sector_index++;
+  }
+
+  return false;
+}
@@ -0,0 +1,101 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Mode.hpp"
+#include "OperatingState.hpp"
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+
+struct HistorySample {
+  uint32_t timestamp;  // Unix time in seconds
+  int16_t temperature_x10;
+  uint16_t humidity_x10;
+  OperatingState operating_state;
+  Mode mode;
+  uint8_t target_temperature;
+  uint8_t fan_speed;
+};
+
+// Samples are stored as a full sample followed by delta records:
+//   full:   [timestamp:u32][temperature*10:i16][humidity*10:u16][state:u8]
+//           [target:u8][fan:u8][reserved:u8]
+//   record: [state:u8][dt:varint][dtemperature:zigzag varint]
+//           [dhumidity:zigzag varint][target:u8 fan:u8 if changed]
+// where state packs the operating state (bits 0-1), the mode (bits 2-3) and
+// whether target and fan follow (bit 4). Erased flash reads as 0xFF, which is
+// never a valid state byte.
+constexpr size_t HISTORY_FULL_SAMPLE_SIZE = 12;
+constexpr size_t HISTORY_MAX_RECORD_SIZE = 1 + 5 + 3 + 3 + 2;
+
+size_t history_encode_full(const HistorySample& sample, uint8_t* out);
+bool history_decode_full(const uint8_t* data, HistorySample& sample);
+size_t history_encode_record(const HistorySample& previous,
+                             const HistorySample& sample, uint8_t* out);
+// Applies the record at offset to sample and advances offset past it
+bool history_decode_record(const uint8_t* data, size_t size, size_t& offset,
+                           HistorySample& sample);
+
+struct HistoryStats {
+  uint32_t samples;
+  uint32_t sector_erases;
+  uint32_t write_errors;
+  uint32_t queries;
+};
+
+// Time series of samples in a dedicated flash partition. Each sector starts
+// with a header and a full sample, so sectors decode on their own. Sectors are
+// filled in turn and the oldest one is erased when the partition is full,
+// which spreads erases evenly over the partition.
+class History {
+ public:
+  History(const char* partition_label, const uint32_t interval_s);
+  esp_err_t init();
+
+  // Stores the sample unless the previous one is more recent than interval_s
+  void record(const HistorySample& sample);
+
+  // Queries are answered in chunks, each a full sample and delta records
+  esp_err_t start_query(const uint32_t from, const uint32_t to);
+  bool is_querying();
+  bool next_chunk(uint8_t* buffer, size_t size, size_t& length,
+                  bool& is_last);
+
+  HistoryStats get_stats();
+
+ private:
+  const char* partition_label;
+  const uint32_t interval_s;
+  const esp_partition_t* partition;
+  size_t sector_count;
+
+  // Write position
+  size_t sector;
+  uint32_t sequence;
+  size_t offset;
+  HistorySample last_sample;
+  bool has_last_sample;
+
+  // Query cursor, sectors are visited oldest first
+  bool is_query_active;
+  uint32_t query_from;
+  uint32_t query_to;
+  size_t query_first_sector;
+  size_t query_sector_index;
+  size_t query_offset;
+  bool is_query_sector_loaded;
+  HistorySample query_sample;
+  portMUX_TYPE query_lock;
+
+  HistoryStats stats;
+
+  bool read_header(size_t index, uint32_t& sequence, HistorySample& sample);
+  void recover();
+  esp_err_t start_sector(const HistorySample& sample);
+  bool next_sample(HistorySample& sample);
+};
+
+#endif
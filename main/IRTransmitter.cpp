@@ -2,6 +2,7 @@
 
 #include <cstring>
 
+#include "Timeline.hpp"
 #include "esp_rom_sys.h"
 
 constexpr const char* SIGNAL_KEY = "signal";
@@ -22,11 +23,26 @@ constexpr uint32_t ONE_SPACE = 1600;
 constexpr uint32_t END_PULSE = 560;
 constexpr uint32_t END_SPACE = 7450;
 
+// Share of pulses the loopback receiver has to see to confirm a frame
+constexpr uint32_t LOOPBACK_CONFIRM_PERCENT = 90;
+
 IRTransmitter::IRTransmitter(const int gpio_pin, const int pwm_channel,
-                             const int pwm_timer)
+                             const int pwm_timer,
+                             const IRRepeatPolicy repeat_policy,
+                             const int repeat_count,
+                             const int loopback_gpio_pin,
+                             const bool suppress_duplicates)
     : gpio(static_cast<gpio_num_t>(gpio_pin)),
       pwm_channel(static_cast<ledc_channel_t>(pwm_channel)),
-      pwm_timer(static_cast<ledc_timer_t>(pwm_timer)) {}
+      pwm_timer(static_cast<ledc_timer_t>(pwm_timer)),
+      repeat_policy(repeat_policy),
+      repeat_count(repeat_count),
+      loopback_gpio(static_cast<gpio_num_t>(loopback_gpio_pin)),
+      suppress_duplicates(suppress_duplicates),
+      last_signal{},
+      pulses_sent(0),
+      pulses_seen(0),
+      stats({}) {}
 
 esp_err_t IRTransmitter::init() {
   gpio_config_t config = {};
@@ -61,24 +77,80 @@ esp_err_t IRTransmitter::init() {
     return err;
   }
 
+  if (loopback_gpio >= 0) {
+    gpio_config_t loopback_config = {};
+    loopback_config.mode = GPIO_MODE_INPUT;
+    loopback_config.pull_up_en = GPIO_PULLUP_ENABLE;
+    loopback_config.pin_bit_mask = 1ULL << loopback_gpio;
+
+    err = gpio_config(&loopback_config);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+
   return ESP_OK;
 }
 
 esp_err_t IRTransmitter::transmit_ir_signal(const char* signal) {
-  // Send the IR signal twice to ensure reception
-  esp_err_t err;
-  for (size_t i = 0; i < 2; i++) {
-    err = send_signal(signal);
+  if (strlen(signal) > IR_MAX_SIGNAL_LENGTH) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if (suppress_duplicates && strcmp(signal, last_signal) == 0) {
+    stats.frames_suppressed++;
+    printf("Signal suppressed, matches last transmitted state\n");
+    return ESP_OK;
+  }
+
+  bool adaptive =
+      repeat_policy == IRRepeatPolicy::ADAPTIVE && loopback_gpio >= 0;
+  bool confirmed = false;
+  int copies = 0;
+  while (copies < repeat_count) {
+    pulses_sent = 0;
+    pulses_seen = 0;
+
+    timeline_begin(TimelineEvent::IR_FRAME, strlen(signal));
+    esp_err_t err = send_signal(signal);
+    timeline_end(TimelineEvent::IR_FRAME);
     if (err != ESP_OK) {
+      last_signal[0] = '\0';
       return err;
     }
+
+    stats.frames_sent++;
+    if (copies > 0) {
+      stats.frames_repeated++;
+    }
+    copies++;
+
+    // Stop as soon as the loopback receiver saw the whole frame
+    if (adaptive && is_confirmed()) {
+      confirmed = true;
+      break;
+    }
   }
 
-  printf("Signal transmitted: %s\n", signal);
+  // Only a state the unit is known to have received suppresses a retry
+  if (adaptive && !confirmed) {
+    stats.frames_unconfirmed++;
+    last_signal[0] = '\0';
+  } else {
+    strcpy(last_signal, signal);
+  }
+  printf("Signal transmitted (%d copies): %s\n", copies, signal);
 
   return ESP_OK;
 }
 
+IRStats IRTransmitter::get_stats() { return stats; }
+
+bool IRTransmitter::is_confirmed() {
+  return pulses_sent > 0 &&
+         pulses_seen * 100 >= pulses_sent * LOOPBACK_CONFIRM_PERCENT;
+}
+
 esp_err_t IRTransmitter::send_signal(const char* signal) {
   esp_err_t err;
 
@@ -118,6 +190,14 @@ esp_err_t IRTransmitter::send_pulse(uint32_t duration_us) {
 
   esp_rom_delay_us(duration_us);
 
+  // A demodulating receiver pulls its output low while it sees the carrier
+  if (loopback_gpio >= 0) {
+    pulses_sent++;
+    if (gpio_get_level(loopback_gpio) == 0) {
+      pulses_seen++;
+    }
+  }
+
   err = ledc_set_duty(PWM_SPEED_MODE, pwm_channel, PWM_DUTY_OFF);
   if (err != ESP_OK) {
     return err;
@@ -6,17 +6,42 @@
 #include "driver/gpio.h"
 #include "driver/ledc.h"
 
+constexpr size_t IR_MAX_SIGNAL_LENGTH = 128;
+
+enum class IRRepeatPolicy { FIXED, ADAPTIVE };
+
+struct IRStats {
+  uint32_t frames_sent;
+  uint32_t frames_suppressed;
+  uint32_t frames_repeated;
+  uint32_t frames_unconfirmed;
+};
+
 class IRTransmitter {
  public:
-  IRTransmitter(const int gpio_pin, const int pwm_channel, const int pwm_timer);
+  IRTransmitter(const int gpio_pin, const int pwm_channel, const int pwm_timer,
+                const IRRepeatPolicy repeat_policy, const int repeat_count,
+                const int loopback_gpio_pin, const bool suppress_duplicates);
   esp_err_t init();
 
   esp_err_t transmit_ir_signal(const char* signal);
 
+  IRStats get_stats();
+
  private:
   const gpio_num_t gpio;
   const ledc_channel_t pwm_channel;
   const ledc_timer_t pwm_timer;
+  const IRRepeatPolicy repeat_policy;
+  const int repeat_count;
+  const gpio_num_t loopback_gpio;
+  const bool suppress_duplicates;
+  char last_signal[IR_MAX_SIGNAL_LENGTH + 1];
+  uint32_t pulses_sent;
+  uint32_t pulses_seen;
+  IRStats stats;
+
+  bool is_confirmed();
 
   esp_err_t send_signal(const char* signal);
   esp_err_t send_pulse(uint32_t duration_us);
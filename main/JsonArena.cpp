@@ -0,0 +1,73 @@
+#include "JsonArena.hpp"
+
+#include "cJSON.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_STATIC_MEMORY_MODE
+
+constexpr size_t ARENA_SIZE = CONFIG_STATIC_MEMORY_JSON_ARENA_SIZE;
+constexpr size_t ARENA_ALIGNMENT = 8;
+
+static uint8_t arena[ARENA_SIZE] __attribute__((aligned(ARENA_ALIGNMENT)));
+static size_t arena_offset = 0;
+static size_t live_allocations = 0;
+static JsonArenaStats stats = {};
+static portMUX_TYPE arena_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void* arena_malloc(size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+  void* ptr = nullptr;
+  portENTER_CRITICAL(&arena_lock);
+  if (arena_offset + size <= ARENA_SIZE) {
+    ptr = &arena[arena_offset];
+    arena_offset += size;
+    live_allocations++;
+    if (arena_offset > stats.high_water) {
+      stats.high_water = arena_offset;
+    }
+  } else {
+    stats.overflows++;
+  }
+  portEXIT_CRITICAL(&arena_lock);
+
+  // cJSON treats a failed allocation as a parse error
+  return ptr;
+}
+
+static void arena_free(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+
+  portENTER_CRITICAL(&arena_lock);
+  if (live_allocations > 0 && --live_allocations == 0) {
+    arena_offset = 0;
+  }
+  portEXIT_CRITICAL(&arena_lock);
+}
+
+esp_err_t json_arena_init() {
+  cJSON_Hooks hooks = {};
+  hooks.malloc_fn = &arena_malloc;
+  hooks.free_fn = &arena_free;
+  cJSON_InitHooks(&hooks);
+
+  return ESP_OK;
+}
+
+JsonArenaStats json_arena_get_stats() {
+  portENTER_CRITICAL(&arena_lock);
+  JsonArenaStats result = stats;
+  portEXIT_CRITICAL(&arena_lock);
+  return result;
+}
+
+#else
+
+esp_err_t json_arena_init() { return ESP_OK; }
+
+JsonArenaStats json_arena_get_stats() { return JsonArenaStats{}; }
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef JSON_ARENA_HPP
+#define JSON_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_err.h"
+
+struct JsonArenaStats {
+  size_t high_water;
+  uint32_t overflows;
+};
+
+// Routes cJSON allocations into a static bump arena when static memory mode
+// is enabled. The arena rewinds once every parsed tree has been deleted, so
+// handlers must not keep cJSON objects alive between messages.
+esp_err_t json_arena_init();
+JsonArenaStats json_arena_get_stats();
+
+#endif
@@ -0,0 +1,247 @@
+#include "LocalControl.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "TimeServer.hpp"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "mbedtls/constant_time.h"
+#include "mbedtls/md.h"
+#include "nvs_flash.h"
+
+constexpr uint32_t SERVER_TASK_STACK_SIZE = 4096;
+constexpr UBaseType_t SERVER_TASK_PRIORITY = 5;
+
+constexpr const char* NVS_NAMESPACE = "local_ctl";
+// Every nonce up to the stored one counts as used, see reserve_nonces()
+constexpr const char* NONCE_MARK_NVS_KEY = "last_nonce";
+
+// Requests and responses share the key and the layout, the MAC covers the
+// direction so a response cannot be sent back as a request
+constexpr const char* REQUEST_MAC_TAG = "heatpump-local-control-request";
+constexpr const char* RESPONSE_MAC_TAG = "heatpump-local-control-response";
+
+static uint64_t read_nonce(const uint8_t* data) {
+  uint64_t nonce = 0;
+  for (size_t i = 0; i < LOCAL_CONTROL_NONCE_SIZE; i++) {
+    nonce = (nonce << 8) | data[i];
+  }
+  return nonce;
+}
+
+LocalControlServer::LocalControlServer(const uint16_t port, const char* secret,
+                                       const uint32_t nonce_window_ms,
+                                       LocalControlHandler handler)
+    : port(port),
+      secret(secret),
+      nonce_window_ms(nonce_window_ms),
+      handler(handler),
+      socket_fd(-1),
+      last_nonce(0),
+      nonce_mark(0),
+      buffer{},
+      stats({}) {}
+
+esp_err_t LocalControlServer::init() {
+  // Never accept unauthenticated commands
+  if (strlen(secret) == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // Nonces accepted before a reboot must stay rejected, also while the clock
+  // is not set
+  nvs_handle_t nvs_storage;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = nvs_get_u64(nvs_storage, NONCE_MARK_NVS_KEY, &nonce_mark);
+  nvs_close(nvs_storage);
+  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+    return err;
+  }
+  last_nonce = nonce_mark;
+
+  socket_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (socket_fd < 0) {
+    return ESP_FAIL;
+  }
+
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (bind(socket_fd, reinterpret_cast<struct sockaddr*>(&address),
+           sizeof(address)) < 0) {
+    close(socket_fd);
+    socket_fd = -1;
+    return ESP_FAIL;
+  }
+
+  BaseType_t result =
+      xTaskCreate(&LocalControlServer::server_task, "local_ctl",
+                  SERVER_TASK_STACK_SIZE, this, SERVER_TASK_PRIORITY, nullptr);
+  if (result != pdPASS) {
+    close(socket_fd);
+    socket_fd = -1;
+    return ESP_ERR_NO_MEM;
+  }
+
+  return ESP_OK;
+}
+
+LocalControlStats LocalControlServer::get_stats() { return stats; }
+
+void LocalControlServer::server_task(void* arg) {
+  static_cast<LocalControlServer*>(arg)->serve();
+}
+
+void LocalControlServer::serve() {
+  while (true) {
+    struct sockaddr_storage source;
+    socklen_t source_length = sizeof(source);
+    int length = recvfrom(socket_fd, buffer, sizeof(buffer) - 1, 0,
+                          reinterpret_cast<struct sockaddr*>(&source),
+                          &source_length);
+    if (length < 0) {
+      printf("Error receiving local control request: errno %d\n", errno);
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+
+    int64_t received_at = esp_timer_get_time();
+
+    // Unauthenticated requests get no response, so the endpoint cannot be
+    // used to probe for the secret or to reflect traffic
+    if (static_cast<size_t>(length) < LOCAL_CONTROL_HEADER_SIZE ||
+        !is_authentic(buffer, length)) {
+      stats.rejected++;
+      continue;
+    }
+
+    uint64_t nonce = read_nonce(buffer + LOCAL_CONTROL_MAC_SIZE);
+    if (!is_fresh(nonce)) {
+      stats.rejected++;
+      continue;
+    }
+    // Reserved before the command runs, a request that cannot be recorded
+    // is not executed. Most requests fall below the mark and cost no NVS
+    // commit.
+    if (nonce > nonce_mark &&
+        reserve_nonces(nonce + nonce_window_ms) != ESP_OK) {
+      printf("Error storing local control nonce\n");
+      stats.failed++;
+      continue;
+    }
+    last_nonce = nonce;
+
+    buffer[length] = '\0';
+    esp_err_t err =
+        handler(reinterpret_cast<char*>(buffer + LOCAL_CONTROL_HEADER_SIZE));
+    stats.requests++;
+    if (err != ESP_OK) {
+      stats.failed++;
+    }
+
+    // The response echoes the nonce and carries the result
+    char* payload = reinterpret_cast<char*>(buffer + LOCAL_CONTROL_HEADER_SIZE);
+    size_t payload_size = sizeof(buffer) - LOCAL_CONTROL_HEADER_SIZE;
+    int written =
+        err == ESP_OK
+            ? snprintf(payload, payload_size, "{\"status\":\"ok\"}")
+            : snprintf(payload, payload_size,
+                       "{\"status\":\"error\",\"error\":\"%s\"}",
+                       esp_err_to_name(err));
+    size_t response_length = LOCAL_CONTROL_HEADER_SIZE + written;
+
+    if (sign(buffer, response_length) == ESP_OK) {
+      sendto(socket_fd, buffer, response_length, 0,
+             reinterpret_cast<struct sockaddr*>(&source), source_length);
+    }
+
+    uint32_t latency_us =
+        static_cast<uint32_t>(esp_timer_get_time() - received_at);
+    stats.last_latency_us = latency_us;
+    if (latency_us > stats.max_latency_us) {
+      stats.max_latency_us = latency_us;
+    }
+  }
+}
+
+bool LocalControlServer::is_authentic(const uint8_t* packet, size_t length) {
+  uint8_t mac[LOCAL_CONTROL_MAC_SIZE];
+  if (compute_mac(REQUEST_MAC_TAG, packet, length, mac) != ESP_OK) {
+    return false;
+  }
+
+  return mbedtls_ct_memcmp(mac, packet, LOCAL_CONTROL_MAC_SIZE) == 0;
+}
+
+bool LocalControlServer::is_fresh(uint64_t nonce) {
+  if (nonce <= last_nonce) {
+    return false;
+  }
+
+  if (!TimeServer::is_synced()) {
+    return true;
+  }
+
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  int64_t now_ms = static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+  int64_t skew_ms = static_cast<int64_t>(nonce) - now_ms;
+  return skew_ms < nonce_window_ms && -skew_ms < nonce_window_ms;
+}
+
+esp_err_t LocalControlServer::sign(uint8_t* packet, size_t length) {
+  return compute_mac(RESPONSE_MAC_TAG, packet, length, packet);
+}
+
+esp_err_t LocalControlServer::compute_mac(const char* tag,
+                                          const uint8_t* packet, size_t length,
+                                          uint8_t* mac) {
+  mbedtls_md_context_t context;
+  mbedtls_md_init(&context);
+  int err = mbedtls_md_setup(
+      &context, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+  if (err == 0) {
+    err = mbedtls_md_hmac_starts(
+        &context, reinterpret_cast<const uint8_t*>(secret), strlen(secret));
+  }
+  if (err == 0) {
+    err = mbedtls_md_hmac_update(
+        &context, reinterpret_cast<const uint8_t*>(tag), strlen(tag));
+  }
+  if (err == 0) {
+    err = mbedtls_md_hmac_update(&context, packet + LOCAL_CONTROL_MAC_SIZE,
+                                 length - LOCAL_CONTROL_MAC_SIZE);
+  }
+  if (err == 0) {
+    err = mbedtls_md_hmac_finish(&context, mac);
+  }
+  mbedtls_md_free(&context);
+  return err == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t LocalControlServer::reserve_nonces(uint64_t mark) {
+  nvs_handle_t nvs_storage;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  err = nvs_set_u64(nvs_storage, NONCE_MARK_NVS_KEY, mark);
+  if (err == ESP_OK) {
+    err = nvs_commit(nvs_storage);
+  }
+  nvs_close(nvs_storage);
+
+  if (err == ESP_OK) {
+    nonce_mark = mark;
+  }
+  return err;
+}
@@ -0,0 +1,68 @@
+#ifndef LOCAL_CONTROL_HPP
+#define LOCAL_CONTROL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "MQTTManager.hpp"
+#include "esp_err.h"
+
+constexpr size_t LOCAL_CONTROL_MAC_SIZE = 32;
+constexpr size_t LOCAL_CONTROL_NONCE_SIZE = 8;
+constexpr size_t LOCAL_CONTROL_HEADER_SIZE =
+    LOCAL_CONTROL_MAC_SIZE + LOCAL_CONTROL_NONCE_SIZE;
+
+// Returns ESP_OK once the command has been accepted
+typedef esp_err_t (*LocalControlHandler)(const char* message);
+
+struct LocalControlStats {
+  uint32_t requests;
+  uint32_t rejected;
+  uint32_t failed;
+  uint32_t last_latency_us;
+  uint32_t max_latency_us;
+};
+
+// Accepts target-state commands over UDP on the local network, so the units
+// stay controllable while the broker is unreachable.
+//
+// Requests and responses share one layout:
+//   [mac:32][nonce:u64 big endian][JSON payload]
+// where mac is HMAC-SHA256 with the shared secret over a direction tag, the
+// nonce and the payload. Clients use their wall-clock time in ms as nonce. A
+// nonce must be larger than the last accepted one and, once the device clock
+// is set, close to the device time, so captured requests cannot be replayed.
+// To survive a reboot without an NVS commit per request, nonces are reserved
+// in blocks of nonce_window_ms: the end of the block is stored when a request
+// crosses it, and after a reboot everything up to it counts as used.
+class LocalControlServer {
+ public:
+  LocalControlServer(const uint16_t port, const char* secret,
+                     const uint32_t nonce_window_ms,
+                     LocalControlHandler handler);
+  esp_err_t init();
+
+  LocalControlStats get_stats();
+
+ private:
+  const uint16_t port;
+  const char* secret;
+  const uint32_t nonce_window_ms;
+  LocalControlHandler handler;
+  int socket_fd;
+  uint64_t last_nonce;
+  uint64_t nonce_mark;
+  uint8_t buffer[LOCAL_CONTROL_HEADER_SIZE + MQTT_MAX_MESSAGE_SIZE + 1];
+  LocalControlStats stats;
+
+  static void server_task(void* arg);
+  void serve();
+  bool is_authentic(const uint8_t* packet, size_t length);
+  bool is_fresh(uint64_t nonce);
+  esp_err_t sign(uint8_t* packet, size_t length);
+  esp_err_t compute_mac(const char* tag, const uint8_t* packet, size_t length,
+                        uint8_t* mac);
+  esp_err_t reserve_nonces(uint64_t mark);
+};
+
+#endif
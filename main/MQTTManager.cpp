@@ -1,26 +1,86 @@
 #include "MQTTManager.hpp"
 
-#include <string>
+#include <cstring>
+
+#include "Timeline.hpp"
+#include "esp_crt_bundle.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+// The outbox reports expired messages with MQTT_EVENT_DELETED (with
+// CONFIG_MQTT_REPORT_DELETED_MESSAGES), this only catches messages dropped
+// without an event, e.g. on a full outbox
+constexpr int64_t PUBLISH_ACK_TIMEOUT_US = 120 * 1000 * 1000;
+
+// Embedded from main/certs, see CMakeLists.txt
+#ifdef CONFIG_MQTT_TLS_PINNED_CA
+extern const char mqtt_ca_pem_start[] asm("_binary_mqtt_ca_pem_start");
+#endif
+#ifdef CONFIG_MQTT_TLS_CLIENT_CERT
+extern const char mqtt_client_crt_start[] asm(
+    "_binary_mqtt_client_crt_start");
+extern const char mqtt_client_key_start[] asm(
+    "_binary_mqtt_client_key_start");
+#endif
 
 MQTTManager::MQTTManager(const char* broker_uri, const char* client_id,
-                         const int qos, const int retention_policy)
+                         const int qos, const int retention_policy,
+                         const int reconnect_timeout_ms,
+                         const int outbox_limit_bytes)
     : broker_uri(broker_uri),
       client_id(client_id),
       qos(qos),
       retention_policy(retention_policy),
+      reconnect_timeout_ms(reconnect_timeout_ms),
+      outbox_limit_bytes(outbox_limit_bytes),
+      is_started(false),
       is_connected(false),
-      client(nullptr) {}
+      client(nullptr),
+      pending_subscriptions(0),
+      disconnected_at(0),
+      connect_started_at(0),
+      early_acks(),
+      next_early_ack(0),
+      lock(portMUX_INITIALIZER_UNLOCKED),
+      stats({}) {}
 
 esp_err_t MQTTManager::init() {
   esp_mqtt_client_config_t cfg = {};
   cfg.broker.address.uri = broker_uri;
   cfg.credentials.client_id = client_id;
+  cfg.network.reconnect_timeout_ms = reconnect_timeout_ms;
+  cfg.outbox.limit = outbox_limit_bytes;
+
+#ifdef CONFIG_MQTT_PERSISTENT_SESSION
+  // Let the broker keep our subscriptions and queued messages across short
+  // outages, so a reconnect does not need to subscribe again
+  cfg.session.disable_clean_session = true;
+#endif
+
+  // TLS settings only apply to mqtts:// and wss:// URLs. Embedded PEM data is
+  // null-terminated, so no lengths are needed.
+#ifdef CONFIG_MQTT_TLS_PINNED_CA
+  cfg.broker.verification.certificate = mqtt_ca_pem_start;
+#else
+  cfg.broker.verification.crt_bundle_attach = esp_crt_bundle_attach;
+#endif
+#ifdef CONFIG_MQTT_TLS_CLIENT_CERT
+  cfg.credentials.authentication.certificate = mqtt_client_crt_start;
+  cfg.credentials.authentication.key = mqtt_client_key_start;
+#endif
 
   client = esp_mqtt_client_init(&cfg);
 
   // Register event handlers for MQTT events
-  esp_err_t err = esp_mqtt_client_register_event(
-      client, MQTT_EVENT_CONNECTED, &MQTTManager::mqtt_event_handler, this);
+  esp_err_t err =
+      esp_mqtt_client_register_event(client, MQTT_EVENT_BEFORE_CONNECT,
+                                     &MQTTManager::mqtt_event_handler, this);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  err = esp_mqtt_client_register_event(client, MQTT_EVENT_CONNECTED,
+                                       &MQTTManager::mqtt_event_handler, this);
   if (err != ESP_OK) {
     return err;
   }
@@ -31,12 +91,36 @@ esp_err_t MQTTManager::init() {
     return err;
   }
 
+  err = esp_mqtt_client_register_event(client, MQTT_EVENT_SUBSCRIBED,
+                                       &MQTTManager::mqtt_event_handler, this);
+  if (err != ESP_OK) {
+    return err;
+  }
+
   err = esp_mqtt_client_register_event(client, MQTT_EVENT_DATA,
                                        &MQTTManager::mqtt_event_handler, this);
   if (err != ESP_OK) {
     return err;
   }
 
+  err = esp_mqtt_client_register_event(client, MQTT_EVENT_PUBLISHED,
+                                       &MQTTManager::mqtt_event_handler, this);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  err = esp_mqtt_client_register_event(client, MQTT_EVENT_DELETED,
+                                       &MQTTManager::mqtt_event_handler, this);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  err = esp_mqtt_client_register_event(client, MQTT_EVENT_ERROR,
+                                       &MQTTManager::mqtt_event_handler, this);
+  if (err != ESP_OK) {
+    return err;
+  }
+
   return ESP_OK;
 }
 
@@ -45,11 +129,23 @@ esp_err_t MQTTManager::start() {
     return ESP_ERR_INVALID_STATE;
   }
 
+  // The client reconnects on its own once started, we only nudge it to skip
+  // the remaining reconnect timeout when the network comes back. The nudge
+  // fails unless the client is waiting to reconnect, e.g. while its own
+  // connect is still in progress, which is fine.
+  if (is_started) {
+    if (!is_connected) {
+      esp_mqtt_client_reconnect(client);
+    }
+    return ESP_OK;
+  }
+
   esp_err_t err = esp_mqtt_client_start(client);
   if (err != ESP_OK) {
     return err;
   }
 
+  is_started = true;
   return ESP_OK;
 }
 
@@ -63,71 +159,400 @@ esp_err_t MQTTManager::stop() {
     return err;
   }
 
+  // No disconnect event follows, so the outage is counted from here
+  if (is_connected) {
+    disconnected_at = esp_timer_get_time();
+  }
+  is_started = false;
+  is_connected = false;
   return ESP_OK;
 }
 
-void MQTTManager::publish(const char* topic, const char* message) {
-  // We do not retain messages, so ignore if the client is not connected
-  if (!is_connected) {
-    return;
+esp_err_t MQTTManager::set_broker_uri(const char* uri) {
+  if (client == nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  return esp_mqtt_client_set_uri(client, uri);
+}
+
+void MQTTManager::set_topic_options(const char* topic, const int qos,
+                                    const bool retain) {
+  TopicOptions options = {topic, qos, retain};
+  if (!topic_options.push_back(options)) {
+    printf("Error setting options for topic %s: table is full\n", topic);
+  }
+}
+
+int MQTTManager::publish(const char* topic, const char* message) {
+  return publish(topic, message, nullptr);
+}
+
+int MQTTManager::publish(const char* topic, const char* message,
+                         PublishCallback callback) {
+  TopicOptions options = find_topic_options(topic);
+
+  // QoS 0 messages are not kept in the outbox, so ignore them if the client is
+  // not connected. QoS>0 messages are queued up to the configured outbox limit
+  // and delivered once the session is resumed.
+  if (!is_connected && options.qos == 0) {
+    return -1;
   }
 
-  int msg_id =
-      esp_mqtt_client_publish(client, topic, message, 0, qos, retention_policy);
+  // Must not hold lock around the publish, the MQTT task takes the client
+  // lock before it handles acks
+  size_t message_length = strlen(message);
+  int64_t sent_at = esp_timer_get_time();
+  timeline_begin(TimelineEvent::MQTT_PUBLISH,
+                 static_cast<int32_t>(message_length));
+  int msg_id = esp_mqtt_client_publish(client, topic, message, 0, options.qos,
+                                       options.retain);
+  timeline_end(TimelineEvent::MQTT_PUBLISH);
 
   if (msg_id < 0) {
+    portENTER_CRITICAL(&lock);
+    stats.publish_failures++;
+    portEXIT_CRITICAL(&lock);
     printf("Error publishing message to topic %s\n", topic);
-    return;
+    return -1;
   }
+
+  portENTER_CRITICAL(&lock);
+  stats.messages_published++;
+  stats.bytes_published += strlen(topic) + message_length;
+  portEXIT_CRITICAL(&lock);
+
+  if (options.qos > 0) {
+    track_publish(msg_id, sent_at, callback);
+  }
+  return msg_id;
 }
 
 void MQTTManager::subscribe(const char* topic, Handler handler) {
   Subscription subscription = {topic, handler};
-  subscriptions.push_back(subscription);
+  if (!subscriptions.push_back(subscription)) {
+    printf("Error subscribing to topic %s: subscription table is full\n",
+           topic);
+    return;
+  }
   printf("Subscribed to topic %s\n", topic);
 }
 
+void MQTTManager::on_connect(ConnectCallback callback) {
+  if (!callbacks_on_connect.push_back(callback)) {
+    printf("Error registering MQTT connect callback: table is full\n");
+  }
+}
+
+bool MQTTManager::is_ready() {
+  return is_connected && pending_subscriptions == 0;
+}
+
+MQTTStats MQTTManager::get_stats() {
+  int outbox_size = client != nullptr ? esp_mqtt_client_get_outbox_size(client)
+                                      : 0;
+
+  portENTER_CRITICAL(&lock);
+  stats.publishes_pending = pending_publishes.size();
+  stats.outbox_bytes = outbox_size > 0 ? outbox_size : 0;
+  MQTTStats current = stats;
+  portEXIT_CRITICAL(&lock);
+  return current;
+}
+
 void MQTTManager::mqtt_event_handler(void* arg, esp_event_base_t base,
                                      int32_t event_id, void* data) {
   auto* self = static_cast<MQTTManager*>(arg);
 
   switch (event_id) {
+    case MQTT_EVENT_BEFORE_CONNECT:
+      self->handle_before_connect();
+      break;
     case MQTT_EVENT_CONNECTED:
-      self->handle_connected();
+      self->handle_connected(static_cast<esp_mqtt_event_handle_t>(data));
       break;
     case MQTT_EVENT_DISCONNECTED:
       self->handle_disconnected();
       break;
+    case MQTT_EVENT_SUBSCRIBED:
+      self->handle_subscribed();
+      break;
     case MQTT_EVENT_DATA:
       self->handle_message(static_cast<esp_mqtt_event_handle_t>(data));
       break;
+    case MQTT_EVENT_PUBLISHED:
+      self->handle_publish_done(static_cast<esp_mqtt_event_handle_t>(data),
+                                true);
+      break;
+    case MQTT_EVENT_DELETED:
+      self->handle_publish_done(static_cast<esp_mqtt_event_handle_t>(data),
+                                false);
+      break;
+    case MQTT_EVENT_ERROR:
+      self->handle_error(static_cast<esp_mqtt_event_handle_t>(data));
+      break;
   }
 }
 
-void MQTTManager::handle_connected() {
-  printf("MQTT client %s connected\n", client_id);
+void MQTTManager::handle_before_connect() {
+  connect_started_at = esp_timer_get_time();
+}
+
+void MQTTManager::handle_connected(esp_mqtt_event_handle_t event) {
+  uint32_t connect_ms = static_cast<uint32_t>(
+      (esp_timer_get_time() - connect_started_at) / 1000);
+  portENTER_CRITICAL(&lock);
+  stats.connects++;
+  stats.last_connect_ms = connect_ms;
+  if (connect_ms > stats.max_connect_ms) {
+    stats.max_connect_ms = connect_ms;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  timeline_instant(TimelineEvent::MQTT_CONNECTED, event->session_present);
+  printf("MQTT client %s connected in %lu ms (session present: %d)\n",
+         client_id, static_cast<unsigned long>(connect_ms),
+         event->session_present);
   is_connected = true;
 
+  for (const auto& callback : callbacks_on_connect) {
+    callback();
+  }
+
+  // The broker still has our subscriptions, nothing to restore
+  if (event->session_present) {
+    portENTER_CRITICAL(&lock);
+    stats.session_resumes++;
+    portEXIT_CRITICAL(&lock);
+    pending_subscriptions = 0;
+    record_recovery();
+    return;
+  }
+
+  pending_subscriptions = 0;
   for (const auto& subscription : subscriptions) {
-    esp_mqtt_client_subscribe(client, subscription.topic, qos);
+    if (esp_mqtt_client_subscribe(client, subscription.topic, qos) >= 0) {
+      pending_subscriptions++;
+    }
+  }
+
+  if (pending_subscriptions == 0) {
+    record_recovery();
   }
 }
 
 void MQTTManager::handle_disconnected() {
+  timeline_instant(TimelineEvent::MQTT_DISCONNECTED);
   printf("MQTT client %s disconnected\n", client_id);
+
+  if (is_connected) {
+    disconnected_at = esp_timer_get_time();
+  }
   is_connected = false;
 }
 
+void MQTTManager::handle_subscribed() {
+  if (pending_subscriptions == 0) {
+    return;
+  }
+
+  pending_subscriptions--;
+  if (pending_subscriptions == 0) {
+    record_recovery();
+  }
+}
+
 void MQTTManager::handle_message(esp_mqtt_event_handle_t event) {
-  std::string topic(event->topic, event->topic_len);
-  std::string message(event->data, event->data_len);
+  TimelineScope scope(TimelineEvent::MQTT_MESSAGE, event->data_len);
+  portENTER_CRITICAL(&lock);
+  stats.messages_received++;
+  stats.bytes_received += event->topic_len + event->data_len;
+  portEXIT_CRITICAL(&lock);
+
+  // Messages are copied into a fixed buffer to null-terminate them, messages
+  // that do not fit (or arrive fragmented) are dropped
+  if (event->data_len > static_cast<int>(MQTT_MAX_MESSAGE_SIZE) ||
+      event->total_data_len > event->data_len) {
+    printf("Error: message on topic %.*s is too large (%d bytes)\n",
+           event->topic_len, event->topic, event->total_data_len);
+    return;
+  }
+
+  memcpy(message_buffer, event->data, event->data_len);
+  message_buffer[event->data_len] = '\0';
 
   for (const auto& subscription : subscriptions) {
-    if (strcmp(subscription.topic, topic.c_str()) == 0) {
-      subscription.handler(message.c_str());
+    if (strncmp(subscription.topic, event->topic, event->topic_len) == 0 &&
+        subscription.topic[event->topic_len] == '\0') {
+      subscription.handler(message_buffer);
       return;
     }
   }
 
-  printf("Error: no handler for topic: %s\n", topic.c_str());
+  printf("Error: no handler for topic: %.*s\n", event->topic_len,
+         event->topic);
+}
+
+void MQTTManager::handle_error(esp_mqtt_event_handle_t event) {
+  // Errors while connected are reported again as a disconnect
+  if (is_connected || event->error_handle == nullptr) {
+    return;
+  }
+
+  const esp_mqtt_error_codes_t* error = event->error_handle;
+  portENTER_CRITICAL(&lock);
+  stats.connect_failures++;
+  portEXIT_CRITICAL(&lock);
+  if (error->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
+    printf("MQTT connect failed: %s (TLS stack error 0x%x, errno %d)\n",
+           esp_err_to_name(error->esp_tls_last_esp_err),
+           error->esp_tls_stack_err, error->esp_transport_sock_errno);
+  } else if (error->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+    printf("MQTT connect refused by broker: %d\n",
+           error->connect_return_code);
+  }
+}
+
+void MQTTManager::handle_publish_done(esp_mqtt_event_handle_t event,
+                                      bool delivered) {
+  PublishCallback callback = nullptr;
+  bool is_tracked = false;
+  int64_t now = esp_timer_get_time();
+  timeline_instant(TimelineEvent::MQTT_ACK,
+                   delivered ? event->msg_id : -event->msg_id);
+
+  portENTER_CRITICAL(&lock);
+  for (size_t i = 0; i < pending_publishes.size(); i++) {
+    if (pending_publishes[i].msg_id == event->msg_id) {
+      callback = pending_publishes[i].callback;
+      if (delivered) {
+        record_ack(pending_publishes[i].sent_at, now);
+      }
+      pending_publishes.erase(i);
+      is_tracked = true;
+      break;
+    }
+  }
+  // Acked before publish() returned, track_publish() completes it
+  if (!is_tracked && delivered) {
+    early_acks[next_early_ack] = {event->msg_id, now};
+    next_early_ack = (next_early_ack + 1) % MQTT_EARLY_ACKS;
+  }
+  // Messages that already expired in track_publish() were counted there
+  if (is_tracked && !delivered) {
+    stats.publishes_expired++;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  if (!delivered) {
+    printf("MQTT message %d expired from the outbox\n", event->msg_id);
+  }
+
+  if (callback != nullptr) {
+    callback(event->msg_id, delivered);
+  }
+}
+
+TopicOptions MQTTManager::find_topic_options(const char* topic) {
+  for (const auto& options : topic_options) {
+    if (strcmp(options.topic, topic) == 0) {
+      return options;
+    }
+  }
+  return {topic, qos, retention_policy != 0};
+}
+
+void MQTTManager::track_publish(int msg_id, int64_t sent_at,
+                                PublishCallback callback) {
+  // Makes room for the new message
+  expire_stale_publishes();
+
+  bool is_acked = false;
+  bool is_tracked = true;
+
+  portENTER_CRITICAL(&lock);
+  for (size_t i = 0; i < MQTT_EARLY_ACKS; i++) {
+    if (early_acks[i].msg_id == msg_id) {
+      early_acks[i].msg_id = 0;
+      record_ack(sent_at, early_acks[i].acked_at);
+      is_acked = true;
+      break;
+    }
+  }
+
+  if (!is_acked) {
+    PendingPublish pending = {msg_id, sent_at, callback};
+    is_tracked = pending_publishes.push_back(pending);
+  }
+
+  // Delivery of untracked messages is never reported
+  if (!is_tracked) {
+    stats.publishes_untracked++;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  if (is_acked && callback != nullptr) {
+    callback(msg_id, true);
+  }
+}
+
+void MQTTManager::expire_stale_publishes() {
+  int64_t now = esp_timer_get_time();
+  PublishCallback expired[MQTT_MAX_PENDING_PUBLISHES];
+  int expired_ids[MQTT_MAX_PENDING_PUBLISHES];
+  size_t expired_count = 0;
+
+  portENTER_CRITICAL(&lock);
+  for (size_t i = 0; i < pending_publishes.size();) {
+    if (now - pending_publishes[i].sent_at < PUBLISH_ACK_TIMEOUT_US) {
+      i++;
+      continue;
+    }
+    expired[expired_count] = pending_publishes[i].callback;
+    expired_ids[expired_count] = pending_publishes[i].msg_id;
+    expired_count++;
+    pending_publishes.erase(i);
+  }
+  stats.publishes_expired += expired_count;
+  portEXIT_CRITICAL(&lock);
+
+  for (size_t i = 0; i < expired_count; i++) {
+    if (expired[i] != nullptr) {
+      expired[i](expired_ids[i], false);
+    }
+  }
+}
+
+// Called with lock held
+void MQTTManager::record_ack(int64_t sent_at, int64_t acked_at) {
+  uint32_t ack_ms = static_cast<uint32_t>((acked_at - sent_at) / 1000);
+  stats.publishes_acked++;
+  stats.last_ack_ms = ack_ms;
+  if (ack_ms > stats.max_ack_ms) {
+    stats.max_ack_ms = ack_ms;
+  }
+}
+
+void MQTTManager::record_recovery() {
+  // First connection after boot is not a reconnect
+  if (disconnected_at == 0) {
+    return;
+  }
+
+  uint32_t duration_ms =
+      static_cast<uint32_t>((esp_timer_get_time() - disconnected_at) / 1000);
+  disconnected_at = 0;
+
+  portENTER_CRITICAL(&lock);
+  stats.reconnects++;
+  stats.last_resubscribe_ms = duration_ms;
+  if (duration_ms > stats.max_resubscribe_ms) {
+    stats.max_resubscribe_ms = duration_ms;
+  }
+  uint32_t reconnects = stats.reconnects;
+  portEXIT_CRITICAL(&lock);
+
+  printf("MQTT client %s recovered in %lu ms (reconnects: %lu)\n", client_id,
+         static_cast<unsigned long>(duration_ms),
+         static_cast<unsigned long>(reconnects));
 }
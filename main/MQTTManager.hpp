@@ -2,45 +2,152 @@
 #define MQTT_MANAGER_HPP
 
 #include <cstdint>
-#include <vector>
 
+#include "FixedVector.hpp"
 #include "esp_event.h"
+#include "freertos/FreeRTOS.h"
 #include "mqtt_client.h"
+#include "sdkconfig.h"
+
+constexpr size_t MQTT_MAX_SUBSCRIPTIONS = CONFIG_MQTT_MAX_SUBSCRIPTIONS;
+constexpr size_t MQTT_MAX_MESSAGE_SIZE = CONFIG_MQTT_MAX_MESSAGE_SIZE;
+constexpr size_t MQTT_MAX_CONNECT_CALLBACKS = 4;
+constexpr size_t MQTT_MAX_TOPIC_OPTIONS = 8;
+constexpr size_t MQTT_MAX_PENDING_PUBLISHES = 16;
+constexpr size_t MQTT_EARLY_ACKS = 4;
 
 typedef void (*Handler)(const char* message);
+typedef void (*ConnectCallback)();
+// Runs on the MQTT task once a QoS>0 message was acknowledged (delivered) or
+// given up on, i.e. expired from the outbox. Messages that went unanswered
+// for too long are given up on by expire_stale_publishes(), on the task
+// calling it.
+typedef void (*PublishCallback)(int msg_id, bool delivered);
 
 struct Subscription {
   const char* topic;
   Handler handler;
 };
 
+struct TopicOptions {
+  const char* topic;
+  int qos;
+  bool retain;
+};
+
+struct PendingPublish {
+  int msg_id;
+  int64_t sent_at;
+  PublishCallback callback;
+};
+
+struct EarlyAck {
+  int msg_id;
+  int64_t acked_at;
+};
+
+struct MQTTStats {
+  uint32_t reconnects;
+  uint32_t session_resumes;
+  uint32_t last_resubscribe_ms;
+  uint32_t max_resubscribe_ms;
+  uint32_t publish_failures;
+  uint32_t messages_received;
+  uint32_t messages_published;
+  uint32_t bytes_received;
+  uint32_t bytes_published;
+  // Broker connections, each from the start of the TCP connect to CONNACK,
+  // which includes the TLS handshake for mqtts://
+  uint32_t connects;
+  uint32_t connect_failures;
+  uint32_t last_connect_ms;
+  uint32_t max_connect_ms;
+  // QoS>0 publishes, from publish() to PUBACK (PUBCOMP for QoS 2)
+  uint32_t publishes_acked;
+  uint32_t publishes_expired;
+  uint32_t publishes_untracked;
+  uint32_t last_ack_ms;
+  uint32_t max_ack_ms;
+  uint32_t publishes_pending;
+  uint32_t outbox_bytes;
+};
+
 class MQTTManager {
  public:
   MQTTManager(const char* broker_uri, const char* clientId, const int qos,
-              const int retention_policy);
+              const int retention_policy, const int reconnect_timeout_ms,
+              const int outbox_limit_bytes);
   esp_err_t init();
 
+  // Only the first start can fail, later calls nudge a pending reconnect
   esp_err_t start();
   esp_err_t stop();
+  // Takes effect with the next connect, an open connection is kept
+  esp_err_t set_broker_uri(const char* uri);
 
-  void publish(const char* topic, const char* payload);
+  // Topics without options use the QoS and retention policy passed to the
+  // constructor. Set before start().
+  void set_topic_options(const char* topic, const int qos, const bool retain);
+
+  // Returns the message ID, 0 for QoS 0 and -1 when the message was dropped
+  int publish(const char* topic, const char* payload);
+  int publish(const char* topic, const char* payload,
+              PublishCallback callback);
   void subscribe(const char* topic, Handler handler);
+  // Runs on the MQTT task each time the broker accepts the connection
+  void on_connect(ConnectCallback callback);
+  // Connected with all subscriptions in place
+  bool is_ready();
+  // Gives up on messages the broker never acknowledged, called from the main
+  // loop so a lost message is noticed without waiting for the next publish
+  void expire_stale_publishes();
+
+  MQTTStats get_stats();
 
  private:
   const char* broker_uri;
   const char* client_id;
   const int qos;
   const int retention_policy;
+  const int reconnect_timeout_ms;
+  const int outbox_limit_bytes;
+  bool is_started;
   bool is_connected;
   esp_mqtt_client_handle_t client;
-  std::vector<Subscription> subscriptions;
+  FixedVector<Subscription, MQTT_MAX_SUBSCRIPTIONS> subscriptions;
+  FixedVector<ConnectCallback, MQTT_MAX_CONNECT_CALLBACKS> callbacks_on_connect;
+  FixedVector<TopicOptions, MQTT_MAX_TOPIC_OPTIONS> topic_options;
+  char message_buffer[MQTT_MAX_MESSAGE_SIZE + 1];
+  int pending_subscriptions;
+  int64_t disconnected_at;
+  int64_t connect_started_at;
+
+  // Written by publishing tasks and the MQTT task, lock also guards stats.
+  // An ack can be handled before publish() has the message ID, it is then
+  // kept in early_acks.
+  FixedVector<PendingPublish, MQTT_MAX_PENDING_PUBLISHES> pending_publishes;
+  EarlyAck early_acks[MQTT_EARLY_ACKS];
+  size_t next_early_ack;
+  portMUX_TYPE lock;
+
+  MQTTStats stats;
 
   static void mqtt_event_handler(void* arg, esp_event_base_t event_base,
                                  int32_t event_id, void* event_data);
 
-  void handle_connected();
+  void handle_before_connect();
+  void handle_connected(esp_mqtt_event_handle_t event);
   void handle_disconnected();
+  void handle_subscribed();
   void handle_message(esp_mqtt_event_handle_t event);
+  void handle_error(esp_mqtt_event_handle_t event);
+  void handle_publish_done(esp_mqtt_event_handle_t event, bool delivered);
+
+  TopicOptions find_topic_options(const char* topic);
+  void track_publish(int msg_id, int64_t sent_at, PublishCallback callback);
+  void record_ack(int64_t sent_at, int64_t acked_at);
+
+  void record_recovery();
 };
 
 #endif
@@ -0,0 +1,52 @@
+#include "SHT3xSensor.hpp"
+
+#include <cstring>
+
+#include "freertos/FreeRTOS.h"
+#include "i2cdev.h"
+
+SHT3xSensor::SHT3xSensor(const int i2c_port, const int sda_gpio_pin,
+                         const int scl_gpio_pin, const uint8_t address)
+    : i2c_port(i2c_port),
+      sda_gpio(static_cast<gpio_num_t>(sda_gpio_pin)),
+      scl_gpio(static_cast<gpio_num_t>(scl_gpio_pin)),
+      address(address) {
+  memset(&device, 0, sizeof(device));
+}
+
+const char* SHT3xSensor::name() { return "sht3x"; }
+
+esp_err_t SHT3xSensor::init() {
+  esp_err_t err = i2cdev_init();
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  err = sht3x_init_desc(&device, address, static_cast<i2c_port_t>(i2c_port),
+                        sda_gpio, scl_gpio);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  return sht3x_init(&device);
+}
+
+esp_err_t SHT3xSensor::start() {
+  return sht3x_start_measurement(&device, SHT3X_SINGLE_SHOT, SHT3X_HIGH);
+}
+
+uint32_t SHT3xSensor::conversion_time_ms() {
+  return pdTICKS_TO_MS(sht3x_get_measurement_duration(SHT3X_HIGH));
+}
+
+esp_err_t SHT3xSensor::collect(SensorSample& sample) {
+  float temperature;
+  float humidity;
+  esp_err_t err = sht3x_get_results(&device, &temperature, &humidity);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  sample = {temperature, humidity, true};
+  return ESP_OK;
+}
@@ -0,0 +1,28 @@
+#ifndef SHT3X_SENSOR_HPP
+#define SHT3X_SENSOR_HPP
+
+#include "SensorBackend.hpp"
+#include "sht3x.h"
+
+// SHT3x on I2C, using single shot measurements at high repeatability
+class SHT3xSensor : public SensorBackend {
+ public:
+  SHT3xSensor(const int i2c_port, const int sda_gpio_pin,
+              const int scl_gpio_pin, const uint8_t address);
+
+  const char* name() override;
+  esp_err_t init() override;
+
+  esp_err_t start() override;
+  uint32_t conversion_time_ms() override;
+  esp_err_t collect(SensorSample& sample) override;
+
+ private:
+  const int i2c_port;
+  const gpio_num_t sda_gpio;
+  const gpio_num_t scl_gpio;
+  const uint8_t address;
+  sht3x_t device;
+};
+
+#endif
@@ -0,0 +1,389 @@
+#include "Schedule.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include "nvs_flash.h"
+
+constexpr const char* NVS_NAMESPACE = "schedule";
+constexpr const char* ENTRIES_NVS_KEY = "entries";
+
+constexpr const char* DAYS_JSON_KEY = "days";
+constexpr const char* ENTRIES_JSON_KEY = "entries";
+constexpr const char* TIME_JSON_KEY = "time";
+
+constexpr uint32_t MINUTES_PER_DAY = 24 * 60;
+constexpr uint8_t NO_ENTRY = UINT8_MAX;
+
+// A wakeup earlier than this before the pending transition is stale, the
+// schedule was replaced while the timer callback was waiting for the lock
+constexpr time_t EARLY_WAKEUP_TOLERANCE_S = 2;
+
+constexpr uint32_t WEEK_MINUTE_MASK = 0x3FFF;
+constexpr uint32_t HAS_MODE_BIT = 1 << 14;
+constexpr uint32_t MODE_SHIFT = 15;
+constexpr uint32_t HAS_TARGET_TEMPERATURE_BIT = 1 << 17;
+constexpr uint32_t TARGET_TEMPERATURE_SHIFT = 18;
+constexpr uint32_t HAS_FAN_SPEED_BIT = 1 << 22;
+constexpr uint32_t FAN_SPEED_SHIFT = 23;
+
+static_assert(MINUTES_PER_WEEK <= WEEK_MINUTE_MASK + 1);
+static_assert(MAX_TARGET_TEMPERATURE - MIN_TARGET_TEMPERATURE < 16);
+static_assert(MAX_FAN_SPEED < 128);
+
+static ScheduleEntry encode_entry(uint32_t week_minute,
+                                  const HeatpumpUpdate& update) {
+  ScheduleEntry entry = week_minute;
+  if (update.has_mode) {
+    entry |= HAS_MODE_BIT | static_cast<uint32_t>(update.mode) << MODE_SHIFT;
+  }
+  if (update.has_target_temperature) {
+    entry |= HAS_TARGET_TEMPERATURE_BIT |
+             static_cast<uint32_t>(update.target_temperature -
+                                   MIN_TARGET_TEMPERATURE)
+                 << TARGET_TEMPERATURE_SHIFT;
+  }
+  if (update.has_fan_speed) {
+    entry |= HAS_FAN_SPEED_BIT | static_cast<uint32_t>(update.fan_speed)
+                                     << FAN_SPEED_SHIFT;
+  }
+  return entry;
+}
+
+static uint32_t entry_week_minute(ScheduleEntry entry) {
+  return entry & WEEK_MINUTE_MASK;
+}
+
+static HeatpumpUpdate decode_entry(ScheduleEntry entry) {
+  HeatpumpUpdate update = {};
+  update.has_mode = entry & HAS_MODE_BIT;
+  update.mode = static_cast<Mode>((entry >> MODE_SHIFT) & 0x3);
+  update.has_target_temperature = entry & HAS_TARGET_TEMPERATURE_BIT;
+  update.target_temperature =
+      MIN_TARGET_TEMPERATURE + ((entry >> TARGET_TEMPERATURE_SHIFT) & 0xF);
+  update.has_fan_speed = entry & HAS_FAN_SPEED_BIT;
+  update.fan_speed = (entry >> FAN_SPEED_SHIFT) & 0x7F;
+  return update;
+}
+
+static uint32_t local_week_minute(const struct tm& local) {
+  return local.tm_wday * MINUTES_PER_DAY + local.tm_hour * 60 + local.tm_min;
+}
+
+Schedule::Schedule(ScheduleCallback on_transition)
+    : on_transition(on_transition),
+      slot_heads{},
+      next_in_slot{},
+      occupied_slots{},
+      is_active(false),
+      pending_entry(-1),
+      pending_at(0),
+      mutex(nullptr),
+      timer(nullptr),
+      stats({}) {}
+
+esp_err_t Schedule::init() {
+  mutex = xSemaphoreCreateMutex();
+  if (mutex == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = &Schedule::timer_callback;
+  timer_args.arg = this;
+  timer_args.dispatch_method = ESP_TIMER_TASK;
+  timer_args.name = "schedule";
+
+  esp_err_t err = esp_timer_create(&timer_args, &timer);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  // A missing or corrupt schedule leaves it empty
+  nvs_handle_t nvs_storage;
+  if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_storage) == ESP_OK) {
+    ScheduleEntry stored[SCHEDULE_MAX_ENTRIES];
+    size_t stored_size = sizeof(stored);
+    if (nvs_get_blob(nvs_storage, ENTRIES_NVS_KEY, stored, &stored_size) ==
+            ESP_OK &&
+        stored_size % sizeof(ScheduleEntry) == 0) {
+      for (size_t i = 0; i < stored_size / sizeof(ScheduleEntry); i++) {
+        if (entry_week_minute(stored[i]) < MINUTES_PER_WEEK) {
+          entries.push_back(stored[i]);
+        }
+      }
+    }
+    nvs_close(nvs_storage);
+  }
+
+  build_wheel();
+  return ESP_OK;
+}
+
+esp_err_t Schedule::populate_from_json(const cJSON* root) {
+  cJSON* days_item = cJSON_GetObjectItem(root, DAYS_JSON_KEY);
+  cJSON* entries_item = cJSON_GetObjectItem(root, ENTRIES_JSON_KEY);
+  if (!cJSON_IsArray(days_item) || !cJSON_IsArray(entries_item)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  uint8_t days = 0;
+  cJSON* day_item;
+  cJSON_ArrayForEach(day_item, days_item) {
+    if (!cJSON_IsNumber(day_item) || day_item->valueint < 0 ||
+        day_item->valueint > 6) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    days |= 1 << day_item->valueint;
+  }
+
+  // Validate the whole message before touching the current schedule
+  FixedVector<ScheduleEntry, SCHEDULE_MAX_ENTRIES> day_entries;
+  cJSON* entry_item;
+  cJSON_ArrayForEach(entry_item, entries_item) {
+    cJSON* time_item = cJSON_GetObjectItem(entry_item, TIME_JSON_KEY);
+    unsigned hour;
+    unsigned minute;
+    if (!cJSON_IsString(time_item) ||
+        sscanf(time_item->valuestring, "%2u:%2u", &hour, &minute) != 2 ||
+        hour > 23 || minute > 59) {
+      return ESP_ERR_INVALID_ARG;
+    }
+
+    HeatpumpUpdate update;
+    esp_err_t err = Heatpump::parse_update(entry_item, update);
+    if (err != ESP_OK) {
+      return err;
+    }
+    if (!update.has_mode && !update.has_target_temperature &&
+        !update.has_fan_speed) {
+      return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!day_entries.push_back(encode_entry(hour * 60 + minute, update))) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  xSemaphoreTake(mutex, portMAX_DELAY);
+
+  // Keep the other days, then add the new entries for every listed day
+  FixedVector<ScheduleEntry, SCHEDULE_MAX_ENTRIES> updated;
+  for (ScheduleEntry entry : entries) {
+    if (!(days & (1 << (entry_week_minute(entry) / MINUTES_PER_DAY)))) {
+      updated.push_back(entry);
+    }
+  }
+
+  for (uint32_t day = 0; day < 7; day++) {
+    if (!(days & (1 << day))) {
+      continue;
+    }
+    for (ScheduleEntry entry : day_entries) {
+      if (!updated.push_back(entry + day * MINUTES_PER_DAY)) {
+        xSemaphoreGive(mutex);
+        return ESP_ERR_NO_MEM;
+      }
+    }
+  }
+
+  entries = updated;
+  build_wheel();
+  stats.updates++;
+
+  esp_err_t err = save();
+  if (is_active) {
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    arm_after(local_week_minute(local), now);
+  }
+
+  xSemaphoreGive(mutex);
+  return err;
+}
+
+esp_err_t Schedule::arm() {
+  time_t now = time(nullptr);
+  struct tm local;
+  localtime_r(&now, &local);
+
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  is_active = true;
+  esp_err_t err = arm_after(local_week_minute(local), now);
+  xSemaphoreGive(mutex);
+  return err;
+}
+
+bool Schedule::is_armed() { return is_active; }
+
+size_t Schedule::size() { return entries.size(); }
+
+ScheduleStats Schedule::get_stats() { return stats; }
+
+void Schedule::build_wheel() {
+  memset(slot_heads, NO_ENTRY, sizeof(slot_heads));
+  memset(occupied_slots, 0, sizeof(occupied_slots));
+
+  // Each slot is a list sorted by minute, with later duplicates replacing
+  // earlier ones
+  for (size_t i = 0; i < entries.size(); i++) {
+    uint32_t week_minute = entry_week_minute(entries[i]);
+    size_t slot = week_minute / 60;
+
+    uint8_t* link = &slot_heads[slot];
+    while (*link != NO_ENTRY &&
+           entry_week_minute(entries[*link]) < week_minute) {
+      link = &next_in_slot[*link];
+    }
+    if (*link != NO_ENTRY &&
+        entry_week_minute(entries[*link]) == week_minute) {
+      next_in_slot[i] = next_in_slot[*link];
+    } else {
+      next_in_slot[i] = *link;
+    }
+    *link = static_cast<uint8_t>(i);
+
+    occupied_slots[slot / 32] |= 1u << (slot % 32);
+  }
+}
+
+// First occupied slot at or after start, or -1
+static int find_occupied_slot(const uint32_t* occupied_slots, size_t start) {
+  for (size_t word = start / 32; word < SCHEDULE_SLOT_WORDS; word++) {
+    uint32_t bits = occupied_slots[word];
+    if (word == start / 32) {
+      bits &= ~0u << (start % 32);
+    }
+    if (bits) {
+      return word * 32 + __builtin_ctz(bits);
+    }
+  }
+  return -1;
+}
+
+int Schedule::find_next(uint32_t week_minute) {
+  // Later entries in the current hour
+  size_t slot = week_minute / 60;
+  for (uint8_t i = slot_heads[slot]; i != NO_ENTRY; i = next_in_slot[i]) {
+    if (entry_week_minute(entries[i]) > week_minute) {
+      return i;
+    }
+  }
+
+  // Otherwise the first entry of the next occupied hour, wrapping around to
+  // next week
+  int next_slot = slot + 1 < SCHEDULE_SLOTS
+                      ? find_occupied_slot(occupied_slots, slot + 1)
+                      : -1;
+  if (next_slot < 0) {
+    next_slot = find_occupied_slot(occupied_slots, 0);
+  }
+  if (next_slot < 0) {
+    return -1;
+  }
+  return slot_heads[next_slot];
+}
+
+esp_err_t Schedule::arm_after(uint32_t week_minute, time_t at) {
+  esp_timer_stop(timer);
+
+  pending_entry = find_next(week_minute);
+  if (pending_entry < 0) {
+    return ESP_OK;
+  }
+
+  // Count from week_minute as it was at the given time rather than from the
+  // clock, so entries that became due meanwhile are not pushed to next week.
+  // find_next wraps around to the same entry when it is the only one, that
+  // occurrence is a week away.
+  uint32_t minutes_ahead =
+      (entry_week_minute(entries[pending_entry]) + MINUTES_PER_WEEK -
+       week_minute) %
+      MINUTES_PER_WEEK;
+  if (minutes_ahead == 0) {
+    minutes_ahead = MINUTES_PER_WEEK;
+  }
+
+  // Let mktime resolve the wall-clock target so DST changes are accounted
+  // for. An entry in a skipped hour fires later than its minute, which is
+  // taken back out first.
+  struct tm target;
+  localtime_r(&at, &target);
+  uint32_t shifted_minutes =
+      (local_week_minute(target) + MINUTES_PER_WEEK - week_minute) %
+      MINUTES_PER_WEEK;
+  target.tm_min += static_cast<int>(minutes_ahead) -
+                   static_cast<int>(shifted_minutes);
+  target.tm_sec = 0;
+  target.tm_isdst = -1;
+  pending_at = mktime(&target);
+
+  // Entries that are already due, e.g. after the clock was stepped forward,
+  // fire right away and in order
+  time_t now = time(nullptr);
+  int64_t delay_us = static_cast<int64_t>(pending_at - now) * 1000000;
+  if (delay_us < 0) {
+    delay_us = 0;
+  }
+
+  return esp_timer_start_once(timer, delay_us);
+}
+
+esp_err_t Schedule::save() {
+  nvs_handle_t nvs_storage;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  if (entries.size() > 0) {
+    err = nvs_set_blob(nvs_storage, ENTRIES_NVS_KEY, entries.begin(),
+                       entries.size() * sizeof(ScheduleEntry));
+  } else {
+    err = nvs_erase_key(nvs_storage, ENTRIES_NVS_KEY);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+      err = ESP_OK;
+    }
+  }
+
+  if (err == ESP_OK) {
+    err = nvs_commit(nvs_storage);
+  }
+
+  nvs_close(nvs_storage);
+  return err;
+}
+
+void Schedule::timer_callback(void* arg) {
+  static_cast<Schedule*>(arg)->handle_transition();
+}
+
+void Schedule::handle_transition() {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  if (pending_entry < 0) {
+    xSemaphoreGive(mutex);
+    return;
+  }
+
+  // Woke up too early, e.g. the clock was stepped back, wait for the entry
+  // again
+  time_t now = time(nullptr);
+  if (now + EARLY_WAKEUP_TOLERANCE_S < pending_at) {
+    esp_timer_start_once(timer,
+                         static_cast<int64_t>(pending_at - now) * 1000000);
+    xSemaphoreGive(mutex);
+    return;
+  }
+
+  ScheduleEntry entry = entries[pending_entry];
+  stats.transitions++;
+
+  // Continue from the entry that fired rather than the clock, so a slightly
+  // early wakeup does not fire the same entry twice and a late one does not
+  // skip the entries in between
+  arm_after(entry_week_minute(entry), pending_at);
+  xSemaphoreGive(mutex);
+
+  on_transition(decode_entry(entry));
+}
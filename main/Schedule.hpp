@@ -0,0 +1,86 @@
+#ifndef SCHEDULE_HPP
+#define SCHEDULE_HPP
+
+#include <cstdint>
+#include <ctime>
+
+#include "FixedVector.hpp"
+#include "Heatpump.hpp"
+#include "cJSON.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+constexpr size_t SCHEDULE_MAX_ENTRIES = CONFIG_SCHEDULE_MAX_ENTRIES;
+constexpr uint32_t MINUTES_PER_WEEK = 7 * 24 * 60;
+
+// One slot per hour of the week
+constexpr size_t SCHEDULE_SLOTS = 7 * 24;
+constexpr size_t SCHEDULE_SLOT_WORDS = (SCHEDULE_SLOTS + 31) / 32;
+
+static_assert(SCHEDULE_MAX_ENTRIES < UINT8_MAX,
+              "Schedule entries are linked by 8-bit indexes");
+
+typedef void (*ScheduleCallback)(const HeatpumpUpdate& update);
+
+// Entries are packed into 32 bits so the whole schedule is a single small NVS
+// blob:
+//   [0:13]  minute of the week, 0 is Sunday 00:00 local time
+//   [14]    has mode, [15:16] mode
+//   [17]    has target temperature, [18:21] target - MIN_TARGET_TEMPERATURE
+//   [22]    has fan speed, [23:29] fan speed
+typedef uint32_t ScheduleEntry;
+
+struct ScheduleStats {
+  uint32_t transitions;
+  uint32_t updates;
+};
+
+// Weekly schedule of heatpump states evaluated on the device. Entries are
+// bucketed into an hourly timer wheel with an occupancy bitmap, so finding the
+// next transition does not depend on the number of entries, and a one-shot
+// timer wakes the CPU only when that transition is due.
+class Schedule {
+ public:
+  Schedule(ScheduleCallback on_transition);
+  esp_err_t init();
+
+  // Replaces the entries of the days listed in the message:
+  // {"days":[1,2,3,4,5],"entries":[{"time":"07:00","mode":"HEAT",
+  //  "targetTemperature":21}, ...]}, days are 0-6 starting on Sunday
+  esp_err_t populate_from_json(const cJSON* root);
+
+  // Arms the timer for the next transition, needs the wall clock to be set
+  esp_err_t arm();
+  bool is_armed();
+
+  size_t size();
+  ScheduleStats get_stats();
+
+ private:
+  ScheduleCallback on_transition;
+  FixedVector<ScheduleEntry, SCHEDULE_MAX_ENTRIES> entries;
+  uint8_t slot_heads[SCHEDULE_SLOTS];
+  uint8_t next_in_slot[SCHEDULE_MAX_ENTRIES];
+  uint32_t occupied_slots[SCHEDULE_SLOT_WORDS];
+  bool is_active;
+  int pending_entry;
+  time_t pending_at;
+  SemaphoreHandle_t mutex;
+  esp_timer_handle_t timer;
+  ScheduleStats stats;
+
+  void build_wheel();
+  int find_next(uint32_t week_minute);
+  // Arms the timer for the first entry after week_minute, the local minute at
+  // the given time. Entries that are already due fire right away.
+  esp_err_t arm_after(uint32_t week_minute, time_t at);
+  esp_err_t save();
+
+  static void timer_callback(void* arg);
+  void handle_transition();
+};
+
+#endif
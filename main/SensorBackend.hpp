@@ -0,0 +1,29 @@
+#ifndef SENSOR_BACKEND_HPP
+#define SENSOR_BACKEND_HPP
+
+#include <cstdint>
+
+#include "esp_err.h"
+
+struct SensorSample {
+  float temperature;
+  float humidity;
+  bool has_humidity;
+};
+
+// A single temperature sensor. Reads are split into start() and collect() so
+// several sensors can convert at the same time, collect() is called once
+// conversion_time_ms() has passed since start().
+class SensorBackend {
+ public:
+  virtual ~SensorBackend() = default;
+
+  virtual const char* name() = 0;
+  virtual esp_err_t init() = 0;
+
+  virtual esp_err_t start() = 0;
+  virtual uint32_t conversion_time_ms() = 0;
+  virtual esp_err_t collect(SensorSample& sample) = 0;
+};
+
+#endif
@@ -1,36 +1,173 @@
 #include "TemperatureSensor.hpp"
 
-#include <cstdint>
+#include <algorithm>
+#include <cstdio>
 
-#include "dht.h"
+#include "FaultInjector.hpp"
+#include "Timeline.hpp"
+#include "esp_timer.h"
 
-TemperatureSensor::TemperatureSensor(const int gpio_pin)
-    : gpio(static_cast<gpio_num_t>(gpio_pin)) {}
+TemperatureSensor::TemperatureSensor(const SensorFusion fusion)
+    : fusion(fusion),
+      status{},
+      is_available{},
+      is_started{},
+      is_reading(false),
+      started_at(0),
+      ready_at(0),
+      stats({}) {}
+
+void TemperatureSensor::add_sensor(SensorBackend* sensor) {
+  if (!sensors.push_back(sensor)) {
+    printf("Error adding temperature sensor %s: sensor table is full\n",
+           sensor->name());
+    return;
+  }
+  status[sensors.size() - 1].name = sensor->name();
+}
 
 esp_err_t TemperatureSensor::init() {
-  gpio_config_t config = {};
-  config.mode = GPIO_MODE_INPUT;
-  config.pin_bit_mask = 1ULL << gpio;
+  // A broken sensor is skipped as long as another one works
+  esp_err_t result = ESP_ERR_NOT_FOUND;
+  for (size_t i = 0; i < sensors.size(); i++) {
+    esp_err_t err = sensors[i]->init();
+    if (err != ESP_OK) {
+      printf("Error initializing temperature sensor %s: %s\n",
+             sensors[i]->name(), esp_err_to_name(err));
+      if (result != ESP_OK) {
+        result = err;
+      }
+      continue;
+    }
+    is_available[i] = true;
+    result = ESP_OK;
+  }
+
+  return result;
+}
+
+void TemperatureSensor::start() {
+  if (is_reading) {
+    return;
+  }
+
+  started_at = esp_timer_get_time();
+  uint32_t conversion_time_ms = 0;
+  for (size_t i = 0; i < sensors.size(); i++) {
+    is_started[i] = false;
+    if (!is_available[i]) {
+      continue;
+    }
+
+    int64_t call_started_at = esp_timer_get_time();
+    timeline_begin(TimelineEvent::SENSOR_START, i);
+    esp_err_t err = sensors[i]->start();
+    timeline_end(TimelineEvent::SENSOR_START, i);
+    status[i].busy_us =
+        static_cast<uint32_t>(esp_timer_get_time() - call_started_at);
+    if (err != ESP_OK) {
+      printf("Error starting temperature sensor %s: %s\n", sensors[i]->name(),
+             esp_err_to_name(err));
+      continue;
+    }
+
+    is_started[i] = true;
+    conversion_time_ms =
+        std::max(conversion_time_ms, sensors[i]->conversion_time_ms());
+  }
+
+  ready_at = started_at + static_cast<int64_t>(conversion_time_ms) * 1000;
+  is_reading = true;
+}
+
+bool TemperatureSensor::collect(TemperatureReading& reading) {
+  if (!is_reading || esp_timer_get_time() < ready_at) {
+    return false;
+  }
+  is_reading = false;
+
+  float temperatures[TEMPERATURE_SENSOR_MAX_BACKENDS];
+  size_t temperature_count = 0;
+  float humidity_sum = 0;
+  size_t humidity_count = 0;
+
+  stats.reads++;
+  for (size_t i = 0; i < sensors.size(); i++) {
+    status[i].is_valid = false;
+    if (!is_started[i]) {
+      if (is_available[i]) {
+        status[i].errors++;
+        stats.errors++;
+      }
+      continue;
+    }
+
+    SensorSample sample;
+    int64_t call_started_at = esp_timer_get_time();
+    timeline_begin(TimelineEvent::SENSOR_COLLECT, i);
+    esp_err_t err = sensors[i]->collect(sample);
+    timeline_end(TimelineEvent::SENSOR_COLLECT, i);
+    // Dropped after the backend finished, so it starts clean next time
+    if (fault_is_active(Fault::SENSOR)) {
+      err = ESP_ERR_TIMEOUT;
+    }
+    int64_t now = esp_timer_get_time();
+    status[i].busy_us += static_cast<uint32_t>(now - call_started_at);
+    status[i].latency_ms = static_cast<uint32_t>((now - started_at) / 1000);
+
+    if (err != ESP_OK) {
+      status[i].errors++;
+      stats.errors++;
+      printf("Error reading from temperature sensor %s: %s\n",
+             sensors[i]->name(), esp_err_to_name(err));
+      continue;
+    }
 
-  esp_err_t err = gpio_config(&config);
-  if (err != ESP_OK) {
-    return err;
+    status[i].is_valid = true;
+    status[i].temperature = sample.temperature;
+    temperatures[temperature_count++] = sample.temperature;
+    if (sample.has_humidity) {
+      humidity_sum += sample.humidity;
+      humidity_count++;
+    }
   }
 
-  return ESP_OK;
+  if (temperature_count == 0) {
+    reading = {0, 0, false};
+    return true;
+  }
+
+  reading = {fuse(temperatures, temperature_count),
+             humidity_count > 0 ? humidity_sum / humidity_count : 0, true};
+  return true;
+}
+
+size_t TemperatureSensor::get_sensor_count() { return sensors.size(); }
+
+SensorStatus TemperatureSensor::get_sensor_status(size_t index) {
+  return status[index];
 }
 
-TemperatureReading TemperatureSensor::read() {
-  int16_t temperature;
-  int16_t humidity;
+TemperatureSensorStats TemperatureSensor::get_stats() { return stats; }
 
-  esp_err_t err = dht_read_data(DHT_TYPE_AM2301, gpio, &humidity, &temperature);
-  if (err != ESP_OK) {
-    printf("Error reading from TemperatureSensor on gpio %d: %s\n", gpio,
-           esp_err_to_name(err));
-    return TemperatureReading{0, 0};
+float TemperatureSensor::fuse(float* values, size_t count) {
+  switch (fusion) {
+    case SensorFusion::MEDIAN: {
+      std::sort(values, values + count);
+      return count % 2 == 1 ? values[count / 2]
+                            : (values[count / 2 - 1] + values[count / 2]) / 2;
+    }
+    case SensorFusion::MIN:
+      return *std::min_element(values, values + count);
+    case SensorFusion::MAX:
+      return *std::max_element(values, values + count);
+    case SensorFusion::AVERAGE:
+      break;
   }
 
-  return TemperatureReading{static_cast<float>(temperature) / 10,
-                            static_cast<float>(humidity) / 10};
+  float sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    sum += values[i];
+  }
+  return sum / count;
 }
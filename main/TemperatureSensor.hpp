@@ -1,22 +1,69 @@
 #ifndef TEMPERATURE_SENSOR_HPP
 #define TEMPERATURE_SENSOR_HPP
 
-#include "driver/gpio.h"
+#include <cstdint>
+
+#include "FixedVector.hpp"
+#include "SensorBackend.hpp"
+#include "esp_err.h"
+
+constexpr size_t TEMPERATURE_SENSOR_MAX_BACKENDS = 4;
+
+// How the valid readings of several sensors are combined into one
+enum class SensorFusion { AVERAGE, MEDIAN, MIN, MAX };
 
 struct TemperatureReading {
   float temperature;
   float humidity;
+  bool is_valid;
+};
+
+struct SensorStatus {
+  const char* name;
+  bool is_valid;
+  float temperature;
+  uint32_t latency_ms;  // From start to collected value
+  uint32_t busy_us;     // Time spent blocked in start and collect
+  uint32_t errors;
 };
 
+struct TemperatureSensorStats {
+  uint32_t reads;
+  uint32_t errors;
+};
+
+// Reads all configured sensors in one cycle and fuses them into a single
+// reading. start() triggers every sensor at once and collect() returns the
+// result once the slowest conversion is done, so the caller is never blocked
+// for the conversion time.
 class TemperatureSensor {
  public:
-  TemperatureSensor(const int gpio_pin);
+  TemperatureSensor(const SensorFusion fusion);
+
+  // Sensors must be added before init
+  void add_sensor(SensorBackend* sensor);
   esp_err_t init();
 
-  TemperatureReading read();
+  void start();
+  bool collect(TemperatureReading& reading);
+
+  size_t get_sensor_count();
+  SensorStatus get_sensor_status(size_t index);
+
+  TemperatureSensorStats get_stats();
 
  private:
-  const gpio_num_t gpio;
+  const SensorFusion fusion;
+  FixedVector<SensorBackend*, TEMPERATURE_SENSOR_MAX_BACKENDS> sensors;
+  SensorStatus status[TEMPERATURE_SENSOR_MAX_BACKENDS];
+  bool is_available[TEMPERATURE_SENSOR_MAX_BACKENDS];
+  bool is_started[TEMPERATURE_SENSOR_MAX_BACKENDS];
+  bool is_reading;
+  int64_t started_at;
+  int64_t ready_at;
+  TemperatureSensorStats stats;
+
+  float fuse(float* values, size_t count);
 };
 
 #endif
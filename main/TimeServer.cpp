@@ -1,14 +1,28 @@
 #include "TimeServer.hpp"
 
+#include <cstdlib>
 #include <ctime>
 
 #include "esp_netif_sntp.h"
 
 constexpr const char* NTP_SERVER = "pool.ntp.org";
 
-TimeServer::TimeServer() {}
+// Anything before 2024-01-01 means the clock has not been set yet
+constexpr time_t MIN_SYNCED_TIME = 1704067200;
+
+TimeServer::TimeServer(const char* timezone)
+    : timezone(timezone), is_initialized(false) {}
 
 esp_err_t TimeServer::init() {
+  // SNTP keeps running across Wi-Fi reconnects, only start it once
+  if (is_initialized) {
+    return ESP_OK;
+  }
+
+  // Local time is used for schedules
+  setenv("TZ", timezone, 1);
+  tzset();
+
   // Initialize SNTP
   esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(NTP_SERVER);
   esp_err_t err = esp_netif_sntp_init(&config);
@@ -16,12 +30,21 @@ esp_err_t TimeServer::init() {
     return err;
   }
 
+  is_initialized = true;
   return ESP_OK;
 }
 
 char* TimeServer::timestamp() {
-  static char timestamp[21];
-  time_t now = time(nullptr);
-  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  static char timestamp[TIMESTAMP_SIZE];
+  format_timestamp(time(nullptr), timestamp);
   return timestamp;
 }
+
+void TimeServer::format_timestamp(const time_t at,
+                                  char (&buffer)[TIMESTAMP_SIZE]) {
+  struct tm utc;
+  gmtime_r(&at, &utc);
+  strftime(buffer, TIMESTAMP_SIZE, "%Y-%m-%dT%H:%M:%SZ", &utc);
+}
+
+bool TimeServer::is_synced() { return time(nullptr) >= MIN_SYNCED_TIME; }
@@ -1,13 +1,26 @@
 #ifndef TIME_SERVER_HPP
 #define TIME_SERVER_HPP
 
+#include <ctime>
+
 #include "esp_err.h"
 
+// ISO 8601 in UTC, e.g. 2025-01-01T12:00:00Z
+constexpr size_t TIMESTAMP_SIZE = 21;
+
 class TimeServer {
  public:
-  TimeServer();
+  TimeServer(const char* timezone);
   esp_err_t init();
   char* timestamp();
+  // Reentrant, for tasks other than the main loop
+  static void format_timestamp(const time_t at,
+                               char (&buffer)[TIMESTAMP_SIZE]);
+  static bool is_synced();
+
+ private:
+  const char* timezone;
+  bool is_initialized;
 };
 
 #endif
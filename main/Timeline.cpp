@@ -0,0 +1,178 @@
+#include "Timeline.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_TIMELINE_ENABLED
+
+constexpr size_t TIMELINE_CAPACITY = CONFIG_TIMELINE_EVENTS;
+constexpr size_t MAX_TIMELINE_TASKS = 16;
+constexpr size_t MAX_TASK_NAME_SIZE = 16;
+// Events of tasks that did not fit into the task table
+constexpr uint8_t OTHER_TASK = 0xFF;
+
+struct TimelineRecord {
+  uint32_t time_us;
+  int32_t value;
+  uint8_t event;
+  uint8_t phase;
+  uint8_t core;
+  uint8_t task;
+};
+static_assert(sizeof(TimelineRecord) == 12, "dump layout changed");
+
+struct TimelineTask {
+  TaskHandle_t task;
+  char name[MAX_TASK_NAME_SIZE];
+};
+
+constexpr size_t MAX_HEADER_SIZE = sizeof(TIMELINE_MAGIC) + 4 + 4 + 1 +
+                                   MAX_TIMELINE_TASKS * MAX_TASK_NAME_SIZE;
+
+static TimelineRecord records[TIMELINE_CAPACITY];
+static size_t next_record = 0;
+static size_t record_count = 0;
+static uint32_t overwritten = 0;
+static bool is_recording = true;
+
+// Names are copied when a task is first seen, tasks like "ota" delete
+// themselves before the dump
+static TimelineTask tasks[MAX_TIMELINE_TASKS];
+static size_t task_count = 0;
+
+static uint8_t header[MAX_HEADER_SIZE];
+static size_t header_size = 0;
+
+static portMUX_TYPE timeline_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t task_index(TaskHandle_t task) {
+  for (size_t i = 0; i < task_count; i++) {
+    if (tasks[i].task == task) {
+      return static_cast<uint8_t>(i);
+    }
+  }
+  if (task_count == MAX_TIMELINE_TASKS) {
+    return OTHER_TASK;
+  }
+
+  tasks[task_count].task = task;
+  strncpy(tasks[task_count].name, pcTaskGetName(task),
+          sizeof(tasks[task_count].name) - 1);
+  return static_cast<uint8_t>(task_count++);
+}
+
+static void put_u32(uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    header[header_size++] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+void timeline_record(TimelineEvent event, TimelinePhase phase,
+                     int32_t value) {
+  if (!is_recording) {
+    return;
+  }
+
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  uint8_t core = static_cast<uint8_t>(xPortGetCoreID());
+
+  // Timestamps are taken under the lock so records from both cores stay in
+  // order. esp_timer is shared by the cores, unlike the cycle counters.
+  portENTER_CRITICAL(&timeline_lock);
+  if (!is_recording) {
+    portEXIT_CRITICAL(&timeline_lock);
+    return;
+  }
+
+  TimelineRecord& record = records[next_record];
+  record.time_us = static_cast<uint32_t>(esp_timer_get_time());
+  record.value = value;
+  record.event = static_cast<uint8_t>(event);
+  record.phase = static_cast<uint8_t>(phase);
+  record.core = core;
+  record.task = task_index(task);
+
+  next_record = (next_record + 1) % TIMELINE_CAPACITY;
+  if (record_count < TIMELINE_CAPACITY) {
+    record_count++;
+  } else {
+    overwritten++;
+  }
+  portEXIT_CRITICAL(&timeline_lock);
+}
+
+void timeline_start() {
+  portENTER_CRITICAL(&timeline_lock);
+  next_record = 0;
+  record_count = 0;
+  overwritten = 0;
+  is_recording = true;
+  portEXIT_CRITICAL(&timeline_lock);
+}
+
+void timeline_stop() {
+  portENTER_CRITICAL(&timeline_lock);
+  is_recording = false;
+  portEXIT_CRITICAL(&timeline_lock);
+
+  header_size = 0;
+  memcpy(header, TIMELINE_MAGIC, sizeof(TIMELINE_MAGIC));
+  header_size += sizeof(TIMELINE_MAGIC);
+  put_u32(overwritten);
+  put_u32(static_cast<uint32_t>(record_count));
+  header[header_size++] = static_cast<uint8_t>(task_count);
+  for (size_t i = 0; i < task_count; i++) {
+    size_t length = strnlen(tasks[i].name, sizeof(tasks[i].name));
+    header[header_size++] = static_cast<uint8_t>(length);
+    memcpy(header + header_size, tasks[i].name, length);
+    header_size += length;
+  }
+}
+
+size_t timeline_size() {
+  return header_size + record_count * sizeof(TimelineRecord);
+}
+
+size_t timeline_read(size_t offset, uint8_t* data, size_t size) {
+  if (is_recording) {
+    return 0;
+  }
+
+  size_t total = timeline_size();
+  size_t copied = 0;
+  if (offset < header_size) {
+    copied = std::min(size, header_size - offset);
+    memcpy(data, header + offset, copied);
+  }
+
+  // The oldest record follows the newest one once the ring wrapped
+  size_t first = record_count < TIMELINE_CAPACITY ? 0 : next_record;
+  while (copied < size && offset + copied < total) {
+    size_t record_offset = offset + copied - header_size;
+    size_t index = record_offset / sizeof(TimelineRecord);
+    size_t within = record_offset % sizeof(TimelineRecord);
+    const auto* record = reinterpret_cast<const uint8_t*>(
+        &records[(first + index) % TIMELINE_CAPACITY]);
+
+    size_t length = std::min(sizeof(TimelineRecord) - within, size - copied);
+    memcpy(data + copied, record + within, length);
+    copied += length;
+  }
+  return copied;
+}
+
+#else
+
+void timeline_record(TimelineEvent event, TimelinePhase phase,
+                     int32_t value) {}
+void timeline_start() {}
+void timeline_stop() {}
+size_t timeline_size() { return 0; }
+size_t timeline_read(size_t offset, uint8_t* data, size_t size) { return 0; }
+
+#endif
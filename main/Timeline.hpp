@@ -0,0 +1,72 @@
+#ifndef TIMELINE_HPP
+#define TIMELINE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Dump layout, all integers little-endian:
+//   "HPL1" magic, [overwritten:u32][event_count:u32][task_count:u8],
+//   task_count x [name_length:u8][name], then event_count records of
+//   [time_us:u32][value:i32][event:u8][phase:u8][core:u8][task:u8]
+// Records are in recording order, time_us wraps every ~71 minutes.
+constexpr uint8_t TIMELINE_MAGIC[] = {'H', 'P', 'L', '1'};
+
+// Values are listed per event, tools/timeline_to_perfetto.py has the names
+enum class TimelineEvent : uint8_t {
+  WIFI_HANDLER = 1,     // event ID, IP_EVENT IDs are offset by 0x100
+  MQTT_CONNECTED = 2,   // session present
+  MQTT_DISCONNECTED = 3,
+  MQTT_MESSAGE = 4,     // payload bytes
+  MQTT_PUBLISH = 5,     // payload bytes
+  MQTT_ACK = 6,         // message ID, negative when it expired
+  HEATPUMP_SET = 7,
+  HEATPUMP_APPLY = 8,
+  NVS_COMMIT = 9,
+  IR_FRAME = 10,        // signal bits
+  SENSOR_START = 11,    // sensor index
+  SENSOR_COLLECT = 12,  // sensor index
+};
+
+enum class TimelinePhase : uint8_t { BEGIN = 0, END = 1, INSTANT = 2 };
+
+// Events go into a fixed ring that overwrites the oldest ones, so the last
+// few seconds before a slow command are always at hand. Recording runs from
+// boot, stop() freezes the ring for reading it out.
+void timeline_record(TimelineEvent event, TimelinePhase phase,
+                     int32_t value = 0);
+void timeline_start();
+void timeline_stop();
+
+// Serialized dump of the frozen ring, see the layout above
+size_t timeline_size();
+size_t timeline_read(size_t offset, uint8_t* data, size_t size);
+
+inline void timeline_begin(TimelineEvent event, int32_t value = 0) {
+  timeline_record(event, TimelinePhase::BEGIN, value);
+}
+
+inline void timeline_end(TimelineEvent event, int32_t value = 0) {
+  timeline_record(event, TimelinePhase::END, value);
+}
+
+inline void timeline_instant(TimelineEvent event, int32_t value = 0) {
+  timeline_record(event, TimelinePhase::INSTANT, value);
+}
+
+// Records the enclosing block as a begin/end pair
+class TimelineScope {
+ public:
+  explicit TimelineScope(TimelineEvent event, int32_t value = 0)
+      : event(event) {
+    timeline_begin(event, value);
+  }
+  ~TimelineScope() { timeline_end(event); }
+
+  TimelineScope(const TimelineScope&) = delete;
+  TimelineScope& operator=(const TimelineScope&) = delete;
+
+ private:
+  const TimelineEvent event;
+};
+
+#endif
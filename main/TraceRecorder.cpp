@@ -0,0 +1,216 @@
+#include "TraceRecorder.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#include "Varint.hpp"
+#include "esp_timer.h"
+
+constexpr size_t MAX_IR_FRAME_BITS = 255;
+
+bool trace_next_record(const uint8_t* buffer, size_t size, size_t& offset,
+                       uint32_t& timestamp_ms, TraceRecord& record) {
+  if (offset == 0) {
+    if (size < sizeof(TRACE_MAGIC) ||
+        memcmp(buffer, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+      return false;
+    }
+    offset = sizeof(TRACE_MAGIC);
+  }
+
+  if (offset >= size) {
+    return false;
+  }
+
+  size_t cursor = offset;
+  uint8_t type = buffer[cursor++];
+
+  uint32_t delta_ms;
+  uint32_t length;
+  if (!decode_varint(buffer, size, cursor, delta_ms) ||
+      !decode_varint(buffer, size, cursor, length) || length > size - cursor) {
+    return false;
+  }
+
+  timestamp_ms += delta_ms;
+  record = {static_cast<TraceRecordType>(type), timestamp_ms, buffer + cursor,
+            length};
+  offset = cursor + length;
+  return true;
+}
+
+bool trace_replay_input(const TraceRecord& record, const TraceSink& sink) {
+  static char topic[UINT8_MAX + 1];
+  static char payload[CONFIG_MQTT_MAX_MESSAGE_SIZE + 1];
+
+  switch (record.type) {
+    case TraceRecordType::MQTT_MESSAGE: {
+      size_t topic_length = record.length > 0 ? record.payload[0] : 0;
+      if (record.length < topic_length + 1 ||
+          record.length - topic_length - 1 >= sizeof(payload)) {
+        return false;
+      }
+      memcpy(topic, record.payload + 1, topic_length);
+      topic[topic_length] = '\0';
+      size_t payload_length = record.length - topic_length - 1;
+      memcpy(payload, record.payload + 1 + topic_length, payload_length);
+      payload[payload_length] = '\0';
+      sink.on_message(topic, payload);
+      return true;
+    }
+    case TraceRecordType::SENSOR_READING: {
+      if (record.length < 4) {
+        return false;
+      }
+      int16_t temperature_x10 = static_cast<int16_t>(
+          record.payload[0] | (record.payload[1] << 8));
+      int16_t humidity_x10 = static_cast<int16_t>(record.payload[2] |
+                                                  (record.payload[3] << 8));
+      sink.on_sensor_reading(static_cast<float>(temperature_x10) / 10,
+                             static_cast<float>(humidity_x10) / 10);
+      return true;
+    }
+    case TraceRecordType::TIMER:
+      if (record.length < 1) {
+        return false;
+      }
+      sink.on_timer(static_cast<TraceTimer>(record.payload[0]));
+      return true;
+    case TraceRecordType::IR_FRAME:
+      break;
+  }
+  return false;
+}
+
+TraceRecorder::TraceRecorder()
+    : buffer{},
+      length(0),
+      is_active(false),
+      last_record_at(0),
+      dropped(0),
+      lock(portMUX_INITIALIZER_UNLOCKED) {}
+
+void TraceRecorder::start() {
+  if (TRACE_BUFFER_SIZE == 0) {
+    return;
+  }
+
+  portENTER_CRITICAL(&lock);
+  memcpy(buffer, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  length = sizeof(TRACE_MAGIC);
+  last_record_at = esp_timer_get_time();
+  dropped = 0;
+  is_active = true;
+  portEXIT_CRITICAL(&lock);
+}
+
+void TraceRecorder::stop() { is_active = false; }
+
+bool TraceRecorder::is_recording() { return is_active; }
+
+void TraceRecorder::record_message(const char* topic, const char* payload) {
+  if (!is_active) {
+    return;
+  }
+
+  size_t topic_length = strnlen(topic, UINT8_MAX);
+  uint8_t header[UINT8_MAX + 1];
+  header[0] = static_cast<uint8_t>(topic_length);
+  memcpy(header + 1, topic, topic_length);
+
+  append(TraceRecordType::MQTT_MESSAGE, header, topic_length + 1,
+         reinterpret_cast<const uint8_t*>(payload), strlen(payload));
+}
+
+void TraceRecorder::record_sensor_reading(float temperature, float humidity) {
+  if (!is_active) {
+    return;
+  }
+
+  // Rounded, a fused reading like 22.35 is no whole number of tenths
+  int16_t temperature_x10 = static_cast<int16_t>(lroundf(temperature * 10));
+  int16_t humidity_x10 = static_cast<int16_t>(lroundf(humidity * 10));
+  uint8_t payload[4] = {
+      static_cast<uint8_t>(temperature_x10 & 0xFF),
+      static_cast<uint8_t>((temperature_x10 >> 8) & 0xFF),
+      static_cast<uint8_t>(humidity_x10 & 0xFF),
+      static_cast<uint8_t>((humidity_x10 >> 8) & 0xFF),
+  };
+
+  append(TraceRecordType::SENSOR_READING, nullptr, 0, payload,
+         sizeof(payload));
+}
+
+void TraceRecorder::record_timer(TraceTimer timer) {
+  if (!is_active) {
+    return;
+  }
+
+  uint8_t payload = static_cast<uint8_t>(timer);
+  append(TraceRecordType::TIMER, nullptr, 0, &payload, sizeof(payload));
+}
+
+void TraceRecorder::record_ir_frame(const char* signal) {
+  if (!is_active) {
+    return;
+  }
+
+  size_t bits = strnlen(signal, MAX_IR_FRAME_BITS);
+  uint8_t payload[1 + (MAX_IR_FRAME_BITS + 7) / 8] = {};
+  payload[0] = static_cast<uint8_t>(bits);
+  for (size_t i = 0; i < bits; i++) {
+    if (signal[i] == '1') {
+      payload[1 + i / 8] |= 0x80 >> (i % 8);
+    }
+  }
+
+  append(TraceRecordType::IR_FRAME, nullptr, 0, payload, 1 + (bits + 7) / 8);
+}
+
+const uint8_t* TraceRecorder::data() { return buffer; }
+
+size_t TraceRecorder::size() { return length; }
+
+uint32_t TraceRecorder::get_dropped() { return dropped; }
+
+void TraceRecorder::append(TraceRecordType type, const uint8_t* header,
+                           size_t header_size, const uint8_t* payload,
+                           size_t payload_size) {
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&lock);
+  if (!is_active) {
+    portEXIT_CRITICAL(&lock);
+    return;
+  }
+
+  uint8_t prefix[1 + 2 * MAX_VARINT_SIZE];
+  size_t prefix_size = 0;
+  uint32_t delta_ms = static_cast<uint32_t>((now - last_record_at) / 1000);
+  prefix[prefix_size++] = static_cast<uint8_t>(type);
+  prefix_size += encode_varint(delta_ms, prefix + prefix_size);
+  prefix_size +=
+      encode_varint(header_size + payload_size, prefix + prefix_size);
+
+  // The trace is a bounded snapshot, recording stops once the buffer is full
+  size_t record_size = prefix_size + header_size + payload_size;
+  if (length + record_size > sizeof(buffer)) {
+    dropped++;
+    is_active = false;
+    portEXIT_CRITICAL(&lock);
+    return;
+  }
+
+  memcpy(buffer + length, prefix, prefix_size);
+  length += prefix_size;
+  if (header_size > 0) {
+    memcpy(buffer + length, header, header_size);
+    length += header_size;
+  }
+  memcpy(buffer + length, payload, payload_size);
+  length += payload_size;
+
+  // Keep sub-millisecond remainders so deltas do not drift
+  last_record_at += static_cast<int64_t>(delta_ms) * 1000;
+  portEXIT_CRITICAL(&lock);
+}
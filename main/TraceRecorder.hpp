@@ -0,0 +1,83 @@
+#ifndef TRACE_RECORDER_HPP
+#define TRACE_RECORDER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_TRACE_ENABLED
+constexpr size_t TRACE_BUFFER_SIZE = CONFIG_TRACE_BUFFER_SIZE;
+#else
+constexpr size_t TRACE_BUFFER_SIZE = 0;
+#endif
+
+// Trace layout: "HPT1" magic, then records of
+//   [type:u8][delta_ms:varint][length:varint][payload:length]
+// where delta_ms is the time since the previous record (or since start).
+constexpr uint8_t TRACE_MAGIC[] = {'H', 'P', 'T', '1'};
+
+enum class TraceRecordType : uint8_t {
+  MQTT_MESSAGE = 1,    // [topic_length:u8][topic][payload]
+  SENSOR_READING = 2,  // [temperature*10:i16][humidity*10:i16]
+  TIMER = 3,           // [timer:u8]
+  IR_FRAME = 4,        // signal bits packed MSB first
+};
+
+enum class TraceTimer : uint8_t { TELEMETRY = 0, DIAGNOSTICS = 1 };
+
+struct TraceRecord {
+  TraceRecordType type;
+  uint32_t timestamp_ms;
+  const uint8_t* payload;
+  size_t length;
+};
+
+// Decodes the record at offset and advances offset past it. timestamp_ms
+// accumulates the deltas, start it at 0 and reuse it between calls.
+bool trace_next_record(const uint8_t* buffer, size_t size, size_t& offset,
+                       uint32_t& timestamp_ms, TraceRecord& record);
+
+// Inputs from a trace are fed back through these callbacks. Outputs (IR
+// frames) are skipped, they are what the replay produces again.
+struct TraceSink {
+  void (*on_message)(const char* topic, const char* payload);
+  void (*on_sensor_reading)(float temperature, float humidity);
+  void (*on_timer)(TraceTimer timer);
+};
+
+// Passes an input record to sink, returns false for outputs and malformed
+// records
+bool trace_replay_input(const TraceRecord& record, const TraceSink& sink);
+
+class TraceRecorder {
+ public:
+  TraceRecorder();
+
+  void start();
+  void stop();
+  bool is_recording();
+
+  void record_message(const char* topic, const char* payload);
+  void record_sensor_reading(float temperature, float humidity);
+  void record_timer(TraceTimer timer);
+  void record_ir_frame(const char* signal);
+
+  const uint8_t* data();
+  size_t size();
+  uint32_t get_dropped();
+
+ private:
+  uint8_t buffer[TRACE_BUFFER_SIZE + sizeof(TRACE_MAGIC)];
+  size_t length;
+  bool is_active;
+  int64_t last_record_at;
+  uint32_t dropped;
+  portMUX_TYPE lock;
+
+  void append(TraceRecordType type, const uint8_t* header, size_t header_size,
+              const uint8_t* payload, size_t payload_size);
+};
+
+#endif
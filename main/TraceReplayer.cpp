@@ -0,0 +1,102 @@
+#include "TraceReplayer.hpp"
+
+#include <cstring>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+constexpr uint32_t REPLAY_TASK_STACK_SIZE = 4096;
+constexpr UBaseType_t REPLAY_TASK_PRIORITY = 5;
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+TraceReplayer::TraceReplayer(const TraceSink sink)
+    : sink(sink), buffer{}, length(0), is_active(false) {}
+
+esp_err_t TraceReplayer::load_chunk(size_t offset, const char* hex,
+                                    size_t total_size) {
+  if (is_active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  size_t hex_length = strlen(hex);
+  if (hex_length % 2 != 0 || total_size > sizeof(buffer) ||
+      offset + hex_length / 2 > total_size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  for (size_t i = 0; i < hex_length; i += 2) {
+    int high = hex_value(hex[i]);
+    int low = hex_value(hex[i + 1]);
+    if (high < 0 || low < 0) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    buffer[offset + i / 2] = static_cast<uint8_t>((high << 4) | low);
+  }
+
+  length = total_size;
+  return ESP_OK;
+}
+
+esp_err_t TraceReplayer::start() {
+  if (is_active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  size_t offset = 0;
+  uint32_t timestamp_ms = 0;
+  TraceRecord record;
+  if (!trace_next_record(buffer, length, offset, timestamp_ms, record)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  is_active = true;
+  BaseType_t result =
+      xTaskCreate(&TraceReplayer::replay_task, "trace_replay",
+                  REPLAY_TASK_STACK_SIZE, this, REPLAY_TASK_PRIORITY, nullptr);
+  if (result != pdPASS) {
+    is_active = false;
+    return ESP_ERR_NO_MEM;
+  }
+
+  return ESP_OK;
+}
+
+bool TraceReplayer::is_running() { return is_active; }
+
+void TraceReplayer::replay_task(void* arg) {
+  auto* self = static_cast<TraceReplayer*>(arg);
+  self->replay();
+  self->is_active = false;
+  vTaskDelete(nullptr);
+}
+
+void TraceReplayer::replay() {
+  int64_t started_at = esp_timer_get_time();
+  size_t offset = 0;
+  uint32_t timestamp_ms = 0;
+  uint32_t replayed = 0;
+  TraceRecord record;
+
+  while (trace_next_record(buffer, length, offset, timestamp_ms, record)) {
+    int64_t elapsed_ms = (esp_timer_get_time() - started_at) / 1000;
+    if (record.timestamp_ms > elapsed_ms) {
+      vTaskDelay(pdMS_TO_TICKS(record.timestamp_ms - elapsed_ms));
+    }
+
+    if (trace_replay_input(record, sink)) {
+      replayed++;
+    }
+  }
+
+  int64_t duration_ms = (esp_timer_get_time() - started_at) / 1000;
+  printf("Trace replay finished: %lu inputs in %lu ms\n",
+         static_cast<unsigned long>(replayed),
+         static_cast<unsigned long>(duration_ms));
+}
@@ -0,0 +1,29 @@
+#ifndef TRACE_REPLAYER_HPP
+#define TRACE_REPLAYER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "TraceRecorder.hpp"
+#include "esp_err.h"
+
+// Replays the inputs of a loaded trace into sink with their original timing
+class TraceReplayer {
+ public:
+  TraceReplayer(const TraceSink sink);
+
+  esp_err_t load_chunk(size_t offset, const char* hex, size_t total_size);
+  esp_err_t start();
+  bool is_running();
+
+ private:
+  const TraceSink sink;
+  uint8_t buffer[TRACE_BUFFER_SIZE + sizeof(TRACE_MAGIC)];
+  size_t length;
+  bool is_active;
+
+  static void replay_task(void* arg);
+  void replay();
+};
+
+#endif
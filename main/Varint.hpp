@@ -0,0 +1,46 @@
+#ifndef VARINT_HPP
+#define VARINT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// LEB128 style variable-length integers, 7 bits per byte, low bits first
+constexpr size_t MAX_VARINT_SIZE = 5;
+
+inline size_t encode_varint(uint32_t value, uint8_t* out) {
+  size_t size = 0;
+  do {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    out[size++] = value ? (byte | 0x80) : byte;
+  } while (value);
+  return size;
+}
+
+inline bool decode_varint(const uint8_t* buffer, size_t size, size_t& offset,
+                          uint32_t& value) {
+  value = 0;
+  for (size_t shift = 0; shift < 35; shift += 7) {
+    if (offset >= size) {
+      return false;
+    }
+    uint8_t byte = buffer[offset++];
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Maps small negative values to small unsigned ones: 0, -1, 1, -2, ...
+inline uint32_t zigzag_encode(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^
+         static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t zigzag_decode(uint32_t value) {
+  return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+#endif
@@ -1,9 +1,33 @@
 #include "WiFiManager.hpp"
 
-#include "esp_wifi.h"
+#include <cstring>
 
-WiFiManager::WiFiManager(const char* ssid, const char* password)
-    : ssid(ssid), password(password) {}
+#include "FaultInjector.hpp"
+#include "Timeline.hpp"
+#include "esp_random.h"
+#include "nvs_flash.h"
+#include "sdkconfig.h"
+
+constexpr const char* NVS_NAMESPACE = "wifi";
+constexpr const char* AP_CACHE_NVS_KEY = "ap_cache";
+
+WiFiManager::WiFiManager(const char* ssid, const char* password,
+                         const uint32_t backoff_min_ms,
+                         const uint32_t backoff_max_ms)
+    : ssid(ssid),
+      password(password),
+      backoff_min_ms(backoff_min_ms),
+      backoff_max_ms(backoff_max_ms),
+      netif(nullptr),
+      reconnect_timer(nullptr),
+      wifi_config({}),
+      cache({}),
+      has_cache(false),
+      using_cache(false),
+      is_connected(false),
+      attempt(0),
+      disconnected_at(0),
+      stats({}) {}
 
 esp_err_t WiFiManager::init() {
   // Initialize ESP network interface abstraction layer
@@ -19,8 +43,8 @@ esp_err_t WiFiManager::init() {
   }
 
   // Create the default network interface for Wi-Fi station mode.
-  esp_netif_t* netif_ptr = esp_netif_create_default_wifi_sta();
-  if (netif_ptr == nullptr) {
+  netif = esp_netif_create_default_wifi_sta();
+  if (netif == nullptr) {
     return ESP_ERR_ESP_NETIF_INIT_FAILED;
   }
 
@@ -31,12 +55,26 @@ esp_err_t WiFiManager::init() {
     return err;
   }
 
+  // Timer used to delay reconnect attempts while the AP is unreachable
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = &WiFiManager::reconnect_timer_callback;
+  timer_args.arg = this;
+  timer_args.dispatch_method = ESP_TIMER_TASK;
+  timer_args.name = "wifi_reconnect";
+
+  err = esp_timer_create(&timer_args, &reconnect_timer);
+  if (err != ESP_OK) {
+    return err;
+  }
+
   // Set up Wi-Fi configuration
-  wifi_config_t wifi_config = {};
   snprintf((char*)wifi_config.sta.ssid, sizeof(wifi_config.sta.ssid), ssid);
   snprintf((char*)wifi_config.sta.password, sizeof(wifi_config.sta.password),
            password);
 
+  load_cache();
+  apply_cache();
+
   err = esp_wifi_set_mode(WIFI_MODE_STA);
   if (err != ESP_OK) {
     return err;
@@ -76,24 +114,50 @@ esp_err_t WiFiManager::init() {
 }
 
 void WiFiManager::on_connect(Callback callback) {
-  callbacks_on_connect.push_back(callback);
+  if (!callbacks_on_connect.push_back(callback)) {
+    printf("Error registering Wi-Fi connect callback: table is full\n");
+  }
 }
 
 void WiFiManager::on_disconnect(Callback callback) {
-  callbacks_on_disconnect.push_back(callback);
+  if (!callbacks_on_disconnect.push_back(callback)) {
+    printf("Error registering Wi-Fi disconnect callback: table is full\n");
+  }
 }
 
+WiFiStats WiFiManager::get_stats() { return stats; }
+
 void WiFiManager::wifi_event_handler(void* arg, esp_event_base_t event_base,
                                      int32_t event_id, void* event_data) {
   auto* self = static_cast<WiFiManager*>(arg);
+  TimelineScope scope(TimelineEvent::WIFI_HANDLER,
+                      event_base == IP_EVENT ? 0x100 + event_id : event_id);
 
-  switch (event_id) {
-    case IP_EVENT_STA_GOT_IP:
-      self->handle_got_ip(static_cast<ip_event_got_ip_t*>(event_data));
-      break;
-    case WIFI_EVENT_STA_DISCONNECTED:
-      self->handle_disconnected();
-      break;
+  if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+    self->handle_got_ip(static_cast<ip_event_got_ip_t*>(event_data));
+  } else if (event_base == WIFI_EVENT &&
+             event_id == WIFI_EVENT_STA_DISCONNECTED) {
+    self->handle_disconnected(
+        static_cast<wifi_event_sta_disconnected_t*>(event_data));
+  }
+}
+
+void WiFiManager::reconnect_timer_callback(void* arg) {
+  auto* self = static_cast<WiFiManager*>(arg);
+
+  // An injected outage keeps the station off the AP, count the attempt as
+  // failed and back off as if the AP did not answer
+  if (fault_is_active(Fault::WIFI)) {
+    self->stats.failed_attempts++;
+    self->attempt++;
+    esp_timer_start_once(self->reconnect_timer,
+                         static_cast<uint64_t>(self->next_backoff_ms()) * 1000);
+    return;
+  }
+
+  esp_err_t err = esp_wifi_connect();
+  if (err != ESP_OK) {
+    printf("Error reconnecting to Wi-Fi: %s\n", esp_err_to_name(err));
   }
 }
 
@@ -101,16 +165,203 @@ void WiFiManager::handle_got_ip(ip_event_got_ip_t* event) {
   printf("Wi-Fi connected, IP address: %d.%d.%d.%d\n",
          IP2STR(&event->ip_info.ip));
 
+  if (disconnected_at != 0) {
+    uint32_t duration_ms =
+        static_cast<uint32_t>((esp_timer_get_time() - disconnected_at) / 1000);
+
+    stats.reconnects++;
+    stats.last_reconnect_ms = duration_ms;
+    stats.total_reconnect_ms += duration_ms;
+    if (duration_ms > stats.max_reconnect_ms) {
+      stats.max_reconnect_ms = duration_ms;
+    }
+
+    printf("Wi-Fi reconnected in %lu ms after %lu attempts (%s)\n",
+           static_cast<unsigned long>(duration_ms),
+           static_cast<unsigned long>(attempt + 1),
+           using_cache ? "fast path" : "full scan");
+  }
+
+  is_connected = true;
+  attempt = 0;
+  disconnected_at = 0;
+
+  save_cache(event);
+
   for (const auto& callback : callbacks_on_connect) {
     callback();
   }
 }
 
-void WiFiManager::handle_disconnected() {
-  for (const auto& callback : callbacks_on_disconnect) {
-    callback();
+void WiFiManager::handle_disconnected(wifi_event_sta_disconnected_t* event) {
+  if (is_connected) {
+    // Lost an established connection, notify once and retry immediately using
+    // the AP we were just connected to
+    is_connected = false;
+    attempt = 0;
+    disconnected_at = esp_timer_get_time();
+
+    for (const auto& callback : callbacks_on_disconnect) {
+      callback();
+    }
+
+    printf("Wi-Fi disconnected (reason %d), reconnecting...\n", event->reason);
+
+    if (!using_cache) {
+      apply_cache();
+      esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    }
+
+    // The immediate retry is what the injected outage blocks, count it as
+    // the first failed attempt so the backoff starts from there
+    if (fault_is_active(Fault::WIFI)) {
+      stats.failed_attempts++;
+      attempt++;
+      esp_timer_start_once(reconnect_timer,
+                           static_cast<uint64_t>(next_backoff_ms()) * 1000);
+      return;
+    }
+
+    esp_wifi_connect();
+    return;
+  }
+
+  // A reconnect attempt failed
+  stats.failed_attempts++;
+  attempt++;
+
+  if (using_cache) {
+    // The cached AP may have moved to another channel or been replaced, fall
+    // back to a full scan
+    drop_cache();
+  }
+
+  uint32_t delay_ms = next_backoff_ms();
+  printf("Wi-Fi reconnect attempt %lu failed (reason %d), retrying in %lu ms\n",
+         static_cast<unsigned long>(attempt), event->reason,
+         static_cast<unsigned long>(delay_ms));
+
+  esp_timer_stop(reconnect_timer);
+  esp_timer_start_once(reconnect_timer, static_cast<uint64_t>(delay_ms) * 1000);
+}
+
+void WiFiManager::load_cache() {
+#ifdef CONFIG_WIFI_FAST_RECONNECT
+  nvs_handle_t nvs_storage;
+  if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_storage) != ESP_OK) {
+    return;
+  }
+
+  size_t cache_size = sizeof(cache);
+  if (nvs_get_blob(nvs_storage, AP_CACHE_NVS_KEY, &cache, &cache_size) ==
+          ESP_OK &&
+      cache_size == sizeof(cache)) {
+    has_cache = true;
+  }
+
+  nvs_close(nvs_storage);
+#endif
+}
+
+void WiFiManager::save_cache(ip_event_got_ip_t* event) {
+#ifdef CONFIG_WIFI_FAST_RECONNECT
+  wifi_ap_record_t ap_info;
+  if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+    return;
+  }
+
+  APCache new_cache = {};
+  memcpy(new_cache.bssid, ap_info.bssid, sizeof(new_cache.bssid));
+  new_cache.channel = ap_info.primary;
+
+#ifdef CONFIG_WIFI_CACHE_IP_INFO
+  esp_netif_dns_info_t dns_info;
+  if (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_info) == ESP_OK) {
+    new_cache.has_ip_info = 1;
+    new_cache.ip_info = event->ip_info;
+    new_cache.dns = dns_info.ip.u_addr.ip4;
+  }
+#endif
+
+  // Only write to flash when the AP actually changed
+  if (has_cache && memcmp(&new_cache, &cache, sizeof(cache)) == 0) {
+    return;
+  }
+
+  nvs_handle_t nvs_storage;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_storage);
+  if (err != ESP_OK) {
+    return;
+  }
+
+  err = nvs_set_blob(nvs_storage, AP_CACHE_NVS_KEY, &new_cache,
+                     sizeof(new_cache));
+  if (err == ESP_OK) {
+    timeline_begin(TimelineEvent::NVS_COMMIT);
+    err = nvs_commit(nvs_storage);
+    timeline_end(TimelineEvent::NVS_COMMIT);
+  }
+
+  nvs_close(nvs_storage);
+
+  if (err != ESP_OK) {
+    printf("Error saving Wi-Fi AP cache: %s\n", esp_err_to_name(err));
+    return;
+  }
+
+  cache = new_cache;
+  has_cache = true;
+#endif
+}
+
+void WiFiManager::apply_cache() {
+  if (!has_cache) {
+    return;
+  }
+
+  // Connect straight to the known AP on its channel instead of scanning
+  wifi_config.sta.channel = cache.channel;
+  wifi_config.sta.bssid_set = true;
+  memcpy(wifi_config.sta.bssid, cache.bssid, sizeof(wifi_config.sta.bssid));
+
+#ifdef CONFIG_WIFI_CACHE_IP_INFO
+  if (cache.has_ip_info) {
+    esp_netif_dhcpc_stop(netif);
+    esp_netif_set_ip_info(netif, &cache.ip_info);
+
+    esp_netif_dns_info_t dns_info = {};
+    dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+    dns_info.ip.u_addr.ip4 = cache.dns;
+    esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_info);
+  }
+#endif
+
+  using_cache = true;
+}
+
+void WiFiManager::drop_cache() {
+  wifi_config.sta.channel = 0;
+  wifi_config.sta.bssid_set = false;
+  esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+
+#ifdef CONFIG_WIFI_CACHE_IP_INFO
+  if (cache.has_ip_info) {
+    esp_netif_dhcpc_start(netif);
+  }
+#endif
+
+  using_cache = false;
+}
+
+uint32_t WiFiManager::next_backoff_ms() {
+  uint32_t shift = attempt > 16 ? 16 : attempt - 1;
+  uint64_t delay_ms = static_cast<uint64_t>(backoff_min_ms) << shift;
+  if (delay_ms > backoff_max_ms) {
+    delay_ms = backoff_max_ms;
   }
 
-  printf("Wi-Fi disconnected, reconnecting...\n");
-  esp_wifi_connect();
+  // Jitter between half and full delay so a fleet behind one AP does not
+  // reconnect in lockstep
+  uint32_t half = static_cast<uint32_t>(delay_ms / 2);
+  return half + esp_random() % (half + 1);
 }
@@ -1,32 +1,76 @@
 #ifndef WIFI_MANAGER_HPP
 #define WIFI_MANAGER_HPP
 
-#include <vector>
+#include <cstdint>
 
+#include "FixedVector.hpp"
 #include "esp_event.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+
+constexpr size_t WIFI_MAX_CALLBACKS = CONFIG_WIFI_MAX_CALLBACKS;
 
 typedef void (*Callback)();
 
+struct APCache {
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t has_ip_info;
+  esp_netif_ip_info_t ip_info;
+  esp_ip4_addr_t dns;
+};
+
+struct WiFiStats {
+  uint32_t reconnects;
+  uint32_t failed_attempts;
+  uint32_t last_reconnect_ms;
+  uint32_t max_reconnect_ms;
+  uint64_t total_reconnect_ms;
+};
+
 class WiFiManager {
  public:
-  WiFiManager(const char* ssid, const char* password);
+  WiFiManager(const char* ssid, const char* password,
+              const uint32_t backoff_min_ms, const uint32_t backoff_max_ms);
   esp_err_t init();
 
   void on_connect(Callback callback);
   void on_disconnect(Callback callback);
 
+  WiFiStats get_stats();
+
  private:
   const char* ssid;
   const char* password;
-  std::vector<Callback> callbacks_on_connect;
-  std::vector<Callback> callbacks_on_disconnect;
+  const uint32_t backoff_min_ms;
+  const uint32_t backoff_max_ms;
+  esp_netif_t* netif;
+  esp_timer_handle_t reconnect_timer;
+  wifi_config_t wifi_config;
+  APCache cache;
+  bool has_cache;
+  bool using_cache;
+  bool is_connected;
+  uint32_t attempt;
+  int64_t disconnected_at;
+  WiFiStats stats;
+  FixedVector<Callback, WIFI_MAX_CALLBACKS> callbacks_on_connect;
+  FixedVector<Callback, WIFI_MAX_CALLBACKS> callbacks_on_disconnect;
 
   static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                  int32_t event_id, void* event_data);
+  static void reconnect_timer_callback(void* arg);
 
   void handle_got_ip(ip_event_got_ip_t* event);
-  void handle_disconnected();
+  void handle_disconnected(wifi_event_sta_disconnected_t* event);
+
+  void load_cache();
+  void save_cache(ip_event_got_ip_t* event);
+  void apply_cache();
+  void drop_cache();
+  uint32_t next_backoff_ms();
 };
 
 #endif
@@ -1,13 +1,30 @@
+#include <math.h>
 #include <stdio.h>
+#include <time.h>
 
+#include "CommandShaper.hpp"
+#include "ControlEngine.hpp"
+#include "DHTRmtSensor.hpp"
+#include "DHTSensor.hpp"
+#include "Diagnostics.hpp"
+#include "FaultInjector.hpp"
+#include "FirmwareUpdater.hpp"
+#include "HeapMonitor.hpp"
+#include "History.hpp"
 #include "Heatpump.hpp"
 #include "IRTransmitter.hpp"
+#include "JsonArena.hpp"
+#include "LocalControl.hpp"
 #include "LoopManager.hpp"
 #include "MQTTManager.hpp"
 #include "Mode.hpp"
 #include "OperatingState.hpp"
+#include "Schedule.hpp"
 #include "TemperatureSensor.hpp"
 #include "TimeServer.hpp"
+#include "Timeline.hpp"
+#include "TraceRecorder.hpp"
+#include "TraceReplayer.hpp"
 #include "WiFiManager.hpp"
 #include "cJSON.h"
 #include "freertos/FreeRTOS.h"
@@ -15,28 +32,1005 @@
 #include "nvs_flash.h"
 #include "sdkconfig.h"
 
+// Built only with their esp-idf-lib components, see CMakeLists.txt
+#ifdef CONFIG_SENSOR_DS18B20
+#include "DS18B20Sensor.hpp"
+#endif
+#ifdef CONFIG_SENSOR_SHT3X
+#include "SHT3xSensor.hpp"
+#endif
+
 // MQTT topics
 constexpr const char* MQTT_CURRENT_STATE_TOPIC =
     CONFIG_MQTT_CURRENT_STATE_TOPIC;
 constexpr const char* MQTT_TARGET_STATE_TOPIC = CONFIG_MQTT_TARGET_STATE_TOPIC;
+constexpr const char* MQTT_GET_STATE_TOPIC = CONFIG_MQTT_GET_STATE_TOPIC;
+constexpr const char* MQTT_STATE_TOPIC = CONFIG_MQTT_STATE_TOPIC;
+constexpr const char* MQTT_DIAGNOSTICS_TOPIC = CONFIG_MQTT_DIAGNOSTICS_TOPIC;
+constexpr const char* MQTT_SCHEDULE_TOPIC = CONFIG_MQTT_SCHEDULE_TOPIC;
+#ifdef CONFIG_HISTORY_ENABLED
+constexpr const char* MQTT_HISTORY_REQUEST_TOPIC =
+    CONFIG_MQTT_HISTORY_REQUEST_TOPIC;
+constexpr const char* MQTT_HISTORY_TOPIC = CONFIG_MQTT_HISTORY_TOPIC;
+#endif
+#ifdef CONFIG_OTA_ENABLED
+constexpr const char* MQTT_OTA_TOPIC = CONFIG_MQTT_OTA_TOPIC;
+#endif
+#ifdef CONFIG_TRACE_ENABLED
+constexpr const char* MQTT_TRACE_TOPIC = CONFIG_MQTT_TRACE_TOPIC;
+constexpr const char* MQTT_TRACE_DUMP_TOPIC = CONFIG_MQTT_TRACE_DUMP_TOPIC;
+#endif
+#ifdef CONFIG_FAULT_INJECTION
+constexpr const char* MQTT_FAULT_TOPIC = CONFIG_MQTT_FAULT_TOPIC;
+constexpr const char* MQTT_FAULT_REPORT_TOPIC = CONFIG_MQTT_FAULT_REPORT_TOPIC;
+// Nothing listens on port 1 of the unit itself, so connects are refused
+// right away, like those to a host whose broker is down
+constexpr const char* UNREACHABLE_BROKER_URI = "mqtt://127.0.0.1:1";
+#endif
+#ifdef CONFIG_TIMELINE_ENABLED
+constexpr const char* MQTT_TIMELINE_TOPIC = CONFIG_MQTT_TIMELINE_TOPIC;
+constexpr const char* MQTT_TIMELINE_DUMP_TOPIC =
+    CONFIG_MQTT_TIMELINE_DUMP_TOPIC;
+#endif
 
 constexpr const char* DEVICE_ID = CONFIG_DEVICE_ID;
 
-WiFiManager wifi(CONFIG_WIFI_SSID, CONFIG_WIFI_PASSWORD);
+constexpr uint32_t MAIN_LOOP_DELAY_MS = 100;
+
+#ifdef CONFIG_IR_SUPPRESS_DUPLICATES
+constexpr bool IR_SUPPRESS_DUPLICATES = true;
+#else
+constexpr bool IR_SUPPRESS_DUPLICATES = false;
+#endif
+
+WiFiManager wifi(CONFIG_WIFI_SSID, CONFIG_WIFI_PASSWORD,
+                 CONFIG_WIFI_RECONNECT_BACKOFF_MIN_MS,
+                 CONFIG_WIFI_RECONNECT_BACKOFF_MAX_MS);
 MQTTManager mqtt(CONFIG_MQTT_BROKER_URL, CONFIG_DEVICE_ID, CONFIG_MQTT_QOS,
-                 CONFIG_MQTT_RETENTION_POLICY);
+                 CONFIG_MQTT_RETENTION_POLICY, CONFIG_MQTT_RECONNECT_TIMEOUT_MS,
+                 CONFIG_MQTT_OUTBOX_LIMIT_BYTES);
 LoopManager loop_manager(CONFIG_TEMPERATURE_CHECK_INTERVAL_MS);
-TimeServer time_server;
+LoopManager diagnostics_loop(CONFIG_DIAGNOSTICS_INTERVAL_MS);
+TimeServer time_server(CONFIG_TIMEZONE);
+Diagnostics diagnostics(MAIN_LOOP_DELAY_MS);
 
 Heatpump heatpump(CONFIG_DEFAULT_MODE, CONFIG_DEFAULT_TARGET_TEMPERATURE);
+CommandShaper command_shaper(CONFIG_COMMAND_SETTLE_MS,
+                             CONFIG_COMMAND_MAX_DELAY_MS,
+                             CONFIG_COMMAND_MIN_INTERVAL_MS);
 
-TemperatureSensor temperature_sensor(CONFIG_TEMPERATURE_SENSOR_GPIO);
+#if defined(CONFIG_SENSOR_FUSION_MEDIAN)
+TemperatureSensor temperature_sensor(SensorFusion::MEDIAN);
+#elif defined(CONFIG_SENSOR_FUSION_MIN)
+TemperatureSensor temperature_sensor(SensorFusion::MIN);
+#elif defined(CONFIG_SENSOR_FUSION_MAX)
+TemperatureSensor temperature_sensor(SensorFusion::MAX);
+#else
+TemperatureSensor temperature_sensor(SensorFusion::AVERAGE);
+#endif
+#if defined(CONFIG_SENSOR_DHT_RMT)
+DHTRmtSensor dht_sensor(CONFIG_TEMPERATURE_SENSOR_GPIO);
+#elif defined(CONFIG_SENSOR_DHT)
+DHTSensor dht_sensor(CONFIG_TEMPERATURE_SENSOR_GPIO);
+#endif
+#ifdef CONFIG_SENSOR_DS18B20
+DS18B20Sensor ds18b20_sensor(CONFIG_SENSOR_DS18B20_GPIO);
+#endif
+#ifdef CONFIG_SENSOR_SHT3X
+SHT3xSensor sht3x_sensor(CONFIG_SENSOR_SHT3X_I2C_PORT,
+                         CONFIG_SENSOR_SHT3X_SDA_GPIO,
+                         CONFIG_SENSOR_SHT3X_SCL_GPIO,
+                         CONFIG_SENSOR_SHT3X_ADDRESS);
+#endif
+#ifdef CONFIG_IR_REPEAT_ADAPTIVE
+IRTransmitter ir_transmitter(CONFIG_IR_TRANSMITTER_GPIO,
+                             CONFIG_IR_TRANSMITTER_PWM_CHANNEL,
+                             CONFIG_IR_TRANSMITTER_PWM_TIMER,
+                             IRRepeatPolicy::ADAPTIVE, CONFIG_IR_REPEAT_COUNT,
+                             CONFIG_IR_LOOPBACK_GPIO, IR_SUPPRESS_DUPLICATES);
+#else
 IRTransmitter ir_transmitter(CONFIG_IR_TRANSMITTER_GPIO,
                              CONFIG_IR_TRANSMITTER_PWM_CHANNEL,
-                             CONFIG_IR_TRANSMITTER_PWM_TIMER);
+                             CONFIG_IR_TRANSMITTER_PWM_TIMER,
+                             IRRepeatPolicy::FIXED, CONFIG_IR_REPEAT_COUNT, -1,
+                             IR_SUPPRESS_DUPLICATES);
+#endif
+
+#ifdef CONFIG_CONTROL_ENGINE
+#ifdef CONFIG_CONTROL_PID
+ControlEngine control_engine(
+    ControlAlgorithm::PID, CONFIG_CONTROL_FILTER_ALPHA_PERCENT / 100.0f, 0,
+    {CONFIG_CONTROL_PID_KP_MILLI / 1000.0f,
+     CONFIG_CONTROL_PID_KI_MILLI / 1000.0f,
+     CONFIG_CONTROL_PID_KD_MILLI / 1000.0f},
+    CONFIG_CONTROL_MAX_SETPOINT_OFFSET, CONFIG_CONTROL_MIN_DWELL_MS,
+    CONFIG_CONTROL_MIN_COMMAND_INTERVAL_MS);
+#else
+ControlEngine control_engine(
+    ControlAlgorithm::HYSTERESIS, CONFIG_CONTROL_FILTER_ALPHA_PERCENT / 100.0f,
+    CONFIG_CONTROL_HYSTERESIS_DECI_C / 10.0f, {0, 0, 0}, 0,
+    CONFIG_CONTROL_MIN_DWELL_MS, CONFIG_CONTROL_MIN_COMMAND_INTERVAL_MS);
+#endif
+#endif
+
+esp_err_t apply_target_state(const char* message);
+esp_err_t handle_local_command(const char* message);
+void apply_scheduled_update(const HeatpumpUpdate& update);
+void replay_message(const char* topic, const char* payload);
+void replay_sensor_reading(float temperature, float humidity);
+void replay_timer(TraceTimer timer);
+#ifdef CONFIG_FAULT_INJECTION
+void inject_fault(Fault fault);
+void clear_fault(Fault fault);
+int64_t fault_recovered_at(Fault fault, int64_t since);
+#endif
+
+Schedule schedule(&apply_scheduled_update);
+
+#ifdef CONFIG_LOCAL_CONTROL
+LocalControlServer local_control(CONFIG_LOCAL_CONTROL_PORT,
+                                 CONFIG_LOCAL_CONTROL_SECRET,
+                                 CONFIG_LOCAL_CONTROL_NONCE_WINDOW_MS,
+                                 &handle_local_command);
+#endif
+
+#ifdef CONFIG_HISTORY_ENABLED
+History history("history", CONFIG_HISTORY_INTERVAL_S);
+#endif
+
+#ifdef CONFIG_OTA_ENABLED
+FirmwareUpdater firmware_updater(CONFIG_OTA_ROLLBACK_TIMEOUT_MS, DEVICE_ID,
+                                 CONFIG_OTA_SECRET);
+#endif
+
+#ifdef CONFIG_FAULT_INJECTION
+FaultInjector fault_injector(CONFIG_FAULT_RECOVERY_TIMEOUT_MS,
+                             {&inject_fault, &clear_fault,
+                              &fault_recovered_at});
+
+// What fault_recovered_at() looks at
+bool is_wifi_connected = false;
+int64_t last_command_applied_at = 0;
+int64_t last_valid_reading_at = 0;
+#endif
+
+TraceRecorder trace_recorder;
+TraceReplayer trace_replayer({&replay_message, &replay_sensor_reading,
+                              &replay_timer});
+
+// Inputs injected by a running trace replay
+TemperatureReading replayed_reading = {0, 0, false};
+bool replayed_telemetry_timer = false;
+
+// Target-state messages addressed to other devices on the shared topic
+uint32_t foreign_commands = 0;
+
+// Everything a state query reports, written by the main loop and read by the
+// MQTT task
+struct StateSnapshot {
+  uint32_t version;
+  Mode mode;
+  int target_temperature;
+  int fan_speed;
+  TemperatureReading reading;
+  OperatingState operating_state;
+  time_t read_at;
+};
+StateSnapshot state_snapshot = {};
+portMUX_TYPE state_snapshot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Retained topic of this device, built at startup
+char commanded_state_topic[128];
+bool should_publish_commanded_state = true;
+
+void update_commanded_snapshot() {
+  portENTER_CRITICAL(&state_snapshot_lock);
+  state_snapshot.version = heatpump.get_version();
+  state_snapshot.mode = heatpump.get_mode();
+  state_snapshot.target_temperature = heatpump.get_target_temperature();
+  state_snapshot.fan_speed = heatpump.get_fan_speed();
+  portEXIT_CRITICAL(&state_snapshot_lock);
+}
+
+void update_sensed_snapshot(const TemperatureReading& reading,
+                            const OperatingState operating_state) {
+  time_t now = time(nullptr);
+  portENTER_CRITICAL(&state_snapshot_lock);
+  state_snapshot.reading = reading;
+  state_snapshot.operating_state = operating_state;
+  state_snapshot.read_at = now;
+  portEXIT_CRITICAL(&state_snapshot_lock);
+}
+
+void publish_commanded_state() {
+  StateSnapshot snapshot;
+  portENTER_CRITICAL(&state_snapshot_lock);
+  snapshot = state_snapshot;
+  portEXIT_CRITICAL(&state_snapshot_lock);
+
+  char message[160];
+  snprintf(message, sizeof(message),
+           "{\"deviceId\":\"%s\",\"version\":%lu,\"mode\":\"%s\","
+           "\"targetTemperature\":%d,\"fanSpeed\":%d,\"timestamp\":\"%s\"}",
+           DEVICE_ID, static_cast<unsigned long>(snapshot.version),
+           mode_to_str(snapshot.mode), snapshot.target_temperature,
+           snapshot.fan_speed, time_server.timestamp());
+  mqtt.publish(commanded_state_topic, message,
+               [](int msg_id, bool delivered) {
+                 if (!delivered) {
+                   should_publish_commanded_state = true;
+                 }
+               });
+}
+
+void handle_get_state(const char* message) {
+  cJSON* root = cJSON_Parse(message);
+  if (!root) {
+    return;
+  }
+
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  cJSON* request_id_item = cJSON_GetObjectItem(root, "requestId");
+  if (!cJSON_IsString(device_id_item) ||
+      strcmp(device_id_item->valuestring, DEVICE_ID) != 0) {
+    cJSON_Delete(root);
+    return;
+  }
+  uint32_t request_id =
+      cJSON_IsNumber(request_id_item) ? request_id_item->valueint : 0;
+  cJSON_Delete(root);
+
+  // Answered from the MQTT task so the reply does not wait for the main loop
+  StateSnapshot snapshot;
+  portENTER_CRITICAL(&state_snapshot_lock);
+  snapshot = state_snapshot;
+  portEXIT_CRITICAL(&state_snapshot_lock);
+
+  char timestamp[TIMESTAMP_SIZE];
+  TimeServer::format_timestamp(snapshot.read_at, timestamp);
+
+  char reply[320];
+  snprintf(reply, sizeof(reply),
+           "{\"deviceId\":\"%s\",\"requestId\":%lu,\"version\":%lu,"
+           "\"mode\":\"%s\",\"targetTemperature\":%d,\"fanSpeed\":%d,"
+           "\"operatingState\":\"%s\",\"currentTemperature\":%.1f,"
+           "\"currentHumidity\":%.1f,\"valid\":%s,\"timestamp\":\"%s\"}",
+           DEVICE_ID, static_cast<unsigned long>(request_id),
+           static_cast<unsigned long>(snapshot.version),
+           mode_to_str(snapshot.mode), snapshot.target_temperature,
+           snapshot.fan_speed,
+           operating_state_to_str(snapshot.operating_state),
+           snapshot.reading.temperature, snapshot.reading.humidity,
+           snapshot.reading.is_valid ? "true" : "false", timestamp);
+  mqtt.publish(MQTT_STATE_TOPIC, reply);
+}
+
+void transmit_state() {
+#ifdef CONFIG_CONTROL_ENGINE
+  ControlOutput output = control_engine.get_output();
+  const char* signal = heatpump.to_binary_state(
+      output.is_on, output.target_temperature, output.fan_speed);
+#else
+  const char* signal = heatpump.to_binary_state();
+#endif
+  trace_recorder.record_ir_frame(signal);
+  ir_transmitter.transmit_ir_signal(signal);
+}
+
+void reset_control_engine() {
+#ifdef CONFIG_CONTROL_ENGINE
+  control_engine.reset(heatpump.get_mode(), heatpump.get_target_temperature(),
+                       heatpump.get_fan_speed());
+#endif
+}
+
+void handle_target_state(const char* message) {
+  SteadyStateScope steady_state;
+
+  // Ignore invalid messages
+  cJSON* root = cJSON_Parse(message);
+  if (!root) {
+    return;
+  }
+
+  // Ignore message that don't have deviceId or it doesn't match this device
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  if (!cJSON_IsString(device_id_item) ||
+      strcmp(device_id_item->valuestring, DEVICE_ID) != 0) {
+    foreign_commands++;
+    cJSON_Delete(root);
+    return;
+  }
+  cJSON_Delete(root);
+
+  apply_target_state(message);
+}
+
+esp_err_t handle_local_command(const char* message) {
+  SteadyStateScope steady_state;
+
+  // Same schema as the target-state topic, but a LAN request is always
+  // meant for this device
+  cJSON* root = cJSON_Parse(message);
+  if (!root) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  bool is_for_this_device = cJSON_IsString(device_id_item) &&
+                            strcmp(device_id_item->valuestring, DEVICE_ID) == 0;
+  cJSON_Delete(root);
+  if (!is_for_this_device) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  return apply_target_state(message);
+}
+
+esp_err_t apply_target_state(const char* message) {
+  trace_recorder.record_message(MQTT_TARGET_STATE_TOPIC, message);
+
+  HeatpumpUpdate update;
+  esp_err_t err = Heatpump::parse_update(message, update);
+  if (err != ESP_OK) {
+    printf("Error parsing heatpump update from JSON message '%s': %s\n",
+           message, esp_err_to_name(err));
+    return err;
+  }
+
+#ifdef CONFIG_FAULT_INJECTION
+  fault_injector.record_command_received();
+#endif
+
+  // Bursts of commands are merged, the main loop applies the converged state
+  command_shaper.submit(update);
+  return ESP_OK;
+}
+
+void apply_scheduled_update(const HeatpumpUpdate& update) {
+  // Runs on the timer task, the main loop applies it like any other command
+  command_shaper.submit(update);
+}
+
+void handle_schedule(const char* message) {
+  cJSON* root = cJSON_Parse(message);
+  if (!root) {
+    return;
+  }
+
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  if (!cJSON_IsString(device_id_item) ||
+      strcmp(device_id_item->valuestring, DEVICE_ID) != 0) {
+    cJSON_Delete(root);
+    return;
+  }
+
+  esp_err_t err = schedule.populate_from_json(root);
+  if (err != ESP_OK) {
+    printf("Error updating schedule from JSON message '%s': %s\n", message,
+           esp_err_to_name(err));
+  } else {
+    printf("Updated schedule: %u entries\n",
+           static_cast<unsigned>(schedule.size()));
+  }
+
+  cJSON_Delete(root);
+}
+
+void apply_update(const HeatpumpUpdate& update) {
+  bool changed;
+  esp_err_t err = heatpump.apply(update, changed);
+  if (err != ESP_OK) {
+    printf("Error applying heatpump update: %s\n", esp_err_to_name(err));
+#ifdef CONFIG_FAULT_INJECTION
+    fault_injector.record_command_failed();
+#endif
+    return;
+  }
+#ifdef CONFIG_FAULT_INJECTION
+  last_command_applied_at = esp_timer_get_time();
+#endif
+
+  // Force run immediately to apply the changes
+  loop_manager.force_run();
+
+  // Transmit new state. A repeated command is sent again too, e.g. to resync
+  // a unit that missed a frame, unless IR_SUPPRESS_DUPLICATES drops it.
+  if (changed) {
+    reset_control_engine();
+  }
+  transmit_state();
+
+  if (!changed) {
+    return;
+  }
+
+  update_commanded_snapshot();
+  should_publish_commanded_state = true;
+
+  Mode mode = heatpump.get_mode();
+  int target_temperature = heatpump.get_target_temperature();
+  printf("Set target state: mode=%s, target_temperature=%d\n",
+         mode_to_str(mode), target_temperature);
+}
+
+void replay_message(const char* topic, const char* payload) {
+  // Recorded messages already passed the deviceId check on the recording unit
+  if (strcmp(topic, MQTT_TARGET_STATE_TOPIC) == 0) {
+    apply_target_state(payload);
+  }
+}
+
+void replay_sensor_reading(float temperature, float humidity) {
+  replayed_reading = {temperature, humidity, true};
+}
+
+void replay_timer(TraceTimer timer) {
+  if (timer == TraceTimer::TELEMETRY) {
+    replayed_telemetry_timer = true;
+  }
+}
+
+constexpr size_t HEX_CHUNK_SIZE = 256;
+
+// Publishes {"deviceId":"...",<fields>,"data":"<hex>"} with up to
+// HEX_CHUNK_SIZE bytes of data, or prints it after serial_prefix on the
+// console when one is given
+void publish_hex_chunk(const char* topic, const char* serial_prefix,
+                       const char* fields, const uint8_t* data,
+                       size_t length) {
+  static char message[HEX_CHUNK_SIZE * 2 + 128];
+  static const char* HEX = "0123456789abcdef";
+
+  int written = snprintf(message, sizeof(message),
+                         "{\"deviceId\":\"%s\",%s,\"data\":\"", DEVICE_ID,
+                         fields);
+  if (written < 0 || written + length * 2 + 3 > sizeof(message)) {
+    printf("Error publishing chunk to topic %s: too large\n", topic);
+    return;
+  }
+  for (size_t i = 0; i < length; i++) {
+    message[written++] = HEX[data[i] >> 4];
+    message[written++] = HEX[data[i] & 0x0F];
+  }
+  snprintf(message + written, sizeof(message) - written, "\"}");
+
+  if (serial_prefix != nullptr) {
+    printf("%s %s\n", serial_prefix, message);
+  } else {
+    mqtt.publish(topic, message);
+  }
+}
+
+#ifdef CONFIG_TRACE_ENABLED
+
+size_t trace_dump_offset = 0;
+bool is_dumping_trace = false;
+bool is_dumping_trace_to_serial = false;
+
+void handle_trace_command(const char* message) {
+  cJSON* root = cJSON_Parse(message);
+  if (!root) {
+    return;
+  }
+
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  cJSON* action_item = cJSON_GetObjectItem(root, "action");
+  if (!cJSON_IsString(device_id_item) ||
+      strcmp(device_id_item->valuestring, DEVICE_ID) != 0 ||
+      !cJSON_IsString(action_item)) {
+    cJSON_Delete(root);
+    return;
+  }
+
+  const char* action = action_item->valuestring;
+  esp_err_t err = ESP_OK;
+  if (strcmp(action, "start") == 0) {
+    trace_recorder.start();
+  } else if (strcmp(action, "stop") == 0) {
+    trace_recorder.stop();
+  } else if (strcmp(action, "dump") == 0) {
+    trace_recorder.stop();
+    trace_dump_offset = 0;
+    is_dumping_trace_to_serial =
+        cJSON_IsTrue(cJSON_GetObjectItem(root, "serial"));
+    is_dumping_trace = true;
+  } else if (strcmp(action, "load") == 0) {
+    cJSON* offset_item = cJSON_GetObjectItem(root, "offset");
+    cJSON* size_item = cJSON_GetObjectItem(root, "size");
+    cJSON* data_item = cJSON_GetObjectItem(root, "data");
+    if (cJSON_IsNumber(offset_item) && cJSON_IsNumber(size_item) &&
+        cJSON_IsString(data_item)) {
+      err = trace_replayer.load_chunk(offset_item->valueint,
+                                      data_item->valuestring,
+                                      size_item->valueint);
+    } else {
+      err = ESP_ERR_INVALID_ARG;
+    }
+  } else if (strcmp(action, "replay") == 0) {
+    // Record the replay so it can be compared with the original trace
+    trace_recorder.start();
+    err = trace_replayer.start();
+  }
+
+  if (err != ESP_OK) {
+    printf("Error handling trace action '%s': %s\n", action,
+           esp_err_to_name(err));
+  }
+
+  cJSON_Delete(root);
+}
+
+void dump_trace_chunk() {
+  size_t size = trace_recorder.size();
+  size_t length = size - trace_dump_offset;
+  if (length > HEX_CHUNK_SIZE) {
+    length = HEX_CHUNK_SIZE;
+  }
+
+  char fields[48];
+  snprintf(fields, sizeof(fields), "\"offset\":%u,\"size\":%u",
+           static_cast<unsigned>(trace_dump_offset),
+           static_cast<unsigned>(size));
+  publish_hex_chunk(MQTT_TRACE_DUMP_TOPIC,
+                    is_dumping_trace_to_serial ? "TRACE" : nullptr, fields,
+                    trace_recorder.data() + trace_dump_offset, length);
+
+  trace_dump_offset += length;
+  if (trace_dump_offset >= size) {
+    is_dumping_trace = false;
+  }
+}
+#endif
+
+#ifdef CONFIG_FAULT_INJECTION
+// {"deviceId":"...","fault":"wifi|mqtt|nvs|sensor","durationMs":5000}
+void handle_fault_command(const char* message) {
+  cJSON* root = cJSON_Parse(message);
+  if (!root) {
+    return;
+  }
+
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  cJSON* fault_item = cJSON_GetObjectItem(root, "fault");
+  cJSON* duration_item = cJSON_GetObjectItem(root, "durationMs");
+  if (!cJSON_IsString(device_id_item) ||
+      strcmp(device_id_item->valuestring, DEVICE_ID) != 0 ||
+      !cJSON_IsString(fault_item) || !cJSON_IsNumber(duration_item) ||
+      duration_item->valuedouble < 0) {
+    cJSON_Delete(root);
+    return;
+  }
+
+  esp_err_t err = fault_injector.start(str_to_fault(fault_item->valuestring),
+                                       duration_item->valuedouble);
+  if (err != ESP_OK) {
+    printf("Error starting fault '%s': %s\n", fault_item->valuestring,
+           esp_err_to_name(err));
+  }
+
+  cJSON_Delete(root);
+}
+
+void inject_fault(Fault fault) {
+  // Wi-Fi stays down through the checks in WiFiManager. For a broker outage
+  // the client is restarted against a port that refuses connects, which drops
+  // its connection and leaves it retrying every reconnect timeout, as it does
+  // while the broker is down.
+  if (fault == Fault::WIFI) {
+    esp_wifi_disconnect();
+  } else if (fault == Fault::MQTT) {
+    mqtt.set_broker_uri(UNREACHABLE_BROKER_URI);
+    mqtt.stop();
+    esp_err_t err = mqtt.start();
+    if (err != ESP_OK) {
+      printf("Error restarting MQTT client: %s\n", esp_err_to_name(err));
+    }
+  }
+}
+
+// Not nudged, the next scheduled retry finds the broker again
+void clear_fault(Fault fault) {
+  if (fault == Fault::MQTT) {
+    esp_err_t err = mqtt.set_broker_uri(CONFIG_MQTT_BROKER_URL);
+    if (err != ESP_OK) {
+      printf("Error restoring MQTT broker: %s\n", esp_err_to_name(err));
+    }
+  }
+}
+
+// Network faults are sampled every main loop pass, the others are stamped
+// when the first command or reading gets through
+int64_t fault_recovered_at(Fault fault, int64_t since) {
+  switch (fault) {
+    case Fault::WIFI:
+      return is_wifi_connected && mqtt.is_ready() ? esp_timer_get_time() : 0;
+    case Fault::MQTT:
+      return mqtt.is_ready() ? esp_timer_get_time() : 0;
+    case Fault::NVS:
+      return last_command_applied_at > since ? last_command_applied_at : 0;
+    case Fault::SENSOR:
+      return last_valid_reading_at > since ? last_valid_reading_at : 0;
+    default:
+      return esp_timer_get_time();
+  }
+}
+
+void publish_fault_report(const FaultReport& report) {
+  char message[256];
+  snprintf(message, sizeof(message),
+           "{\"deviceId\":\"%s\",\"fault\":\"%s\",\"durationMs\":%lu,"
+           "\"recovered\":%s,\"recoveryMs\":%lu,\"commandsReceived\":%lu,"
+           "\"commandsFailed\":%lu,\"telemetryGapMs\":%lu}",
+           DEVICE_ID, fault_to_str(report.fault),
+           static_cast<unsigned long>(report.duration_ms),
+           report.recovered ? "true" : "false",
+           static_cast<unsigned long>(report.recovery_ms),
+           static_cast<unsigned long>(report.commands_received),
+           static_cast<unsigned long>(report.commands_failed),
+           static_cast<unsigned long>(report.telemetry_gap_ms));
+
+  // Also on the console, the report of an unrecovered unit may never arrive
+  printf("FAULT %s\n", message);
+  mqtt.publish(MQTT_FAULT_REPORT_TOPIC, message);
+}
+#endif
+
+#ifdef CONFIG_TIMELINE_ENABLED
+size_t timeline_dump_offset = 0;
+bool is_dumping_timeline = false;
+bool is_dumping_timeline_to_serial = false;
+
+// Actions: "dump" freezes the ring and sends it in chunks, recording starts
+// over afterwards. "clear" drops the recorded events.
+void handle_timeline_command(const char* message) {
+  cJSON* root = cJSON_Parse(message);
+  if (!root) {
+    return;
+  }
+
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  cJSON* action_item = cJSON_GetObjectItem(root, "action");
+  if (!cJSON_IsString(device_id_item) ||
+      strcmp(device_id_item->valuestring, DEVICE_ID) != 0 ||
+      !cJSON_IsString(action_item)) {
+    cJSON_Delete(root);
+    return;
+  }
+
+  const char* action = action_item->valuestring;
+  if (strcmp(action, "dump") == 0 && !is_dumping_timeline) {
+    timeline_stop();
+    timeline_dump_offset = 0;
+    is_dumping_timeline_to_serial =
+        cJSON_IsTrue(cJSON_GetObjectItem(root, "serial"));
+    is_dumping_timeline = true;
+  } else if (strcmp(action, "clear") == 0 && !is_dumping_timeline) {
+    timeline_start();
+  } else {
+    printf("Error handling timeline action '%s'\n", action);
+  }
+
+  cJSON_Delete(root);
+}
+
+void dump_timeline_chunk() {
+  static uint8_t chunk[HEX_CHUNK_SIZE];
+
+  size_t size = timeline_size();
+  size_t length = timeline_read(timeline_dump_offset, chunk, sizeof(chunk));
+
+  char fields[48];
+  snprintf(fields, sizeof(fields), "\"offset\":%u,\"size\":%u",
+           static_cast<unsigned>(timeline_dump_offset),
+           static_cast<unsigned>(size));
+  publish_hex_chunk(MQTT_TIMELINE_DUMP_TOPIC,
+                    is_dumping_timeline_to_serial ? "TIMELINE" : nullptr,
+                    fields, chunk, length);
+
+  timeline_dump_offset += length;
+  if (length == 0 || timeline_dump_offset >= size) {
+    is_dumping_timeline = false;
+    timeline_start();
+  }
+}
+#endif
+
+#ifdef CONFIG_HISTORY_ENABLED
+uint32_t history_request_id = 0;
+uint32_t history_chunk_seq = 0;
+
+void handle_history_request(const char* message) {
+  cJSON* root = cJSON_Parse(message);
+  if (!root) {
+    return;
+  }
+
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  cJSON* from_item = cJSON_GetObjectItem(root, "from");
+  cJSON* to_item = cJSON_GetObjectItem(root, "to");
+  cJSON* request_id_item = cJSON_GetObjectItem(root, "requestId");
+  if (!cJSON_IsString(device_id_item) ||
+      strcmp(device_id_item->valuestring, DEVICE_ID) != 0) {
+    cJSON_Delete(root);
+    return;
+  }
+
+  // Both bounds are optional Unix timestamps
+  uint32_t from = cJSON_IsNumber(from_item) && from_item->valuedouble > 0
+                      ? static_cast<uint32_t>(from_item->valuedouble)
+                      : 0;
+  uint32_t to = cJSON_IsNumber(to_item) && to_item->valuedouble > 0
+                    ? static_cast<uint32_t>(to_item->valuedouble)
+                    : UINT32_MAX;
+  uint32_t request_id =
+      cJSON_IsNumber(request_id_item) ? request_id_item->valueint : 0;
+  cJSON_Delete(root);
+
+  // Only this handler starts queries, so the ids can be set before the main
+  // loop starts publishing chunks
+  if (history.is_querying()) {
+    printf("Error starting history query: another one is running\n");
+    return;
+  }
+  history_request_id = request_id;
+  history_chunk_seq = 0;
+
+  esp_err_t err = history.start_query(from, to);
+  if (err != ESP_OK) {
+    printf("Error starting history query: %s\n", esp_err_to_name(err));
+  }
+}
+
+void publish_history_chunk() {
+  static uint8_t chunk[HEX_CHUNK_SIZE];
+
+  size_t length;
+  bool is_last;
+  if (!history.next_chunk(chunk, sizeof(chunk), length, is_last)) {
+    return;
+  }
+
+  char fields[64];
+  snprintf(fields, sizeof(fields), "\"requestId\":%lu,\"seq\":%lu,\"last\":%s",
+           static_cast<unsigned long>(history_request_id),
+           static_cast<unsigned long>(history_chunk_seq),
+           is_last ? "true" : "false");
+  publish_hex_chunk(MQTT_HISTORY_TOPIC, nullptr, fields, chunk, length);
+  history_chunk_seq++;
+}
+
+void record_history(const TemperatureReading& reading,
+                    const OperatingState operating_state) {
+  // Samples are keyed by wall-clock time, which is unknown until SNTP synced
+  if (!reading.is_valid || !TimeServer::is_synced()) {
+    return;
+  }
+
+  HistorySample sample = {
+      static_cast<uint32_t>(time(nullptr)),
+      static_cast<int16_t>(lroundf(reading.temperature * 10)),
+      static_cast<uint16_t>(lroundf(reading.humidity * 10)),
+      operating_state,
+      heatpump.get_mode(),
+      static_cast<uint8_t>(heatpump.get_target_temperature()),
+      static_cast<uint8_t>(heatpump.get_fan_speed())};
+  history.record(sample);
+}
+#endif
+
+#ifdef CONFIG_OTA_ENABLED
+// {"deviceId":"...","url":"https://...","sha256":"...","nonce":1700000000000,
+//  "mac":"..."}, see FirmwareRequest
+void handle_ota_request(const char* message) {
+  cJSON* root = cJSON_Parse(message);
+  if (!root) {
+    return;
+  }
+
+  cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
+  cJSON* url_item = cJSON_GetObjectItem(root, "url");
+  cJSON* sha256_item = cJSON_GetObjectItem(root, "sha256");
+  cJSON* nonce_item = cJSON_GetObjectItem(root, "nonce");
+  cJSON* mac_item = cJSON_GetObjectItem(root, "mac");
+  if (!cJSON_IsString(device_id_item) ||
+      strcmp(device_id_item->valuestring, DEVICE_ID) != 0 ||
+      !cJSON_IsString(url_item) || !cJSON_IsString(sha256_item) ||
+      !cJSON_IsNumber(nonce_item) || nonce_item->valuedouble < 0 ||
+      !cJSON_IsString(mac_item)) {
+    cJSON_Delete(root);
+    return;
+  }
+
+  FirmwareRequest request = {url_item->valuestring, sha256_item->valuestring,
+                             static_cast<uint64_t>(nonce_item->valuedouble),
+                             mac_item->valuestring};
+  esp_err_t err = firmware_updater.start(request);
+  if (err != ESP_OK) {
+    printf("Error starting firmware update: %s\n", esp_err_to_name(err));
+  } else {
+    printf("Updating firmware from %s\n", url_item->valuestring);
+  }
+
+  cJSON_Delete(root);
+}
+#endif
+
+void publish_diagnostics() {
+  DiagnosticsReport report = {};
+  diagnostics.collect(report);
+
+  report.heap_allocations = heap_monitor_get_stats().allocations;
+  report.wifi_reconnects = wifi.get_stats().reconnects;
+
+  MQTTStats mqtt_stats = mqtt.get_stats();
+  report.mqtt_reconnects = mqtt_stats.reconnects;
+  report.mqtt_publish_failures = mqtt_stats.publish_failures;
+  report.mqtt_messages_received = mqtt_stats.messages_received;
+  report.mqtt_messages_published = mqtt_stats.messages_published;
+  report.mqtt_bytes_received = mqtt_stats.bytes_received;
+  report.mqtt_bytes_published = mqtt_stats.bytes_published;
+  report.mqtt_connects = mqtt_stats.connects;
+  report.mqtt_connect_failures = mqtt_stats.connect_failures;
+  report.mqtt_last_connect_ms = mqtt_stats.last_connect_ms;
+  report.mqtt_max_connect_ms = mqtt_stats.max_connect_ms;
+  report.mqtt_publishes_acked = mqtt_stats.publishes_acked;
+  report.mqtt_publishes_expired = mqtt_stats.publishes_expired;
+  report.mqtt_publishes_untracked = mqtt_stats.publishes_untracked;
+  report.mqtt_last_ack_ms = mqtt_stats.last_ack_ms;
+  report.mqtt_max_ack_ms = mqtt_stats.max_ack_ms;
+  report.mqtt_publishes_pending = mqtt_stats.publishes_pending;
+  report.mqtt_outbox_bytes = mqtt_stats.outbox_bytes;
+  report.foreign_commands = foreign_commands;
+
+  TemperatureSensorStats sensor_stats = temperature_sensor.get_stats();
+  report.sensor_reads = sensor_stats.reads;
+  report.sensor_errors = sensor_stats.errors;
+  report.sensor_count = temperature_sensor.get_sensor_count();
+  for (size_t i = 0; i < report.sensor_count; i++) {
+    report.sensors[i] = temperature_sensor.get_sensor_status(i);
+  }
+
+#ifdef CONFIG_SENSOR_DHT_RMT
+  DHTCaptureStats dht_stats = dht_sensor.get_stats();
+  report.dht_reads = dht_stats.reads;
+  report.dht_decoded = dht_stats.decoded;
+  report.dht_timeouts = dht_stats.timeouts;
+  report.dht_timing_errors = dht_stats.timing_errors;
+  report.dht_checksum_errors = dht_stats.checksum_errors;
+  report.dht_last_decode_us = dht_stats.last_decode_us;
+  report.dht_max_decode_us = dht_stats.max_decode_us;
+#endif
+
+  report.nvs_commits = heatpump.get_stats().nvs_commits;
+
+  CommandShaperStats command_stats = command_shaper.get_stats();
+  report.commands_received = command_stats.received;
+  report.commands_merged = command_stats.merged;
+  report.commands_applied = command_stats.applied;
+
+  IRStats ir_stats = ir_transmitter.get_stats();
+  report.ir_frames_sent = ir_stats.frames_sent;
+  report.ir_frames_suppressed = ir_stats.frames_suppressed;
+  report.ir_frames_repeated = ir_stats.frames_repeated;
+  report.ir_frames_unconfirmed = ir_stats.frames_unconfirmed;
+
+  report.schedule_entries = schedule.size();
+  report.schedule_transitions = schedule.get_stats().transitions;
+
+#ifdef CONFIG_LOCAL_CONTROL
+  LocalControlStats local_stats = local_control.get_stats();
+  report.local_requests = local_stats.requests;
+  report.local_rejected = local_stats.rejected;
+  report.local_failed = local_stats.failed;
+  report.local_last_latency_us = local_stats.last_latency_us;
+  report.local_max_latency_us = local_stats.max_latency_us;
+#endif
+
+#ifdef CONFIG_HISTORY_ENABLED
+  HistoryStats history_stats = history.get_stats();
+  report.history_samples = history_stats.samples;
+  report.history_sector_erases = history_stats.sector_erases;
+  report.history_write_errors = history_stats.write_errors;
+  report.history_queries = history_stats.queries;
+#endif
+
+#ifdef CONFIG_OTA_ENABLED
+  FirmwareUpdateStats ota_stats = firmware_updater.get_stats();
+  report.ota_downloaded_bytes = ota_stats.downloaded_bytes;
+  report.ota_image_bytes = ota_stats.image_bytes;
+  report.ota_apply_ms = ota_stats.apply_ms;
+  report.ota_updates = ota_stats.updates;
+  report.ota_failures = ota_stats.failures;
+  report.ota_rollbacks = ota_stats.rollbacks;
+#endif
+
+#ifdef CONFIG_CONTROL_ENGINE
+  ControlStats control_stats = control_engine.get_stats();
+  report.control_commands = control_stats.commands;
+  report.control_rate_limited = control_stats.rate_limited;
+  report.control_dwell_limited = control_stats.dwell_limited;
+#endif
+
+  // Static, the full report no longer fits comfortably on the main stack
+  static char message[1280];
+  esp_err_t err = diagnostics.to_json(report, DEVICE_ID, message,
+                                      sizeof(message));
+  if (err != ESP_OK) {
+    printf("Error encoding diagnostics: %s\n", esp_err_to_name(err));
+    return;
+  }
+  mqtt.publish(MQTT_DIAGNOSTICS_TOPIC, message);
+}
+
+void publish_current_state(const TemperatureReading& reading) {
+  // The reading is recorded before the timer so a replay has it in place by
+  // the time the timer fires
+  trace_recorder.record_sensor_reading(reading.temperature, reading.humidity);
+  trace_recorder.record_timer(TraceTimer::TELEMETRY);
+
+  int target_temperature = heatpump.get_target_temperature();
+  Mode mode = heatpump.get_mode();
+
+#ifdef CONFIG_CONTROL_ENGINE
+  if (reading.is_valid && control_engine.update(reading.temperature)) {
+    transmit_state();
+  }
+  bool is_on = control_engine.get_output().is_on;
+#else
+  bool is_on = true;
+#endif
+
+  // Since we don't know exactly what the heatpump does right now, we just
+  // estimate based on target and current temperatures.
+  OperatingState operating_state = OperatingState::IDLE;
+  if (!is_on) {
+    operating_state = OperatingState::IDLE;
+  } else if (reading.temperature > target_temperature &&
+             (mode == Mode::AUTO || mode == Mode::COOL)) {
+    operating_state = OperatingState::COOLING;
+  } else if (reading.temperature < target_temperature &&
+             (mode == Mode::AUTO || mode == Mode::HEAT)) {
+    operating_state = OperatingState::HEATING;
+  } else {
+    operating_state = OperatingState::IDLE;
+  }
+
+  update_sensed_snapshot(reading, operating_state);
+
+#ifdef CONFIG_HISTORY_ENABLED
+  record_history(reading, operating_state);
+#endif
+
+  char message[165];
+  snprintf(message, sizeof(message),
+           "{\"deviceId\":\"%s\",\"operatingState\":\"%s\","
+           "\"currentTemperature\":%.1f,\"currentHumidity\":%.1f,"
+           "\"timestamp\":\"%s\"}",
+           DEVICE_ID, operating_state_to_str(operating_state),
+           reading.temperature, reading.humidity, time_server.timestamp());
+
+#ifdef CONFIG_FAULT_INJECTION
+  if (reading.is_valid) {
+    last_valid_reading_at = esp_timer_get_time();
+  }
+  if (mqtt.publish(MQTT_CURRENT_STATE_TOPIC, message) >= 0 &&
+      reading.is_valid) {
+    fault_injector.record_telemetry();
+  }
+#else
+  mqtt.publish(MQTT_CURRENT_STATE_TOPIC, message);
+#endif
+}
 
 extern "C" void app_main(void) {
-  esp_err_t err = nvs_flash_init();
+  esp_err_t err = json_arena_init();
+  if (err != ESP_OK) {
+    printf("Error initializing JSON arena: %s\n", esp_err_to_name(err));
+    esp_restart();
+  }
+
+  err = nvs_flash_init();
   if (err != ESP_OK) {
     printf("Error initializing NVS: %s\n", esp_err_to_name(err));
     esp_restart();
@@ -60,6 +1054,15 @@ extern "C" void app_main(void) {
     esp_restart();
   }
 
+#ifdef CONFIG_SENSOR_DHT
+  temperature_sensor.add_sensor(&dht_sensor);
+#endif
+#ifdef CONFIG_SENSOR_DS18B20
+  temperature_sensor.add_sensor(&ds18b20_sensor);
+#endif
+#ifdef CONFIG_SENSOR_SHT3X
+  temperature_sensor.add_sensor(&sht3x_sensor);
+#endif
   err = temperature_sensor.init();
   if (err != ESP_OK) {
     printf("Error initializing temperature sensor: %s\n", esp_err_to_name(err));
@@ -72,6 +1075,37 @@ extern "C" void app_main(void) {
     esp_restart();
   }
 
+#ifdef CONFIG_LOCAL_CONTROL
+  err = local_control.init();
+  if (err != ESP_OK) {
+    printf("Error initializing local control: %s\n", esp_err_to_name(err));
+    esp_restart();
+  }
+#endif
+
+  err = schedule.init();
+  if (err != ESP_OK) {
+    printf("Error initializing schedule: %s\n", esp_err_to_name(err));
+    esp_restart();
+  }
+
+#ifdef CONFIG_OTA_ENABLED
+  // Not fatal, without it the bootloader still rolls back an image that
+  // keeps crashing
+  err = firmware_updater.init();
+  if (err != ESP_OK) {
+    printf("Error initializing firmware updater: %s\n", esp_err_to_name(err));
+  }
+#endif
+
+#ifdef CONFIG_HISTORY_ENABLED
+  // Not fatal, the controller works without its history
+  err = history.init();
+  if (err != ESP_OK) {
+    printf("Error initializing history: %s\n", esp_err_to_name(err));
+  }
+#endif
+
   wifi.on_connect([]() {
     esp_err_t err = time_server.init();
     if (err != ESP_OK) {
@@ -80,6 +1114,8 @@ extern "C" void app_main(void) {
     }
   });
 
+  // The MQTT client is kept running across Wi-Fi outages and reconnects on its
+  // own, so a short dropout does not cost a full session teardown
   wifi.on_connect([]() {
     esp_err_t err = mqtt.start();
     if (err != ESP_OK) {
@@ -88,84 +1124,159 @@ extern "C" void app_main(void) {
     }
   });
 
-  wifi.on_disconnect([]() {
-    esp_err_t err = mqtt.stop();
-    if (err != ESP_OK) {
-      printf("Error stopping MQTT client: %s\n", esp_err_to_name(err));
-      esp_restart();
+#ifdef CONFIG_OTA_ENABLED
+  // Reaching the broker is what makes new firmware good
+  mqtt.on_connect([]() { firmware_updater.confirm(); });
+  mqtt.subscribe(MQTT_OTA_TOPIC, &handle_ota_request);
+#endif
+
+  // Telemetry is superseded by the next report, the commanded state has to
+  // arrive. It is also published again after every reconnect, in case the
+  // broker lost the session.
+  snprintf(commanded_state_topic, sizeof(commanded_state_topic), "%s/%s",
+           CONFIG_MQTT_COMMANDED_STATE_TOPIC, DEVICE_ID);
+  mqtt.set_topic_options(MQTT_CURRENT_STATE_TOPIC, CONFIG_MQTT_TELEMETRY_QOS,
+                         CONFIG_MQTT_RETENTION_POLICY != 0);
+  mqtt.set_topic_options(MQTT_DIAGNOSTICS_TOPIC, CONFIG_MQTT_TELEMETRY_QOS,
+                         false);
+  mqtt.set_topic_options(commanded_state_topic, CONFIG_MQTT_STATE_QOS, true);
+  update_commanded_snapshot();
+  mqtt.on_connect([]() { should_publish_commanded_state = true; });
+
+#ifdef CONFIG_FAULT_INJECTION
+  err = fault_injector.init();
+  if (err != ESP_OK) {
+    printf("Error initializing fault injector: %s\n", esp_err_to_name(err));
+  }
+  wifi.on_connect([]() { is_wifi_connected = true; });
+  wifi.on_disconnect([]() { is_wifi_connected = false; });
+  mqtt.subscribe(MQTT_FAULT_TOPIC, &handle_fault_command);
+#endif
+
+  mqtt.subscribe(MQTT_TARGET_STATE_TOPIC, &handle_target_state);
+  mqtt.subscribe(MQTT_GET_STATE_TOPIC, &handle_get_state);
+  mqtt.subscribe(MQTT_SCHEDULE_TOPIC, &handle_schedule);
+#ifdef CONFIG_HISTORY_ENABLED
+  mqtt.subscribe(MQTT_HISTORY_REQUEST_TOPIC, &handle_history_request);
+#endif
+#ifdef CONFIG_TIMELINE_ENABLED
+  mqtt.subscribe(MQTT_TIMELINE_TOPIC, &handle_timeline_command);
+#endif
+#ifdef CONFIG_TRACE_ENABLED
+  mqtt.subscribe(MQTT_TRACE_TOPIC, &handle_trace_command);
+#endif
+
+  diagnostics.track_task("main");
+  diagnostics.track_task("mqtt_task");
+  diagnostics.track_task("tiT");
+  diagnostics.track_task("sys_evt");
+  diagnostics.track_task("esp_timer");
+
+  // Transmit saved state on startup
+  reset_control_engine();
+  transmit_state();
+
+  // Publish the current state right away. This also warms up newlib's lazily
+  // allocated formatting buffers, everything after it runs in steady state and
+  // should not touch the heap.
+  temperature_sensor.start();
+  TemperatureReading reading;
+  while (!temperature_sensor.collect(reading)) {
+    vTaskDelay(pdMS_TO_TICKS(MAIN_LOOP_DELAY_MS));
+  }
+  publish_current_state(reading);
+  heap_monitor_seal();
+  uint32_t reported_allocations = 0;
+
+  while (true) {
+    SteadyStateScope steady_state;
+    diagnostics.record_loop_iteration();
+    mqtt.expire_stale_publishes();
+
+    HeapMonitorStats heap_stats = heap_monitor_get_stats();
+    if (heap_stats.allocations != reported_allocations) {
+      printf("Warning: %lu heap allocations (%lu bytes) after init\n",
+             static_cast<unsigned long>(heap_stats.allocations),
+             static_cast<unsigned long>(heap_stats.bytes));
+      reported_allocations = heap_stats.allocations;
     }
-  });
 
-  mqtt.subscribe(MQTT_TARGET_STATE_TOPIC, [](const char* message) {
-    // Ignore invalid messages
-    cJSON* root = cJSON_Parse(message);
-    if (!root) {
-      return;
+    // Transitions that passed while the clock was unset are not replayed, the
+    // schedule starts with the next one
+    if (!schedule.is_armed() && time_server.is_synced()) {
+      esp_err_t err = schedule.arm();
+      if (err != ESP_OK) {
+        printf("Error arming schedule: %s\n", esp_err_to_name(err));
+      }
     }
 
-    // Ignore message that don't have deviceId or it doesn't match this device
-    cJSON* device_id_item = cJSON_GetObjectItem(root, "deviceId");
-    if (!cJSON_IsString(device_id_item) ||
-        strcmp(device_id_item->valuestring, DEVICE_ID) != 0) {
-      cJSON_Delete(root);
-      return;
+    HeatpumpUpdate update;
+    if (command_shaper.poll(update)) {
+      apply_update(update);
     }
-    cJSON_Delete(root);
 
-    esp_err_t err = heatpump.populate_from_json(message);
-    if (err != ESP_OK) {
-      printf("Error populating heatpump from JSON message '%s': %s\n", message,
-             esp_err_to_name(err));
-      return;
+    // Cleared first, so a reconnect while publishing triggers another one
+    if (should_publish_commanded_state) {
+      should_publish_commanded_state = false;
+      publish_commanded_state();
     }
 
-    // Force run immediately to apply the changes
-    loop_manager.force_run();
+    // While a trace is replayed only its timer drives telemetry, so the replay
+    // follows the recorded timeline
+    bool should_run = false;
+    if (trace_replayer.is_running()) {
+      should_run = replayed_telemetry_timer;
+      replayed_telemetry_timer = false;
+    } else {
+      should_run = loop_manager.should_run();
+    }
 
-    // Transmit new state
-    const char* signal = heatpump.to_binary_state();
-    ir_transmitter.transmit_ir_signal(signal);
+    // Sensors convert in the background, the state is published once all of
+    // them have been collected
+    if (should_run) {
+      if (trace_replayer.is_running()) {
+        publish_current_state(replayed_reading);
+      } else {
+        temperature_sensor.start();
+      }
+    }
 
-    Mode mode = heatpump.get_mode();
-    int target_temperature = heatpump.get_target_temperature();
-    printf("Set target state: mode=%s, target_temperature=%d\n",
-           mode_to_str(mode), target_temperature);
-  });
+    TemperatureReading reading;
+    if (temperature_sensor.collect(reading)) {
+      publish_current_state(reading);
+    }
 
-  // Transmit saved state on startup
-  const char* signal = heatpump.to_binary_state();
-  ir_transmitter.transmit_ir_signal(signal);
+    if (diagnostics_loop.should_run()) {
+      trace_recorder.record_timer(TraceTimer::DIAGNOSTICS);
+      publish_diagnostics();
+    }
 
-  while (true) {
-    if (loop_manager.should_run()) {
-      TemperatureReading reading = temperature_sensor.read();
-      int target_temperature = heatpump.get_target_temperature();
-      Mode mode = heatpump.get_mode();
-
-      // Since we don't know exactly what the heatpump does right now, we just
-      // estimate based on target and current temperatures.
-      OperatingState operating_state = OperatingState::IDLE;
-      if (reading.temperature > target_temperature &&
-          (mode == Mode::AUTO || mode == Mode::COOL)) {
-        operating_state = OperatingState::COOLING;
-      } else if (reading.temperature < target_temperature &&
-                 (mode == Mode::AUTO || mode == Mode::HEAT)) {
-        operating_state = OperatingState::HEATING;
-      } else {
-        operating_state = OperatingState::IDLE;
-      }
+#ifdef CONFIG_HISTORY_ENABLED
+    if (history.is_querying()) {
+      publish_history_chunk();
+    }
+#endif
+
+#ifdef CONFIG_FAULT_INJECTION
+    FaultReport fault_report;
+    if (fault_injector.poll(fault_report)) {
+      publish_fault_report(fault_report);
+    }
+#endif
+
+#ifdef CONFIG_TIMELINE_ENABLED
+    if (is_dumping_timeline) {
+      dump_timeline_chunk();
+    }
+#endif
 
-      char message[165];
-      snprintf(message, sizeof(message),
-               "{\"deviceId\":\"%s\",\"operatingState\":\"%s\","
-               "\"currentTemperature\":%.1f,\"currentHumidity\":%.1f,"
-               "\"timestamp\":\"%s\"}",
-               DEVICE_ID, operating_state_to_str(operating_state),
-               reading.temperature, reading.humidity, time_server.timestamp());
-      mqtt.publish(MQTT_CURRENT_STATE_TOPIC, message);
+#ifdef CONFIG_TRACE_ENABLED
+    if (is_dumping_trace) {
+      dump_trace_chunk();
     }
+#endif
 
     // Minimal delay to avoid busy-waiting
-    vTaskDelay(pdMS_TO_TICKS(1000));
+    vTaskDelay(pdMS_TO_TICKS(MAIN_LOOP_DELAY_MS));
   }
 }
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Run fault scenarios against a controller and record how it recovers.
+
+Needs a build with CONFIG_FAULT_INJECTION and the mosquitto clients. Each
+scenario injects one fault on the device, keeps sending target-state
+commands until the device reports back, and appends a row to a CSV file so
+results can be compared across releases:
+
+    fault_campaign.py broker.local --label v1.4.0 --csv faults.csv
+    fault_campaign.py broker.local --label v1.4.0 --scenario mqtt:30000
+
+Columns: label, fault, duration, whether and how fast the unit recovered
+after the fault ended, commands sent, commands lost (never received, or
+received but not applied) and the longest gap in valid telemetry.
+"""
+
+import argparse
+import csv
+import json
+import os
+import subprocess
+import sys
+import time
+
+DEFAULT_SCENARIOS = ["wifi:5000", "mqtt:10000", "nvs:10000", "sensor:60000"]
+FIELDS = [
+    "label", "fault", "duration_ms", "recovered", "recovery_ms",
+    "commands_sent", "commands_lost", "telemetry_gap_ms",
+]
+
+
+def publish(args, topic, payload):
+    subprocess.run(
+        ["mosquitto_pub", "-h", args.host, "-p", str(args.port),
+         "-q", "1", "-t", topic, "-m", json.dumps(payload)],
+        check=True,
+    )
+
+
+def run_scenario(args, fault, duration_ms):
+    # Wait for the report of this device only, reports of others are skipped
+    subscriber = subprocess.Popen(
+        ["mosquitto_sub", "-h", args.host, "-p", str(args.port), "-q", "1",
+         "-t", args.report_topic, "-W", str(args.timeout)],
+        stdout=subprocess.PIPE, text=True,
+    )
+    time.sleep(0.5)
+
+    publish(args, args.fault_topic, {
+        "deviceId": args.device_id, "fault": fault, "durationMs": duration_ms,
+    })
+
+    # Commands keep coming during the fault and the recovery, the device
+    # counts the ones that reached it
+    os.set_blocking(subscriber.stdout.fileno(), False)
+    sent = 0
+    report = None
+    buffered = ""
+    deadline = time.monotonic() + args.timeout
+    while report is None and time.monotonic() < deadline:
+        publish(args, args.command_topic, {
+            "deviceId": args.device_id,
+            "targetTemperature": 20 + sent % 2,
+        })
+        sent += 1
+        time.sleep(args.command_interval)
+
+        buffered += subscriber.stdout.read() or ""
+        for line in buffered.splitlines():
+            try:
+                message = json.loads(line)
+            except json.JSONDecodeError:
+                continue
+            if message.get("deviceId") == args.device_id:
+                report = message
+        buffered = buffered[buffered.rfind("\n") + 1:]
+
+    subscriber.terminate()
+    if report is None:
+        return None
+
+    lost = max(0, sent - report["commandsReceived"]) + report["commandsFailed"]
+    return {
+        "label": args.label,
+        "fault": report["fault"],
+        "duration_ms": report["durationMs"],
+        "recovered": report["recovered"],
+        "recovery_ms": report["recoveryMs"],
+        "commands_sent": sent,
+        "commands_lost": lost,
+        "telemetry_gap_ms": report["telemetryGapMs"],
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host", help="MQTT broker")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--device-id", default="heatpump-controller")
+    parser.add_argument("--label", required=True,
+                        help="firmware release the results belong to")
+    parser.add_argument("--csv", default="fault_results.csv")
+    parser.add_argument("--scenario", action="append",
+                        help="fault:duration_ms, may be repeated "
+                             f"(default: {' '.join(DEFAULT_SCENARIOS)})")
+    parser.add_argument("--command-interval", type=float, default=2.0)
+    parser.add_argument("--timeout", type=int, default=300,
+                        help="seconds to wait for a report")
+    parser.add_argument("--fault-topic", default="thermostat/fault")
+    parser.add_argument("--report-topic", default="thermostat/fault/report")
+    parser.add_argument("--command-topic",
+                        default="thermostat/set/target-state")
+    args = parser.parse_args()
+
+    is_new = not os.path.exists(args.csv)
+    failed = False
+    with open(args.csv, "a", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=FIELDS)
+        if is_new:
+            writer.writeheader()
+
+        for scenario in args.scenario or DEFAULT_SCENARIOS:
+            fault, _, duration = scenario.partition(":")
+            print(f"{fault} for {duration} ms...", flush=True)
+            row = run_scenario(args, fault, int(duration))
+            if row is None:
+                print(f"  no report within {args.timeout} s")
+                failed = True
+                continue
+
+            writer.writerow(row)
+            f.flush()
+            if row["recovered"]:
+                print(f"  recovered in {row['recovery_ms']} ms, "
+                      f"{row['commands_lost']}/{row['commands_sent']} "
+                      f"commands lost, telemetry gap "
+                      f"{row['telemetry_gap_ms']} ms")
+            else:
+                print("  did not recover")
+                failed = True
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,606 @@
+#!/usr/bin/env python3
+"""Run a fleet of virtual controllers against an MQTT broker.
+
+Every virtual controller follows the firmware's MQTT traffic: it subscribes
+to the shared command topics, publishes telemetry and diagnostics on their
+Kconfig intervals, ignores target-state commands for other devices, merges
+commands for the settle window of CommandShaper and then publishes its
+commanded state. A backend stand-in sends target-state commands to random
+devices and waits for their commanded state, which gives the end-to-end
+command latency.
+
+Without --host an in-process broker stand-in is started, so no broker has
+to be installed; with --host any MQTT 3.1.1 broker can be measured:
+
+    fleet_sim.py --devices 10 100 1000 --duration 60
+    fleet_sim.py --host broker.local --devices 500 --label mosquitto-2.0
+    fleet_sim.py --devices 1000 --per-device-topics
+
+Fan-out is counted at the subscribers: every target-state command is
+delivered to every controller, while only one of them acts on it.
+--per-device-topics shows what splitting the target-state topic per device
+would save; the firmware does not support that layout yet. All packets use
+QoS 0, so the latencies exclude the acknowledgement round trips of QoS 1.
+The in-process stand-in shares one core with the whole fleet, so its
+latencies grow faster with the fleet size than a real broker's would.
+
+The virtual controllers only imitate the firmware's traffic: they use no
+CPU worth measuring and reconnect without the backoff of WiFiManager and
+MQTTManager. For controller CPU time and reconnect behaviour use the
+fleet_sim target of host_test/, which runs the controllers built from
+main/ on a simulated broker; this script is for measuring real brokers.
+
+The "traffic" counters in the diagnostics of real units have the same
+layout as the simulated ones, so both can be compared.
+
+Results for each fleet size are printed and, with --csv, appended as a row
+so runs can be compared across brokers and releases.
+"""
+
+import argparse
+import asyncio
+import csv
+import json
+import os
+import random
+import resource
+import statistics
+import struct
+import sys
+import time
+
+CONNECT, CONNACK, PUBLISH = 1, 2, 3
+SUBSCRIBE, SUBACK = 8, 9
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+KEEPALIVE_S = 60
+
+FIELDS = [
+    "label", "devices", "per_device_topics", "duration_s",
+    "commands_sent", "commands_confirmed", "commands_lost",
+    "latency_p50_ms", "latency_p90_ms", "latency_p99_ms", "latency_max_ms",
+    "device_publishes_per_s", "device_deliveries_per_s",
+    "deliveries_per_command", "bytes_per_command", "foreign_fraction",
+]
+
+
+# MQTT 3.1.1 framing, only what the simulator and the broker stand-in need
+
+def encode_length(length):
+    encoded = bytearray()
+    while True:
+        byte = length % 128
+        length //= 128
+        encoded.append(byte | 0x80 if length else byte)
+        if not length:
+            return bytes(encoded)
+
+
+def encode_string(value):
+    data = value.encode()
+    return struct.pack("!H", len(data)) + data
+
+
+def packet(kind, flags, body):
+    return bytes([kind << 4 | flags]) + encode_length(len(body)) + body
+
+
+def connect_packet(client_id):
+    body = (encode_string("MQTT") + bytes([4, 0x02])
+            + struct.pack("!H", KEEPALIVE_S) + encode_string(client_id))
+    return packet(CONNECT, 0, body)
+
+
+def subscribe_packet(packet_id, topics):
+    body = struct.pack("!H", packet_id)
+    for topic in topics:
+        body += encode_string(topic) + b"\x00"
+    return packet(SUBSCRIBE, 2, body)
+
+
+def publish_packet(topic, payload, retain=False):
+    return packet(PUBLISH, 1 if retain else 0, encode_string(topic) + payload)
+
+
+async def read_packet(reader):
+    header = await reader.readexactly(1)
+    length, shift = 0, 0
+    while True:
+        byte = (await reader.readexactly(1))[0]
+        length |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            break
+    return header[0] >> 4, header[0] & 0x0F, await reader.readexactly(length)
+
+
+def parse_publish(flags, body):
+    topic_length = struct.unpack_from("!H", body)[0]
+    topic = body[2:2 + topic_length].decode()
+    offset = 2 + topic_length
+    # Packet identifier, only present above QoS 0
+    if flags & 0x06:
+        offset += 2
+    return topic, body[offset:]
+
+
+def topic_matches(topic_filter, topic):
+    filter_levels = topic_filter.split("/")
+    topic_levels = topic.split("/")
+    for index, level in enumerate(filter_levels):
+        if level == "#":
+            return True
+        if index >= len(topic_levels):
+            return False
+        if level != "+" and level != topic_levels[index]:
+            return False
+    return len(filter_levels) == len(topic_levels)
+
+
+class Broker:
+    """Broker stand-in: clean sessions, QoS 0 and retained messages."""
+
+    def __init__(self):
+        self.exact = {}
+        self.wildcards = []
+        self.retained = {}
+        self.server = None
+
+    async def start(self):
+        self.server = await asyncio.start_server(
+            self.handle_client, "127.0.0.1", 0, backlog=4096)
+        return self.server.sockets[0].getsockname()[1]
+
+    def route(self, topic, data):
+        subscribers = set(self.exact.get(topic, ()))
+        for topic_filter, writer in self.wildcards:
+            if topic_matches(topic_filter, topic):
+                subscribers.add(writer)
+        for writer in subscribers:
+            writer.write(data)
+
+    def drop(self, writer):
+        for subscribers in self.exact.values():
+            subscribers.discard(writer)
+        self.wildcards = [(f, w) for f, w in self.wildcards if w is not writer]
+
+    async def handle_client(self, reader, writer):
+        try:
+            while True:
+                kind, flags, body = await read_packet(reader)
+                if kind == CONNECT:
+                    writer.write(packet(CONNACK, 0, b"\x00\x00"))
+                elif kind == SUBSCRIBE:
+                    offset, codes = 2, b""
+                    while offset < len(body):
+                        length = struct.unpack_from("!H", body, offset)[0]
+                        topic_filter = body[offset + 2:offset + 2 + length]
+                        topic_filter = topic_filter.decode()
+                        offset += 3 + length
+                        codes += b"\x00"
+                        if "+" in topic_filter or "#" in topic_filter:
+                            self.wildcards.append((topic_filter, writer))
+                        else:
+                            self.exact.setdefault(topic_filter, set()).add(
+                                writer)
+                        for topic, data in self.retained.items():
+                            if topic_matches(topic_filter, topic):
+                                writer.write(data)
+                    writer.write(packet(SUBACK, 0, body[:2] + codes))
+                elif kind == PUBLISH:
+                    topic, _ = parse_publish(flags, body)
+                    # Delivered without the retain flag, like any live message
+                    data = packet(PUBLISH, 0, body)
+                    if flags & 0x01:
+                        self.retained[topic] = data
+                    self.route(topic, data)
+                elif kind == PINGREQ:
+                    writer.write(packet(PINGRESP, 0, b""))
+                elif kind == DISCONNECT:
+                    break
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            self.drop(writer)
+            writer.close()
+
+
+class Client:
+    """MQTT client with a callback per received message."""
+
+    def __init__(self, client_id, on_message):
+        self.client_id = client_id
+        self.on_message = on_message
+        self.writer = None
+        self.published = 0
+        self.published_bytes = 0
+        self.received = 0
+        self.received_bytes = 0
+
+    async def connect(self, host, port, topics):
+        reader, self.writer = await asyncio.open_connection(host, port)
+        self.writer.write(connect_packet(self.client_id))
+        kind, _, body = await read_packet(reader)
+        if kind != CONNACK or body[1] != 0:
+            raise ConnectionError(f"{self.client_id}: connection refused")
+        if topics:
+            self.writer.write(subscribe_packet(1, topics))
+        return asyncio.create_task(self.receive(reader))
+
+    async def receive(self, reader):
+        try:
+            while True:
+                kind, flags, body = await read_packet(reader)
+                if kind == PUBLISH:
+                    topic, payload = parse_publish(flags, body)
+                    self.received += 1
+                    self.received_bytes += len(body)
+                    self.on_message(topic, payload)
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+
+    def publish(self, topic, message, retain=False):
+        data = publish_packet(topic, json.dumps(message).encode(), retain)
+        self.writer.write(data)
+        self.published += 1
+        self.published_bytes += len(data)
+
+    async def ping(self):
+        while True:
+            await asyncio.sleep(KEEPALIVE_S / 2)
+            self.writer.write(packet(PINGREQ, 0, b""))
+
+    def close(self):
+        if self.writer is not None:
+            self.writer.write(packet(DISCONNECT, 0, b""))
+            self.writer.close()
+
+
+class Controller:
+    """One virtual controller with the firmware's topics and timings."""
+
+    def __init__(self, args, device_id):
+        self.args = args
+        self.device_id = device_id
+        self.client = Client(device_id, self.handle_message)
+        self.version = 0
+        self.state = {"mode": "heat", "targetTemperature": 21, "fanSpeed": 0}
+        self.pending = {}
+        self.first_submit_at = None
+        self.settle_handle = None
+        self.foreign_commands = 0
+        self.commands = 0
+
+    def target_state_topic(self):
+        if self.args.per_device_topics:
+            return f"{self.args.target_state_topic}/{self.device_id}"
+        return self.args.target_state_topic
+
+    async def run(self, host, port):
+        topics = [self.target_state_topic(), self.args.get_state_topic,
+                  self.args.schedule_topic]
+        tasks = [await self.client.connect(host, port, topics)]
+        tasks.append(asyncio.create_task(self.client.ping()))
+        # Republished on every connect, in case the broker lost the session
+        self.publish_commanded_state()
+
+        # Devices booted at different times, so the timers are spread out
+        tasks.append(asyncio.create_task(self.every(
+            self.args.telemetry_interval, self.publish_telemetry,
+            random.uniform(0, self.args.telemetry_interval))))
+        tasks.append(asyncio.create_task(self.every(
+            self.args.diagnostics_interval, self.publish_diagnostics,
+            random.uniform(0, self.args.diagnostics_interval))))
+        try:
+            await asyncio.Future()
+        finally:
+            for task in tasks:
+                task.cancel()
+            if self.settle_handle is not None:
+                self.settle_handle.cancel()
+            self.client.close()
+
+    async def every(self, interval, callback, delay):
+        await asyncio.sleep(delay)
+        while True:
+            callback()
+            await asyncio.sleep(interval)
+
+    def handle_message(self, topic, payload):
+        if topic != self.target_state_topic():
+            return
+        try:
+            message = json.loads(payload)
+        except json.JSONDecodeError:
+            return
+        if message.get("deviceId") != self.device_id:
+            self.foreign_commands += 1
+            return
+        self.submit(message)
+
+    # CommandShaper: later commands win per field, the merged update is
+    # applied once the settle window passed without a new command, or after
+    # the maximum delay
+    def submit(self, message):
+        self.commands += 1
+        for key in ("mode", "targetTemperature", "fanSpeed"):
+            if key in message:
+                self.pending[key] = message[key]
+
+        now = time.monotonic()
+        if self.first_submit_at is None:
+            self.first_submit_at = now
+        if self.settle_handle is not None:
+            self.settle_handle.cancel()
+        delay = min(self.args.settle_ms / 1000,
+                    self.first_submit_at + self.args.max_delay_ms / 1000
+                    - now)
+        self.settle_handle = asyncio.get_running_loop().call_later(
+            max(0, delay), self.apply)
+
+    def apply(self):
+        self.settle_handle = None
+        self.first_submit_at = None
+        changed = any(self.state.get(k) != v for k, v in self.pending.items())
+        self.state.update(self.pending)
+        self.pending = {}
+        if changed:
+            self.version += 1
+        self.publish_commanded_state()
+
+    def publish_commanded_state(self):
+        self.client.publish(
+            f"{self.args.commanded_state_topic}/{self.device_id}",
+            {"deviceId": self.device_id, "version": self.version,
+             **self.state, "timestamp": timestamp()},
+            retain=True)
+
+    def publish_telemetry(self):
+        self.client.publish(self.args.current_state_topic, {
+            "deviceId": self.device_id, "operatingState": "heating",
+            "currentTemperature": round(random.uniform(19, 23), 1),
+            "currentHumidity": round(random.uniform(35, 55), 1),
+            "timestamp": timestamp(),
+        })
+
+    def publish_diagnostics(self):
+        # Same size as the firmware's report, only the traffic counters are
+        # filled in, with the layout of main/Diagnostics.cpp
+        client = self.client
+        report = {"deviceId": self.device_id, "traffic": [
+            client.received, client.published, client.received_bytes,
+            client.published_bytes, self.foreign_commands,
+        ], "padding": ""}
+        padding = self.args.diagnostics_bytes - len(json.dumps(report))
+        report["padding"] = "0" * max(0, padding)
+        self.client.publish(self.args.diagnostics_topic, report)
+
+
+class Backend:
+    """Sends target-state commands and waits for the commanded state."""
+
+    def __init__(self, args, device_ids):
+        self.args = args
+        self.device_ids = device_ids
+        self.client = Client("fleet-sim-backend", self.handle_message)
+        self.pending = {}
+        self.latencies = []
+        self.sent = 0
+
+    async def connect(self, host, port):
+        return await self.client.connect(host, port, [
+            f"{self.args.commanded_state_topic}/+",
+            self.args.current_state_topic, self.args.diagnostics_topic,
+        ])
+
+    async def run(self, duration):
+        interval = 1 / self.args.command_rate
+        deadline = time.monotonic() + duration
+        while time.monotonic() < deadline:
+            # One command in flight per device, so every reply is matched
+            idle = [d for d in self.device_ids if d not in self.pending]
+            if idle:
+                device_id = random.choice(idle)
+                temperature = random.randint(17, 30)
+                topic = self.args.target_state_topic
+                if self.args.per_device_topics:
+                    topic = f"{topic}/{device_id}"
+                self.pending[device_id] = (temperature, time.monotonic())
+                self.client.publish(topic, {
+                    "deviceId": device_id, "mode": "heat",
+                    "targetTemperature": temperature,
+                })
+                self.sent += 1
+            await asyncio.sleep(interval)
+
+    def handle_message(self, topic, payload):
+        if not topic.startswith(self.args.commanded_state_topic + "/"):
+            return
+        try:
+            message = json.loads(payload)
+        except json.JSONDecodeError:
+            return
+        device_id = message.get("deviceId")
+        if device_id not in self.pending:
+            return
+        temperature, sent_at = self.pending[device_id]
+        if message.get("targetTemperature") == temperature:
+            del self.pending[device_id]
+            self.latencies.append((time.monotonic() - sent_at) * 1000)
+
+
+def timestamp():
+    return time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime())
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def raise_file_limit(devices):
+    # Each device needs a socket, and another one in the broker stand-in
+    needed = 2 * devices + 64
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < needed:
+        limit = needed if hard == resource.RLIM_INFINITY else min(hard,
+                                                                   needed)
+        resource.setrlimit(resource.RLIMIT_NOFILE, (limit, hard))
+        soft = limit
+    return soft >= needed
+
+
+async def run_fleet(args, devices):
+    broker = None
+    host, port = args.host, args.port
+    if host is None:
+        broker = Broker()
+        host, port = "127.0.0.1", await broker.start()
+
+    device_ids = [f"{args.device_prefix}-{i:05d}" for i in range(devices)]
+    controllers = [Controller(args, device_id) for device_id in device_ids]
+    backend = Backend(args, device_ids)
+    receiver = await backend.connect(host, port)
+
+    tasks = []
+    for index, controller in enumerate(controllers):
+        tasks.append(asyncio.create_task(controller.run(host, port)))
+        # Connects are spread over the ramp, like a fleet coming back online
+        await asyncio.sleep(args.ramp / devices)
+        if index % 100 == 99:
+            print(f"  {index + 1} devices connected", flush=True)
+    await asyncio.sleep(1)
+
+    # Counters start once the fleet is connected
+    for controller in controllers:
+        controller.client.published = 0
+        controller.client.received = 0
+        controller.client.received_bytes = 0
+        controller.foreign_commands = 0
+    backend.client.received = 0
+
+    started = time.monotonic()
+    await backend.run(args.duration)
+    # Late replies still count, commands without one are lost
+    grace = time.monotonic() + args.max_delay_ms / 1000 + 2
+    while backend.pending and time.monotonic() < grace:
+        await asyncio.sleep(0.1)
+    elapsed = time.monotonic() - started
+
+    for task in tasks:
+        task.cancel()
+    await asyncio.gather(*tasks, return_exceptions=True)
+    receiver.cancel()
+    backend.client.close()
+    if broker is not None:
+        # Lets the stand-in read the DISCONNECTs before it goes away
+        await asyncio.sleep(0.5)
+        broker.server.close()
+
+    published = sum(c.client.published for c in controllers)
+    deliveries = sum(c.client.received for c in controllers)
+    delivered_bytes = sum(c.client.received_bytes for c in controllers)
+    foreign = sum(c.foreign_commands for c in controllers)
+    latencies = backend.latencies
+    return {
+        "label": args.label,
+        "devices": devices,
+        "per_device_topics": args.per_device_topics,
+        "duration_s": round(elapsed, 1),
+        "commands_sent": backend.sent,
+        "commands_confirmed": len(latencies),
+        "commands_lost": backend.sent - len(latencies),
+        "latency_p50_ms": round(statistics.median(latencies), 1)
+        if latencies else 0.0,
+        "latency_p90_ms": round(percentile(latencies, 0.90), 1),
+        "latency_p99_ms": round(percentile(latencies, 0.99), 1),
+        "latency_max_ms": round(max(latencies, default=0.0), 1),
+        "device_publishes_per_s": round(published / elapsed / devices, 3),
+        "device_deliveries_per_s": round(deliveries / elapsed, 1),
+        "deliveries_per_command": round(deliveries / max(1, backend.sent), 1),
+        "bytes_per_command": round(delivered_bytes / max(1, backend.sent)),
+        "foreign_fraction": round(foreign / max(1, deliveries), 3),
+    }
+
+
+def print_result(row):
+    print(f"  commands: {row['commands_confirmed']}/{row['commands_sent']} "
+          f"confirmed, {row['commands_lost']} lost")
+    print(f"  latency: p50 {row['latency_p50_ms']} ms, "
+          f"p90 {row['latency_p90_ms']} ms, p99 {row['latency_p99_ms']} ms, "
+          f"max {row['latency_max_ms']} ms")
+    print(f"  per device: {row['device_publishes_per_s']} publishes/s")
+    print(f"  broker to devices: {row['device_deliveries_per_s']} "
+          f"deliveries/s, {row['deliveries_per_command']} deliveries and "
+          f"{row['bytes_per_command']} bytes per command, "
+          f"{row['foreign_fraction']:.1%} for another device")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host",
+                        help="MQTT broker (default: in-process stand-in)")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--devices", type=int, nargs="+", default=[100],
+                        help="fleet sizes to run, one after the other")
+    parser.add_argument("--duration", type=float, default=60,
+                        help="seconds of commands per fleet size")
+    parser.add_argument("--ramp", type=float, default=5,
+                        help="seconds over which the fleet connects")
+    parser.add_argument("--command-rate", type=float, default=5,
+                        help="target-state commands per second, fleet-wide")
+    parser.add_argument("--per-device-topics", action="store_true",
+                        help="send commands on <target-state topic>/<id>")
+    parser.add_argument("--label", default="",
+                        help="broker or release the results belong to")
+    parser.add_argument("--csv")
+    parser.add_argument("--device-prefix", default="heatpump-sim")
+    parser.add_argument("--seed", type=int, default=1)
+    # Kconfig defaults
+    parser.add_argument("--telemetry-interval", type=float, default=30)
+    parser.add_argument("--diagnostics-interval", type=float, default=60)
+    parser.add_argument("--diagnostics-bytes", type=int, default=900)
+    parser.add_argument("--settle-ms", type=int, default=300)
+    parser.add_argument("--max-delay-ms", type=int, default=2000)
+    parser.add_argument("--target-state-topic",
+                        default="thermostat/set/target-state")
+    parser.add_argument("--get-state-topic", default="thermostat/get/state")
+    parser.add_argument("--schedule-topic", default="thermostat/set/schedule")
+    parser.add_argument("--current-state-topic",
+                        default="thermostat/current-state")
+    parser.add_argument("--commanded-state-topic",
+                        default="thermostat/commanded-state")
+    parser.add_argument("--diagnostics-topic",
+                        default="thermostat/diagnostics")
+    args = parser.parse_args()
+    random.seed(args.seed)
+
+    rows = []
+    for devices in args.devices:
+        if not raise_file_limit(devices):
+            print(f"{devices} devices need more open files than allowed, "
+                  f"raise the hard limit (ulimit -Hn)", file=sys.stderr)
+            return 1
+        print(f"{devices} devices...", flush=True)
+        try:
+            row = asyncio.run(run_fleet(args, devices))
+        except OSError as e:
+            print(f"  {e}", file=sys.stderr)
+            return 1
+        print_result(row)
+        rows.append(row)
+
+    if args.csv:
+        is_new = not os.path.exists(args.csv)
+        with open(args.csv, "a", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=FIELDS)
+            if is_new:
+                writer.writeheader()
+            writer.writerows(rows)
+
+    return 1 if any(row["commands_lost"] for row in rows) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
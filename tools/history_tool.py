@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Decode telemetry history chunks published by the controller.
+
+Request a time range (Unix timestamps, both optional) on the history request
+topic and capture the chunks published on the history topic:
+
+    mosquitto_sub -t thermostat/history > history.log &
+    mosquitto_pub -t thermostat/history/get \\
+        -m '{"deviceId":"heatpump-controller","requestId":1,"from":1735689600}'
+    history_tool.py history.log > history.csv
+
+Each input line is one chunk message. Chunks are decoded on their own, so a
+lost chunk only leaves a gap. The samples are printed as CSV.
+"""
+
+import argparse
+import csv
+import datetime
+import json
+import struct
+import sys
+
+FULL_SAMPLE_SIZE = 12
+
+OPERATING_STATES = ["IDLE", "COOLING", "HEATING", "UNKNOWN"]
+MODES = ["OFF", "COOL", "HEAT", "AUTO"]
+
+HAS_COMMAND_BIT = 0x10
+RESERVED_BITS = 0xE0
+
+
+def decode_varint(data, offset):
+    value = 0
+    shift = 0
+    while offset < len(data) and shift < 35:
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, offset
+        shift += 7
+    raise ValueError("truncated varint")
+
+
+def zigzag_decode(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode_state(state, sample):
+    sample["operatingState"] = OPERATING_STATES[state & 0x03]
+    sample["mode"] = MODES[(state >> 2) & 0x03]
+
+
+def decode_chunk(data):
+    if len(data) < FULL_SAMPLE_SIZE:
+        return []
+
+    timestamp, temperature, humidity, state, target, fan = struct.unpack_from(
+        "<IhHBBB", data
+    )
+    sample = {
+        "timestamp": timestamp,
+        "temperature": temperature,
+        "humidity": humidity,
+        "targetTemperature": target,
+        "fanSpeed": fan,
+    }
+    decode_state(state, sample)
+    samples = [dict(sample)]
+
+    offset = FULL_SAMPLE_SIZE
+    while offset < len(data):
+        state = data[offset]
+        if state & RESERVED_BITS:
+            raise ValueError(f"invalid record at offset {offset}")
+        offset += 1
+        dt, offset = decode_varint(data, offset)
+        dtemperature, offset = decode_varint(data, offset)
+        dhumidity, offset = decode_varint(data, offset)
+        if state & HAS_COMMAND_BIT:
+            sample["targetTemperature"] = data[offset]
+            sample["fanSpeed"] = data[offset + 1]
+            offset += 2
+        decode_state(state, sample)
+        sample["timestamp"] += dt
+        sample["temperature"] += zigzag_decode(dtemperature)
+        sample["humidity"] += zigzag_decode(dhumidity)
+        samples.append(dict(sample))
+
+    return samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", default="-")
+    parser.add_argument("--request-id", type=int)
+    args = parser.parse_args()
+
+    log = sys.stdin if args.log == "-" else open(args.log)
+    writer = csv.writer(sys.stdout)
+    writer.writerow(
+        [
+            "time",
+            "temperature",
+            "humidity",
+            "operatingState",
+            "mode",
+            "targetTemperature",
+            "fanSpeed",
+        ]
+    )
+
+    expected_seq = 0
+    encoded_bytes = 0
+    sample_count = 0
+    for line in log:
+        line = line.strip()
+        if not line.startswith("{"):
+            continue
+        chunk = json.loads(line)
+        if args.request_id is not None and chunk["requestId"] != args.request_id:
+            continue
+        if chunk["seq"] != expected_seq:
+            print(f"Missing chunks before {chunk['seq']}", file=sys.stderr)
+        expected_seq = chunk["seq"] + 1
+
+        data = bytes.fromhex(chunk["data"])
+        encoded_bytes += len(data)
+        for sample in decode_chunk(data):
+            time = datetime.datetime.fromtimestamp(
+                sample["timestamp"], datetime.timezone.utc
+            )
+            writer.writerow(
+                [
+                    time.isoformat(),
+                    sample["temperature"] / 10,
+                    sample["humidity"] / 10,
+                    sample["operatingState"],
+                    sample["mode"],
+                    sample["targetTemperature"],
+                    sample["fanSpeed"],
+                ]
+            )
+            sample_count += 1
+
+        if chunk["last"]:
+            expected_seq = 0
+
+    if sample_count:
+        print(
+            f"{sample_count} samples in {encoded_bytes} bytes "
+            f"({encoded_bytes / sample_count:.1f} bytes/sample)",
+            file=sys.stderr,
+        )
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Send target-state commands to a controller over the local network.
+
+Talks to the UDP endpoint enabled with CONFIG_LOCAL_CONTROL, bypassing the
+MQTT broker. The payload uses the same schema as the target-state topic.
+
+    local_control.py 192.168.1.40 --secret s3cret \\
+        '{"deviceId":"heatpump-controller","mode":"HEAT","targetTemperature":21}'
+
+Prints the device's response and the measured round-trip time. Use --repeat to
+send the command several times and get latency percentiles.
+"""
+
+import argparse
+import hashlib
+import hmac
+import socket
+import statistics
+import struct
+import sys
+import time
+
+MAC_SIZE = 32
+NONCE_SIZE = 8
+
+# Match the direction tags in main/LocalControl.cpp
+REQUEST_MAC_TAG = b"heatpump-local-control-request"
+RESPONSE_MAC_TAG = b"heatpump-local-control-response"
+
+
+def sign(secret, nonce, payload):
+    body = struct.pack(">Q", nonce) + payload
+    mac = hmac.new(secret, REQUEST_MAC_TAG + body, hashlib.sha256).digest()
+    return mac + body
+
+
+def verify(secret, packet):
+    if len(packet) < MAC_SIZE + NONCE_SIZE:
+        return None
+    body = packet[MAC_SIZE:]
+    expected = hmac.new(secret, RESPONSE_MAC_TAG + body,
+                        hashlib.sha256).digest()
+    if not hmac.compare_digest(expected, packet[:MAC_SIZE]):
+        return None
+    (nonce,) = struct.unpack(">Q", body[:NONCE_SIZE])
+    return nonce, body[NONCE_SIZE:]
+
+
+def send(sock, address, secret, payload, last_nonce):
+    # Nonces must increase, even when two requests share a millisecond
+    nonce = max(int(time.time() * 1000), last_nonce + 1)
+    started_at = time.perf_counter()
+    sock.sendto(sign(secret, nonce, payload), address)
+
+    while True:
+        packet, _ = sock.recvfrom(2048)
+        elapsed_ms = (time.perf_counter() - started_at) * 1000
+        response = verify(secret, packet)
+        if response is None:
+            print("Ignoring response with an invalid signature", file=sys.stderr)
+            continue
+        response_nonce, body = response
+        if response_nonce == nonce:
+            return nonce, body.decode(), elapsed_ms
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("payload")
+    parser.add_argument("--port", type=int, default=4210)
+    parser.add_argument("--secret", required=True)
+    parser.add_argument("--timeout", type=float, default=1.0)
+    parser.add_argument("--repeat", type=int, default=1)
+    args = parser.parse_args()
+
+    address = (args.host, args.port)
+    secret = args.secret.encode()
+    payload = args.payload.encode()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(args.timeout)
+
+    nonce = 0
+    latencies = []
+    for _ in range(args.repeat):
+        try:
+            nonce, body, elapsed_ms = send(sock, address, secret, payload, nonce)
+        except socket.timeout:
+            print("No response (wrong secret, stale clock or unreachable)")
+            continue
+        latencies.append(elapsed_ms)
+        print(f"{body} in {elapsed_ms:.1f} ms")
+
+    if len(latencies) > 1:
+        latencies.sort()
+        p95 = latencies[min(len(latencies) - 1, int(len(latencies) * 0.95))]
+        print(
+            f"{len(latencies)}/{args.repeat} answered, "
+            f"median {statistics.median(latencies):.1f} ms, "
+            f"p95 {p95:.1f} ms, max {latencies[-1]:.1f} ms"
+        )
+
+    return 0 if latencies else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+"""Build firmware deltas for over-the-air updates.
+
+A delta rebuilds the new image from the image the device is running, so
+only the changed parts are downloaded:
+
+    make_delta.py make build/old.bin build/heatpump-controller.bin fw.delta
+    make_delta.py apply build/old.bin fw.delta rebuilt.bin
+
+The old image must be exactly the one installed on the devices. Use
+--full to get a delta without COPY operations, which applies to any
+running image. Serve the file over HTTPS with a certificate from the CA in
+main/certs/ota_ca.pem, then sign an update request with CONFIG_OTA_SECRET
+and publish it on the OTA topic:
+
+    make_delta.py request fw.delta https://example.com/fw.delta \\
+        --secret s3cret | mosquitto_pub -t thermostat/ota -s
+
+"apply" is a reference decoder: it checks the target hash the same way the
+device does.
+"""
+
+import argparse
+import hashlib
+import hmac
+import json
+import struct
+import sys
+import time
+
+MAGIC = b"HPD1"
+OPCODE_COPY = 0x01
+OPCODE_INSERT = 0x02
+
+# Matches shorter than a block cost more to describe than to insert
+BLOCK_SIZE = 32
+
+# Matches REQUEST_MAC_TAG in main/FirmwareUpdater.cpp
+REQUEST_MAC_TAG = "heatpump-ota-request"
+
+
+def encode_varint(value):
+    out = bytearray()
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+    return bytes(out)
+
+
+def decode_varint(data, offset):
+    value = 0
+    shift = 0
+    while shift <= 28:
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, offset
+        shift += 7
+    raise ValueError("overlong varint")
+
+
+def make_delta(source, target, full):
+    # Index every aligned source block, matches are then extended both ways
+    blocks = {}
+    if not full:
+        for offset in range(0, len(source) - BLOCK_SIZE + 1, BLOCK_SIZE):
+            blocks.setdefault(source[offset : offset + BLOCK_SIZE], offset)
+
+    operations = bytearray()
+    pending = bytearray()
+
+    def flush_insert():
+        if pending:
+            operations.append(OPCODE_INSERT)
+            operations.extend(encode_varint(len(pending)))
+            operations.extend(pending)
+            pending.clear()
+
+    i = 0
+    while i < len(target):
+        source_offset = blocks.get(target[i : i + BLOCK_SIZE])
+        if source_offset is None:
+            pending.append(target[i])
+            i += 1
+            continue
+
+        # Take back inserted bytes that also match the source
+        while (
+            pending
+            and source_offset > 0
+            and source[source_offset - 1] == pending[-1]
+        ):
+            pending.pop()
+            source_offset -= 1
+            i -= 1
+
+        length = 0
+        while (
+            i + length < len(target)
+            and source_offset + length < len(source)
+            and source[source_offset + length] == target[i + length]
+        ):
+            length += 1
+
+        flush_insert()
+        operations.append(OPCODE_COPY)
+        operations.extend(encode_varint(source_offset))
+        operations.extend(encode_varint(length))
+        i += length
+
+    flush_insert()
+
+    header = MAGIC + struct.pack("<II", len(source), len(target))
+    return header + hashlib.sha256(target).digest() + bytes(operations)
+
+
+def apply_delta(source, delta):
+    if delta[:4] != MAGIC:
+        raise ValueError("not a delta")
+    source_size, target_size = struct.unpack_from("<II", delta, 4)
+    expected_sha256 = delta[12:44]
+    if source_size > len(source):
+        raise ValueError("delta needs a larger source image")
+
+    target = bytearray()
+    offset = 44
+    while offset < len(delta):
+        opcode = delta[offset]
+        offset += 1
+        if opcode == OPCODE_COPY:
+            source_offset, offset = decode_varint(delta, offset)
+            length, offset = decode_varint(delta, offset)
+            if source_offset + length > source_size:
+                raise ValueError("copy past the end of the source")
+            target += source[source_offset : source_offset + length]
+        elif opcode == OPCODE_INSERT:
+            length, offset = decode_varint(delta, offset)
+            target += delta[offset : offset + length]
+            offset += length
+        else:
+            raise ValueError(f"invalid opcode {opcode:#x} at {offset - 1}")
+        if len(target) > target_size:
+            raise ValueError("target larger than announced")
+
+    if len(target) != target_size:
+        raise ValueError("truncated delta")
+    if hashlib.sha256(target).digest() != expected_sha256:
+        raise ValueError("target hash mismatch")
+    return bytes(target)
+
+
+def sign_request(delta, url, device_id, secret, nonce):
+    if delta[:4] != MAGIC:
+        raise ValueError("not a delta")
+    # The device only accepts the image the signed hash belongs to
+    sha256 = delta[12:44].hex()
+    message = "\n".join([REQUEST_MAC_TAG, device_id, str(nonce), sha256, url])
+    mac = hmac.new(secret, message.encode(), hashlib.sha256).hexdigest()
+    return {
+        "deviceId": device_id,
+        "url": url,
+        "sha256": sha256,
+        "nonce": nonce,
+        "mac": mac,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    make = commands.add_parser("make")
+    make.add_argument("source")
+    make.add_argument("target")
+    make.add_argument("delta")
+    make.add_argument("--full", action="store_true")
+
+    apply = commands.add_parser("apply")
+    apply.add_argument("source")
+    apply.add_argument("delta")
+    apply.add_argument("target")
+
+    request = commands.add_parser("request")
+    request.add_argument("delta")
+    request.add_argument("url")
+    request.add_argument("--secret", required=True)
+    request.add_argument("--device-id", default="heatpump-controller")
+    request.add_argument("--nonce", type=int,
+                         help="must exceed the last accepted one "
+                              "(default: the time in ms)")
+
+    args = parser.parse_args()
+
+    if args.command == "request":
+        if not args.url.startswith("https://"):
+            print("The device only downloads over https", file=sys.stderr)
+            return 1
+        with open(args.delta, "rb") as f:
+            delta = f.read()
+        nonce = args.nonce
+        if nonce is None:
+            nonce = int(time.time() * 1000)
+        try:
+            message = sign_request(delta, args.url, args.device_id,
+                                   args.secret.encode(), nonce)
+        except ValueError as e:
+            print(f"Invalid delta: {e}", file=sys.stderr)
+            return 1
+        print(json.dumps(message, separators=(",", ":")))
+        return 0
+
+    if args.command == "make":
+        with open(args.source, "rb") as f:
+            source = f.read()
+        with open(args.target, "rb") as f:
+            target = f.read()
+        delta = make_delta(source, target, args.full)
+        # Never publish a delta the reference decoder cannot apply
+        assert apply_delta(source, delta) == target
+        with open(args.delta, "wb") as f:
+            f.write(delta)
+        print(
+            f"{len(delta)} bytes for a {len(target)} byte image "
+            f"({100 * len(delta) / len(target):.1f}%)"
+        )
+    else:
+        with open(args.source, "rb") as f:
+            source = f.read()
+        with open(args.delta, "rb") as f:
+            delta = f.read()
+        try:
+            target = apply_delta(source, delta)
+        except ValueError as e:
+            print(f"Invalid delta: {e}", file=sys.stderr)
+            return 1
+        with open(args.target, "wb") as f:
+            f.write(target)
+        print(f"Rebuilt {len(target)} bytes, hash verified")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
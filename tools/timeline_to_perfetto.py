@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Convert an event timeline dump to Chrome trace JSON.
+
+Request a dump with CONFIG_TIMELINE_ENABLED set, on MQTT or on the serial
+console:
+
+    mosquitto_pub -t thermostat/timeline \\
+        -m '{"deviceId":"heatpump-controller","action":"dump"}'
+    mosquitto_pub -t thermostat/timeline \\
+        -m '{"deviceId":"heatpump-controller","action":"dump","serial":true}'
+
+Capture the chunks (e.g. `mosquitto_sub -t thermostat/timeline/dump`, or
+the `TIMELINE {...}` lines of the console log) and convert them:
+
+    timeline_to_perfetto.py dump.log timeline.json
+
+Open the result in https://ui.perfetto.dev or chrome://tracing. Every task
+gets its own track, the core an event ran on is in its arguments.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b"HPL1"
+RECORD = struct.Struct("<IiBBBB")
+BEGIN, END, INSTANT = 0, 1, 2
+OTHER_TASK = 0xFF
+
+# Matches TimelineEvent in main/Timeline.hpp
+EVENTS = {
+    1: ("wifi_handler", "event"),
+    2: ("mqtt_connected", "session_present"),
+    3: ("mqtt_disconnected", None),
+    4: ("mqtt_message", "bytes"),
+    5: ("mqtt_publish", "bytes"),
+    6: ("mqtt_ack", "msg_id"),
+    7: ("heatpump_set", None),
+    8: ("heatpump_apply", None),
+    9: ("nvs_commit", None),
+    10: ("ir_frame", "bits"),
+    11: ("sensor_start", "sensor"),
+    12: ("sensor_collect", "sensor"),
+}
+
+
+def read_dump(path):
+    chunks = {}
+    size = None
+    with open(path) as f:
+        for line in f:
+            start = line.find("{")
+            if start < 0:
+                continue
+            try:
+                chunk = json.loads(line[start:])
+            except json.JSONDecodeError:
+                continue
+            if "data" not in chunk or "offset" not in chunk:
+                continue
+            # A new dump starts over at offset 0
+            if chunk["offset"] == 0:
+                chunks = {}
+            chunks[chunk["offset"]] = bytes.fromhex(chunk["data"])
+            size = chunk["size"]
+
+    if size is None:
+        sys.exit(f"{path}: no timeline chunks found")
+
+    data = bytearray(size)
+    received = 0
+    for offset, chunk in chunks.items():
+        data[offset : offset + len(chunk)] = chunk
+        received += len(chunk)
+    if received < size:
+        sys.exit(f"{path}: incomplete dump ({received}/{size} bytes)")
+    return bytes(data)
+
+
+def parse(data):
+    if data[:4] != MAGIC:
+        raise ValueError("not a timeline dump")
+    overwritten, count = struct.unpack_from("<II", data, 4)
+    offset = 12
+    task_count = data[offset]
+    offset += 1
+    tasks = []
+    for _ in range(task_count):
+        length = data[offset]
+        tasks.append(data[offset + 1 : offset + 1 + length].decode())
+        offset += 1 + length
+
+    records = [
+        RECORD.unpack_from(data, offset + i * RECORD.size) for i in range(count)
+    ]
+    return overwritten, tasks, records
+
+
+def to_trace_events(tasks, records):
+    events = [
+        {"ph": "M", "pid": 1, "name": "process_name",
+         "args": {"name": "heatpump-controller"}},
+    ]
+    for index, name in enumerate(tasks):
+        events.append({"ph": "M", "pid": 1, "tid": index,
+                       "name": "thread_name", "args": {"name": name}})
+    events.append({"ph": "M", "pid": 1, "tid": OTHER_TASK,
+                   "name": "thread_name", "args": {"name": "other"}})
+
+    # Timestamps are the low 32 bits of esp_timer, records are in order
+    wraps = 0
+    previous = None
+    for time_us, value, event, phase, core, task in records:
+        if previous is not None and time_us < previous:
+            wraps += 1
+        previous = time_us
+
+        name, value_name = EVENTS.get(event, (f"event_{event}", "value"))
+        trace_event = {
+            "name": name,
+            "ph": {BEGIN: "B", END: "E", INSTANT: "i"}.get(phase, "i"),
+            "ts": time_us + (wraps << 32),
+            "pid": 1,
+            "tid": task,
+            "args": {"core": core},
+        }
+        if phase == INSTANT:
+            trace_event["s"] = "t"
+        if value_name is not None and phase != END:
+            trace_event["args"][value_name] = value
+        events.append(trace_event)
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    try:
+        overwritten, tasks, records = parse(read_dump(args.dump))
+    except (ValueError, struct.error) as e:
+        print(f"Invalid timeline: {e}", file=sys.stderr)
+        return 1
+
+    with open(args.output, "w") as f:
+        json.dump({"traceEvents": to_trace_events(tasks, records),
+                   "displayTimeUnit": "ms"}, f)
+
+    print(f"{len(records)} events from {len(tasks)} tasks", end="")
+    if overwritten:
+        print(f", {overwritten} older events were overwritten", end="")
+    print()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
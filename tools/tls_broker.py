@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Run a local MQTT broker with TLS for testing mqtts:// connections.
+
+Creates a throwaway CA, a broker certificate for the given host name or IP
+address and a client certificate (all ECDSA P-256), then starts mosquitto
+with them:
+
+    tls_broker.py 192.168.1.10 --dir /tmp/tls-broker --install
+
+--install copies the CA and the client certificate to main/certs, so a
+build with CONFIG_MQTT_TLS_PINNED_CA (and CONFIG_MQTT_TLS_CLIENT_CERT)
+and CONFIG_MQTT_BROKER_URL="mqtts://192.168.1.10:8883" connects to it.
+The device reports its connect times in the "conn" diagnostics array.
+
+--probe measures full and resumed handshakes against the broker from this
+machine, to tell how much of the device's connect time TLS accounts for.
+"""
+
+import argparse
+import ipaddress
+import os
+import shutil
+import socket
+import ssl
+import subprocess
+import sys
+import time
+
+REPO_CERTS = os.path.join(os.path.dirname(__file__), "..", "main", "certs")
+
+
+def openssl(*args):
+    subprocess.run(["openssl", *args], check=True, capture_output=True)
+
+
+def create_certs(directory, host):
+    def path(name):
+        return os.path.join(directory, name)
+
+    if os.path.exists(path("ca.pem")):
+        return
+
+    openssl("ecparam", "-name", "prime256v1", "-genkey", "-noout",
+            "-out", path("ca.key"))
+    openssl("req", "-x509", "-new", "-key", path("ca.key"), "-days", "3650",
+            "-subj", "/CN=heatpump test CA", "-out", path("ca.pem"))
+
+    try:
+        ipaddress.ip_address(host)
+        san = f"subjectAltName=IP:{host}"
+    except ValueError:
+        san = f"subjectAltName=DNS:{host}"
+
+    for name, subject, extension in [
+        ("server", host, san),
+        ("client", "heatpump-controller", "extendedKeyUsage=clientAuth"),
+    ]:
+        openssl("ecparam", "-name", "prime256v1", "-genkey", "-noout",
+                "-out", path(f"{name}.key"))
+        openssl("req", "-new", "-key", path(f"{name}.key"),
+                "-subj", f"/CN={subject}", "-out", path(f"{name}.csr"))
+        with open(path(f"{name}.ext"), "w") as f:
+            f.write(extension + "\n")
+        openssl("x509", "-req", "-in", path(f"{name}.csr"),
+                "-CA", path("ca.pem"), "-CAkey", path("ca.key"),
+                "-CAcreateserial", "-days", "3650",
+                "-extfile", path(f"{name}.ext"), "-out", path(f"{name}.crt"))
+
+
+def write_config(directory, port, require_client_cert):
+    config = os.path.join(directory, "mosquitto.conf")
+    with open(config, "w") as f:
+        f.write(f"listener {port}\n")
+        f.write(f"cafile {os.path.join(directory, 'ca.pem')}\n")
+        f.write(f"certfile {os.path.join(directory, 'server.crt')}\n")
+        f.write(f"keyfile {os.path.join(directory, 'server.key')}\n")
+        f.write(f"require_certificate {str(require_client_cert).lower()}\n")
+        f.write("allow_anonymous true\n")
+    return config
+
+
+def install(directory):
+    os.makedirs(REPO_CERTS, exist_ok=True)
+    for source, target in [
+        ("ca.pem", "mqtt_ca.pem"),
+        ("client.crt", "mqtt_client.crt"),
+        ("client.key", "mqtt_client.key"),
+    ]:
+        shutil.copy(os.path.join(directory, source),
+                    os.path.join(REPO_CERTS, target))
+    print(f"Installed certificates to {os.path.normpath(REPO_CERTS)}")
+
+
+def probe(directory, host, port, count):
+    context = ssl.create_default_context(cafile=os.path.join(directory, "ca.pem"))
+    context.load_cert_chain(os.path.join(directory, "client.crt"),
+                            os.path.join(directory, "client.key"))
+    # Session tickets are only reused with TLS 1.2 in the ssl module
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+
+    session = None
+    for i in range(count):
+        started_at = time.perf_counter()
+        with socket.create_connection((host, port)) as raw:
+            with context.wrap_socket(raw, server_hostname=host,
+                                     session=session) as tls:
+                elapsed_ms = (time.perf_counter() - started_at) * 1000
+                kind = "resumed" if tls.session_reused else "full"
+                print(f"{i + 1}: {kind} handshake in {elapsed_ms:.1f} ms")
+                session = tls.session
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host", help="host name or IP the device connects to")
+    parser.add_argument("--dir", default="tls-broker")
+    parser.add_argument("--port", type=int, default=8883)
+    parser.add_argument("--require-client-cert", action="store_true")
+    parser.add_argument("--install", action="store_true")
+    parser.add_argument("--probe", type=int, metavar="COUNT")
+    args = parser.parse_args()
+
+    directory = os.path.abspath(args.dir)
+    os.makedirs(directory, exist_ok=True)
+    create_certs(directory, args.host)
+    if args.install:
+        install(directory)
+
+    if args.probe:
+        probe(directory, args.host, args.port, args.probe)
+        return 0
+
+    config = write_config(directory, args.port, args.require_client_cert)
+    if shutil.which("mosquitto") is None:
+        print(f"mosquitto not found, start it with: mosquitto -c {config}")
+        return 1
+    return subprocess.call(["mosquitto", "-v", "-c", config])
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Decode and compare controller traces.
+
+Traces are dumped by the device as JSON chunks, either on the trace dump topic
+(e.g. captured with `mosquitto_sub -t thermostat/trace/dump`) or on the serial
+console as `TRACE {...}` lines. Both forms can be passed to this tool as-is.
+
+    trace_tool.py show dump.log
+    trace_tool.py diff original.log replay.log
+    trace_tool.py load dump.log --device-id heatpump-controller
+
+`load` prints the MQTT messages that upload a trace to a device for replay.
+The trace_replay target of host_test/ replays a dump on the host instead.
+"""
+
+import argparse
+import json
+import sys
+
+MAGIC = b"HPT1"
+MQTT_MESSAGE, SENSOR_READING, TIMER, IR_FRAME = 1, 2, 3, 4
+TIMERS = {0: "telemetry", 1: "diagnostics"}
+LOAD_CHUNK_SIZE = 200
+
+
+def read_dump(path):
+    chunks = {}
+    size = 0
+    with open(path) as f:
+        for line in f:
+            start = line.find("{")
+            if start < 0:
+                continue
+            try:
+                chunk = json.loads(line[start:])
+            except json.JSONDecodeError:
+                continue
+            if "data" not in chunk:
+                continue
+            chunks[chunk["offset"]] = bytes.fromhex(chunk["data"])
+            size = chunk["size"]
+
+    data = bytearray(size)
+    received = 0
+    for offset, chunk in chunks.items():
+        data[offset : offset + len(chunk)] = chunk
+        received += len(chunk)
+    if received < size:
+        sys.exit(f"{path}: incomplete dump ({received}/{size} bytes)")
+    return bytes(data)
+
+
+def read_varint(data, offset):
+    value = shift = 0
+    while True:
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, offset
+        shift += 7
+
+
+def decode(data):
+    if not data.startswith(MAGIC):
+        sys.exit("not a controller trace")
+
+    records = []
+    offset = len(MAGIC)
+    timestamp = 0
+    while offset < len(data):
+        kind = data[offset]
+        delta, offset = read_varint(data, offset + 1)
+        length, offset = read_varint(data, offset)
+        payload = data[offset : offset + length]
+        offset += length
+        timestamp += delta
+
+        if kind == MQTT_MESSAGE:
+            topic_length = payload[0]
+            value = {
+                "topic": payload[1 : 1 + topic_length].decode(),
+                "payload": payload[1 + topic_length :].decode(),
+            }
+        elif kind == SENSOR_READING:
+            temperature = int.from_bytes(payload[0:2], "little", signed=True)
+            humidity = int.from_bytes(payload[2:4], "little", signed=True)
+            value = {"temperature": temperature / 10, "humidity": humidity / 10}
+        elif kind == TIMER:
+            value = {"timer": TIMERS.get(payload[0], payload[0])}
+        elif kind == IR_FRAME:
+            bits = payload[0]
+            value = {
+                "signal": "".join(
+                    "1" if payload[1 + i // 8] & (0x80 >> (i % 8)) else "0"
+                    for i in range(bits)
+                )
+            }
+        else:
+            value = {"raw": payload.hex()}
+
+        records.append({"t": timestamp, "type": kind, **value})
+    return records
+
+
+def frames_with_latency(records):
+    """IR frames paired with the time since the input that caused them."""
+    frames = []
+    last_input = None
+    for record in records:
+        if record["type"] == MQTT_MESSAGE:
+            last_input = record["t"]
+        elif record["type"] == IR_FRAME:
+            latency = record["t"] - last_input if last_input is not None else None
+            frames.append((record["t"], record["signal"], latency))
+    return frames
+
+
+def show(args):
+    for record in decode(read_dump(args.trace)):
+        print(json.dumps(record))
+
+
+def diff(args):
+    base = frames_with_latency(decode(read_dump(args.base)))
+    other = frames_with_latency(decode(read_dump(args.other)))
+
+    mismatches = 0
+    for i in range(max(len(base), len(other))):
+        a = base[i] if i < len(base) else None
+        b = other[i] if i < len(other) else None
+        if a is None or b is None or a[1] != b[1]:
+            mismatches += 1
+            print(f"frame {i}: {a and a[1]} != {b and b[1]}")
+
+    def latencies(frames):
+        return sorted(f[2] for f in frames if f[2] is not None)
+
+    def summary(values):
+        if not values:
+            return "n/a"
+        return (
+            f"p50={values[len(values) // 2]}ms "
+            f"max={values[-1]}ms n={len(values)}"
+        )
+
+    print(f"frames: {len(base)} vs {len(other)}, {mismatches} mismatched")
+    print(f"command->IR latency base:  {summary(latencies(base))}")
+    print(f"command->IR latency other: {summary(latencies(other))}")
+    return 1 if mismatches else 0
+
+
+def load(args):
+    data = read_dump(args.trace)
+    for offset in range(0, len(data), LOAD_CHUNK_SIZE):
+        print(
+            json.dumps(
+                {
+                    "deviceId": args.device_id,
+                    "action": "load",
+                    "offset": offset,
+                    "size": len(data),
+                    "data": data[offset : offset + LOAD_CHUNK_SIZE].hex(),
+                },
+                separators=(",", ":"),
+            )
+        )
+    print(
+        json.dumps(
+            {"deviceId": args.device_id, "action": "replay"},
+            separators=(",", ":"),
+        )
+    )
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    show_parser = commands.add_parser("show", help="print decoded records")
+    show_parser.add_argument("trace")
+    show_parser.set_defaults(func=show)
+
+    diff_parser = commands.add_parser("diff", help="compare IR output and timing")
+    diff_parser.add_argument("base")
+    diff_parser.add_argument("other")
+    diff_parser.set_defaults(func=diff)
+
+    load_parser = commands.add_parser("load", help="emit replay upload messages")
+    load_parser.add_argument("trace")
+    load_parser.add_argument("--device-id", required=True)
+    load_parser.set_defaults(func=load)
+
+    args = parser.parse_args()
+    sys.exit(args.func(args) or 0)
+
+
+if __name__ == "__main__":
+    main()